@@ -0,0 +1,189 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+// Measure the throughput of ServerTP with different placements of the server
+// and worker threads.  The clients call a method that reads all of its
+// parameters so the request data has to move from the CPU that received it to
+// the CPU that executes it.  On a multi-socket host, keeping the workers on the
+// same node as the server thread avoids the cross-node cache transfers.
+//
+// The CPUs of the first two NUMA nodes are read from sysfs.  Without a second
+// node, the CPUs are split in half so the placements still differ.
+
+#include "anyrpc/anyrpc.h"
+#include "anyrpc/internal/affinity.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+using namespace anyrpc;
+using namespace anyrpc::internal;
+
+#if defined(ANYRPC_THREADING) && defined(ANYRPC_INCLUDE_JSON)
+
+static const int BenchPort = 9010;
+
+static void Sum(Value& params, Value& result)
+{
+    double sum = 0;
+    for (int i=0; i<static_cast<int>(params.Size()); i++)
+        sum += params[i].GetDouble();
+    result = sum;
+}
+
+//! Read a cpulist such as "0-7,16-23" from sysfs
+static bool ReadNodeCpus(unsigned node, CpuSet& cpus)
+{
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (!std::getline(file, list))
+        return false;
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ','))
+    {
+        unsigned first, last;
+        int fields = sscanf(range.c_str(), "%u-%u", &first, &last);
+        if (fields < 1)
+            continue;
+        if (fields == 1)
+            last = first;
+        for (unsigned cpu=first; cpu<=last; cpu++)
+            cpus.push_back(cpu);
+    }
+    return !cpus.empty();
+}
+
+static void GetNodes(CpuSet& near, CpuSet& far)
+{
+    if (ReadNodeCpus(0, near) && ReadNodeCpus(1, far))
+        return;
+    near.clear();
+    far.clear();
+    unsigned numCpus = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned cpu=0; cpu<numCpus; cpu++)
+    {
+        if ((cpu < (numCpus + 1) / 2) || (numCpus == 1))
+            near.push_back(cpu);
+        if (cpu >= numCpus / 2)
+            far.push_back(cpu);
+    }
+}
+
+static std::atomic<bool> clientsRunning(false);
+static std::atomic<uint64_t> callCount(0);
+
+static void ClientThread(unsigned numValues)
+{
+    JsonTcpClient client("127.0.0.1", BenchPort);
+    client.SetTimeout(2000);
+    Value params;
+    Value result;
+    while (clientsRunning)
+    {
+        params.SetSize(numValues);
+        for (int i=0; i<static_cast<int>(numValues); i++)
+            params[i] = i;
+        if (client.Call("sum", params, result))
+            callCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+enum Placement { UNPINNED, COLOCATED, SPLIT };
+
+static double RunBench(Placement placement, const CpuSet& near, const CpuSet& far,
+                       unsigned numWorkers, unsigned numClients, unsigned numValues, unsigned ms)
+{
+    JsonTcpServerTP server(numWorkers);
+    server.SetMaxConnections(numClients + 1);
+    if (placement != UNPINNED)
+        server.SetThreadAffinity(near);
+    if (placement == COLOCATED)
+        server.SetWorkerColocation(true);
+    else if (placement == SPLIT)
+        server.SetWorkerAffinity(std::vector<CpuSet>(1, far));
+    server.GetMethodManager()->AddFunction(&Sum, "sum", "Sum the parameters");
+    if (!server.BindAndListen(BenchPort))
+        return 0;
+    server.StartThread();
+
+    // the clients stay with the server thread so only the worker placement changes
+    std::vector<std::thread> clients;
+    clientsRunning = true;
+    callCount = 0;
+    for (unsigned i=0; i<numClients; i++)
+    {
+        clients.emplace_back(&ClientThread, numValues);
+        if (placement != UNPINNED)
+            SetThreadAffinity(clients.back(), near);
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    uint64_t calls = callCount.load();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    clientsRunning = false;
+    for (std::thread& client : clients)
+        client.join();
+    server.StopThread();
+    return calls / elapsed.count();
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned numWorkers = 4;
+    unsigned numClients = 8;
+    unsigned numValues = 256;
+    unsigned ms = 2000;
+    if (argc > 1)
+        numWorkers = static_cast<unsigned>(atoi(argv[1]));
+    if (argc > 2)
+        numClients = static_cast<unsigned>(atoi(argv[2]));
+    if (argc > 3)
+        numValues = static_cast<unsigned>(atoi(argv[3]));
+    if (argc > 4)
+        ms = static_cast<unsigned>(atoi(argv[4]));
+
+    CpuSet near, far;
+    GetNodes(near, far);
+    printf("Workers: %u, clients: %u, values per call: %u, near cpus: %u, far cpus: %u\n",
+           numWorkers, numClients, numValues, static_cast<unsigned>(near.size()), static_cast<unsigned>(far.size()));
+    printf("%10s %18s\n", "placement", "calls/s");
+    printf("%10s %18.0f\n", "unpinned", RunBench(UNPINNED, near, far, numWorkers, numClients, numValues, ms));
+    printf("%10s %18.0f\n", "colocated", RunBench(COLOCATED, near, far, numWorkers, numClients, numValues, ms));
+    printf("%10s %18.0f\n", "split", RunBench(SPLIT, near, far, numWorkers, numClients, numValues, ms));
+    return 0;
+}
+
+#else
+
+int main()
+{
+    printf("The benchmark requires threading and the json protocol\n");
+    return 0;
+}
+
+#endif // defined(ANYRPC_THREADING) && defined(ANYRPC_INCLUDE_JSON)
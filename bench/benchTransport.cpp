@@ -0,0 +1,154 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+// Measure the round trip rate of small calls over loopback TCP, over Unix
+// domain sockets, and over shared memory rings.  Each client makes one call at
+// a time so the time is mostly the kernel's transport and the scheduling of
+// the threads.  The local transports skip the TCP/IP stack, including the
+// checksums, the acknowledgements, and the loopback device.
+//
+// The Unix domain socket is tried with both a path in the file system and a
+// Linux abstract name.  The shared memory rings only use the socket to wake a
+// side that is asleep, and with busy polling the client doesn't sleep at all
+// while the server works on a short call.
+
+#include "anyrpc/anyrpc.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+using namespace std;
+using namespace anyrpc;
+
+#if defined(ANYRPC_THREADING) && defined(ANYRPC_INCLUDE_MESSAGEPACK)
+
+static const int BenchPort = 9011;
+static const char* BenchPath = "/tmp/anyrpc-bench.sock";
+static const char* BenchName = "@anyrpc-bench";
+
+static void Echo(Value& params, Value& result)
+{
+    result = params;
+}
+
+static std::atomic<bool> clientsRunning(false);
+static std::atomic<uint64_t> callCount(0);
+
+static void ClientThread(std::string host, unsigned numValues, unsigned busyPoll)
+{
+    MessagePackTcpClient client(host.c_str(), BenchPort);
+    client.SetTimeout(2000);
+#if defined(ANYRPC_SHARED_MEMORY)
+    client.SetBusyPoll(busyPoll);
+#endif // defined(ANYRPC_SHARED_MEMORY)
+    Value params;
+    Value result;
+    while (clientsRunning)
+    {
+        params.SetSize(numValues);
+        for (int i=0; i<static_cast<int>(numValues); i++)
+            params[i] = i;
+        if (client.Call("echo", params, result))
+            callCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+enum Transport { TCP, LOCAL, SHARED };
+
+//! Run the clients against a server on the port, or on the local path if it is not empty
+static double RunBench(Transport transport, const std::string& localPath, unsigned busyPoll,
+                       unsigned numClients, unsigned numValues, unsigned ms)
+{
+    MessagePackTcpServer server;
+    server.SetMaxConnections(numClients + 1);
+#if defined(ANYRPC_SHARED_MEMORY)
+    server.SetSharedMemory(transport == SHARED);
+#endif // defined(ANYRPC_SHARED_MEMORY)
+    server.GetMethodManager()->AddFunction(&Echo, "echo", "Return the parameters");
+    bool listening = (transport == TCP) ? server.BindAndListen(BenchPort) : server.BindAndListenLocal(localPath);
+    if (!listening)
+        return 0;
+    server.StartThread();
+
+    std::string host = (transport == TCP) ? std::string("127.0.0.1") : ((transport == SHARED) ? "shm:" : "unix:") + localPath;
+    std::vector<std::thread> clients;
+    clientsRunning = true;
+    callCount = 0;
+    for (unsigned i=0; i<numClients; i++)
+        clients.emplace_back(&ClientThread, host, numValues, busyPoll);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    uint64_t calls = callCount.load();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    clientsRunning = false;
+    for (std::thread& client : clients)
+        client.join();
+    server.StopThread();
+    return calls / elapsed.count();
+}
+
+//! Print the rate and the round trip time seen by each client
+static void PrintResult(const char* transport, double callsPerSecond, unsigned numClients)
+{
+    double roundTrip = (callsPerSecond > 0) ? numClients * 1000000.0 / callsPerSecond : 0;
+    printf("%10s %18.0f %12.1f\n", transport, callsPerSecond, roundTrip);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned numClients = 4;
+    unsigned numValues = 8;
+    unsigned ms = 2000;
+    if (argc > 1)
+        numClients = static_cast<unsigned>(atoi(argv[1]));
+    if (argc > 2)
+        numValues = static_cast<unsigned>(atoi(argv[2]));
+    if (argc > 3)
+        ms = static_cast<unsigned>(atoi(argv[3]));
+
+    printf("Clients: %u, values per call: %u\n", numClients, numValues);
+    printf("%10s %18s %12s\n", "transport", "calls/s", "us/call");
+    PrintResult("tcp", RunBench(TCP, std::string(), 0, numClients, numValues, ms), numClients);
+#if defined(ANYRPC_LOCAL_SOCKET)
+    PrintResult("unix", RunBench(LOCAL, BenchPath, 0, numClients, numValues, ms), numClients);
+# if defined(__linux__)
+    PrintResult("abstract", RunBench(LOCAL, BenchName, 0, numClients, numValues, ms), numClients);
+# endif // defined(__linux__)
+#endif // defined(ANYRPC_LOCAL_SOCKET)
+#if defined(ANYRPC_SHARED_MEMORY)
+    PrintResult("shm", RunBench(SHARED, BenchPath, 0, numClients, numValues, ms), numClients);
+    PrintResult("shm+poll", RunBench(SHARED, BenchPath, 50, numClients, numValues, ms), numClients);
+#endif // defined(ANYRPC_SHARED_MEMORY)
+    return 0;
+}
+
+#else
+
+int main()
+{
+    printf("The benchmark requires threading and the MessagePack protocol\n");
+    return 0;
+}
+
+#endif // defined(ANYRPC_THREADING) && defined(ANYRPC_INCLUDE_MESSAGEPACK)
@@ -0,0 +1,154 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+// Compare the work-stealing worker pool used by ServerTP with a pool using a
+// single queue protected by a mutex and condition variable.  One thread submits
+// short tasks, similar to the main thread of ServerTP handing off connections,
+// and the time until all of the tasks have executed is measured.
+
+#include "anyrpc/anyrpc.h"
+#include "anyrpc/internal/workerpool.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+using namespace std;
+using namespace anyrpc;
+using namespace anyrpc::internal;
+
+#if defined(ANYRPC_THREADING)
+
+//! Thread pool with the mutex and condition variable queue that ServerTP used before
+class QueuePool
+{
+public:
+    QueuePool() : exit_(false) {}
+    ~QueuePool() { Stop(); }
+
+    void Start(unsigned numThreads)
+    {
+        exit_ = false;
+        for (unsigned i=0; i<numThreads; i++)
+            workers_.emplace_back(&QueuePool::WorkerThread, this);
+    }
+
+    void Stop()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            exit_ = true;
+            block_.notify_all();
+        }
+        for (std::thread& worker : workers_)
+            worker.join();
+        workers_.clear();
+    }
+
+    void Submit(TaskFunction* function, void* context, void* argument)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        queue_.push(Task(function, context, argument));
+        block_.notify_one();
+    }
+
+private:
+    void WorkerThread()
+    {
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            block_.wait(lock, [this]{ return this->exit_ || !this->queue_.empty(); });
+            if (exit_)
+                return;
+            Task task = queue_.front();
+            queue_.pop();
+            lock.unlock();
+            task.function_(task.context_, task.argument_);
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::queue<Task> queue_;
+    std::mutex mutex_;
+    std::condition_variable block_;
+    bool exit_;
+};
+
+static std::atomic<unsigned> completed(0);
+static unsigned taskWork = 200;
+
+static void BenchTask(void* context, void* argument)
+{
+    // a small amount of work to stand in for executing a method
+    volatile unsigned value = 0;
+    for (unsigned i=0; i<taskWork; i++)
+        value = value + i;
+    completed.fetch_add(1, std::memory_order_relaxed);
+}
+
+template<typename Pool>
+static double RunBench(unsigned numThreads, unsigned numTasks)
+{
+    Pool pool;
+    pool.Start(numThreads);
+    completed = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned i=0; i<numTasks; i++)
+        pool.Submit(&BenchTask, 0, 0);
+    while (completed.load(std::memory_order_relaxed) < numTasks)
+        std::this_thread::yield();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    pool.Stop();
+    return numTasks / elapsed.count();
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned numTasks = 200000;
+    if (argc > 1)
+        numTasks = static_cast<unsigned>(atoi(argv[1]));
+    if (argc > 2)
+        taskWork = static_cast<unsigned>(atoi(argv[2]));
+
+    printf("Tasks: %u, work per task: %u, hardware threads: %u\n", numTasks, taskWork, std::thread::hardware_concurrency());
+    printf("%8s %18s %18s %8s\n", "workers", "queue (tasks/s)", "stealing (tasks/s)", "ratio");
+    const unsigned workerCounts[] = { 1, 4, 16, 64 };
+    for (unsigned i=0; i<sizeof(workerCounts)/sizeof(workerCounts[0]); i++)
+    {
+        double queueRate = RunBench<QueuePool>(workerCounts[i], numTasks);
+        double stealRate = RunBench<WorkerPool>(workerCounts[i], numTasks);
+        printf("%8u %18.0f %18.0f %8.2f\n", workerCounts[i], queueRate, stealRate, stealRate / queueRate);
+    }
+    return 0;
+}
+
+#else
+
+int main()
+{
+    printf("The benchmarks require threading\n");
+    return 0;
+}
+
+#endif // defined(ANYRPC_THREADING)
@@ -131,6 +131,10 @@ int main(int argc, char *argv[])
         server = new JsonHttpServerTP;
     else if (strcasecmp(argv[1], "jsontcptp") == 0)
         server = new JsonTcpServerTP;
+    else if (strcasecmp(argv[1], "jsonhttpmr") == 0)
+        server = new JsonHttpServerMR;
+    else if (strcasecmp(argv[1], "jsontcpmr") == 0)
+        server = new JsonTcpServerMR;
 # endif // defined(ANYRPC_INCLUDE_JSON)
 
 # if defined(ANYRPC_INCLUDE_XML)
@@ -142,6 +146,10 @@ int main(int argc, char *argv[])
         server = new XmlHttpServerTP;
     else if (strcasecmp(argv[1], "xmltcptp") == 0)
         server = new XmlTcpServerTP;
+    else if (strcasecmp(argv[1], "xmlhttpmr") == 0)
+        server = new XmlHttpServerMR;
+    else if (strcasecmp(argv[1], "xmltcpmr") == 0)
+        server = new XmlTcpServerMR;
 # endif // defined(ANYRPC_INCLUDE_XML)
 
 # if defined(ANYRPC_INCLUDE_MESSAGEPACK)
@@ -153,10 +161,16 @@ int main(int argc, char *argv[])
         server = new MessagePackHttpServerTP;
     else if (strcasecmp(argv[1], "messagepacktcptp") == 0)
         server = new MessagePackTcpServerTP;
+    else if (strcasecmp(argv[1], "messagepackhttpmr") == 0)
+        server = new MessagePackHttpServerMR;
+    else if (strcasecmp(argv[1], "messagepacktcpmr") == 0)
+        server = new MessagePackTcpServerMR;
 # endif // defined(ANYRPC_INCLUDE_MESSAGEPACK)
 
     else if (strcasecmp(argv[1], "anyhttptp") == 0)
         server = new AnyHttpServerTP; // support all protocols with thread pool server
+    else if (strcasecmp(argv[1], "anyhttpmr") == 0)
+        server = new AnyHttpServerMR; // support all protocols with multi-reactor server
 
 #endif // defined(ANYRPC_THREADING)
     else
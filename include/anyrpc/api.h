@@ -35,6 +35,7 @@
 #include <algorithm>
 #include <vector>
 #include <list>
+#include <deque>
 #include <map>
 #include <queue>
 #include <cassert>
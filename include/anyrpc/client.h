@@ -22,6 +22,8 @@
 #define ANYRPC_CLIENT_H_
 
 #include "internal/http.h"
+#include "internal/http2.h"
+#include "internal/websocket.h"
 
 #if defined(__CYGWIN__)
 # include <sys/time.h>
@@ -100,6 +102,11 @@ private:
  *
  *  The header and request are stored in a segmented buffer so that data copying is not required
  *  from realloc calls as a single buffer is expanded.
+ *
+ *  A host of the form "unix:PATH" connects to a server's Unix domain socket
+ *  (Server::BindAndListenLocal) and the port is ignored.  With "shm:PATH" the
+ *  connection then moves its data to shared memory rings if the server allows
+ *  it (Server::SetSharedMemory, Linux).
  */
 class ANYRPC_API Client
 {
@@ -108,10 +115,22 @@ public:
     Client(ClientHandler* handler, const char* host, int port);
     virtual ~Client();
 
-    //! Set the server name and port. This will close any currently active socket.
+    //! Set the server name and port, or "unix:PATH" for a Unix domain socket. This will close any currently active socket.
     virtual void SetServer(const char* host, int port) { host_ = host; port_ = port; Close(); }
     //! Set timeout for the client to respond to a request
     virtual void SetTimeout(unsigned msTime) { timeout_ = msTime; }
+    //! Get the timeout for the client to respond to a request
+    unsigned GetTimeout() const { return timeout_; }
+    //! Set the largest response body that is accepted
+    void SetMaxContentLength(std::size_t maxContentLength) { maxContentLength_ = maxContentLength; }
+#if defined(ANYRPC_SHARED_MEMORY)
+    //! Set the size of each shared memory ring for a "shm:" host - takes effect on the next connection
+    void SetRingSize(std::size_t ringSize) { ringSize_ = ringSize; }
+    //! Set the microseconds to spin waiting for a shared memory response before sleeping, 0 to sleep right away
+    void SetBusyPoll(unsigned microseconds) { socket_.SetBusyPoll(microseconds); }
+#endif // defined(ANYRPC_SHARED_MEMORY)
+    //! Get the socket's file descriptor, for example to wait for the response to a Post
+    SOCKET GetFileDescriptor() { return socket_.GetFileDescriptor(); }
     //! Close the connection
     virtual void Close() { log_info("close socket, fd=" << socket_.GetFileDescriptor()); socket_.Close(); }
 
@@ -144,6 +163,10 @@ protected:
     unsigned GetTimeLeft();
     //! Connect to the server
     virtual bool Connect();
+    //! Check if the host is a Unix domain socket path
+    bool IsLocal() const { return host_.compare(0, LocalPrefixLength, LocalPrefix) == 0; }
+    //! Check if the host is a Unix domain socket path that carries the data in shared memory
+    bool IsShared() const { return host_.compare(0, SharedPrefixLength, SharedPrefix) == 0; }
     //! Generate the RPC request into the request_ stream based on the method and params
     virtual bool GenerateRequest(const char* method, Value& params, bool notification=false);
     //! Generate the protocol specific header for the RPC request
@@ -166,10 +189,15 @@ protected:
 
     WriteSegmentedStream header_;           //!< Data for the request header
     WriteSegmentedStream request_;          //!< Data for the request body
+    SendSegmentList segments_;              //!< Blocks of data for the write - kept to reuse the storage
     std::list<unsigned> requestId_;         //!< Id for the last request
 
+    static const char* const LocalPrefix;   //!< Host prefix for a Unix domain socket path
+    static const std::size_t LocalPrefixLength = 5;
+    static const char* const SharedPrefix;  //!< Host prefix for a Unix domain socket path with shared memory
+    static const std::size_t SharedPrefixLength = 4;
     static const std::size_t MaxBufferLength = 2048;
-    static const std::size_t MaxContentLength = 1000000;
+    static const std::size_t DefaultMaxContentLength = 1000000;
 
     char buffer_[MaxBufferLength+1];        //!< Fixed buffer for the response header and possibly the body
 	std::size_t bufferLength_;              //!< Amount of data in the buffer_
@@ -184,6 +212,8 @@ protected:
     std::string host_;                      //!< Connection host name/IP address
     int port_;                              //!< Connection port
     unsigned timeout_;                      //!< Timeout value in milliseconds
+    std::size_t ringSize_;                  //!< Size of each shared memory ring
+    std::size_t maxContentLength_;          //!< Largest response body that is accepted
 
     bool responseProcessed_;                //!< The response has been process and buffer needs to be reclaimed
 };
@@ -199,22 +229,33 @@ class ANYRPC_API HttpClient : public Client
 {
 public:
     HttpClient(ClientHandler* handler, std::string contentType) :
-        Client(handler), contentType_(contentType) {}
+        Client(handler), contentType_(contentType), responseCapacity_(0) {}
 
     HttpClient(ClientHandler* handler, std::string contentType, const char* host, int port) :
-        Client(handler,host,port), contentType_(contentType) {}
+        Client(handler,host,port), contentType_(contentType), responseCapacity_(0) {}
 
     //! Reset for a new transaction including the HTTP header processing
     virtual void ResetTransaction() { Client::ResetTransaction(); httpResponseState_.Initialize(); }
 
 protected:
+    virtual void PreserveReceiveBuffer();
     virtual bool GenerateHeader();
     virtual int ProcessHeader(bool eof);
+    virtual bool ReadResponse(Value& result);
     virtual ProcessResponseEnum ProcessResponse(Value& result, bool notification=false);
     virtual bool TransportHasNotifyResponse() { return true; }
 
+    //! Decode a chunked response body as it arrives
+    bool ReadChunkedResponse(Value& result);
+    //! Grow the allocated response so it can hold at least the length.  Return false if over the limit.
+    bool ReserveResponse(std::size_t length);
+
     internal::HttpResponse httpResponseState_;  //!< Processing of the HTTP header
+    internal::HttpChunkedDecoder chunkedDecoder_;   //!< Decoding of a chunked response body
     std::string contentType_;
+    std::size_t responseCapacity_;              //!< Bytes that fit in the allocated response of a chunked body
+
+    static const std::size_t InitialResponseCapacity = 64*1024; //!< First allocation for a chunked response body
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -247,6 +288,138 @@ private:
     bool commaExpected_;        //!< Expecting the netstrings comma separator before the next message
 };
 
+////////////////////////////////////////////////////////////////////////////////
+
+//! Process an HTTP/2 client
+/*!
+ *  The client connects with prior knowledge of h2c, i.e. it sends the HTTP/2
+ *  connection preface without an upgrade from HTTP/1.1.  Each request is a stream
+ *  of the connection, so the requests that are posted are sent right away and
+ *  the server can execute them concurrently.  GetPostResult returns the results
+ *  in the order that the requests were posted.
+ *
+ *  A request that times out is cancelled with RST_STREAM and the connection is
+ *  kept for the other streams.
+ */
+class ANYRPC_API Http2Client : public Client
+{
+public:
+    Http2Client(ClientHandler* handler, std::string contentType);
+    Http2Client(ClientHandler* handler, std::string contentType, const char* host, int port);
+
+    //! Close the connection and forget the streams that are open
+    virtual void Close();
+
+    virtual bool Call(const char* method, Value& params, Value& result);
+    virtual bool Post(const char* method, Value& params, Value& result);
+    virtual bool GetPostResult(Value& result);
+    virtual bool Notify(const char* method, Value& params, Value& result);
+
+protected:
+    virtual bool Connect();
+    //! Generate the HEADERS frame for the next stream
+    virtual bool GenerateHeader();
+    virtual bool TransportHasNotifyResponse() { return true; }
+
+private:
+    //! State of a stream from when its request is sent until its result is taken
+    struct StreamState
+    {
+        StreamState() : requestId_(0), notification_(false), complete_(false), reset_(false), status_(0), sendWindow_(0) {}
+
+        unsigned requestId_;                //!< Id of the request for the handler
+        bool notification_;                 //!< Whether the request is a notification
+        bool complete_;                     //!< Whether all of the response has been read
+        bool reset_;                        //!< Whether the server reset or refused the stream
+        unsigned status_;                   //!< HTTP status of the response, 0 until its headers are read
+        std::string response_;              //!< Response data that has been read
+        int64_t sendWindow_;                //!< Flow control window for the request data
+    };
+    typedef std::map<uint32_t, StreamState> StreamMap;
+
+    //! Generate the request and send it on a new stream.  Return the stream id, or 0 on a failure.
+    uint32_t StartStream(const char* method, Value& params, Value& result, bool notification);
+    //! Send the HEADERS and DATA frames of the request within the flow control windows
+    bool SendRequest(uint32_t streamId, Value& result);
+    //! Wait for the response of the stream and process it
+    bool FinishStream(uint32_t streamId, Value& result);
+    //! Wait for the available frames and process them.  Return false on a timeout or a connection error.
+    bool ReadFrames(Value& result);
+    //! Process a complete frame.  Return false on a connection error.
+    bool ProcessFrame(internal::Http2Frame& frame, const char* payload);
+    bool ProcessSettings(internal::Http2Frame& frame, const char* payload);
+    //! Decode a complete header block for the stream
+    bool ProcessHeaderBlock(uint32_t streamId, bool endStream);
+    //! Write the control frames that have been queued
+    bool Flush();
+
+    std::string contentType_;
+    StreamMap streams_;                     //!< Streams that are open or have a result to take
+    std::list<uint32_t> posted_;            //!< Streams of the posted requests in the order that they were sent
+    uint32_t nextStreamId_;                 //!< Id for the next stream, always odd
+    int64_t sendWindow_;                    //!< Flow control window of the connection for the request data
+    uint32_t initialWindow_;                //!< Window of a new stream from the server's settings
+    std::size_t maxFrameSize_;              //!< Largest frame payload that the server accepts
+    uint32_t windowUpdate_;                 //!< Response data read for the connection window since it was last opened
+    bool prefaceSent_;                      //!< Whether the connection preface has been queued for this connection
+    bool goAway_;                           //!< Whether the server won't accept any more streams
+    internal::HpackDecoder decoder_;        //!< Decoder for the header blocks from the server
+    std::vector<char> input_;               //!< Frames that have been read but not processed
+    std::size_t inputLength_;               //!< Amount of data in input_
+    uint32_t continuationStream_;           //!< Stream of a header block that continues in the next frame, 0 if none
+    bool continuationEndStream_;            //!< Whether the header block that continues ends its stream
+    std::string headerBlock_;               //!< Header block that continues in the next frame
+    WriteSegmentedStream frames_;           //!< Frames to write
+    std::string lastResponse_;              //!< Response of the last result processed, which the result may refer to
+
+    static const uint32_t ReceiveWindow = 1024*1024;    //!< Flow control window for the response data
+    static const uint32_t MaxStreamId = 0x7fffffff;
+    static const std::size_t OutputLimit = 64*1024;     //!< Amount of request data to frame for each write
+    static const std::size_t MaxHeaderBlockLength = 64*1024;    //!< Largest header block that is accepted
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Process a WebSocket client
+/*!
+ *  The connection starts with an HTTP/1.1 upgrade to the WebSocket protocol
+ *  (RFC 6455) that asks for the subprotocol, like json-rpc, which the server
+ *  uses to select the handler.  After the handshake, each request is sent as a
+ *  single masked frame and each response is read from a single frame, so the
+ *  framing adds 2 to 14 bytes to the messages.  The pings from the server are
+ *  answered while waiting for a response.
+ */
+class ANYRPC_API WebSocketClient : public Client
+{
+public:
+    WebSocketClient(ClientHandler* handler, std::string protocol);
+    WebSocketClient(ClientHandler* handler, std::string protocol, const char* host, int port);
+
+    //! Send the requests in binary frames instead of text frames, as needed for messagepack-rpc
+    void SetBinary(bool binary) { binary_ = binary; }
+    //! Close the connection, which needs a new handshake
+    virtual void Close() { upgraded_ = false; Client::Close(); }
+
+protected:
+    //! Connect to the server and upgrade the connection to a WebSocket
+    virtual bool Connect();
+    //! Generate the frame header and mask the request
+    virtual bool GenerateHeader();
+    virtual int ProcessHeader(bool eof);
+    virtual bool TransportHasNotifyResponse() { return false; }
+
+private:
+    //! Send the upgrade request and check the response of the server
+    bool Handshake();
+    //! Fill the data with bytes for the masking keys and the handshake key
+    void RandomBytes(unsigned char* data, std::size_t length);
+
+    std::string protocol_;                  //!< Subprotocol to ask the server for
+    bool binary_;                           //!< Whether the requests are sent in binary frames
+    bool upgraded_;                         //!< Whether the handshake has been done on this connection
+    uint32_t random_;                       //!< State of the generator for the masking keys
+};
+
 
 } // namespace anyrpc
 
@@ -33,7 +33,18 @@
 # include <regex>        // this requires a compiler with c++11 support
 #endif // defined(ANYRPC_REGEX)
 
+#include <atomic>
+#include <memory>
+
 #include "internal/http.h"
+#include "internal/http2.h"
+#include "internal/websocket.h"
+#include "internal/time.h"
+#include "internal/timerwheel.h"
+#include "internal/lrulist.h"
+#include "internal/zerocopyreaper.h"
+#include "internal/completionqueue.h"
+#include "internal/wakeup.h"
 
 namespace anyrpc
 {
@@ -50,6 +61,22 @@ namespace anyrpc
  */
 typedef bool RpcHandler(MethodManager* manager, char* request, std::size_t length, Stream &response);
 
+//! Produce a fault response to an RPC request without executing it
+/*!
+ *  The RpcFaultHandler is used when the server sheds a request.  The request is only
+ *  parsed enough to address the fault to the caller (e.g. the id for Json).
+ *  Returns false if no response should be sent, such as for a notification.
+ */
+typedef bool RpcFaultHandler(char* request, std::size_t length, int errorCode, std::string const& errorMsg, Stream &response);
+
+//! Find the name of the method that an RPC request calls without executing it
+/*!
+ *  The RpcMethodNameHandler only scans the request far enough to find the method
+ *  name so the server can choose how to schedule the request.  For a batch, the
+ *  name of the first call is used.  Returns false if the name was not found.
+ */
+typedef bool RpcMethodNameHandler(const char* request, std::size_t length, std::string& methodName);
+
 ////////////////////////////////////////////////////////////////////////////////
 
 //! Hold the information to match HTTP content-type field to an RpcHandler
@@ -61,15 +88,19 @@ typedef bool RpcHandler(MethodManager* manager, char* request, std::size_t lengt
 class RpcContentHandler
 {
 public:
-    RpcContentHandler() : handler_(0), matchAnyContentType_(true) {}
-    RpcContentHandler(RpcHandler* handler, std::string requestContentType, std::string responseContentType) :
-        handler_(handler), requestContentType_(requestContentType), responseContentType_(responseContentType),
-        matchAnyContentType_(requestContentType==""){}
+    RpcContentHandler() : handler_(0), methodNameHandler_(0), matchAnyContentType_(true) {}
+    RpcContentHandler(RpcHandler* handler, std::string requestContentType, std::string responseContentType,
+                      RpcMethodNameHandler* methodNameHandler=0) :
+        handler_(handler), methodNameHandler_(methodNameHandler), requestContentType_(requestContentType),
+        responseContentType_(responseContentType), matchAnyContentType_(requestContentType==""){}
 
     //! Perform processing on the request using this handler
     bool HandleRequest(MethodManager* manager, char* request, std::size_t length, Stream &response)
         { anyrpc_assert(handler_ != 0, AnyRpcErrorHandlerNotDefined, "The RPC handler was not defined");
           return handler_(manager,request,length,response); }
+    //! Find the name of the method called by the request.  Return false if not found or not supported by the protocol.
+    bool GetMethodName(const char* request, std::size_t length, std::string& methodName)
+        { return (methodNameHandler_ != 0) && methodNameHandler_(request, length, methodName); }
     //! Determine if this handler is able to process the given contentType
     bool CanProcessContentType(std::string contentType);
     //! Get the content-type string to use with the response
@@ -82,6 +113,7 @@ private:
     log_define("AnyRPC.RpcHandler");
 
     RpcHandler* handler_;               //!< Function pointer to RPC handler
+    RpcMethodNameHandler* methodNameHandler_;   //!< Function pointer to find the method name, null if not supported
 #if defined(ANYRPC_REGEX)
     std::regex requestContentType_;     //!< Regular express to match with the HTTP request content-type
 #else
@@ -96,6 +128,132 @@ typedef std::vector<RpcContentHandler> RpcHandlerList;
 
 ////////////////////////////////////////////////////////////////////////////////
 
+namespace internal
+{
+class Poller;
+}
+
+class Connection;
+
+//! A request taken from a pipelined connection to execute independently of the connection's state
+/*!
+ *  The request is owned by its connection until the response has been written.
+ *  A worker thread fills in the response and returns the request to the connection's
+ *  completion queue, so the responses are written in the order that they complete
+ *  rather than the order of the requests.  This requires a protocol where the response
+ *  carries the id of the request.
+ */
+struct ANYRPC_API PipelinedRequest
+{
+    PipelinedRequest(Connection* connection, const char* request, std::size_t length);
+    virtual ~PipelinedRequest() { free(request_); }
+
+    PipelinedRequest* GetNextCompleted() { return nextCompleted_; }
+    void SetNextCompleted(PipelinedRequest* next) { nextCompleted_ = next; }
+    PipelinedRequest* GetPrevListed() { return prevListed_; }
+    void SetPrevListed(PipelinedRequest* prev) { prevListed_ = prev; }
+    PipelinedRequest* GetNextListed() { return nextListed_; }
+    void SetNextListed(PipelinedRequest* next) { nextListed_ = next; }
+
+    Connection* connection_;                //!< Connection that the request was read from
+    char* request_;                         //!< Copy of the request body, null terminated
+    std::size_t length_;                    //!< Length of the request body
+    int64_t queuedTime_;                    //!< Time (MonotonicMicroTime) when the request was queued for execution
+    bool sendResponse_;                     //!< Whether there is a response to write
+    WriteSegmentedStream header_;           //!< Data for the response header
+    std::size_t headerBytesWritten_;        //!< Number of bytes of the header already written
+    WriteSegmentedStream response_;         //!< Data for the response body
+    std::size_t resultBytesWritten_;        //!< Number of bytes of the body already written
+    PipelinedRequest* nextCompleted_;       //!< Link for the connection's completion queue
+    PipelinedRequest* prevListed_;          //!< Link for the connection's list of requests
+    PipelinedRequest* nextListed_;          //!< Link for the connection's list of requests
+    PipelinedRequest* nextWrite_;           //!< Link for the connection's write queue
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+class ResponseGate;
+
+//! Responder for a call whose response the connection writes after the method has returned
+/*!
+ *  The responder is created for an AsyncMethod while the RPC handler runs.  When the
+ *  method responds, from any thread, the result is passed to the server thread through
+ *  the server's ResponseGate.  The server thread then encodes the response with the
+ *  protocol's encoder and writes it on the connection, or in the pipelined request
+ *  that the call came from.  The request is parsed in place so the response is only
+ *  passed once both the method has responded and the RPC handler has returned.
+ */
+class ANYRPC_API DeferredResponse : public MethodResponder
+{
+public:
+    DeferredResponse(const std::shared_ptr<ResponseGate>& gate, Connection* connection, PipelinedRequest* request,
+                     RpcResponseEncoder* encoder, Value& id) :
+        gate_(gate), connection_(connection), request_(request), encoder_(encoder), id_(id),
+        errorCode_(0), fault_(false), handoff_(0), nextCompleted_(0) {}
+
+    virtual void Respond(Value& result);
+    virtual void Fault(int errorCode, std::string const& errorMsg);
+    //! Indicate that the RPC handler has returned - the response can't be used after
+    void Release();
+
+    //! Get the connection that writes the response
+    Connection* GetConnection() { return connection_; }
+    //! Get the pipelined request that the call came from, null if it came from the connection
+    PipelinedRequest* GetRequest() { return request_; }
+    //! Encode the response - called by the server thread
+    void Encode(Stream& response) { encoder_(id_, fault_ ? 0 : &result_, errorCode_, errorMsg_, response); }
+
+    DeferredResponse* GetNextCompleted() { return nextCompleted_; }
+    void SetNextCompleted(DeferredResponse* next) { nextCompleted_ = next; }
+
+private:
+    std::shared_ptr<ResponseGate> gate_;    //!< Gate to the server thread that owns the connection
+    Connection* connection_;                //!< Connection that the call came from - only used by the server thread
+    PipelinedRequest* request_;             //!< Pipelined request that the call came from, null if none
+    RpcResponseEncoder* encoder_;           //!< Protocol encoder for the response
+    Value id_;                              //!< Copy of the id of the call
+    Value result_;                          //!< Result of the call
+    int errorCode_;                         //!< Code of the fault
+    std::string errorMsg_;                  //!< Message of the fault
+    bool fault_;                            //!< Whether the call finished with a fault
+    std::atomic<int> handoff_;              //!< Number of the method responding and the handler returning that have happened
+    DeferredResponse* nextCompleted_;       //!< Link for the gate's completion queue
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Passes the deferred responses from the threads that finish them to the server thread
+/*!
+ *  The gate is shared by the server and its outstanding responders so a method can
+ *  respond after the server has been shutdown.  Once the server closes the gate,
+ *  the responses are dropped without referring to their connections.
+ */
+class ANYRPC_API ResponseGate
+{
+public:
+    ResponseGate() : open_(false) {}
+    ~ResponseGate() { Close(); }
+
+    //! Create the signal for the server's poller and start passing responses
+    bool Open();
+    //! Stop passing responses and delete the ones that have not been taken
+    void Close();
+    //! Pass a finished response to the server thread.  Return false if the gate is closed.  Safe to call from any thread.
+    bool Complete(DeferredResponse* response);
+    //! Take the responses in the order that they finished - called by the server thread
+    DeferredResponse* TakeCompleted();
+    //! Descriptor to register with the server's poller
+    SOCKET GetFileDescriptor() { return signal_.GetFileDescriptor(); }
+
+private:
+    std::mutex mutex_;                                      //!< Keeps Close from racing with Complete
+    bool open_;                                             //!< Whether the server is taking responses
+    internal::CompletionQueue<DeferredResponse> completed_; //!< Responses waiting for the server thread
+    internal::Wakeup signal_;                               //!< Wakes the server thread for the responses
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 //! A connection from the server to a specific client.
 /*!
  *  The connection can be processed in a thread or as a set of event driven
@@ -114,36 +272,145 @@ typedef std::vector<RpcContentHandler> RpcHandlerList;
  *
  *  The response is stored in a segmented buffer so that data copying is not required
  *  from realloc calls as a single buffer is expanded.
+ *
+ *  When the protocol supports it, the server can instead take each request with TakeRequest
+ *  as soon as it is read so that several requests from the connection execute concurrently.
+ *  The executed requests are returned with CompletePipelined and WritePipelined writes
+ *  the responses in the order that they completed.
  */
 class ANYRPC_API Connection
 {
 public:
+    //! Create the connection for a socket from TcpSocket::Accept, which must be non-blocking
     Connection(SOCKET fd, MethodManager* manager);
     virtual ~Connection();
 
     //! Initialize the data to start processing a new request
     virtual void Initialize(bool preserveBufferData=false);
+    //! Close the socket and return to the state of a new connection so the object can be kept for another client
+    virtual void Recycle();
+    //! Start using a recycled connection for a socket from TcpSocket::Accept
+    void Reuse(SOCKET fd);
+#if defined(ANYRPC_ZEROCOPY)
+    //! Give the socket to the reaper if zero copy sends are still in flight so closing doesn't reset it
+    bool LingerZeroCopy(internal::ZeroCopyReaper& reaper, int64_t now) { return reaper.Add(socket_, now); }
+#endif // defined(ANYRPC_ZEROCOPY)
+#if defined(ANYRPC_SHARED_MEMORY)
+    //! Let the client switch the connection to shared memory rings before its first request
+    void AcceptSharedMemory() { socket_.AcceptRing(); }
+#endif // defined(ANYRPC_SHARED_MEMORY)
+    //! Move the data of the socket through the poller if it supports it - only for a connection processed by the poller thread
+    bool AttachPoller(internal::Poller* poller);
     //! Get the file descriptor for the socket - needed for select calls
     virtual SOCKET GetFileDescriptor() { return socket_.GetFileDescriptor(); }
     //! Process data from the socket being either readable or writable.
     virtual void Process(bool executeAfterRead = true);
+    //! Execute the request that has been read and write the response without reading the next one
+    /*! Used by a thread pool worker so each request is admitted by the server thread. */
+    void ProcessRequest();
+    //! Whether the data of another request has already been read while waiting for its header
+    bool HasBufferedRequest() { return (connectionState_ == READ_HEADER) && (bufferLength_ > 0); }
     //! Indicate that this connection should be closed.
     virtual void SetCloseState() { connectionState_ = CLOSE_CONNECTION; }
     //! Set the active flag - used for thread pool processing to determine whether the main thread should process this connection
-    virtual void SetActive(bool active = true) { active_ = active; }
+    virtual void SetActive(bool active = true) { active_.store(active, std::memory_order_release); }
 
     //! Whether a select call should wait for readability of the socket
-    virtual bool WaitForReadability() { return active_ && (connectionState_ <= READ_REQUEST); }
+    virtual bool WaitForReadability() { return IsActive() && (connectionState_ <= READ_REQUEST) && !RequestLimitReached(); }
     //! Whether a select call should wait for writability of the socket
-    virtual bool WaitForWritability() { return active_ && (connectionState_ == WRITE_RESPONSE); }
+    virtual bool WaitForWritability()
+        { return IsActive() && ((connectionState_ == WRITE_RESPONSE) || ((writeHead_ != 0) && (connectionState_ != CLOSE_CONNECTION))); }
     //! Whether in the execute state - used for thread pool
     virtual bool CheckExecuteState() { return (connectionState_ == EXECUTE_REQUEST); }
     //! Whether the connection should be closed
     virtual bool CheckClose() { return (connectionState_ == CLOSE_CONNECTION); }
     //! Whether the connection can be forced to disconnect at this time
-    virtual bool ForcedDisconnectAllowed() { return (bufferLength_ == 0); }
-    //! Get the time when the last RPC transaction took place
-    virtual time_t GetLastTransactionTime() { return lastTransactionTime_; }
+    virtual bool ForcedDisconnectAllowed() { return !HasOutstandingRequests() && (bufferLength_ == 0); }
+    //! Respond to the request that has been read with a server busy error instead of executing it.  Return false if the connection should close.
+    virtual bool RejectRequest() { return false; }
+    //! Find the name of the method called by the request that has been read.  Return false if not known.
+    virtual bool GetMethodName(std::string& /* methodName */) { return false; }
+    //! Get the size of the request body that has been read
+    std::size_t GetContentLength() { return contentLength_; }
+    //! Get the time (MonotonicMicroTime) when the request was queued for execution
+    int64_t GetQueuedTime() { return queuedTime_; }
+    //! Set the time (MonotonicMicroTime) when the request was queued for execution
+    void SetQueuedTime(int64_t queuedTime) { queuedTime_ = queuedTime; }
+
+    //! Whether the requests can be taken to execute concurrently - the protocol must identify the responses
+    virtual bool PipeliningSupported() { return false; }
+    //! Take the request that has been read so it can execute separately and start reading the next one
+    virtual PipelinedRequest* TakeRequest();
+    //! Execute a request that was taken from the connection - can be called from any thread.  Return false if the response was deferred.
+    virtual bool ExecutePipelined(PipelinedRequest* request) { request->sendResponse_ = false; return true; }
+    //! Respond to a request that was taken with a server busy error instead of executing it - can be called from any thread
+    virtual void RejectPipelined(PipelinedRequest* request) { request->sendResponse_ = false; }
+    //! Return a request that was taken - can be called from any thread.  Return true if the caller must schedule WritePipelined.
+    bool CompletePipelined(PipelinedRequest* request);
+    //! Allow CompletePipelined to schedule the connection again - called before WritePipelined when it is scheduled
+    void ClearCompletionScheduled() { completionScheduled_.store(false); }
+    //! Write the responses of the returned requests.  Return false if the connection should close.
+    virtual bool WritePipelined();
+    //! Whether there are taken requests that have not been returned or a return is still scheduled
+    bool HasOutstandingRequests() { return (outstanding_.load() > 0) || completionScheduled_.load(); }
+    //! Set the gate that passes the deferred responses to the server thread, null to not defer any
+    void SetResponseGate(const std::shared_ptr<ResponseGate>& gate) { responseGate_ = gate; }
+    //! Write the response of a deferred call - called by the server thread.  Return true if the caller must schedule WritePipelined.
+    bool CompleteDeferred(DeferredResponse* response);
+    //! Keep a deferred response that finished while a worker thread still has the connection
+    void ParkResponse(DeferredResponse* response) { parkedResponse_ = response; }
+    //! Take the response that was kept by ParkResponse, null if none
+    DeferredResponse* TakeParkedResponse() { DeferredResponse* response = parkedResponse_; parkedResponse_ = 0; return response; }
+    enum TimeoutType
+    {
+        TIMEOUT_NONE, TIMEOUT_IDLE, TIMEOUT_HEADER, TIMEOUT_BODY
+    };
+    //! Get the timeout that applies to the current state - idle between requests or while reading a request
+    virtual TimeoutType GetTimeoutType();
+    //! Set the keep alive limits - the idle timeout in milliseconds and the number of requests before closing, 0 for no limit
+    void SetKeepAliveLimits(unsigned idleTimeout, unsigned maxRequests) { idleTimeout_ = idleTimeout; maxRequests_ = maxRequests; }
+    //! Set the largest request body that is accepted
+    void SetMaxContentLength(std::size_t maxContentLength) { maxContentLength_ = maxContentLength; }
+#if defined(ANYRPC_ZEROCOPY)
+    //! Send the response bodies of at least the number of bytes without copying them (MSG_ZEROCOPY), 0 to always copy
+    void SetZeroCopyThreshold(std::size_t threshold);
+#endif // defined(ANYRPC_ZEROCOPY)
+    //! Get the number of requests that have been read
+    unsigned GetRequestCount() { return requestCount_; }
+    //! Get the time (MonotonicMicroTime) when data was last read from or written to the client
+    virtual int64_t GetLastTransactionTime() { return lastTransactionTime_.load(std::memory_order_relaxed); }
+    //! Whether the connection is active for processing by the server's main thread
+    bool IsActive() { return active_.load(std::memory_order_acquire); }
+
+    //! Get the next connection in a completion queue
+    Connection* GetNextCompleted() { return nextCompleted_; }
+    //! Set the next connection in a completion queue
+    void SetNextCompleted(Connection* next) { nextCompleted_ = next; }
+
+    //! Get the connection used before this one in the server's list
+    Connection* GetPrevListed() { return prevListed_; }
+    //! Set the connection used before this one in the server's list
+    void SetPrevListed(Connection* prev) { prevListed_ = prev; }
+    //! Get the connection used after this one in the server's list
+    Connection* GetNextListed() { return nextListed_; }
+    //! Set the connection used after this one in the server's list
+    void SetNextListed(Connection* next) { nextListed_ = next; }
+    //! Whether the connection is in the server's list of busy connections instead of the idle ones
+    bool IsListedBusy() { return listedBusy_; }
+    //! Set whether the connection is in the server's list of busy connections
+    void SetListedBusy(bool busy) { listedBusy_ = busy; }
+
+    //! Get the timer used by the server for the timeouts
+    internal::TimerEntry* GetTimer() { return &timer_; }
+    //! Get the timeout type and request count when the timer was last set
+    TimeoutType GetTimerType(unsigned& requestCount) { requestCount = timerRequest_; return timerType_; }
+    //! Set the timeout type and request count when the timer is set
+    void SetTimerType(TimeoutType type, unsigned requestCount) { timerType_ = type; timerRequest_ = requestCount; }
+
+    //! Get the events currently registered with the server's poller
+    unsigned GetPollEvents() { return pollEvents_; }
+    //! Set the events currently registered with the server's poller
+    void SetPollEvents(unsigned events) { pollEvents_ = events; }
 
     //! Get ip and port of connection (local)
     virtual bool GetSockInfo(std::string& ip, unsigned& port) const { return socket_.GetSockInfo(ip, port); }
@@ -151,7 +418,10 @@ public:
     virtual bool GetPeerInfo(std::string& ip, unsigned& port) const { return socket_.GetPeerInfo(ip, port); }
 
 #if defined(ANYRPC_THREADING)
-    void StartThread();
+    //! Function called by the connection's thread after it processes data and once more when it stops
+    typedef void ThreadCallback(void* owner, Connection* connection, bool stopped);
+
+    void StartThread(ThreadCallback* callback=0, void* owner=0);
     void StopThread(bool waitForJoin=true);
     bool IsThreadRunning() { return threadRunning_; }
 #endif
@@ -163,24 +433,84 @@ protected:
     virtual bool ReadHeader() = 0;
     //! Read the request body
     virtual bool ReadRequest();
+    //! Read the available data of the request body without completing it.  Return false if the connection should close.
+    bool ReceiveRequest();
+    //! Finish a request body that has been read and prepare to execute it
+    void CompleteRequest();
+    //! Allocate the request body, or grow the allocation, so it can hold at least the length.
+    /*! The allocation grows by doubling up to the limit so the memory follows the data that has arrived
+     *  instead of the length given by the client.  The data already in request_ is kept.
+     *  The whole body is still held in memory before it is parsed.
+     *  Return false if the memory can't be allocated.
+     */
+    bool ReserveRequest(std::size_t length, std::size_t limit);
     //! Execute the request to produce the response
     virtual bool ExecuteRequest() = 0;
+    //! Continue with the response of a deferred call after it has been encoded.  Return false if the connection should close.
+    virtual bool ResumeRequest() { return false; }
+    //! Add the framing to the response of a pipelined request
+    virtual void FrameResponse(PipelinedRequest* request, bool sendResponse) { request->sendResponse_ = sendResponse; }
+    //! Send the encoded part of a streamed response while the method is running.  Return false if it failed.
+    virtual bool SendPart() { return true; }
+    //! Drop the encoded part of a streamed response.  Return false if some of it has been sent.
+    virtual bool DiscardPart(WriteSegmentedStream& response) { response.Clear(); return true; }
     //! Write the response - header and body
     virtual bool WriteResponse();
+    //! Record that data was transferred with the client
+    void Touch() { lastTransactionTime_.store(MonotonicMicroTime(), std::memory_order_relaxed); }
+    //! Whether the last request allowed on the connection has been read
+    bool RequestLimitReached() { return (maxRequests_ > 0) && (requestCount_ >= maxRequests_); }
+    //! Add a returned request to the write queue, or delete it if there is nothing to write
+    void QueueResponse(PipelinedRequest* request);
+    //! Remove a request from the list and delete it
+    void DeleteRequest(PipelinedRequest* request);
+    //! Move the part of a gather write that belongs to the stream to its count.  Return true if all of the stream has been written.
+    static bool AdvanceStream(WriteSegmentedStream& stream, std::size_t& streamBytesWritten, std::size_t& bytesWritten);
+    //! Add the data of a response body from the offset to the next write, marking the buffers that can be sent without a copy
+    void AppendResponse(WriteSegmentedStream& response, std::size_t offset);
+    //! Keep the buffers of a response body that was sent without a copy until the kernel is done with them
+    void FinishResponse(WriteSegmentedStream& response);
+    //! Whether a response body is large enough to send without a copy
+    bool UseZeroCopy(WriteSegmentedStream& response) { return (zeroCopyThreshold_ > 0) && (response.Length() >= zeroCopyThreshold_); }
+    //! Set the state for a new connection - the buffers are kept
+    void ResetState();
 
     TcpSocket socket_;                      //!< Socket for communication
     MethodManager *manager_;                //!< Pointer to the manager with the list of methods
 
     enum ConnectionState
     {
-        READ_HEADER, READ_REQUEST, EXECUTE_REQUEST, WRITE_RESPONSE, CLOSE_CONNECTION
+        READ_HEADER, READ_REQUEST, EXECUTE_REQUEST, WAIT_RESPONSE, WRITE_RESPONSE, CLOSE_CONNECTION
     };
     ConnectionState connectionState_;       //!< Current state for processing the RPC request
-    time_t lastTransactionTime_;            //!< Time when the last transaction occurred - used to set priority for forced disconnect
-    bool active_;
+    std::atomic<int64_t> lastTransactionTime_;  //!< Time when data was last transferred - used to set priority for forced disconnect
+    std::atomic<bool> active_;              //!< Whether the server's main thread should process this connection
+    Connection* nextCompleted_;             //!< Link for the completion queue when returned from a worker thread
+    Connection* prevListed_;                //!< Link for the server's list of connections
+    Connection* nextListed_;                //!< Link for the server's list of connections
+    bool listedBusy_;                       //!< Whether the server has the connection in its list of busy connections
+    unsigned pollEvents_;                   //!< Events registered with the server's poller
+    internal::TimerEntry timer_;            //!< Timer for the server's timer wheel
+    TimeoutType timerType_;                 //!< Type of timeout when the timer was set
+    unsigned timerRequest_;                 //!< Request count when the timer was set
+    unsigned idleTimeout_;                  //!< Time in milliseconds that the server waits between requests, 0 for no limit
+    unsigned maxRequests_;                  //!< Number of requests before the connection is closed, 0 for no limit
+    unsigned requestCount_;                 //!< Number of requests that have been read
+    int64_t queuedTime_;                    //!< Time when the request was queued for a worker thread
+    std::size_t zeroCopyThreshold_;         //!< Size of a response body to send without a copy, 0 to always copy
+
+    internal::LruList<PipelinedRequest> requests_;  //!< Requests taken from the connection that have not been written
+    internal::CompletionQueue<PipelinedRequest> completedRequests_;    //!< Requests returned by the worker threads
+    std::atomic<unsigned> outstanding_;     //!< Requests taken that have not been returned
+    std::atomic<bool> completionScheduled_; //!< Whether a returned request has scheduled WritePipelined
+    PipelinedRequest* writeHead_;           //!< Next response to write
+    PipelinedRequest* writeTail_;           //!< Last response to write
+    std::shared_ptr<ResponseGate> responseGate_;    //!< Gate for the deferred responses, null if they are not supported
+    DeferredResponse* parkedResponse_;      //!< Deferred response that finished while a worker thread had the connection
 
     static const std::size_t MaxBufferLength = 2048;
-    static const std::size_t MaxContentLength = 1000000;
+    static const std::size_t DefaultMaxContentLength = 1000000;
+    static const std::size_t InitialRequestCapacity = 64*1024;  //!< First allocation for a request body that doesn't fit in buffer_
 
     char buffer_[MaxBufferLength+1];        //!< Fixed buffer for request header and possibly the body
     std::size_t bufferLength_;              //!< Amount of data in the buffer_
@@ -190,22 +520,30 @@ protected:
     char* request_;                         //!< Pointer to the start of the request body
     std::size_t contentAvail_;              //!< Number of bytes of the request body in the buffer
     bool requestAllocated_;                 //!< Whether the request pointer is allocated or just a pointer to buffer_
+    std::size_t requestCapacity_;           //!< Bytes that fit in an allocated request, not counting the null termination
+    std::size_t maxContentLength_;          //!< Largest request body that is accepted
 
     WriteSegmentedStream header_;           //!< Data for the response header
     std::size_t headerBytesWritten_;        //!< Number of bytes of the header already written
 
     WriteSegmentedStream response_;         //!< Data for the response body
     std::size_t resultBytesWritten_;        //!< Number of bytes of the body already written
+    SendSegmentList segments_;              //!< Blocks of data for the next write - kept to reuse the storage
+
+    //! Creates the responders for the AsyncMethods called by the RPC handler
+    class Deferral;
 
 #if defined(ANYRPC_THREADING)
 private:
     //! Function that is called when the thread is started
     void ThreadStarter();
-    //! Process data for a number of milliseconds before checking if the thread should stop
+    //! Process data for a number of milliseconds, or until the connection closes if negative
     void Work(int ms);
 
     std::thread thread_;                    //!< Thread information
-    bool threadRunning_;                    //!< Indication that the thread should be running
+    std::atomic<bool> threadRunning_;       //!< Indication that the thread should be running
+    ThreadCallback* threadCallback_;        //!< Function that tells the server about the thread, null if none
+    void* threadOwner_;                     //!< Server passed to the callback
 #endif
 };
 
@@ -224,21 +562,100 @@ class ANYRPC_API HttpConnection : public Connection
 {
 public:
     HttpConnection(SOCKET fd, MethodManager* manager, RpcHandlerList& handlers) :
-        Connection(fd, manager), handlers_(handlers) {}
+        Connection(fd, manager), handlers_(handlers), partSent_(false) {}
 
     virtual void Initialize(bool preserveBufferData=false);
+    virtual bool RejectRequest();
+    virtual bool GetMethodName(std::string& methodName);
 
 protected:
     virtual bool ReadHeader();
+    virtual bool ReadRequest();
     virtual bool ExecuteRequest();
-
-private:
-    void GeneratePOSTResponseHeader(std::size_t bodySize, std::string& contentType);
-    void GenerateOPTIONSResponseHeader();
+    virtual bool ResumeRequest();
+    virtual bool SendPart();
+    virtual bool DiscardPart(WriteSegmentedStream& response) { return !partSent_ && Connection::DiscardPart(response); }
+    //! Switch to the protocol of a GET request with an Upgrade header after generating the response header.  Return false if not supported.
+    virtual bool Upgrade() { return false; }
+    //! Find the handler for the content-type of the request, or the end of the list if none
+    RpcHandlerList::iterator FindHandler();
     void GenerateErrorResponseHeader(int code, std::string message);
 
     internal::HttpRequest httpRequestState_;    //!< Processing of the HTTP header
     RpcHandlerList& handlers_;                  //!< List of RPC handlers to check
+
+private:
+    //! Decode the chunks that have arrived into the request body
+    /*! The chunks are only collected in request_.  The body is parsed after the last chunk has arrived.
+     */
+    bool ReadChunkedRequest();
+    //! Frame the encoded part of the response as a chunk in front of the data that follows it
+    void FrameChunk(const char* following);
+    //! Get the content-type for the response of the handler
+    std::string& GetResponseContentType(RpcContentHandler& handler);
+    //! Generate the header for the response to a POST that used the handler
+    void FinishPOSTResponse(RpcContentHandler& handler);
+    void GeneratePOSTResponseHeader(std::size_t bodySize, std::string& contentType, bool chunked=false);
+    void GenerateOPTIONSResponseHeader();
+    void GenerateBusyResponseHeader();
+
+    internal::HttpChunkedDecoder chunkedDecoder_;   //!< Decoding of a chunked request body
+    bool partSent_;                             //!< Whether part of the response has been sent in chunks
+
+    static const std::size_t PartLength = 64*1024;  //!< Encoded data of a streamed response to collect before sending a chunk
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Process an HTTP server connection that can be upgraded to the WebSocket protocol
+/*!
+ *  The connection is handled as HTTP until a GET request asks to upgrade to a
+ *  WebSocket (RFC 6455).  The handler is selected by the first token of the
+ *  Sec-WebSocket-Protocol header that it can process as a content-type, like
+ *  json-rpc or messagepack-rpc, or by the content-type of the GET request
+ *  without the header.  After the handshake, each text or binary message is an
+ *  RPC request, a JSON-RPC batch included, and the response is sent as a single
+ *  frame of the same type so the framing only adds a few bytes to the messages.
+ *  The messages that arrive together are executed back to back, fragmented
+ *  messages are assembled before they are executed, pings are answered, and a
+ *  close frame from the client is answered before the connection closes.
+ */
+class ANYRPC_API WebSocketConnection : public HttpConnection
+{
+public:
+    WebSocketConnection(SOCKET fd, MethodManager* manager, RpcHandlerList& handlers) :
+        HttpConnection(fd, manager, handlers), upgraded_(false), handler_(0), opcode_(0), fragmented_(false) {}
+
+    virtual void Recycle();
+    virtual bool RejectRequest();
+    virtual bool GetMethodName(std::string& methodName);
+
+protected:
+    //! Read the HTTP header, or the frames after the upgrade
+    virtual bool ReadHeader();
+    virtual bool ReadRequest();
+    virtual bool ExecuteRequest();
+    virtual bool ResumeRequest() { return upgraded_ ? FinishRequest(true) : HttpConnection::ResumeRequest(); }
+    //! The response of a message is sent in one frame
+    virtual bool SendPart() { return upgraded_ || HttpConnection::SendPart(); }
+    virtual bool Upgrade();
+
+private:
+    //! Process the frames in the buffer until a message is being read.  Return false if the connection should close.
+    bool ProcessFrames(bool eof);
+    //! Answer a complete control frame that is at the start of the buffer
+    bool ProcessControlFrame();
+    //! Send the response if there is one or continue with the next message
+    bool FinishRequest(bool sendResponse);
+    //! Drop the data that has been read and close the connection after sending a close frame with the status code
+    bool SendClose(unsigned code);
+
+    bool upgraded_;                         //!< Whether the WebSocket handshake has been done
+    RpcContentHandler* handler_;            //!< Handler for the subprotocol of the WebSocket
+    internal::WebSocketFrame frame_;        //!< Header of the frame being read
+    unsigned opcode_;                       //!< Type of the message being read, used for its response
+    bool fragmented_;                       //!< Whether the message being read continues in the next frame
+    std::string message_;                   //!< Fragments of the message that have been read
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -254,20 +671,167 @@ private:
 class ANYRPC_API TcpConnection : public Connection
 {
 public:
-    TcpConnection(SOCKET fd, MethodManager* manager, RpcHandler* handler) :
-        Connection(fd, manager), handler_(handler), commaExpected_(false) {}
-
-    virtual bool ForcedDisconnectAllowed() { return commaExpected_ ? (bufferLength_ <= 1) : (bufferLength_ == 0); }
+    TcpConnection(SOCKET fd, MethodManager* manager, RpcHandler* handler, RpcFaultHandler* faultHandler=0, bool pipeliningSupported=false,
+                  RpcMethodNameHandler* methodNameHandler=0) :
+        Connection(fd, manager), handler_(handler), faultHandler_(faultHandler), methodNameHandler_(methodNameHandler),
+        pipeliningSupported_(pipeliningSupported), commaExpected_(false) {}
+
+    virtual bool ForcedDisconnectAllowed()
+        { return !HasOutstandingRequests() && (writeHead_ == 0) && (commaExpected_ ? (bufferLength_ <= 1) : (bufferLength_ == 0)); }
+    virtual void Recycle() { Connection::Recycle(); commaExpected_ = false; }
+    virtual bool GetMethodName(std::string& methodName)
+        { return (methodNameHandler_ != 0) && (request_ != 0) && methodNameHandler_(request_, contentLength_, methodName); }
+    virtual bool RejectRequest();
+    virtual bool PipeliningSupported() { return pipeliningSupported_; }
+    virtual bool ExecutePipelined(PipelinedRequest* request);
+    virtual void RejectPipelined(PipelinedRequest* request);
 
 protected:
     virtual bool ReadHeader();
     virtual bool ExecuteRequest();
+    virtual bool ResumeRequest() { return FinishRequest(true); }
+    //! Add the netstring framing to the response of a pipelined request
+    virtual void FrameResponse(PipelinedRequest* request, bool sendResponse);
 
 private:
+    //! Send the response if there is one or continue with the next request
+    bool FinishRequest(bool sendResponse);
+
     RpcHandler *handler_;                   //!< Pointer to the handler to process the requests
+    RpcFaultHandler *faultHandler_;         //!< Pointer to the handler for rejected requests, the connection closes if not defined
+    RpcMethodNameHandler *methodNameHandler_;   //!< Pointer to the function to find the method name, null if not supported
+    bool pipeliningSupported_;              //!< Whether the protocol's responses identify the requests so they can be out of order
     bool commaExpected_;                    //!< A comma separate is expected before the next message
 };
 
+////////////////////////////////////////////////////////////////////////////////
+
+//! Request of an HTTP/2 stream that is executed separately from the connection
+struct ANYRPC_API Http2Request : public PipelinedRequest
+{
+    Http2Request(Connection* connection, const char* request, std::size_t length, uint32_t streamId, RpcContentHandler* handler) :
+        PipelinedRequest(connection, request, length), streamId_(streamId), handler_(handler), status_(200), headersSent_(false) {}
+
+    uint32_t streamId_;                     //!< Stream that carries the request
+    RpcContentHandler* handler_;            //!< Handler for the content-type of the request
+    unsigned status_;                       //!< HTTP status of the response
+    bool headersSent_;                      //!< Whether the HEADERS frame of the response has been framed
+};
+
+//! Process an HTTP/2 server connection without TLS (h2c) that starts with the client's connection preface
+/*!
+ *  Each stream carries a POST request and the content-type of the stream selects the
+ *  RpcContentHandler the same way as HttpConnection.  A stream is taken as a PipelinedRequest
+ *  as soon as its request has been read, so the streams of a connection execute
+ *  concurrently on the workers of ServerTP, and the responses are written in the
+ *  order that they complete.  The other servers execute the streams one at a time.
+ *
+ *  The server thread frames the responses when they are written so the DATA frames
+ *  stay within the flow control windows that the client gives.  The windows for the
+ *  request data are opened again as soon as the data has been read, and a stream
+ *  with more than the maximum content length is reset.  The header blocks are
+ *  decoded with HPACK, including Huffman coded strings, but the responses don't add
+ *  entries to the client's dynamic table.
+ */
+class ANYRPC_API Http2Connection : public Connection
+{
+public:
+    Http2Connection(SOCKET fd, MethodManager* manager, RpcHandlerList& handlers);
+
+    virtual void Process(bool executeAfterRead = true);
+    virtual void Recycle();
+    virtual bool WaitForReadability() { return IsActive() && (connectionState_ != CLOSE_CONNECTION); }
+    virtual bool WaitForWritability();
+    virtual bool CheckExecuteState() { return !readyStreams_.empty() && (connectionState_ != CLOSE_CONNECTION); }
+    virtual bool ForcedDisconnectAllowed();
+    virtual bool RejectRequest() { return false; }
+    virtual bool GetMethodName(std::string& methodName);
+    virtual bool PipeliningSupported() { return true; }
+    virtual PipelinedRequest* TakeRequest();
+    virtual bool ExecutePipelined(PipelinedRequest* request);
+    virtual void RejectPipelined(PipelinedRequest* request);
+    virtual bool WritePipelined();
+
+    static const unsigned MaxStreams = 100;     //!< Streams that the client can open at the same time
+
+protected:
+    //! Read the available frames and process them
+    virtual bool ReadHeader();
+    //! Execute the streams that have been read one at a time
+    virtual bool ExecuteRequest();
+    //! Every stream is answered, with an error status if the request failed
+    virtual void FrameResponse(PipelinedRequest* request, bool /* sendResponse */) { request->sendResponse_ = true; }
+
+private:
+    //! State of a stream from when its HEADERS frame is read until its response has been framed
+    struct StreamState
+    {
+        StreamState() : handler_(0), status_(200), sendWindow_(0), endStream_(false), taken_(false), reset_(false) {}
+
+        std::string body_;                  //!< Request data that has been read
+        RpcContentHandler* handler_;        //!< Handler for the content-type of the request
+        std::string contentType_;           //!< Content-type for the response
+        unsigned status_;                   //!< HTTP status when the request can't be executed
+        int64_t sendWindow_;                //!< Flow control window for the response data
+        bool endStream_;                    //!< Whether all of the request has been read
+        bool taken_;                        //!< Whether the request has been taken to execute
+        bool reset_;                        //!< Whether the client reset the stream after it was taken
+    };
+    typedef std::map<uint32_t, StreamState> StreamMap;
+
+    //! Process a complete frame.  Return false if the connection should close.
+    bool ProcessFrame(internal::Http2Frame& frame, const char* payload);
+    bool ProcessSettings(internal::Http2Frame& frame, const char* payload);
+    bool ProcessWindowUpdate(internal::Http2Frame& frame, const char* payload);
+    bool ProcessData(internal::Http2Frame& frame, const char* payload);
+    //! Decode a complete header block and start the stream.  Return false if the connection should close.
+    bool ProcessHeaderBlock(uint32_t streamId, bool endStream);
+    //! Make the request of a stream that has been read ready to take, or answer it if it can't be executed
+    void FinishStream(uint32_t streamId, StreamState& stream);
+    //! Point request_ to the request of the next stream to take
+    void SelectReadyStream();
+    //! Answer a stream with an error status without executing it
+    void QueueStatus(uint32_t streamId, unsigned status);
+    //! Forget a stream that was reset, or drop its response if it was already taken
+    void DropStream(StreamMap::iterator it);
+    //! Reset a stream with the error and forget it
+    void ResetStream(StreamMap::iterator it, unsigned errorCode);
+    //! Frame the queued responses within the flow control windows
+    void FrameResponses();
+    //! Frame more of the response of a stream.  Return true once all of it has been framed.
+    bool FrameStream(Http2Request* request, StreamState& stream);
+    //! Whether a queued response has data that the flow control windows allow
+    bool CanFrameResponse();
+    //! Whether the connection has nothing left to do after the client or the request limit ended it
+    bool Finished() { return goAway_ && streams_.empty() && !HasOutstandingRequests() && (writeHead_ == 0); }
+    //! Send GOAWAY with the error and close the connection.  Always returns false.
+    bool Fail(unsigned errorCode, const char* reason);
+    //! Reset the protocol state for a new connection
+    void ResetStreams();
+
+    RpcHandlerList& handlers_;              //!< List of RPC handlers to check
+    internal::HpackDecoder decoder_;        //!< Decoder for the header blocks from the client
+    std::vector<char> input_;               //!< Frames that have been read but not processed
+    std::size_t inputLength_;               //!< Amount of data in input_
+    bool prefaceReceived_;                  //!< Whether the client's connection preface has been read
+    WriteSegmentedStream output_;           //!< Frames to write
+    std::size_t outputBytesWritten_;        //!< Number of bytes of output_ already written
+    StreamMap streams_;                     //!< Streams that are open
+    std::deque<uint32_t> readyStreams_;     //!< Streams whose request has been read and can be taken
+    uint32_t lastStreamId_;                 //!< Highest stream id opened by the client
+    uint32_t continuationStream_;           //!< Stream of a header block that continues in the next frame, 0 if none
+    bool continuationEndStream_;            //!< Whether the header block that continues ends its stream
+    std::string headerBlock_;               //!< Header block that continues in the next frame
+    int64_t sendWindow_;                    //!< Flow control window of the connection for the response data
+    uint32_t initialWindow_;                //!< Window of a new stream from the client's settings
+    std::size_t maxFrameSize_;              //!< Largest frame payload that the client accepts
+    uint32_t windowUpdate_;                 //!< Request data read for the connection window since it was last opened
+    bool goAway_;                           //!< Whether new streams are refused
+
+    static const std::size_t MaxHeaderBlockLength = 64*1024;   //!< Largest header block that is accepted
+    static const std::size_t OutputLimit = 64*1024;            //!< Amount of response data to frame for each write
+};
+
 } // namespace anyrpc
 
 #endif // ANYRPC_CONNECTION_H_
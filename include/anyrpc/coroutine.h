@@ -0,0 +1,309 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef ANYRPC_COROUTINE_H_
+#define ANYRPC_COROUTINE_H_
+
+// This header requires C++20 and is only used with the anyrpc-coroutine library
+// (BUILD_WITH_COROUTINES), the rest of AnyRPC only requires C++11.
+#if !defined(__cpp_impl_coroutine)
+# error "anyrpc/coroutine.h requires a compiler with C++20 coroutine support"
+#endif
+
+#include "anyrpc.h"
+#include "internal/wakeup.h"
+
+#if !defined(ANYRPC_THREADING)
+# error "anyrpc/coroutine.h requires AnyRPC to be built with threading"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+#if defined(__MINGW32__)
+# include "internal/mingw.thread.h"
+# include "internal/mingw.mutex.h"
+#else
+# include <thread>
+# include <mutex>
+#endif // defined(__MINGW32__)
+
+namespace anyrpc
+{
+
+template <typename T> class Task;
+
+namespace internal
+{
+
+//! Promise state shared by all of the Task types
+class TaskPromiseBase
+{
+public:
+    //! Resume the coroutine that is awaiting the task once it finishes
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            std::coroutine_handle<> continuation = handle.promise().GetContinuation();
+            return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { exception_ = std::current_exception(); }
+
+    std::coroutine_handle<> GetContinuation() { return continuation_; }
+    void SetContinuation(std::coroutine_handle<> continuation) { continuation_ = continuation; }
+
+protected:
+    void RethrowIfFailed() { if (exception_) std::rethrow_exception(exception_); }
+
+private:
+    std::coroutine_handle<> continuation_;      //!< Coroutine awaiting the task
+    std::exception_ptr exception_;              //!< Exception thrown by the task
+};
+
+//! Promise for a Task that produces a value
+template <typename T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+    anyrpc::Task<T> get_return_object();
+    void return_value(T value) { value_ = std::move(value); }
+    //! Get the value or rethrow the exception from the task
+    T Result() { RethrowIfFailed(); return std::move(value_); }
+
+private:
+    T value_;
+};
+
+//! Promise for a Task that doesn't produce a value
+template <>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+    anyrpc::Task<void> get_return_object();
+    void return_void() {}
+    //! Rethrow the exception from the task
+    void Result() { RethrowIfFailed(); }
+};
+
+//! A coroutine waiting for a socket or to be scheduled on a CoroutineExecutor
+struct CoroutineWaiter
+{
+    CoroutineWaiter() : fd_(static_cast<SOCKET>(-1)), events_(0), deadline_(0), ready_(false) {}
+
+    SOCKET fd_;                             //!< Socket to wait for
+    unsigned events_;                       //!< Poller events to wait for, none to only be scheduled
+    int64_t deadline_;                      //!< Monotonic time to give up waiting, 0 to wait forever
+    bool ready_;                            //!< Whether the socket was ready before the deadline
+    std::coroutine_handle<> handle_;        //!< Coroutine to resume
+};
+
+} // namespace internal
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! A lazily started coroutine that produces a T when awaited
+/*!
+ *  A Task doesn't run until it is awaited by another coroutine.  When it finishes
+ *  the awaiting coroutine resumes on the same thread, so a chain of tasks follows
+ *  the thread that resumes the innermost one.  An exception thrown by the task is
+ *  rethrown from the co_await.
+ */
+template <typename T = void>
+class Task
+{
+public:
+    typedef internal::TaskPromise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    explicit Task(Handle handle) : handle_(handle) {}
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, Handle())) {}
+    ~Task() { if (handle_) handle_.destroy(); }
+
+    bool await_ready() const noexcept { return handle_.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle_.promise().SetContinuation(awaiting);
+        return handle_;
+    }
+    T await_resume() { return handle_.promise().Result(); }
+
+private:
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    Handle handle_;                         //!< The coroutine for the task
+};
+
+namespace internal
+{
+template <typename T>
+inline anyrpc::Task<T> TaskPromise<T>::get_return_object()
+{
+    return anyrpc::Task<T>(std::coroutine_handle<TaskPromise<T> >::from_promise(*this));
+}
+
+inline anyrpc::Task<void> TaskPromise<void>::get_return_object()
+{
+    return anyrpc::Task<void>(std::coroutine_handle<TaskPromise<void> >::from_promise(*this));
+}
+} // namespace internal
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Function signature for a method implemented as a coroutine
+typedef Task<Value> CoroutineFunction(Value& params);
+
+//! A CoroutineMethod responds with the value produced by a coroutine
+/*!
+ *  The coroutine starts on the thread executing the request and the thread is
+ *  released at the first co_await that suspends, so a server with a few threads
+ *  can hold many calls that wait on sockets or other servers.  The parameters
+ *  are copied into the coroutine so they stay valid after the request buffer
+ *  is reused.  An AnyRpcException thrown by the coroutine is sent as a fault.
+ *
+ *  When the connection can't write the response later (see AsyncMethod), the
+ *  executing thread waits for the coroutine to finish instead.
+ */
+class ANYRPC_API CoroutineMethod : public AsyncMethod
+{
+public:
+    CoroutineMethod(std::string const& name, std::string const& help, bool deleteOnRemove=true) :
+        AsyncMethod(name, help, deleteOnRemove) {}
+
+    virtual void ExecuteAsync(Value& params, MethodResponder* responder);
+    virtual Task<Value> ExecuteCoroutine(Value& params) = 0;
+};
+
+//! A CoroutineMethodFunction is created with a function pointer that is called by the ExecuteCoroutine method.
+class CoroutineMethodFunction : public CoroutineMethod
+{
+public:
+    CoroutineMethodFunction(CoroutineFunction* function, std::string const& name, std::string const& help, bool deleteOnRemove=true) :
+        CoroutineMethod(name, help, deleteOnRemove), function_(function) {}
+    virtual Task<Value> ExecuteCoroutine(Value& params) { return function_(params); }
+private:
+    CoroutineFunction *function_;
+};
+
+//! Add a coroutine function to the methods of the manager
+inline void AddCoroutineFunction(MethodManager* manager, CoroutineFunction* function, std::string const& name, std::string const& help)
+{
+    manager->AddMethod(new CoroutineMethodFunction(function, name, help));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Thread that resumes coroutines when their sockets are ready
+/*!
+ *  The executor runs its own event loop with a Poller so a coroutine waiting
+ *  for a socket doesn't hold a server or worker thread.  The coroutine resumes
+ *  on the executor thread, so the code between co_await calls should be short
+ *  or hop to another thread.  The response of a CoroutineMethod is still
+ *  encoded and sent by the server thread.
+ *
+ *  Only one coroutine can wait on a socket at a time.  When the executor is
+ *  stopped, the waiting coroutines resume as if they timed out and later
+ *  waits finish immediately without success.
+ */
+class ANYRPC_API CoroutineExecutor
+{
+public:
+    CoroutineExecutor();
+    ~CoroutineExecutor();
+
+    //! Start the executor thread
+    bool Start();
+    //! Stop the executor thread after resuming the waiting coroutines
+    void Stop();
+    //! Whether the executor thread is running
+    bool IsRunning();
+
+    //! Awaitable that resumes on the executor thread
+    class ANYRPC_API Awaiter
+    {
+    public:
+        Awaiter(CoroutineExecutor* executor) : executor_(executor) {}
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle);
+        //! Whether the socket was ready before the timeout
+        bool await_resume() const noexcept { return waiter_.ready_; }
+
+    private:
+        friend class CoroutineExecutor;
+
+        CoroutineExecutor* executor_;       //!< Executor that resumes the coroutine
+        internal::CoroutineWaiter waiter_;  //!< Registration with the executor
+    };
+
+    //! Wait for the socket to be readable, giving up after ms milliseconds if it isn't negative
+    Awaiter Readable(SOCKET fd, int ms = -1) { return Wait(fd, ms, true); }
+    //! Wait for the socket to be writable, giving up after ms milliseconds if it isn't negative
+    Awaiter Writable(SOCKET fd, int ms = -1) { return Wait(fd, ms, false); }
+    //! Continue on the executor thread - the result is false if the executor isn't running
+    Awaiter Schedule() { return Awaiter(this); }
+
+    //! Make an RPC call with the client and wait for the response without holding the thread
+    /*!
+     *  The request is sent with Client::Post on the current thread and the response
+     *  is read with Client::GetPostResult once the socket is readable, using the
+     *  client's timeout for both.  The client must only be used by one call at a time.
+     */
+    Task<bool> Call(Client& client, const char* method, Value& params, Value& result);
+
+private:
+    log_define("AnyRPC.CoroutineExecutor");
+
+    Awaiter Wait(SOCKET fd, int ms, bool read);
+    //! Queue the waiter for the executor thread, false if it isn't running
+    bool Submit(internal::CoroutineWaiter* waiter);
+    //! Event loop for the executor thread
+    void Run();
+    //! Register the queued waiters with the poller, scheduled ones are added to the ready list
+    void Register(std::vector<internal::CoroutineWaiter*>& ready);
+    //! Stop waiting for the socket
+    void Unregister(internal::CoroutineWaiter* waiter);
+
+    internal::Poller* poller_;                              //!< Poller for the waiting sockets
+    internal::Wakeup wakeup_;                               //!< Signals the executor thread that waiters were queued
+    std::thread thread_;                                    //!< Executor thread
+    std::mutex mutex_;                                      //!< Protects running_ and incoming_
+    bool running_;                                          //!< Whether waiters are accepted
+    bool stop_;                                             //!< Request for the executor thread to finish
+    std::vector<internal::CoroutineWaiter*> incoming_;      //!< Waiters queued by other threads
+    std::set<internal::CoroutineWaiter*> waiting_;          //!< Waiters registered with the poller
+    std::multimap<int64_t, internal::CoroutineWaiter*> deadlines_;  //!< Waiters with a timeout, by deadline
+};
+
+} // namespace anyrpc
+
+#endif // ANYRPC_COROUTINE_H_
@@ -41,6 +41,7 @@ enum ANYRPC_API AnyRpcErrorCode
     AnyRpcErrorServerError                          = -32000,   //!< Generic server error
     AnyRpcErrorResponseParseError                   = -32001,   //!< Parse error with RPC response
     AnyRpcErrorInvalidResponse                      = -32002,   //!< Invalid RPC response
+    AnyRpcErrorServerBusy                           = -32003,   //!< Request shed by the server's admission control
 
     // Transport Errors
     AnyRpcErrorTransportError                       = -32300,   //!< Generic transport error
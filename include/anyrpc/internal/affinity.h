@@ -0,0 +1,59 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef ANYRPC_AFFINITY_H_
+#define ANYRPC_AFFINITY_H_
+
+#if defined(ANYRPC_THREADING)
+
+#include <string>
+#include <vector>
+#if defined(__MINGW32__)
+# include "mingw.thread.h"
+#else
+# include <thread>
+#endif // defined(__MINGW32__)
+
+namespace anyrpc
+{
+namespace internal
+{
+
+//! Set of CPU numbers that a thread is allowed to run on
+typedef std::vector<unsigned> CpuSet;
+
+//! Restrict a thread to a set of CPUs.  Return false if not supported or a CPU is not available.
+ANYRPC_API bool SetThreadAffinity(std::thread& thread, const CpuSet& cpus);
+//! Restrict the calling thread to a set of CPUs
+ANYRPC_API bool SetCurrentThreadAffinity(const CpuSet& cpus);
+//! Get the set of CPUs that the calling thread is allowed to run on
+ANYRPC_API bool GetCurrentThreadAffinity(CpuSet& cpus);
+//! Set the name shown for a thread by debuggers and tools like top - Linux limits it to 15 characters
+ANYRPC_API bool SetThreadName(std::thread& thread, const std::string& name);
+//! Set the name of the calling thread
+ANYRPC_API bool SetCurrentThreadName(const std::string& name);
+
+} // namespace internal
+} // namespace anyrpc
+
+#endif // defined(ANYRPC_THREADING)
+
+#endif // ANYRPC_AFFINITY_H_
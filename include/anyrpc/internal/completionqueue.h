@@ -0,0 +1,95 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef ANYRPC_COMPLETIONQUEUE_H_
+#define ANYRPC_COMPLETIONQUEUE_H_
+
+#include <atomic>
+
+namespace anyrpc
+{
+namespace internal
+{
+
+//! Size used to keep data that is shared between threads on separate cache lines
+static const std::size_t CacheLineSize = 64;
+
+//! Lock-free queue for passing items from many producer threads to a single consumer
+/*!
+ *  The queue is intrusive so a push never allocates memory.  The item type must
+ *  provide GetNextCompleted and SetNextCompleted to access the link pointer and an
+ *  item can only be in one queue at a time.
+ *
+ *  Producers push items individually and the consumer takes all of the items at
+ *  once, so there is only a single atomic operation for each side of the handoff.
+ *  Push returns true when the queue was empty so a producer only needs to wake the
+ *  consumer on that transition.  The consumer should consume the wakeup before
+ *  taking the items so a push that races with the consumer is never missed.
+ *
+ *  The head is padded to a separate cache line so the producers do not contend
+ *  with other data in the owning object.
+ */
+template <typename T>
+class CompletionQueue
+{
+public:
+    CompletionQueue() : head_(0) {}
+
+    //! Add an item to the queue.  Return true if the queue was empty.
+    bool Push(T* item)
+    {
+        T* head = head_.load(std::memory_order_relaxed);
+        do
+        {
+            item->SetNextCompleted(head);
+        } while (!head_.compare_exchange_weak(head, item, std::memory_order_release, std::memory_order_relaxed));
+        return (head == 0);
+    }
+
+    //! Remove all of the items from the queue in the order they were pushed
+    T* PopAll()
+    {
+        T* item = head_.exchange(0, std::memory_order_acquire);
+
+        // the items are linked newest first so reverse the list
+        T* first = 0;
+        while (item != 0)
+        {
+            T* next = item->GetNextCompleted();
+            item->SetNextCompleted(first);
+            first = item;
+            item = next;
+        }
+        return first;
+    }
+
+    //! Whether the queue is empty - only a hint when other threads are pushing
+    bool Empty() const { return (head_.load(std::memory_order_relaxed) == 0); }
+
+private:
+    char padBefore_[CacheLineSize];                             //!< Separate the head from the preceding data
+    std::atomic<T*> head_;                                      //!< Most recently pushed item
+    char padAfter_[CacheLineSize - sizeof(std::atomic<T*>)];    //!< Separate the head from the following data
+};
+
+} // namespace internal
+} // namespace anyrpc
+
+#endif // ANYRPC_COMPLETIONQUEUE_H_
@@ -54,6 +54,14 @@ public:
     bool GetKeepAlive()             { return keepAlive_; }
     std::size_t GetBodyStartPos()   { return startIndex_; }
     std::string& GetContentType()   { return contentType_; }
+    //! Whether the body is sent in chunks (Transfer-Encoding: chunked) instead of with a content length
+    bool GetChunked()               { return chunked_; }
+    //! Get the protocol of the upgrade field in lower case, empty if none
+    std::string& GetUpgrade()       { return upgrade_; }
+    //! Whether the connection field includes the upgrade option
+    bool GetConnectionUpgrade()     { return connectionUpgrade_; }
+    //! Get the subprotocols of a WebSocket handshake (Sec-WebSocket-Protocol)
+    std::string& GetWebSocketProtocol() { return webSocketProtocol_; }
 
 protected:
     log_define("AnyRPC.HttpHeader");
@@ -69,11 +77,21 @@ protected:
     virtual ResultEnum ProcessLine(std::string &key, std::string &value) = 0;
     //! Verify that the header to acceptable
     virtual ResultEnum Verify() = 0;
+    //! Process the value of the transfer-encoding field
+    ResultEnum ProcessTransferEncoding(std::string &value);
+    //! Verify that the length of the body is given one way
+    ResultEnum VerifyBodyLength(bool required);
+    //! Process the fields that are common to the requests and responses for an upgrade.  Return true if the key was one of them.
+    bool ProcessUpgradeLine(std::string &key, std::string &value);
 
     std::string httpVersion_;       //!< HTTP version field from the first line
     std::string contentType_;       //!< Info from the content-type field
     int contentLength_;             //!< Info from the content-length field
     bool keepAlive_;                //!< Indication whether the connection should be kept alive after processing
+    bool chunked_;                  //!< Info from the transfer-encoding field
+    std::string upgrade_;           //!< Info from the upgrade field, in lower case
+    bool connectionUpgrade_;        //!< Whether the connection field has the upgrade option
+    std::string webSocketProtocol_; //!< Info from the sec-websocket-protocol field
 
 private:
     std::size_t startIndex_;        //!< Offset from the start of the buffer to continue processing
@@ -96,6 +114,8 @@ public:
     std::string& GetMethod()        { return method_; }
     std::string& GetRequestUri()    { return requestUri_; }
     std::string& GetHost()          { return host_; }
+    std::string& GetWebSocketKey()  { return webSocketKey_; }
+    std::string& GetWebSocketVersion() { return webSocketVersion_; }
 
 protected:
     virtual ResultEnum ProcessFirstLine(std::string &first, std::string &second, std::string &third);
@@ -106,6 +126,8 @@ private:
     std::string method_;            //!< Request method from the first line
     std::string requestUri_;        //!< Request URI from the first line
     std::string host_;              //!< Info from the host field
+    std::string webSocketKey_;      //!< Info from the sec-websocket-key field
+    std::string webSocketVersion_;  //!< Info from the sec-websocket-version field
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -123,6 +145,7 @@ public:
 
     std::string& GetResponseCode()  { return responseCode_; }
     std::string& GetResponseString(){ return responseString_; }
+    std::string& GetWebSocketAccept() { return webSocketAccept_; }
 
 protected:
     virtual ResultEnum ProcessFirstLine(std::string &first, std::string &second, std::string &third);
@@ -132,6 +155,57 @@ protected:
 private:
     std::string responseCode_;          //!< Response code from the first line
     std::string responseString_;        //!< Response string from the first line
+    std::string webSocketAccept_;       //!< Info from the sec-websocket-accept field
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Decode a body sent with chunked transfer encoding as the data arrives
+/*!
+ *  The encoded data can be passed in pieces of any size.  Each call to Process
+ *  returns at most one block of body data, which points into the encoded data,
+ *  so the caller keeps calling with the rest of the data until it is all consumed.
+ *  The chunk extensions and the trailer fields are skipped.
+ */
+class ANYRPC_API HttpChunkedDecoder
+{
+public:
+    HttpChunkedDecoder() { Initialize(); }
+
+    //! Initialize for a new body
+    void Initialize();
+
+    //! States for the processing
+    enum ResultEnum { CHUNKED_COMPLETE, CHUNKED_INCOMPLETE, CHUNKED_FAULT };
+
+    //! Process encoded data and return the state
+    /*! The number of bytes used is returned in consumed, so any data after a complete body
+     *  is left for the next message.  A block of body data is returned in data and dataLength,
+     *  with a length of 0 if there is none.
+     */
+    ResultEnum Process(const char* buffer, std::size_t length, std::size_t& consumed, const char*& data, std::size_t& dataLength);
+    //! Get the number of data bytes left in the current chunk, 0 if not in the data of a chunk
+    std::size_t GetDataLeft() const { return (state_ == CHUNK_DATA) ? chunkSize_ : 0; }
+
+protected:
+    log_define("AnyRPC.HttpChunkedDecoder");
+
+    //! Finish a chunk size line
+    void EndSizeLine();
+    //! Finish a line that ended with CRLF
+    void EndLine();
+
+    enum StateEnum { CHUNK_SIZE, CHUNK_EXTENSION, CHUNK_DATA, CHUNK_END, TRAILER, DONE, FAULT };
+
+    static const unsigned MaxSizeDigits = 15;       //!< Hex digits allowed in a chunk size
+    static const std::size_t MaxLineLength = 4096;  //!< Length allowed for an extension or trailer line
+
+    StateEnum state_;               //!< Current part of the encoding
+    std::size_t chunkSize_;         //!< Size of the chunk, then the data left in it
+    unsigned sizeDigits_;           //!< Number of hex digits in the chunk size
+    bool sizeEnded_;                //!< Whether whitespace followed the chunk size so no more digits are allowed
+    bool lineEnd_;                  //!< Whether a CR was read so the next character must be LF
+    std::size_t lineLength_;        //!< Length of the current extension or trailer line
 };
 
 } // namespace internal
@@ -0,0 +1,159 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef ANYRPC_HTTP2_H_
+#define ANYRPC_HTTP2_H_
+
+namespace anyrpc
+{
+namespace internal
+{
+
+//! Read the header of an HTTP/2 frame and write the frames (RFC 7540)
+/*!
+ *  Every frame starts with a 9 byte header: the 24 bit payload length, the type,
+ *  the flags, and the 31 bit stream id.  Stream 0 carries the frames for the
+ *  whole connection.
+ */
+class ANYRPC_API Http2Frame
+{
+public:
+    enum TypeEnum
+    {
+        FRAME_DATA = 0, FRAME_HEADERS = 1, FRAME_PRIORITY = 2, FRAME_RST_STREAM = 3, FRAME_SETTINGS = 4,
+        FRAME_PUSH_PROMISE = 5, FRAME_PING = 6, FRAME_GOAWAY = 7, FRAME_WINDOW_UPDATE = 8, FRAME_CONTINUATION = 9
+    };
+    enum FlagEnum
+    {
+        FLAG_END_STREAM = 0x1, FLAG_ACK = 0x1, FLAG_END_HEADERS = 0x4, FLAG_PADDED = 0x8, FLAG_PRIORITY = 0x20
+    };
+    enum SettingEnum
+    {
+        SETTINGS_HEADER_TABLE_SIZE = 1, SETTINGS_ENABLE_PUSH = 2, SETTINGS_MAX_CONCURRENT_STREAMS = 3,
+        SETTINGS_INITIAL_WINDOW_SIZE = 4, SETTINGS_MAX_FRAME_SIZE = 5, SETTINGS_MAX_HEADER_LIST_SIZE = 6
+    };
+    enum ErrorEnum
+    {
+        ERR_NONE = 0, ERR_PROTOCOL = 1, ERR_INTERNAL = 2, ERR_FLOW_CONTROL = 3, ERR_SETTINGS_TIMEOUT = 4,
+        ERR_STREAM_CLOSED = 5, ERR_FRAME_SIZE = 6, ERR_REFUSED_STREAM = 7, ERR_CANCEL = 8, ERR_COMPRESSION = 9,
+        ERR_CONNECT = 10, ERR_ENHANCE_YOUR_CALM = 11
+    };
+
+    static const char* const Preface;                       //!< Sent by the client before its first frame
+    static const std::size_t PrefaceLength = 24;
+    static const std::size_t HeaderLength = 9;
+    static const std::size_t DefaultMaxFrameSize = 16384;   //!< Largest payload until the peer's settings allow more
+    static const std::size_t MaxFrameSizeLimit = 16777215;  //!< Largest payload that a peer can allow
+    static const uint32_t DefaultWindowSize = 65535;        //!< Flow control window of a new stream or connection
+    static const uint32_t MaxWindowSize = 0x7fffffff;
+
+    //! Decode the frame header at the start of the data, which must hold at least HeaderLength bytes
+    void ParseHeader(const char* data);
+    //! Find the data in a DATA or HEADERS payload without the padding and priority fields.  Return false if they don't fit.
+    bool GetData(const char* payload, const char*& data, std::size_t& length) const;
+
+    //! Get a 32 bit value in network order
+    static uint32_t Get32(const char* data);
+    //! Get a 16 bit value in network order
+    static unsigned Get16(const char* data);
+
+    //! Write a frame header
+    static void WriteHeader(Stream& os, std::size_t length, unsigned type, unsigned flags, uint32_t streamId);
+    //! Write a parameter of a SETTINGS payload
+    static void WriteSetting(Stream& os, unsigned id, uint32_t value);
+    static void WriteWindowUpdate(Stream& os, uint32_t streamId, uint32_t increment);
+    static void WriteRstStream(Stream& os, uint32_t streamId, unsigned errorCode);
+    static void WriteGoAway(Stream& os, uint32_t lastStreamId, unsigned errorCode);
+    static void WritePing(Stream& os, const char* data, bool ack);
+    //! Write a header block as a HEADERS frame followed by CONTINUATION frames if it doesn't fit in one
+    static void WriteHeaders(Stream& os, uint32_t streamId, const std::string& block, bool endStream, std::size_t maxFrameSize);
+    //! Write a DATA frame with the length of data from the offset in the stream
+    static void WriteData(Stream& os, uint32_t streamId, WriteBufferedStream& data, std::size_t offset, std::size_t length, bool endStream);
+
+    std::size_t length_;        //!< Length of the payload
+    unsigned type_;             //!< Frame type
+    unsigned flags_;            //!< Flags for the type
+    uint32_t streamId_;         //!< Stream of the frame, 0 for the connection
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Name and value pairs of a decoded header block
+typedef std::vector<std::pair<std::string, std::string> > HpackHeaderList;
+
+//! Decode the header blocks of an HTTP/2 connection (RFC 7541)
+/*!
+ *  The decoder keeps the dynamic table that the peer's encoder builds, so
+ *  every header block of the connection must be decoded in order, including
+ *  the blocks for streams that are refused.
+ */
+class ANYRPC_API HpackDecoder
+{
+public:
+    HpackDecoder() : tableSize_(0), maxTableSize_(DefaultTableSize) {}
+
+    //! Decode a complete header block.  Return false if it is invalid, which is an error for the whole connection.
+    bool Decode(const char* block, std::size_t length, HpackHeaderList& headers);
+    //! Forget the dynamic table for a new connection
+    void Reset() { table_.clear(); tableSize_ = 0; maxTableSize_ = DefaultTableSize; }
+
+    static const std::size_t DefaultTableSize = 4096;   //!< Table size allowed by SETTINGS_HEADER_TABLE_SIZE
+    static const std::size_t EntryOverhead = 32;        //!< Size counted for an entry in addition to its strings
+
+private:
+    log_define("AnyRPC.HpackDecoder");
+
+    //! Decode an integer with a prefix of the bits in the first byte
+    static bool DecodeInteger(const unsigned char*& pos, const unsigned char* end, unsigned prefixBits, std::size_t& value);
+    //! Decode a string literal, which may be Huffman encoded
+    static bool DecodeString(const unsigned char*& pos, const unsigned char* end, std::string& str);
+    //! Get the static or dynamic table entry for the index
+    bool GetEntry(std::size_t index, std::string& name, std::string& value);
+    //! Add an entry to the dynamic table, evicting the oldest ones to make room
+    void AddEntry(const std::string& name, const std::string& value);
+    //! Evict the oldest entries until the table fits in the size
+    void EvictEntries(std::size_t size);
+
+    std::deque<std::pair<std::string, std::string> > table_;    //!< Dynamic table with the newest entry first
+    std::size_t tableSize_;         //!< Size of the dynamic table entries
+    std::size_t maxTableSize_;      //!< Size limit from the last table size update
+};
+
+//! Add a header field to a header block
+/*!
+ *  The field is encoded with the static table when it matches and is otherwise
+ *  a literal that isn't indexed, so the encoder doesn't need any state and the
+ *  peer's dynamic table stays empty.  The strings are Huffman encoded when that
+ *  makes them shorter.
+ */
+ANYRPC_API void HpackEncode(std::string& block, const std::string& name, const std::string& value);
+
+//! Decode a Huffman encoded HPACK string.  Return false if it is invalid.
+ANYRPC_API bool HuffmanDecode(const unsigned char* data, std::size_t length, std::string& str);
+//! Add the Huffman encoding of a string to the output
+ANYRPC_API void HuffmanEncode(const std::string& str, std::string& out);
+//! Get the length of the Huffman encoding of a string
+ANYRPC_API std::size_t HuffmanEncodedLength(const std::string& str);
+
+} // namespace internal
+} // namespace anyrpc
+
+#endif // ANYRPC_HTTP2_H_
@@ -0,0 +1,106 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef ANYRPC_LRULIST_H_
+#define ANYRPC_LRULIST_H_
+
+namespace anyrpc
+{
+namespace internal
+{
+
+//! Intrusive doubly linked list kept in least recently used order
+/*!
+ *  The item type must provide GetPrevListed, SetPrevListed, GetNextListed,
+ *  and SetNextListed to access the link pointers, so adding, removing, and
+ *  moving an item to the back never allocates or searches.  An item can only
+ *  be in one list at a time.
+ *
+ *  Items are added at the back and moved to the back when they are used, so
+ *  the front is the least recently used item.  The list is not thread safe.
+ */
+template <typename T>
+class LruList
+{
+public:
+    LruList() : front_(0), back_(0), size_(0) {}
+
+    //! Add an item as the most recently used
+    void PushBack(T* item)
+    {
+        item->SetPrevListed(back_);
+        item->SetNextListed(0);
+        if (back_ != 0)
+            back_->SetNextListed(item);
+        else
+            front_ = item;
+        back_ = item;
+        size_++;
+    }
+
+    //! Remove an item from the list
+    void Remove(T* item)
+    {
+        T* prev = item->GetPrevListed();
+        T* next = item->GetNextListed();
+        if (prev != 0)
+            prev->SetNextListed(next);
+        else
+            front_ = next;
+        if (next != 0)
+            next->SetPrevListed(prev);
+        else
+            back_ = prev;
+        item->SetPrevListed(0);
+        item->SetNextListed(0);
+        size_--;
+    }
+
+    //! Mark an item as the most recently used
+    void Touch(T* item)
+    {
+        if (item != back_)
+        {
+            Remove(item);
+            PushBack(item);
+        }
+    }
+
+    //! Get the least recently used item
+    T* Front() const { return front_; }
+    //! Get the item that was used after this one
+    static T* Next(T* item) { return item->GetNextListed(); }
+    //! Get the number of items in the list
+    std::size_t Size() const { return size_; }
+    //! Whether the list is empty
+    bool Empty() const { return (size_ == 0); }
+    //! Forget all of the items without changing them
+    void Clear() { front_ = back_ = 0; size_ = 0; }
+
+private:
+    T* front_;              //!< Least recently used item
+    T* back_;               //!< Most recently used item
+    std::size_t size_;      //!< Number of items in the list
+};
+
+} // namespace internal
+} // namespace anyrpc
+
+#endif // ANYRPC_LRULIST_H_
@@ -0,0 +1,395 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef ANYRPC_POLLER_H_
+#define ANYRPC_POLLER_H_
+
+#if defined(__linux__)
+# define ANYRPC_EPOLL
+# include <sys/epoll.h>
+#endif // defined(__linux__)
+
+#if defined(__linux__) && defined(ANYRPC_URING)
+# include <linux/io_uring.h>
+#else
+# undef ANYRPC_URING
+#endif // defined(__linux__) && defined(ANYRPC_URING)
+
+#if defined(ANYRPC_URING) && !defined(IORING_RECV_MULTISHOT)
+// the headers are older than the provided buffer rings and multishot receives (6.0)
+# undef ANYRPC_URING
+#endif // defined(ANYRPC_URING) && !defined(IORING_RECV_MULTISHOT)
+
+namespace anyrpc
+{
+
+class TcpSocket;
+struct SendSegment;
+
+namespace internal
+{
+
+//! Monitor a set of sockets for readability and writability
+/*!
+ *  The Poller is the event notification used by the servers.  Each socket
+ *  is registered once with the events of interest and a data pointer that
+ *  is returned when the socket is ready.  The events only need to be modified
+ *  when the interest changes.
+ *
+ *  After a Wait call, only the sockets that are ready are returned so the
+ *  cost of a wakeup does not depend on the number of idle sockets when the
+ *  platform supports it (epoll or io_uring on Linux).  Other platforms use
+ *  select and are limited to FD_SETSIZE sockets.
+ *
+ *  A ready socket may occasionally be reported for an event that is no longer
+ *  of interest, so the caller must tolerate spurious notifications.
+ */
+class ANYRPC_API Poller
+{
+public:
+    //! Events that can be monitored and returned
+    enum EventEnum { EVENT_NONE = 0, EVENT_READ = 1, EVENT_WRITE = 2, EVENT_ERROR = 4 };
+    //! Notification mechanisms that can be requested
+    enum PollerType { POLLER_DEFAULT, POLLER_SELECT, POLLER_EPOLL, POLLER_URING };
+
+    Poller() {}
+    virtual ~Poller() {}
+
+    //! Create the requested poller or the best one available if it is not supported by the platform
+    static Poller* Create(PollerType type = POLLER_DEFAULT);
+
+    //! Start monitoring the socket for the events
+    virtual bool Add(SOCKET fd, unsigned events, void* data) = 0;
+    //! Change the events being monitored for the socket
+    virtual bool Modify(SOCKET fd, unsigned events, void* data) = 0;
+    //! Stop monitoring the socket
+    virtual bool Remove(SOCKET fd) = 0;
+    //! Wait up to ms milliseconds for events.  Return the number of ready sockets or -1 on error.
+    virtual int Wait(int ms) = 0;
+    //! Get the events for a ready socket from the last Wait call
+    virtual unsigned GetEvents(int index) = 0;
+    //! Get the data pointer for a ready socket from the last Wait call
+    virtual void* GetData(int index) = 0;
+
+    //! Move the data of the socket through the poller instead of system calls.  Return false if not supported.
+    /*! The socket is attached before it is added and stays attached until it is closed.  Only the
+     *  thread that calls Wait can use the socket after it is attached.  A listening socket
+     *  returns the connections accepted by the poller.
+     */
+    virtual bool Attach(TcpSocket& /* socket */, bool /* listening */) { return false; }
+    //! Start the operations queued by the attached sockets without waiting for events
+    virtual void Submit() {}
+
+protected:
+    log_define("AnyRPC.Poller");
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Poller using the portable select call
+/*!
+ *  The registered sockets are kept in a map so the fd_sets must still be
+ *  constructed for each Wait call.
+ */
+class ANYRPC_API SelectPoller : public Poller
+{
+public:
+    SelectPoller() {}
+
+    virtual bool Add(SOCKET fd, unsigned events, void* data);
+    virtual bool Modify(SOCKET fd, unsigned events, void* data);
+    virtual bool Remove(SOCKET fd);
+    virtual int Wait(int ms);
+    virtual unsigned GetEvents(int index) { return ready_[index].events_; }
+    virtual void* GetData(int index) { return ready_[index].data_; }
+
+private:
+    struct Entry
+    {
+        Entry() : events_(EVENT_NONE), data_(0) {}
+        Entry(unsigned events, void* data) : events_(events), data_(data) {}
+
+        unsigned events_;           //!< Events of interest or events that are ready
+        void* data_;                //!< Data pointer returned with the events
+    };
+    typedef std::map<SOCKET, Entry> EntryMap;
+
+    EntryMap entries_;              //!< Registered sockets
+    std::vector<Entry> ready_;      //!< Sockets ready from the last Wait call
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(ANYRPC_EPOLL)
+//! Poller using the Linux epoll interface
+/*!
+ *  Level-triggered notification is used so the behavior matches the select call.
+ */
+class ANYRPC_API EpollPoller : public Poller
+{
+public:
+    EpollPoller();
+    virtual ~EpollPoller();
+
+    //! Whether the epoll descriptor was created
+    bool IsValid() { return (epfd_ >= 0); }
+
+    virtual bool Add(SOCKET fd, unsigned events, void* data);
+    virtual bool Modify(SOCKET fd, unsigned events, void* data);
+    virtual bool Remove(SOCKET fd);
+    virtual int Wait(int ms);
+    virtual unsigned GetEvents(int index);
+    virtual void* GetData(int index) { return events_[index].data.ptr; }
+
+private:
+    bool Control(int operation, SOCKET fd, unsigned events, void* data);
+
+    static const int MaxEvents = 256;   //!< Maximum number of events returned by one Wait call
+
+    int epfd_;                                  //!< File descriptor for the epoll instance
+    struct epoll_event events_[MaxEvents];      //!< Events returned by the last Wait call
+};
+#endif // defined(ANYRPC_EPOLL)
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(ANYRPC_URING)
+class UringPoller;
+
+//! The data of a socket attached to a UringPoller
+/*!
+ *  The poller keeps a multishot receive in the ring while the socket is registered
+ *  for reading and the received data stays in the ring buffers until it is read.
+ *  Data that is sent is copied and the poller submits it with the next Wait call,
+ *  so a request that is read and answered in one wakeup needs no system calls of
+ *  its own.  A listening socket has a multishot accept instead.
+ *
+ *  The channel owns the socket after Close and closes it once the queued data
+ *  has been sent.
+ */
+class ANYRPC_API UringChannel
+{
+public:
+    //! Copy up to maxLength bytes of the received data.  Return the number of bytes copied.
+    std::size_t Read(char* buffer, std::size_t maxLength);
+    //! Whether the peer closed the connection and all of the data before it has been read
+    bool IsEnded() const { return ended_ && input_.empty() && (spillOffset_ >= spill_.length()); }
+    //! Error from a receive or send, 0 if there was none
+    int GetError() const { return error_; }
+    //! Queue a copy of the blocks to send.  Return false if the queue is still full after the timeout in milliseconds.
+    bool Write(const SendSegment* segments, std::size_t count, int timeout);
+    //! Take a connection accepted by the ring.  Return -1 with err set if there is none.
+    SOCKET Accept(int& err);
+    //! Detach from the socket and close it after the queued data is sent
+    void Close();
+
+private:
+    friend class UringPoller;
+
+    //! Data received in a ring buffer
+    struct Input
+    {
+        Input(unsigned short bufferId, unsigned length) : bufferId_(bufferId), offset_(0), length_(length) {}
+
+        unsigned short bufferId_;   //!< Ring buffer holding the data
+        unsigned offset_;           //!< Bytes of the buffer already read
+        unsigned length_;           //!< Bytes received in the buffer
+    };
+
+    UringChannel(UringPoller* poller, TcpSocket* socket, SOCKET fd, bool listening);
+    //! Number of bytes received and not read yet
+    std::size_t InputLength() const;
+    //! Number of bytes queued or in flight to send
+    std::size_t OutputLength() const { return output_.length() + (sending_.length() - sent_); }
+    //! Whether a receive, send, or accept is in the ring
+    bool IsBusy() const { return recvArmed_ || sendArmed_ || acceptArmed_; }
+
+    UringPoller* poller_;               //!< Poller that does the operations
+    TcpSocket* socket_;                 //!< Socket using the channel, null after Close
+    SOCKET fd_;                         //!< Descriptor for the operations
+    bool listening_;                    //!< Accept connections instead of receiving data
+    unsigned events_;                   //!< Events of interest
+    void* data_;                        //!< Data pointer returned with the events
+    bool registered_;                   //!< Added to the poller
+    bool listed_;                       //!< In the list of channels for the next Wait call
+    bool closed_;                       //!< Close was called
+    std::deque<Input> input_;           //!< Ring buffers with data that has not been read
+    std::string spill_;                 //!< Data copied out of the ring buffers while the socket is not reading
+    std::size_t spillOffset_;           //!< Bytes of the spilled data already read
+    bool ended_;                        //!< The peer closed the connection
+    int error_;                         //!< Error from the receive or send
+    bool recvArmed_;                    //!< A receive is in the ring
+    bool recvCanceled_;                 //!< The receive was canceled to stop taking buffers
+    std::string output_;                //!< Data queued for the next send
+    std::string sending_;               //!< Data of the send in the ring, unchanged until it completes
+    std::size_t sent_;                  //!< Bytes of sending_ already sent
+    bool sendArmed_;                    //!< A send is in the ring
+    std::deque<SOCKET> accepted_;       //!< Connections accepted and not taken yet
+    int acceptError_;                   //!< Error from the accept, reported once
+    bool acceptArmed_;                  //!< An accept is in the ring
+};
+
+//! Poller using the Linux io_uring interface
+/*!
+ *  Each registered socket has a poll request in the submission ring.  The
+ *  requests are one-shot so they behave like level-triggered notification and
+ *  are rearmed by the next Wait call after the event is returned.  Registration
+ *  changes are only queued in the ring and are submitted together with the wait
+ *  in a single io_uring_enter call, so a wakeup that changes the interest of
+ *  many sockets still only costs one system call.
+ *
+ *  Attached sockets do not use poll requests.  Their data is received into a
+ *  ring of provided buffers, their sends are submitted together with the wait,
+ *  and a listening socket accepts connections with a multishot accept, so the
+ *  server loop only makes the io_uring_enter call.  Their readiness is level
+ *  triggered from the data already received and the room left to send.
+ *
+ *  The kernel interface is used directly so liburing is not required.  The
+ *  ring is only valid with kernels that support updating poll requests (5.13)
+ *  and Create will fall back to epoll when it is not available.  Sockets are
+ *  only attached when the kernel supports provided buffer rings (5.19).
+ */
+class ANYRPC_API UringPoller : public Poller
+{
+public:
+    UringPoller();
+    virtual ~UringPoller();
+
+    //! Whether the ring was created and supports the required features
+    bool IsValid() { return (ringFd_ >= 0); }
+
+    virtual bool Add(SOCKET fd, unsigned events, void* data);
+    virtual bool Modify(SOCKET fd, unsigned events, void* data);
+    virtual bool Remove(SOCKET fd);
+    virtual int Wait(int ms);
+    virtual unsigned GetEvents(int index) { return ready_[index].events_; }
+    virtual void* GetData(int index) { return ready_[index].data_; }
+    virtual bool Attach(TcpSocket& socket, bool listening);
+    virtual void Submit();
+
+private:
+    friend class UringChannel;
+
+    //! Information for a registered socket - the address is the user data for the poll request
+    struct Registration
+    {
+        Registration(SOCKET fd, unsigned events, void* data) :
+            fd_(fd), events_(events), data_(data), armed_(false), queued_(false), removed_(false) {}
+
+        SOCKET fd_;                 //!< Socket being monitored
+        unsigned events_;           //!< Events of interest
+        void* data_;                //!< Data pointer returned with the events
+        bool armed_;                //!< Whether a poll request is in the kernel
+        bool queued_;               //!< Whether the registration is in the arm list
+        bool removed_;              //!< Whether the socket was removed while the poll request was armed
+    };
+    struct Ready
+    {
+        Ready(unsigned events, void* data) : events_(events), data_(data) {}
+
+        unsigned events_;           //!< Events that are ready
+        void* data_;                //!< Data pointer for the socket
+    };
+    typedef std::map<SOCKET, Registration*> RegistrationMap;
+    typedef std::map<SOCKET, UringChannel*> ChannelMap;
+
+    static const unsigned BufferCount = 256;        //!< Provided buffers in the ring, a power of 2
+    static const unsigned BufferSize = 16*1024;     //!< Bytes in each provided buffer
+    static const unsigned short BufferGroup = 0;    //!< Group id of the provided buffers
+    static const std::size_t InputLimit = 128*1024; //!< Received bytes held for a channel before its receive is canceled
+    static const std::size_t OutputLimit = 1024*1024;   //!< Queued bytes before a channel is not writable
+
+    void Close();
+    //! Register the provided buffer ring used by the receives
+    bool SetupBuffers();
+    //! Give a buffer back to the kernel
+    void ReturnBuffer(unsigned short bufferId);
+    char* GetBuffer(unsigned short bufferId) { return buffers_ + bufferId * BufferSize; }
+    //! Queue a channel to be checked by the next Wait call
+    void QueueChannel(UringChannel* channel);
+    //! Arm the receive or accept and submit the queued data of a channel
+    void PrepareChannel(UringChannel* channel);
+    //! Submit a send with the queued data if there is none in the ring
+    void SubmitSend(UringChannel* channel);
+    //! Cancel an operation of a channel
+    void Cancel(UringChannel* channel, unsigned tag);
+    //! Events that are ready for a channel
+    unsigned ChannelEvents(UringChannel* channel);
+    //! Wait for a channel to have room to send more data
+    void WaitOutput(UringChannel* channel, int timeout);
+    //! Release the buffers of a closed channel and finish its operations
+    void CloseChannel(UringChannel* channel);
+    //! Process a completion for a channel
+    void ReapChannel(const struct io_uring_cqe& cqe);
+    //! Whether the next Wait call has to arm or submit something for a channel
+    bool NeedsPrepare(UringChannel* channel);
+    //! Stop the operations of the channels and wait for them to complete when the poller is deleted
+    void StopChannels();
+    //! Queue a registration to have its poll request armed by the next Wait call
+    void QueueArm(Registration* registration);
+    //! Get the next submission entry, flushing the ring if it is full
+    struct io_uring_sqe* GetSqe();
+    //! Submit the queued entries and optionally wait for a completion
+    int Enter(unsigned minComplete, int ms);
+    //! Process the completion ring
+    void Reap();
+
+    int ringFd_;                                //!< File descriptor for the ring
+
+    void* sqRing_;                              //!< Mapping for the submission ring
+    std::size_t sqRingSize_;                    //!< Size of the submission ring mapping
+    void* cqRing_;                              //!< Mapping for the completion ring (may be the same as sqRing_)
+    std::size_t cqRingSize_;                    //!< Size of the completion ring mapping
+    struct io_uring_sqe* sqes_;                 //!< Mapping for the submission entries
+    std::size_t sqesSize_;                      //!< Size of the submission entries mapping
+
+    unsigned* sqHead_;                          //!< Submission ring head - updated by the kernel
+    unsigned* sqTail_;                          //!< Submission ring tail - updated by this class
+    unsigned sqMask_;                           //!< Mask for the submission ring indexes
+    unsigned sqEntries_;                        //!< Number of submission ring entries
+    unsigned* sqArray_;                         //!< Indirection array for the submission entries
+    unsigned sqLocalTail_;                      //!< Tail including entries not yet published to the kernel
+    unsigned* cqHead_;                          //!< Completion ring head - updated by this class
+    unsigned* cqTail_;                          //!< Completion ring tail - updated by the kernel
+    unsigned cqMask_;                           //!< Mask for the completion ring indexes
+    struct io_uring_cqe* cqes_;                 //!< Completion entries
+
+    RegistrationMap registrations_;             //!< Registered sockets
+    std::vector<Registration*> armList_;        //!< Registrations to arm with the next Wait call
+    std::vector<Registration*> retired_;        //!< Removed registrations waiting for the poll request to complete
+    std::vector<Ready> ready_;                  //!< Sockets ready from the last Wait call
+
+    void* bufferRing_;                          //!< Mapping for the provided buffer ring
+    std::size_t bufferRingSize_;                //!< Size of the provided buffer ring mapping
+    char* buffers_;                             //!< Memory of the provided buffers
+    unsigned short bufferTail_;                 //!< Tail of the provided buffer ring
+    bool buffersExhausted_;                     //!< A receive found no buffers so none are armed until one is returned
+    bool multishotRecv_;                        //!< The kernel supports multishot receives
+
+    ChannelMap channels_;                       //!< Attached sockets
+    std::vector<UringChannel*> closing_;        //!< Closed channels waiting for their operations to complete
+    std::vector<UringChannel*> channelList_;    //!< Channels to check with the next Wait call
+};
+#endif // defined(ANYRPC_URING)
+
+} // namespace internal
+} // namespace anyrpc
+
+#endif // ANYRPC_POLLER_H_
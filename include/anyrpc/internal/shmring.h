@@ -0,0 +1,146 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef ANYRPC_SHMRING_H_
+#define ANYRPC_SHMRING_H_
+
+#include <atomic>
+
+namespace anyrpc
+{
+namespace internal
+{
+
+//! Positions and wait flags of a ring that are shared by the two processes
+/*!
+ *  The positions only increase and are reduced modulo the capacity when used,
+ *  so the ring is empty when they are equal and full when they are a capacity apart.
+ *  The two positions are on separate cache lines since they are written by
+ *  different processes.
+ */
+struct ShmRingControl
+{
+    std::atomic<uint64_t> head_;                //!< Position of the next byte to read - written by the consumer
+    char pad0_[64 - sizeof(uint64_t)];
+    std::atomic<uint64_t> tail_;                //!< Position of the next byte to write - written by the producer
+    char pad1_[64 - sizeof(uint64_t)];
+    std::atomic<uint32_t> consumerWaiting_;     //!< The consumer is asleep until data is written
+    std::atomic<uint32_t> producerWaiting_;     //!< The producer is asleep until data is read
+    char pad2_[64 - 2*sizeof(uint32_t)];
+};
+
+//! Single producer, single consumer byte ring in shared memory
+/*!
+ *  The ring carries the same byte stream as a socket.  The other process may
+ *  be faulty, so the positions are checked before they are used and Read or
+ *  Write return false if they are not consistent.
+ *
+ *  The wait flags work like a futex without the system call: a side sets its
+ *  flag before going to sleep and then checks the ring again, while the other
+ *  side checks the flag after changing the ring.  Either the sleeper sees the
+ *  change or the other side sees the flag and wakes it.
+ */
+class ANYRPC_API ShmRing
+{
+public:
+    ShmRing() : control_(0), data_(0), capacity_(0) {}
+
+    //! Use the control and data in the shared memory
+    void Initialize(ShmRingControl* control, char* data, uint64_t capacity)
+        { control_ = control; data_ = data; capacity_ = capacity; }
+    //! Copy as much of the data as fits into the ring.  Return false if the ring is corrupt.
+    bool Write(const char* buffer, std::size_t length, std::size_t& bytesWritten);
+    //! Copy as much data as is available from the ring.  Return false if the ring is corrupt.
+    bool Read(char* buffer, std::size_t maxLength, std::size_t& bytesRead);
+    //! Whether there is data to read
+    bool IsReadable() const { return control_->tail_.load(std::memory_order_acquire) != control_->head_.load(std::memory_order_relaxed); }
+    //! Whether there is space to write
+    bool IsWritable() const
+        { return control_->tail_.load(std::memory_order_relaxed) - control_->head_.load(std::memory_order_acquire) < capacity_; }
+
+    //! Set or clear the consumer's wait flag - check the ring again after setting it
+    void SetConsumerWaiting(bool waiting) { SetFlag(control_->consumerWaiting_, waiting); }
+    //! Set or clear the producer's wait flag - check the ring again after setting it
+    void SetProducerWaiting(bool waiting) { SetFlag(control_->producerWaiting_, waiting); }
+    //! Whether the consumer has to be woken after writing
+    bool IsConsumerWaiting() const { return IsFlagSet(control_->consumerWaiting_); }
+    //! Whether the producer has to be woken after reading
+    bool IsProducerWaiting() const { return IsFlagSet(control_->producerWaiting_); }
+
+private:
+    static void SetFlag(std::atomic<uint32_t>& flag, bool value)
+        { flag.store(value ? 1 : 0, std::memory_order_relaxed); std::atomic_thread_fence(std::memory_order_seq_cst); }
+    static bool IsFlagSet(const std::atomic<uint32_t>& flag)
+        { std::atomic_thread_fence(std::memory_order_seq_cst); return flag.load(std::memory_order_relaxed) != 0; }
+
+    ShmRingControl* control_;       //!< Shared positions and flags
+    char* data_;                    //!< Shared data of the ring
+    uint64_t capacity_;             //!< Size of the data, a power of two
+};
+
+//! Pair of rings in a shared memory segment for a connection between a client and a server
+/*!
+ *  The client creates the segment as a sealed memfd so the size can't change
+ *  while the server has it mapped, and passes the descriptor to the server over
+ *  the Unix domain socket.  The request ring goes from the client to the server
+ *  and the response ring goes back.
+ */
+class ANYRPC_API ShmChannel
+{
+public:
+    ShmChannel() : memory_(0), size_(0), fd_(-1) {}
+    ~ShmChannel() { Close(); }
+
+    static const std::size_t DefaultCapacity = 1 << 20;     //!< Size of each ring, which holds the largest client message
+
+    //! Create a segment with two rings of the capacity rounded up to a power of two - for the client
+    bool Create(std::size_t capacity = DefaultCapacity);
+    //! Map a segment received from a client and check it - for the server
+    bool Attach(int fd);
+    //! Unmap the segment
+    void Close();
+    //! Descriptor of the created segment to pass to the server
+    int GetFileDescriptor() const { return fd_; }
+    //! Close the descriptor once it has been passed - the mapping stays
+    void CloseFileDescriptor();
+
+    //! Ring from the client to the server
+    ShmRing& GetRequestRing() { return requests_; }
+    //! Ring from the server to the client
+    ShmRing& GetResponseRing() { return responses_; }
+
+private:
+    log_define("AnyRPC.ShmChannel");
+
+    //! Set up the rings in the mapped segment
+    void InitializeRings(uint64_t capacity);
+
+    void* memory_;                  //!< Mapped segment
+    std::size_t size_;              //!< Size of the segment
+    int fd_;                        //!< Descriptor of the segment, -1 once passed or when attached
+    ShmRing requests_;              //!< Ring from the client to the server
+    ShmRing responses_;             //!< Ring from the server to the client
+};
+
+} // namespace internal
+} // namespace anyrpc
+
+#endif // ANYRPC_SHMRING_H_
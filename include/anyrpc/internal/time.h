@@ -42,6 +42,9 @@ ANYRPC_API int MilliTimeDiff(struct timeval &time1, struct timeval &time2);
 //! Compute the difference between the two times in microseconds
 ANYRPC_API int64_t MicroTimeDiff(struct timeval &time1, struct timeval &time2);
 
+//! Get the time in microseconds from a clock that is not affected by changes to the system time
+ANYRPC_API int64_t MonotonicMicroTime();
+
 //! Sleep for a time specified in milliseconds
 ANYRPC_API void MilliSleep(unsigned ms);
 
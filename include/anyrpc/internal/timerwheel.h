@@ -0,0 +1,103 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef ANYRPC_TIMERWHEEL_H_
+#define ANYRPC_TIMERWHEEL_H_
+
+namespace anyrpc
+{
+namespace internal
+{
+
+//! Entry for a timer that is embedded in the object that it times
+struct ANYRPC_API TimerEntry
+{
+    TimerEntry() : prev_(0), next_(0), expiry_(0), data_(0) {}
+
+    //! Whether the timer is waiting in a TimerWheel
+    bool IsScheduled() const { return (next_ != 0); }
+
+    TimerEntry* prev_;              //!< Link to the previous timer in the same slot
+    TimerEntry* next_;              //!< Link to the next timer in the same slot
+    int64_t expiry_;                //!< Time in milliseconds when the timer expires
+    void* data_;                    //!< Object that the timer belongs to
+};
+
+//! Hierarchical timer wheel
+/*!
+ *  The wheel has four levels of 64 slots.  Level 0 has a slot for each millisecond
+ *  and each higher level has slots that are 64 times longer.  A timer is linked
+ *  into the slot for its expiration time on the lowest level that can hold it,
+ *  so scheduling and canceling are O(1).  When the lower levels wrap around, the
+ *  timers in the next slot of the higher level are moved down.  Timers that are
+ *  further away than the top level can hold are moved down when they get closer.
+ *
+ *  The time is supplied by the caller, normally from a clock that is read once
+ *  for each iteration of an event loop.  The wheel is not thread safe.
+ */
+class ANYRPC_API TimerWheel
+{
+public:
+    TimerWheel();
+
+    //! Schedule the timer to expire after a number of milliseconds from now.  A scheduled timer is rescheduled.
+    void Schedule(TimerEntry* entry, int64_t now, unsigned ms);
+    //! Stop the timer if it is scheduled
+    void Cancel(TimerEntry* entry);
+    //! Get the next timer that has expired by the time now, or null if there are none
+    TimerEntry* Expire(int64_t now);
+    //! Get the maximum time to wait until Expire should be called again, or -1 if there are no timers
+    int GetTimeout(int64_t now) const;
+    //! Forget all of the timers without changing them
+    void Clear();
+    //! Get the number of scheduled timers
+    std::size_t Size() const { return size_; }
+
+private:
+    TimerWheel(const TimerWheel&);
+    TimerWheel& operator=(const TimerWheel&);
+
+    static const int LevelBits = 6;
+    static const int SlotsPerLevel = 1 << LevelBits;
+    static const int SlotMask = SlotsPerLevel - 1;
+    static const int NumLevels = 4;
+    static const int64_t MaxDelay = (int64_t(1) << (LevelBits * NumLevels)) - 1;
+
+    //! Link the timer into the slot for its expiration time
+    void Insert(TimerEntry* entry);
+    //! Move the wheel ahead one millisecond
+    void Tick();
+    //! Reinsert the timers from a slot in one of the higher levels
+    void Cascade(int level, int slot);
+
+    static void Link(TimerEntry* head, TimerEntry* entry);
+    static void Unlink(TimerEntry* entry);
+    static bool IsEmpty(const TimerEntry* head) { return (head->next_ == head); }
+
+    TimerEntry slots_[NumLevels][SlotsPerLevel];    //!< Circular lists of timers for each slot
+    TimerEntry expired_;                            //!< Timers that have expired but not been returned
+    int64_t current_;                               //!< Time that the wheel has advanced to
+    std::size_t size_;                              //!< Number of scheduled timers
+};
+
+} // namespace internal
+} // namespace anyrpc
+
+#endif // ANYRPC_TIMERWHEEL_H_
@@ -0,0 +1,72 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef ANYRPC_WAKEUP_H_
+#define ANYRPC_WAKEUP_H_
+
+namespace anyrpc
+{
+namespace internal
+{
+
+//! Descriptor that another thread can use to wake a poller
+/*!
+ *  The descriptor becomes readable when Signal is called and stays readable
+ *  until Drain is called, so multiple signals before the poller wakes only
+ *  produce a single event.
+ *
+ *  Linux uses an eventfd, other POSIX platforms use a pipe, and Windows uses
+ *  a UDP socket bound to an ephemeral loopback port since select only
+ *  supports sockets.
+ */
+class ANYRPC_API Wakeup
+{
+public:
+    Wakeup();
+    ~Wakeup();
+
+    //! Create the descriptor - a previous descriptor is closed
+    bool Create();
+    //! Close the descriptor
+    void Close();
+    //! Whether the descriptor has been created
+    bool IsOpen() const { return readFd_ != static_cast<SOCKET>(-1); }
+    //! Descriptor to register with a poller for readability
+    SOCKET GetFileDescriptor() { return readFd_; }
+    //! Make the descriptor readable - safe to call from any thread
+    void Signal();
+    //! Consume all pending signals so the descriptor is no longer readable
+    void Drain();
+
+private:
+    log_define("AnyRPC.Wakeup");
+
+    SOCKET readFd_;                 //!< Descriptor monitored by the poller
+#if defined(WIN32)
+    int port_;                      //!< Loopback port that the socket is bound to
+#else
+    int writeFd_;                   //!< Descriptor written by Signal - same as readFd_ for an eventfd
+#endif // defined(WIN32)
+};
+
+} // namespace internal
+} // namespace anyrpc
+
+#endif // ANYRPC_WAKEUP_H_
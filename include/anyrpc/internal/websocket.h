@@ -0,0 +1,85 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef ANYRPC_WEBSOCKET_H_
+#define ANYRPC_WEBSOCKET_H_
+
+namespace anyrpc
+{
+namespace internal
+{
+
+//! Read the header of a WebSocket frame and write the frame headers (RFC 6455)
+/*!
+ *  A frame header is 2 to 14 bytes: the FIN bit and the opcode, the mask bit and
+ *  a 7 bit length that is extended to 16 or 64 bits, then the 4 byte masking key
+ *  that a client uses for all of its frames.
+ */
+class ANYRPC_API WebSocketFrame
+{
+public:
+    enum OpcodeEnum
+    {
+        OPCODE_CONTINUATION = 0, OPCODE_TEXT = 1, OPCODE_BINARY = 2, OPCODE_CLOSE = 8, OPCODE_PING = 9, OPCODE_PONG = 10
+    };
+    enum CloseEnum
+    {
+        CLOSE_NORMAL = 1000, CLOSE_PROTOCOL = 1002, CLOSE_TOO_LARGE = 1009, CLOSE_TRY_AGAIN = 1013
+    };
+
+    enum ParseResultEnum
+    {
+        FRAME_COMPLETE, FRAME_INCOMPLETE, FRAME_FAULT
+    };
+
+    static const std::size_t MaxHeaderLength = 14;
+    static const std::size_t MaxControlLength = 125;    //!< Largest payload of a control frame
+
+    //! Decode the frame header at the start of the data.  A 64 bit length with the most significant bit set is a fault.
+    ParseResultEnum ParseHeader(const char* data, std::size_t length);
+    //! Whether the frame is a close, ping, or pong frame
+    bool IsControl() const { return (opcode_ & 0x8) != 0; }
+
+    //! Write a frame header, with the masking key if it isn't null
+    static void WriteHeader(Stream& os, unsigned opcode, bool fin, uint64_t length, const unsigned char* mask = 0);
+    //! Write an unmasked close frame with the status code
+    static void WriteClose(Stream& os, unsigned code);
+    //! Apply the masking key to data that starts at the offset in the payload - masking again removes it
+    static void Mask(char* data, std::size_t length, const unsigned char* mask, std::size_t offset = 0);
+
+    bool fin_;                      //!< Whether this is the last frame of the message
+    unsigned reserved_;             //!< Reserved bits, which must be 0 without extensions
+    unsigned opcode_;               //!< Frame type
+    bool masked_;                   //!< Whether the payload is masked
+    unsigned char mask_[4];         //!< Masking key
+    uint64_t length_;               //!< Length of the payload
+    std::size_t headerLength_;      //!< Length of the header including the masking key
+};
+
+//! Compute the SHA-1 digest of the data (RFC 3174)
+ANYRPC_API void Sha1(const char* data, std::size_t length, unsigned char digest[20]);
+//! Get the Sec-WebSocket-Accept value of a handshake for the client's Sec-WebSocket-Key
+ANYRPC_API std::string WebSocketAccept(const std::string& key);
+
+} // namespace internal
+} // namespace anyrpc
+
+#endif // ANYRPC_WEBSOCKET_H_
@@ -0,0 +1,217 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef ANYRPC_WORKERPOOL_H_
+#define ANYRPC_WORKERPOOL_H_
+
+#if defined(ANYRPC_THREADING)
+
+#include <atomic>
+#if defined(__MINGW32__)
+# include "mingw.thread.h"
+# include "mingw.mutex.h"
+# include "mingw.condition_variable.h"
+#else
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+#endif // defined(__MINGW32__)
+
+#include "completionqueue.h"
+#include "affinity.h"
+
+namespace anyrpc
+{
+namespace internal
+{
+
+//! Function executed by a WorkerPool
+typedef void TaskFunction(void* context, void* argument);
+
+//! Unit of work for a WorkerPool
+struct Task
+{
+    Task() : function_(0), context_(0), argument_(0) {}
+    Task(TaskFunction* function, void* context, void* argument) :
+        function_(function), context_(context), argument_(argument) {}
+
+    TaskFunction* function_;        //!< Function to call
+    void* context_;                 //!< First parameter for the function, e.g. the object that submitted the task
+    void* argument_;                //!< Second parameter for the function
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Bounded lock-free queue for multiple producers and multiple consumers
+/*!
+ *  Each cell has a sequence number that tells a producer or consumer whether
+ *  the cell is ready for it, so the only contended operations are the
+ *  compare-exchange on the enqueue and dequeue positions.  The positions are
+ *  kept on separate cache lines.  The capacity must be a power of two.
+ */
+class ANYRPC_API TaskQueue
+{
+public:
+    TaskQueue(std::size_t capacity);
+    ~TaskQueue();
+
+    //! Add a task to the queue.  Return false if the queue is full.
+    bool Push(const Task& task);
+    //! Remove a task from the queue.  Return false if the queue is empty.
+    bool Pop(Task& task);
+    //! Whether the queue is empty - only a hint when other threads are using the queue
+    bool Empty() const;
+
+private:
+    TaskQueue(const TaskQueue&);
+    TaskQueue& operator=(const TaskQueue&);
+
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence_;     //!< Position that the cell is ready for
+        Task task_;                             //!< Task stored in the cell
+    };
+
+    Cell* cells_;                                                   //!< Storage for the tasks
+    std::size_t mask_;                                              //!< Capacity minus one
+    char pad0_[CacheLineSize];
+    std::atomic<std::size_t> enqueuePos_;                           //!< Next position to write
+    char pad1_[CacheLineSize - sizeof(std::atomic<std::size_t>)];
+    std::atomic<std::size_t> dequeuePos_;                           //!< Next position to read
+    char pad2_[CacheLineSize - sizeof(std::atomic<std::size_t>)];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Fixed size work-stealing deque
+/*!
+ *  The owner thread pushes and pops at the bottom without contention while
+ *  other threads steal from the top (Chase-Lev).  The task fields are stored
+ *  as atomics so a thief that loses the race for a slot never reads a torn value.
+ */
+class ANYRPC_API TaskDeque
+{
+public:
+    TaskDeque();
+
+    //! Add a task at the bottom - only called by the owner.  Return false if full.
+    bool Push(const Task& task);
+    //! Remove a task from the bottom - only called by the owner
+    bool Pop(Task& task);
+    //! Remove a task from the top - called by other threads
+    bool Steal(Task& task);
+    //! Whether the deque is empty - only a hint
+    bool Empty() const;
+
+    static const std::size_t Capacity = 256;   //!< Maximum number of tasks in the deque
+
+private:
+    struct Slot
+    {
+        std::atomic<TaskFunction*> function_;
+        std::atomic<void*> context_;
+        std::atomic<void*> argument_;
+    };
+
+    void Store(int64_t position, const Task& task);
+    void Load(int64_t position, Task& task);
+
+    std::atomic<int64_t> top_;                  //!< Position for stealing - modified by thieves
+    char pad0_[CacheLineSize - sizeof(std::atomic<int64_t>)];
+    std::atomic<int64_t> bottom_;               //!< Position for the owner
+    char pad1_[CacheLineSize - sizeof(std::atomic<int64_t>)];
+    Slot slots_[Capacity];                      //!< Storage for the tasks
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Pool of threads for executing tasks off of the I/O thread
+/*!
+ *  Tasks submitted from other threads go into a bounded lock-free injection
+ *  queue.  A worker takes a batch from the injection queue into its own deque
+ *  so idle workers can steal from it, and tasks submitted by a worker go
+ *  directly to its own deque.
+ *
+ *  An idle worker spins for a short time looking for work before it parks.
+ *  Only one parked worker is woken when there is no worker already searching
+ *  for work, and a worker that finds work while searching wakes the next one,
+ *  so a burst of submissions does not cause a wakeup for each task.
+ *
+ *  The workers can be pinned to sets of CPUs that are assigned round robin, so
+ *  a pool can be kept on the CPUs that share a cache or memory node with the
+ *  thread that submits the tasks.
+ */
+class ANYRPC_API WorkerPool
+{
+public:
+    WorkerPool();
+    ~WorkerPool();
+
+    //! Start the worker threads
+    void Start(unsigned numThreads);
+    //! Stop the worker threads - tasks that have not started are discarded
+    void Stop();
+    //! Submit a task to be executed by one of the workers
+    void Submit(const Task& task);
+    //! Submit a task to be executed by one of the workers
+    void Submit(TaskFunction* function, void* context, void* argument) { Submit(Task(function, context, argument)); }
+    //! Get the number of worker threads
+    unsigned GetNumThreads() const { return static_cast<unsigned>(workers_.size()); }
+    //! Set the CPUs for the workers - worker i uses cpuSets[i % size], empty for no pinning.  Takes effect on Start.
+    void SetAffinity(const std::vector<CpuSet>& cpuSets) { cpuSets_ = cpuSets; }
+    //! Set the prefix for the worker thread names - the worker index is appended, empty to leave the names.  Takes effect on Start.
+    void SetNamePrefix(const std::string& namePrefix) { namePrefix_ = namePrefix; }
+
+    static const unsigned SpinCount = 64;           //!< Number of attempts to find work before parking
+    static const unsigned InjectBatch = 16;         //!< Maximum number of tasks taken from the injection queue at once
+    static const std::size_t InjectCapacity = 4096; //!< Capacity of the injection queue
+
+private:
+    struct Worker
+    {
+        TaskDeque deque_;                           //!< Tasks owned by this worker
+        std::thread thread_;                        //!< Thread information
+    };
+
+    void WorkerThread(unsigned index);
+    //! Find a task for the worker from its deque, the injection queue, or the other workers
+    bool FindTask(unsigned index, Task& task);
+    //! Wake a parked worker if no worker is already searching for work
+    void Notify();
+    //! Whether there is work that a parked worker should wake for
+    bool WorkAvailable() const;
+
+    TaskQueue inject_;                              //!< Tasks submitted from outside of the pool
+    std::vector<Worker*> workers_;                  //!< Worker threads and their deques
+    std::atomic<bool> exit_;                        //!< Indication that the workers should exit
+    std::atomic<int> searching_;                    //!< Number of workers spinning for work
+    std::atomic<int> sleepers_;                     //!< Number of parked workers
+    std::mutex parkMutex_;                          //!< Mutex for parking the workers
+    std::condition_variable parkCondition_;         //!< Condition for parked workers to wait on
+    std::vector<CpuSet> cpuSets_;                   //!< CPUs assigned round robin to the workers
+    std::string namePrefix_;                        //!< Prefix for the worker thread names
+};
+
+} // namespace internal
+} // namespace anyrpc
+
+#endif // defined(ANYRPC_THREADING)
+
+#endif // ANYRPC_WORKERPOOL_H_
@@ -0,0 +1,91 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef ANYRPC_ZEROCOPYREAPER_H_
+#define ANYRPC_ZEROCOPYREAPER_H_
+
+#if defined(ANYRPC_ZEROCOPY)
+
+namespace anyrpc
+{
+namespace internal
+{
+
+//! Close the sockets of a server once the kernel is done with their zero copy sends
+/*!
+ *  A connection that closes while its MSG_ZEROCOPY sends are still in flight gives
+ *  its descriptor and the held buffers to the reaper so the event loop never waits
+ *  for the completions.  The event loop calls Reap and each socket has a timer that
+ *  starts at a millisecond and doubles up to MaxInterval, so the error queue is only
+ *  read a few times before the peer has acknowledged the data.  The socket is closed
+ *  and the buffers are freed once the last completion has arrived.
+ *
+ *  A socket whose peer stops reading is reset at its deadline so the kernel drops
+ *  the data that refers to the buffers before they are freed.
+ *
+ *  The reaper is only used by the thread that runs the event loop.
+ */
+class ANYRPC_API ZeroCopyReaper
+{
+public:
+    ZeroCopyReaper() {}
+    ~ZeroCopyReaper() { Clear(); }
+
+    //! Take the descriptor and buffers if the socket has zero copy sends pending.  Return false to leave the socket to the caller.
+    bool Add(TcpSocket& socket, int64_t now);
+    //! Close the sockets whose sends have completed or whose deadline has passed
+    void Reap(int64_t now);
+    //! Get the maximum time to wait until Reap should be called again, or -1 if there are no sockets
+    int GetTimeout(int64_t now) const { return timers_.GetTimeout(now); }
+    //! Reset and close all of the sockets
+    void Clear();
+    //! Get the number of sockets waiting for their sends to complete
+    std::size_t Size() const { return entries_.size(); }
+
+    static const unsigned Deadline = 5000;      //!< Milliseconds to wait for the completions before the reset
+    static const unsigned MaxInterval = 100;    //!< Longest time in milliseconds between reading the completions
+
+private:
+    ZeroCopyReaper(const ZeroCopyReaper&);
+    ZeroCopyReaper& operator=(const ZeroCopyReaper&);
+
+    struct Entry
+    {
+        TcpSocket socket_;          //!< Socket with the descriptor and held buffers
+        TimerEntry timer_;          //!< Timer for the next read of the completions
+        int64_t deadline_;          //!< Time to reset the socket if the sends have not completed
+        unsigned interval_;         //!< Milliseconds until the next read of the completions
+    };
+
+    //! Close the socket of the entry and delete it
+    void Remove(Entry* entry);
+
+    log_define("AnyRPC.ZeroCopyReaper")
+
+    TimerWheel timers_;             //!< Timers for the sockets
+    std::vector<Entry*> entries_;   //!< Sockets waiting for their sends to complete
+};
+
+} // namespace internal
+} // namespace anyrpc
+
+#endif // defined(ANYRPC_ZEROCOPY)
+
+#endif // ANYRPC_ZEROCOPYREAPER_H_
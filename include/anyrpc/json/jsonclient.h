@@ -42,6 +42,24 @@ public:
 
 ////////////////////////////////////////////////////////////////////////////////
 
+class ANYRPC_API JsonHttp2Client : public Http2Client
+{
+public:
+    JsonHttp2Client();
+    JsonHttp2Client(const char* host, int port);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+class ANYRPC_API JsonWebSocketClient : public WebSocketClient
+{
+public:
+    JsonWebSocketClient();
+    JsonWebSocketClient(const char* host, int port);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 //! ClientHandler for Json format to generate the request and process the response
 class ANYRPC_API JsonClientHandler : public ClientHandler
 {
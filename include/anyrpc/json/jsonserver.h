@@ -25,6 +25,8 @@ namespace anyrpc
 {
 
 ANYRPC_API bool JsonRpcHandler(MethodManager* manager, char* request, std::size_t length, Stream &response);
+ANYRPC_API bool JsonRpcFaultHandler(char* request, std::size_t length, int errorCode, std::string const& errorMsg, Stream &response);
+ANYRPC_API bool JsonRpcMethodName(const char* request, std::size_t length, std::string& methodName);
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -47,6 +49,29 @@ protected:
 
 ////////////////////////////////////////////////////////////////////////////////
 
+class ANYRPC_API JsonHttp2Server : public ServerST
+{
+public:
+    JsonHttp2Server() { AddHandler( &JsonRpcHandler, "", "application/json-rpc", &JsonRpcMethodName ); }
+
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return new Http2Connection(fd, GetMethodManager(), GetRpcHandlerList()); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! HTTP server that upgrades the connections that ask for a WebSocket
+class ANYRPC_API JsonWebSocketServer : public ServerST
+{
+public:
+    JsonWebSocketServer() { AddHandler( &JsonRpcHandler, "", "application/json-rpc", &JsonRpcMethodName ); }
+
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return new WebSocketConnection(fd, GetMethodManager(), GetRpcHandlerList()); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 #if defined(ANYRPC_THREADING)
 class ANYRPC_API JsonHttpServerMT : public ServerMT
 {
@@ -70,8 +95,8 @@ protected:
 class ANYRPC_API JsonHttpServerTP : public ServerTP
 {
 public:
-    JsonHttpServerTP() { AddHandler( &JsonRpcHandler, "", "application/json-rpc" ); }
-    JsonHttpServerTP(const unsigned numThreads) : ServerTP(numThreads) { AddHandler( &JsonRpcHandler, "", "application/json-rpc" ); }
+    JsonHttpServerTP() { AddHandler( &JsonRpcHandler, "", "application/json-rpc", &JsonRpcMethodName ); }
+    JsonHttpServerTP(const unsigned numThreads) : ServerTP(numThreads) { AddHandler( &JsonRpcHandler, "", "application/json-rpc", &JsonRpcMethodName ); }
 
 protected:
     virtual Connection* CreateConnection(SOCKET fd) { return new HttpConnection(fd, GetMethodManager(), GetRpcHandlerList()); }
@@ -85,6 +110,56 @@ public:
     JsonTcpServerTP() : ServerTP() {};
     JsonTcpServerTP(const unsigned numThreads) : ServerTP(numThreads) {};
 
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return new TcpConnection(fd, GetMethodManager(), &JsonRpcHandler, &JsonRpcFaultHandler, true, &JsonRpcMethodName); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! HTTP/2 thread-pool server that executes the streams of a connection concurrently
+class ANYRPC_API JsonHttp2ServerTP : public ServerTP
+{
+public:
+    JsonHttp2ServerTP() { AddHandler( &JsonRpcHandler, "", "application/json-rpc", &JsonRpcMethodName ); SetPipelining(true); }
+    JsonHttp2ServerTP(const unsigned numThreads) : ServerTP(numThreads) { AddHandler( &JsonRpcHandler, "", "application/json-rpc", &JsonRpcMethodName ); SetPipelining(true); }
+
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return new Http2Connection(fd, GetMethodManager(), GetRpcHandlerList()); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! HTTP thread-pool server that upgrades the connections that ask for a WebSocket
+class ANYRPC_API JsonWebSocketServerTP : public ServerTP
+{
+public:
+    JsonWebSocketServerTP() { AddHandler( &JsonRpcHandler, "", "application/json-rpc", &JsonRpcMethodName ); }
+    JsonWebSocketServerTP(const unsigned numThreads) : ServerTP(numThreads) { AddHandler( &JsonRpcHandler, "", "application/json-rpc", &JsonRpcMethodName ); }
+
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return new WebSocketConnection(fd, GetMethodManager(), GetRpcHandlerList()); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+class ANYRPC_API JsonHttpServerMR : public ServerMR
+{
+public:
+    JsonHttpServerMR() { AddHandler( &JsonRpcHandler, "", "application/json-rpc" ); }
+    JsonHttpServerMR(const unsigned numReactors) : ServerMR(numReactors) { AddHandler( &JsonRpcHandler, "", "application/json-rpc" ); }
+
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return new HttpConnection(fd, GetMethodManager(), GetRpcHandlerList()); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+class ANYRPC_API JsonTcpServerMR : public ServerMR
+{
+public:
+    JsonTcpServerMR() : ServerMR() {};
+    JsonTcpServerMR(const unsigned numReactors) : ServerMR(numReactors) {};
+
 protected:
     virtual Connection* CreateConnection(SOCKET fd) { return new TcpConnection(fd, GetMethodManager(), &JsonRpcHandler); }
 };
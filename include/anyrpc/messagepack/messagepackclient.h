@@ -42,6 +42,15 @@ public:
 
 ////////////////////////////////////////////////////////////////////////////////
 
+class ANYRPC_API MessagePackWebSocketClient : public WebSocketClient
+{
+public:
+    MessagePackWebSocketClient();
+    MessagePackWebSocketClient(const char* host, int port);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 //! ClientHandler for MessagePack format to generate the request and process the response
 class ANYRPC_API MessagePackClientHandler : public ClientHandler
 {
@@ -25,6 +25,8 @@ namespace anyrpc
 {
 
 ANYRPC_API bool MessagePackRpcHandler(MethodManager* manager, char* request, std::size_t length, Stream &response);
+ANYRPC_API bool MessagePackRpcFaultHandler(char* request, std::size_t length, int errorCode, std::string const& errorMsg, Stream &response);
+ANYRPC_API bool MessagePackRpcMethodName(const char* request, std::size_t length, std::string& methodName);
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -70,8 +72,8 @@ protected:
 class ANYRPC_API MessagePackHttpServerTP : public ServerTP
 {
 public:
-    MessagePackHttpServerTP() { AddHandler( &MessagePackRpcHandler, "", "application/messagepack-rpc" ); }
-    MessagePackHttpServerTP(const unsigned numThreads) : ServerTP(numThreads) { AddHandler( &MessagePackRpcHandler, "", "application/messagepack-rpc" ); }
+    MessagePackHttpServerTP() { AddHandler( &MessagePackRpcHandler, "", "application/messagepack-rpc", &MessagePackRpcMethodName ); }
+    MessagePackHttpServerTP(const unsigned numThreads) : ServerTP(numThreads) { AddHandler( &MessagePackRpcHandler, "", "application/messagepack-rpc", &MessagePackRpcMethodName ); }
 
 protected:
     virtual Connection* CreateConnection(SOCKET fd) { return new HttpConnection(fd, GetMethodManager(), GetRpcHandlerList()); }
@@ -85,6 +87,30 @@ public:
     MessagePackTcpServerTP() : ServerTP() {};
     MessagePackTcpServerTP(const unsigned numThreads) : ServerTP(numThreads) {};
 
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return new TcpConnection(fd, GetMethodManager(), &MessagePackRpcHandler, &MessagePackRpcFaultHandler, true, &MessagePackRpcMethodName); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+class ANYRPC_API MessagePackHttpServerMR : public ServerMR
+{
+public:
+    MessagePackHttpServerMR() { AddHandler( &MessagePackRpcHandler, "", "application/messagepack-rpc" ); }
+    MessagePackHttpServerMR(const unsigned numReactors) : ServerMR(numReactors) { AddHandler( &MessagePackRpcHandler, "", "application/messagepack-rpc" ); }
+
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return new HttpConnection(fd, GetMethodManager(), GetRpcHandlerList()); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+class ANYRPC_API MessagePackTcpServerMR : public ServerMR
+{
+public:
+    MessagePackTcpServerMR() : ServerMR() {};
+    MessagePackTcpServerMR(const unsigned numReactors) : ServerMR(numReactors) {};
+
 protected:
     virtual Connection* CreateConnection(SOCKET fd) { return new TcpConnection(fd, GetMethodManager(), &MessagePackRpcHandler); }
 };
@@ -27,6 +27,128 @@ namespace anyrpc
 typedef void Function (Value& params, Value& result);
 
 class MethodManager;
+class Stream;
+
+//! Handle for finishing a call to an AsyncMethod after its ExecuteAsync has returned
+/*!
+ *  Exactly one of Respond or Fault must be called, from any thread.  The responder
+ *  is finished with by that call and must not be used afterwards.
+ */
+class ANYRPC_API MethodResponder
+{
+public:
+    virtual ~MethodResponder() {}
+
+    //! Send the result of the call.  The result is taken so it will be null after.
+    virtual void Respond(Value& result) = 0;
+    //! Send a fault instead of a result
+    virtual void Fault(int errorCode, std::string const& errorMsg) = 0;
+};
+
+//! Function pointer for a method that finishes with the responder, possibly after returning
+typedef void AsyncFunction (Value& params, MethodResponder* responder);
+
+//! Encode the response to a call that was finished by a MethodResponder.  The result is null for a fault.
+typedef void RpcResponseEncoder(Value& id, Value* result, int errorCode, std::string const& errorMsg, Stream& response);
+
+//! Sink for the elements of an array result that a StreamMethod produces one at a time
+class ANYRPC_API ResultWriter
+{
+public:
+    virtual ~ResultWriter() {}
+
+    //! Add the element to the end of the result.  The element may be changed.
+    virtual void Write(Value& element) = 0;
+};
+
+//! Function pointer for a method that produces an array result with the writer
+typedef void StreamFunction (Value& params, ResultWriter& writer);
+
+//! Encodes the result of a StreamMethod into the response as the elements are written
+/*!
+ *  An RPC handler derives from this for its protocol and gives it to the CallDeferral
+ *  with the call.  The start of the response is encoded with the first element, so
+ *  a fault before then is sent as usual.  After each element the connection is
+ *  allowed to send the part of the response that has been encoded.
+ */
+class ANYRPC_API StreamedResult : public ResultWriter
+{
+public:
+    StreamedResult() : count_(0), finished_(false) {}
+
+    virtual void Write(Value& element);
+    //! Encode the end of the response after the method has returned
+    void Finish();
+    //! Whether the whole response has been encoded
+    bool IsFinished() const { return finished_; }
+    //! Drop the encoded response for a fault.  Return false if part of it has been sent so the fault can't be.
+    bool Discard();
+
+protected:
+    log_define("AnyRPC.StreamedResult");
+
+    //! Encode the response up to the first element of the result
+    virtual void EncodeStart() = 0;
+    //! Encode an element of the result
+    virtual void EncodeElement(Value& element, std::size_t index) = 0;
+    //! Encode the rest of the response after the last element
+    virtual void EncodeEnd(std::size_t count) = 0;
+
+private:
+    std::size_t count_;             //!< Number of elements written
+    bool finished_;                 //!< Whether the end of the response has been encoded
+};
+
+//! Allows the AsyncMethod executed by the current thread to respond after it returns
+/*!
+ *  A connection that can write the response later creates a CallDeferral for the
+ *  thread while its RPC handler runs.  The handler describes a single call with
+ *  SetCall so that the response can be encoded later.  The calls of a batch or a
+ *  multicall are not described, so their methods wait for the responder instead.
+ *
+ *  The handler can also give a StreamedResult with the call so that a StreamMethod
+ *  encodes its result into the response as it is produced.  The connection may
+ *  send the encoded part of the response with SendPart before the method returns.
+ */
+class ANYRPC_API CallDeferral
+{
+public:
+    //! Make this the deferral for the current thread
+    CallDeferral();
+    //! Restore the previous deferral for the current thread
+    virtual ~CallDeferral();
+
+    //! Get the deferral for the current thread, null if none
+    static CallDeferral* Current();
+    //! Describe the call that is about to execute.  An invalid id is a notification.
+    void SetCall(RpcResponseEncoder* encoder, Value& id, std::string const& methodName, StreamedResult* streamedResult=0)
+        { encoder_ = encoder; id_ = &id; methodName_ = &methodName; streamedResult_ = streamedResult; }
+    //! Whether a method has taken a responder to write the response later
+    bool IsDeferred() const { return deferred_; }
+    //! Get a responder for the described call to the method, null if it can't be deferred - called by AsyncMethod
+    MethodResponder* Defer(std::string const& methodName);
+    //! Whether a method has written its result into the response
+    bool IsStreamed() const { return streamed_; }
+    //! Get the writer for the result of the described call to the method, null if it can't be streamed - called by StreamMethod
+    ResultWriter* StreamResult(std::string const& methodName);
+    //! Send the part of a streamed response that has been encoded, if there is enough of it.  Return false if it failed.
+    virtual bool SendPart() { return true; }
+    //! Drop the part of a streamed response that has been encoded.  Return false if some of it has been sent.
+    virtual bool DiscardPart() { return false; }
+
+protected:
+    //! Create the responder that writes the response on the connection, null if not supported
+    virtual MethodResponder* CreateResponder(RpcResponseEncoder* encoder, Value& id) = 0;
+
+private:
+    CallDeferral* previous_;        //!< Deferral of the thread when this one was created
+    RpcResponseEncoder* encoder_;   //!< Encoder for the described call, null if there isn't one
+    Value* id_;                     //!< Id of the described call
+    const std::string* methodName_; //!< Method of the described call - not one that it calls
+    StreamedResult* streamedResult_;//!< Encoder for the streamed result of the described call, null if there isn't one
+    bool deferred_;                 //!< Whether the response will be written later
+    bool streamed_;                 //!< Whether the result was written into the response
+};
 
 //! The Method class is used to specify RPC functions to call.
 /*!
@@ -42,13 +164,16 @@ class ANYRPC_API Method
 {
 public:
     Method(std::string const& name, std::string const& help, bool deleteOnRemove=true) :
-        name_(name), help_(help), deleteOnRemove_(deleteOnRemove), activeThreads_(0), delayedRemove_(false) {}
+        name_(name), help_(help), deleteOnRemove_(deleteOnRemove), lane_(0), activeThreads_(0), delayedRemove_(false) {}
     virtual ~Method() {}
 
     virtual void Execute(Value& /* params */, Value& /* result */) {}
     std::string& Name() { return name_; }
     std::string& Help() { return help_; }
     bool DeleteOnRemove() { return deleteOnRemove_; }
+    //! Lane of worker threads that a thread-pool server executes the method with, 0 for the default lane
+    unsigned Lane() { return lane_; }
+    void SetLane(unsigned lane) { lane_ = lane; }
     bool DelayedRemove() { return delayedRemove_; }
     void SetDelayedRemove() { delayedRemove_ = true; }
     int ActiveThreads() { return activeThreads_; }
@@ -59,6 +184,7 @@ protected:
     std::string name_;
     std::string help_;
     bool deleteOnRemove_;
+    unsigned lane_;
 
 private:
     int activeThreads_;
@@ -78,6 +204,67 @@ private:
     Function *function_;
 };
 
+//! An AsyncMethod finishes the call with a MethodResponder, possibly from another thread.
+/*!
+ *  When the connection can write the response later, ExecuteAsync is given a responder
+ *  and the thread is free to execute other requests as soon as it returns, so a few
+ *  threads can hold many calls that wait on something else.  Otherwise, such as for
+ *  the calls of a batch, Execute waits on the calling thread for the responder to be used.
+ *  An AnyRpcException thrown by ExecuteAsync is sent as a fault, but the responder must
+ *  not have been used if it throws.
+ */
+class ANYRPC_API AsyncMethod : public Method
+{
+public:
+    AsyncMethod(std::string const& name, std::string const& help, bool deleteOnRemove=true) :
+        Method(name, help, deleteOnRemove) {}
+
+    virtual void Execute(Value& params, Value& result);
+    virtual void ExecuteAsync(Value& params, MethodResponder* responder) = 0;
+};
+
+//! An AsyncMethodFunction is created with a function pointer that is called by the ExecuteAsync method.
+class AsyncMethodFunction : public AsyncMethod
+{
+public:
+    AsyncMethodFunction(AsyncFunction* function, std::string const& name, std::string const& help, bool deleteOnRemove=true) :
+        AsyncMethod(name, help, deleteOnRemove), function_(function) {}
+    virtual void ExecuteAsync(Value& params, MethodResponder* responder) { function_(params, responder); }
+private:
+    AsyncFunction *function_;
+};
+
+//! A StreamMethod produces an array result one element at a time with a ResultWriter.
+/*!
+ *  When the RPC handler can encode the result as it is produced, the elements
+ *  given to the writer go straight into the response so the whole result is never
+ *  held as a Value, and an HTTP connection sends the response in chunks while the
+ *  method is still running.  The chunks that the socket can't take right away are
+ *  kept until the method returns.  Otherwise, such as for the calls of a batch, Execute
+ *  collects the elements into the result.  The elements must be written by the
+ *  calling thread before ExecuteStream returns.
+ */
+class ANYRPC_API StreamMethod : public Method
+{
+public:
+    StreamMethod(std::string const& name, std::string const& help, bool deleteOnRemove=true) :
+        Method(name, help, deleteOnRemove) {}
+
+    virtual void Execute(Value& params, Value& result);
+    virtual void ExecuteStream(Value& params, ResultWriter& writer) = 0;
+};
+
+//! A StreamMethodFunction is created with a function pointer that is called by the ExecuteStream method.
+class StreamMethodFunction : public StreamMethod
+{
+public:
+    StreamMethodFunction(StreamFunction* function, std::string const& name, std::string const& help, bool deleteOnRemove=true) :
+        StreamMethod(name, help, deleteOnRemove), function_(function) {}
+    virtual void ExecuteStream(Value& params, ResultWriter& writer) { function_(params, writer); }
+private:
+    StreamFunction *function_;
+};
+
 //! MethodInternal classes are typically used for introspection of the MethodManager.
 class MethodInternal : public Method
 {
@@ -125,9 +312,15 @@ public:
     ~MethodManager();
 
     void AddFunction(Function* function, std::string const& name, std::string const& help);
+    void AddAsyncFunction(AsyncFunction* function, std::string const& name, std::string const& help);
+    void AddStreamFunction(StreamFunction* function, std::string const& name, std::string const& help);
     void AddMethod(Method* method);
     bool RemoveMethod(std::string const& name, bool WaitForDelayedRemove = false);
     bool ExecuteMethod(std::string const& name, Value& params, Value& result);
+    //! Set the lane of worker threads that a thread-pool server uses for the method.  Return false if not found.
+    bool SetMethodLane(std::string const& name, unsigned lane);
+    //! Get the lane for the method, 0 (the default lane) if not found
+    unsigned GetMethodLane(std::string const& name);
     void ListMethods(Value& params, Value& result);
     void FindHelpMethod(Value& params, Value& result);
 
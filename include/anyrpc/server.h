@@ -42,16 +42,24 @@
 # endif //defined(__MINGW32__)
 #endif //defined(ANYRPC_THREADING)
 
+#include "internal/poller.h"
+#include "internal/wakeup.h"
+#include "internal/completionqueue.h"
+#include "internal/workerpool.h"
+#include "internal/affinity.h"
+#include "internal/lrulist.h"
+
 namespace anyrpc
 {
 
 //! Server for an RPC protocol
 /*!
- *  The server can operate in four way.
+ *  The server can operate in five way.
  *  First, as part of the main thread by calling Work.
  *  Second, as an independent thread by calling StartThread.
  *  Third, as an independent thread with individual connection threads.
  *  Fourth, as an independent thread with multiple worker threads for execution.
+ *  Fifth, as multiple independent threads that each accept and process connections.
  *
  *  The server's MethodManager must be populated with the available methods.
  *
@@ -63,12 +71,36 @@ namespace anyrpc
  *  that the client will retry a failed attempt. This prevents stale
  *  connections from consuming resources. Set forcedDisconnectAllowed_ to false
  *  to disable this feature.
+ *
+ *  Closed connections can be kept in a pool and reused for new clients so the
+ *  connection objects with their buffers are not allocated and deleted for each
+ *  client.  The pool can be filled by BindAndListen so the first burst of
+ *  clients after startup does not pay for the allocation either.
+ *
+ *  BindAndListenLocal listens on a Unix domain socket instead of a port for
+ *  clients on the same host.  A path starting with '@' is a Linux abstract
+ *  name that has no file.  The socket file is removed when the server
+ *  shuts down.  With SetSharedMemory, the clients on the path can move the
+ *  data of their connections to shared memory rings (Linux).
  */
 class ANYRPC_API Server
 {
 public:
     Server();
-    virtual ~Server() { Shutdown(); }
+    virtual ~Server();
+
+    //! Counters for the connections accepted by the server
+    struct AcceptStats
+    {
+        uint64_t accepted_;         //!< Sockets accepted, including the ones that were rejected
+        uint64_t rejected_;         //!< Sockets closed right away because there was no room for another connection
+        uint64_t errors_;           //!< Failed accept calls other than when there are no pending connections
+        uint64_t wakeups_;          //!< Times that the listening socket was ready - accepted per wakeup shows the batching
+    };
+
+    static const int DefaultBacklog = 128;  //!< Length of the queue for pending connections
+    static const int LocalPort = -1;        //!< Port passed to BindAndListen to listen on the local path
+    static const std::size_t DefaultMaxContentLength = 1000000;    //!< Largest request body accepted unless changed
 
     //! Set the maximum number of simultaneous connections that the server can have
     void SetMaxConnections(unsigned maxConnections) { maxConnections_ = maxConnections; }
@@ -76,20 +108,57 @@ public:
     void SetForcedDisconnectAllowed(bool forcedDisconnectAllowed) { forcedDisconnectAllowed_ = forcedDisconnectAllowed; }
     //! Check if inactive clients will be disconnected to free slots for new ones
     bool IsForcedDisconnectAllowed() const { return forcedDisconnectAllowed_; }
+    //! Set the time in milliseconds that a connection can wait between requests before it is closed, 0 for no limit
+    void SetIdleTimeout(unsigned ms) { idleTimeout_ = ms; }
+    //! Set the time in milliseconds allowed to receive a request header after its first data, 0 for no limit
+    void SetHeaderTimeout(unsigned ms) { headerTimeout_ = ms; }
+    //! Set the time in milliseconds allowed to receive a request body after its header, 0 for no limit
+    void SetBodyTimeout(unsigned ms) { bodyTimeout_ = ms; }
+    //! Set the number of requests on a connection before it is closed, 0 for no limit
+    void SetMaxRequests(unsigned maxRequests) { maxRequests_ = maxRequests; }
+    //! Set the largest request body that is accepted, including a chunked HTTP body
+    void SetMaxContentLength(std::size_t maxContentLength) { maxContentLength_ = maxContentLength; }
+    //! Set the maximum number of connections accepted each time the listening socket is ready
+    void SetAcceptBatch(unsigned acceptBatch) { acceptBatch_ = std::max(1u, acceptBatch); }
+    //! Set the number of closed connections kept for reuse and the number created by BindAndListen, 0 to delete closed connections
+    void SetConnectionPoolSize(unsigned poolSize, unsigned prewarm = 0) { connectionPoolSize_ = poolSize; connectionPrewarm_ = prewarm; }
+    //! Get the number of closed connections that are available for reuse
+    unsigned GetNumPooledConnections() const { return numPooledConnections_; }
+    //! Only wake the server when a new connection sends data or after the time in seconds (Linux) - must be called before BindAndListen
+    void SetDeferAccept(unsigned seconds) { deferAccept_ = seconds; }
+    //! Get the counters for the connections accepted by the server
+    virtual void GetAcceptStats(AcceptStats& stats) const;
     //! Set the address (network byte order) for the bind operation
     void SetBindAddress(uint32_t address) { address_ = address; }
+    //! Set the event notification mechanism (e.g. io_uring) - must be called before BindAndListen
+    void SetPollerType(internal::Poller::PollerType pollerType) { pollerType_ = pollerType; }
     //! Bind the server to a point and start listening for clients
-    virtual bool BindAndListen(int port, int backlog = 5);
+    virtual bool BindAndListen(int port, int backlog = DefaultBacklog);
+    //! Bind the server to a Unix domain socket path and start listening for clients on the same host
+    bool BindAndListenLocal(const std::string& path, int backlog = DefaultBacklog);
+    //! Get the Unix domain socket path, empty when listening on a port
+    const std::string& GetLocalPath() const { return localPath_; }
+#if defined(ANYRPC_SHARED_MEMORY)
+    //! Allow the clients on the local path to use shared memory rings for their connections
+    void SetSharedMemory(bool sharedMemory) { sharedMemory_ = sharedMemory; }
+#endif // defined(ANYRPC_SHARED_MEMORY)
+#if defined(ANYRPC_ZEROCOPY)
+    //! Send the response bodies of at least the number of bytes over TCP without copying them (MSG_ZEROCOPY), 0 to always copy
+    void SetZeroCopyThreshold(std::size_t bytes) { zeroCopyThreshold_ = bytes; }
+#endif // defined(ANYRPC_ZEROCOPY)
     //! Operate the server for a specified number of milliseconds
     virtual void Work(int ms) = 0;
     //! Close all of the connections
-    virtual void Shutdown() { socket_.Close(); }
+    virtual void Shutdown() { CloseListener(); }
     //! Set the work loop to exit.  Also set the thread to exit if enabled.
     virtual void Exit();
+    //! Wake the work loop so Work returns before its time has elapsed - safe to call from any thread
+    virtual void Interrupt();
     //! Get the method manager with the list of available methods
     MethodManager* GetMethodManager() { return &manager_; }
     //! Add a handler to the list of supported protocols - mostly for http servers
-    void AddHandler(RpcHandler* handler, std::string requestContentType, std::string responseContentType);
+    void AddHandler(RpcHandler* handler, std::string requestContentType, std::string responseContentType,
+                    RpcMethodNameHandler* methodNameHandler=0);
     //! Get the list of handlers - mostly for http servers
     RpcHandlerList& GetRpcHandlerList() { return handlers_; }
 
@@ -98,6 +167,10 @@ public:
     virtual void StartThread();
     //! Stop the server and join the thread
     void StopThread();
+    //! Set the CPUs that the server thread runs on, empty for no restriction - must be called before StartThread
+    void SetThreadAffinity(const std::vector<unsigned>& cpus) { threadCpus_ = cpus; }
+    //! Set the name of the server thread shown by debuggers and tools like top - must be called before StartThread
+    void SetThreadName(const std::string& name) { threadName_ = name; }
 #endif // defined(ANYRPC_THREADING)
 
     //! Get ip and port of the server (local)
@@ -114,23 +187,106 @@ protected:
     virtual Connection* CreateConnection(SOCKET fd) = 0;
     //! Add all of the protocol handlers to the list
     virtual void AddAllHandlers();
+    //! Create the listening socket for the port or the local path
+    virtual bool CreateListener(int port, int backlog);
+    //! Create the socket and bind it to the port
+    bool BindTcpSocket(int port);
+    //! Create the socket and bind it to the local path
+    bool BindLocalSocket();
+    //! Close the listening socket and remove the local path's socket file
+    void CloseListener();
+    //! Register the wakeup descriptor with the poller so Exit, StopThread, and Interrupt take effect immediately
+    bool AddWakeup();
+    //! Accept a pending connection.  Return -1 when there are no more.
+    SOCKET AcceptSocket();
+    //! Close a socket that was accepted but can't be used
+    void RejectSocket(SOCKET fd);
+    //! Accept the pending connections up to the batch limit and register them with the poller
+    void AcceptConnections();
+    //! Get a connection for the socket from the pool or create a new one
+    Connection* AcquireConnection(SOCKET fd);
+    //! Keep a closed connection in the pool or delete it if the pool is full
+    void ReleaseConnection(Connection* connection);
+    //! Fill the pool up to the prewarm size
+    void PrewarmConnections();
+    //! Delete the connections in the pool
+    void DeletePooledConnections();
+    //! Add a connection to the list and register it with the poller
+    void AddConnection(Connection* connection);
+    //! Unregister a connection from the poller, remove it from the list, and delete it
+    void RemoveConnection(Connection* connection);
+    //! Change the events registered with the poller if the connection's interest has changed
+    void UpdateConnectionEvents(Connection* connection);
+    //! Move a connection between the idle and busy lists if it can or can no longer be forced to disconnect
+    void UpdateConnectionList(Connection* connection);
+    //! Mark a connection as the most recently used if it is idle
+    void TouchConnection(Connection* connection) { if (!connection->IsListedBusy()) connections_.Touch(connection); }
+    //! Remove a connection from the list that it is in
+    void UnlistConnection(Connection* connection)
+        { if (connection->IsListedBusy()) busyConnections_.Remove(connection); else connections_.Remove(connection); }
+    //! Get the number of connections in both lists
+    std::size_t NumConnections() const { return connections_.Size() + busyConnections_.Size(); }
+    //! Set the timer for the connection if the type of timeout has changed
+    void UpdateConnectionTimer(Connection* connection);
+    //! Close the connections whose timers have expired
+    void ExpireConnections();
+    //! Read the clock for the timers and limit the time to wait for events so the timers are not late
+    int GetPollTimeout(int ms, int timeLeft);
+    //! Delete all of the connections without unregistering them from the poller
+    void DeleteConnections();
+    //! Force the least recently used idle connections to disconnect if at the maximum.  Return false if there is no room.
+    bool MakeRoomForConnection();
 
     TcpSocket socket_;             //!< Socket for communication
+    internal::Poller* poller_;     //!< Event notification for the server socket and connections
+    internal::Poller::PollerType pollerType_;  //!< Requested type of poller to create
+    bool pollerIo_;                //!< The sockets are only used by the poller thread so the poller can move their data
+    bool reusePort_;               //!< Set SO_REUSEPORT so multiple sockets can listen on the port
     int port_;                     //!< Port used for socket
     uint32_t address_;             //!< Address used for bind
-    bool exit_;                    //!< Indication to exit the Work function or Thread
+    std::string localPath_;        //!< Unix domain socket path used when port_ is LocalPort
+    bool sharedMemory_;            //!< Clients on the local path can use shared memory rings
+    std::size_t zeroCopyThreshold_;    //!< Size of a response body to send without a copy, 0 to always copy
+    std::atomic<bool> exit_;       //!< Indication to exit the Work function or Thread
     bool working_;                 //!< Inside the work loop
     unsigned maxConnections_;      //!< Maximum number of simultaneous active connections
     bool forcedDisconnectAllowed_; //!< Allow disconnecting of inactive clients to free slots for new ones
-
-    typedef std::list<Connection*> ConnectionList;
-    ConnectionList connections_;   //!< List of active connections
+    unsigned idleTimeout_;         //!< Time in milliseconds that a connection can wait between requests
+    unsigned headerTimeout_;       //!< Time in milliseconds allowed to receive a request header
+    unsigned bodyTimeout_;         //!< Time in milliseconds allowed to receive a request body
+    unsigned maxRequests_;         //!< Number of requests on a connection before it is closed
+    std::size_t maxContentLength_; //!< Largest request body that is accepted
+    unsigned acceptBatch_;         //!< Maximum number of connections accepted for each wakeup
+    unsigned deferAccept_;         //!< Seconds for TCP_DEFER_ACCEPT, 0 to disable
+    std::atomic<uint64_t> acceptedCount_;   //!< Sockets accepted
+    std::atomic<uint64_t> rejectedCount_;   //!< Sockets closed because there was no room
+    std::atomic<uint64_t> acceptErrors_;    //!< Failed accept calls
+    std::atomic<uint64_t> acceptWakeups_;   //!< Times that the listening socket was ready
+    internal::TimerWheel timers_;  //!< Timers for the connection timeouts
+#if defined(ANYRPC_ZEROCOPY)
+    internal::ZeroCopyReaper zeroCopyReaper_;  //!< Closes the sockets with zero copy sends still in flight
+#endif // defined(ANYRPC_ZEROCOPY)
+    int64_t now_;                  //!< Time in milliseconds read once for each iteration of the work loop
+    internal::Wakeup wakeup_;      //!< Wakes the work loop from another thread - kept open until the server is deleted
+    unsigned connectionPoolSize_;  //!< Maximum number of closed connections kept for reuse
+    unsigned connectionPrewarm_;   //!< Number of connections created for the pool by BindAndListen
+    Connection* pooledConnections_;     //!< Closed connections linked through their list links
+    unsigned numPooledConnections_;     //!< Number of connections in the pool
+    std::shared_ptr<ResponseGate> responseGate_;    //!< Passes the deferred responses to the work loop, null if not supported
+
+    typedef internal::LruList<Connection> ConnectionList;
+    ConnectionList connections_;   //!< Connections that can be forced to disconnect in least recently used order
+    ConnectionList busyConnections_;    //!< Connections that are owned by another thread or have a request in progress
 
 #if defined(ANYRPC_THREADING)
     void ThreadStarter();
+    //! Apply the CPU affinity and name to the calling thread - called by the server thread when it starts
+    void PlaceThread();
 
     std::thread thread_;           //!< Thread information
-    bool threadRunning_;           //!< Indication that the thread should be running
+    std::atomic<bool> threadRunning_;   //!< Indication that the thread should be running
+    internal::CpuSet threadCpus_;  //!< CPUs for the server thread, empty for no restriction
+    std::string threadName_;       //!< Name of the server thread, empty to leave the default
 #endif // defined(ANYRPC_THREADING)
 
 private:
@@ -142,10 +298,10 @@ private:
 
 //! Server that uses a single thread for the server socket and all connection sockets
 /*!
- *  The single threaded server monitors all of the sockets with a select call and
- *  then makes individual HandleEvent calls to the connections when they are ready.
- *  The HandleEvent call will return whether to continue monitoring the socket and
- *  whether to wait for readability or writability.
+ *  The single threaded server monitors all of the sockets with a poller and
+ *  then makes individual Process calls to the connections when they are ready.
+ *  Each connection is registered with the poller once and the events are only
+ *  modified when the connection changes between waiting for readability and writability.
  *
  *  A server for a particular protocol will provide the CreateConnection function that
  *  will contain the connection protocol and the RPC handler to use.
@@ -153,14 +309,23 @@ private:
 class ANYRPC_API ServerST : public Server
 {
 public:
-    ServerST() {}
+    ServerST() { pollerIo_ = true; }
+    virtual ~ServerST();
 
+    virtual bool BindAndListen(int port, int backlog = DefaultBacklog);
     virtual void Work(int ms);
     virtual void Shutdown();
 
 protected:
-    void AcceptConnection();
- };
+    //! Process an event from the poller other than the server socket
+    virtual void ProcessEvent(void* data) { ProcessConnection(static_cast<Connection*>(data)); }
+    //! Process a connection that is ready for reading or writing
+    void ProcessConnection(Connection* connection);
+    //! Write the deferred responses that have been passed through the gate
+    void ProcessResponses();
+    //! Write a deferred response on its connection
+    virtual void FinishResponse(DeferredResponse* response);
+};
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -176,28 +341,105 @@ protected:
 
 ////////////////////////////////////////////////////////////////////////////////
 
+//! HTTP/2 server that will process multiple protocols based on the content-type of each stream
+/*!
+ *  The client must start the connection with the HTTP/2 preface (prior knowledge of h2c).
+ *  The streams are executed one at a time in the order that their requests complete.
+ */
+class ANYRPC_API AnyHttp2Server : public ServerST
+{
+public:
+    AnyHttp2Server() { AddAllHandlers(); }
+
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return new Http2Connection(fd, GetMethodManager(), GetRpcHandlerList()); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! HTTP server that will process multiple protocols and upgrade the connections that ask for a WebSocket
+/*!
+ *  The subprotocol of a WebSocket selects the handler the same way as a content-type,
+ *  so json-rpc and messagepack-rpc can be used.
+ */
+class ANYRPC_API AnyWebSocketServer : public ServerST
+{
+public:
+    AnyWebSocketServer() { AddAllHandlers(); }
+
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return new WebSocketConnection(fd, GetMethodManager(), GetRpcHandlerList()); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 #if defined(ANYRPC_THREADING)
 //! Server that uses individual threads for each of the connections
 /*!
  *  The multi-threaded server creates a new thread for each connection
- *  up to a maximum number of allowed threads.  When a new connection is
- *  accepted, it will either add to the list or look for a connection
- *  that has already been stopped.  If there are too many active connections
- *  then new connections are immediately closed.
-  *
+ *  up to a maximum number of allowed threads.  The connection threads keep the
+ *  connection lists in least recently used order under a lock, and a thread that
+ *  stops hands its connection back to the main thread through the completion
+ *  queue.  When there are too many active connections, the least recently used
+ *  idle one is told to stop without waiting for it, or the new connection is
+ *  closed immediately if none can be disconnected.
+ *
+ *  With SetThreadPoolSize, the connections are instead executed by a bounded
+ *  pool of threads.  An idle connection is registered with the poller of the
+ *  main thread and does not use a thread.  When it is ready, a worker thread
+ *  reads, executes, and writes until the connection would block, so the method
+ *  code still runs on a thread that can block without affecting the main thread.
+ *  The worker then returns the connection to the main thread through a lock-free
+ *  completion queue.  Only idle connections are forced to disconnect so an accept
+ *  never waits for a worker thread.
+ *
+ *  On Linux, the threads for each connection are started by the server thread
+ *  and inherit its CPU affinity.  The pool threads can be placed separately with
+ *  SetWorkerAffinity or kept on the server thread's CPUs with SetWorkerColocation.
+ *
  *  A server for a particular protocol will provide the CreateConnection function that
  *  will contain the connection protocol and the RPC handler to use.
  */
 class ANYRPC_API ServerMT : public Server
 {
 public:
-    ServerMT() {}
-
+    ServerMT() : poolSize_(0), colocateWorkers_(false), numStopping_(0) {}
+
+    //! Set the number of threads to execute the connections, or 0 for a thread per connection - must be called before BindAndListen
+    void SetThreadPoolSize(unsigned numThreads) { poolSize_ = numThreads; }
+    //! Get the number of threads to execute the connections, or 0 for a thread per connection
+    unsigned GetThreadPoolSize() const { return poolSize_; }
+    //! Set the CPUs for the pool threads, assigned round robin - must be called before BindAndListen
+    void SetWorkerAffinity(const std::vector<std::vector<unsigned> >& cpuSets) { workers_.SetAffinity(cpuSets); }
+    //! Set the prefix for the pool thread names - must be called before BindAndListen
+    void SetWorkerName(const std::string& namePrefix) { workers_.SetNamePrefix(namePrefix); }
+    //! Run the pool threads on the CPUs set for the server thread - must be called before BindAndListen
+    void SetWorkerColocation(bool colocate) { colocateWorkers_ = colocate; }
+
+    virtual bool BindAndListen(int port, int backlog = DefaultBacklog);
     virtual void Work(int ms);
     virtual void Shutdown();
 
 protected:
     void AcceptConnection();
+
+private:
+    void StartConnectionThread(SOCKET fd);
+    void ProcessPoolEvent(void* data);
+    void ProcessCompleted();
+    //! Join the threads of the connections that have stopped and release the connections
+    void ProcessStopped();
+    static void ExecuteConnection(void* server, void* data);
+    //! Called by a connection thread to keep the lists in order and to report that it stopped
+    static void ConnectionThreadEvent(void* server, Connection* connection, bool stopped);
+
+    unsigned poolSize_;                     //!< Number of pool threads, 0 for a thread per connection
+    bool colocateWorkers_;                  //!< Run the pool threads on the CPUs of the server thread
+    internal::WorkerPool workers_;          //!< Threads that execute the connections in pool mode
+    internal::CompletionQueue<Connection> completed_;   //!< Connections returned by the worker threads or whose threads stopped
+    internal::Wakeup completionSignal_;     //!< Signal to the main thread that a worker thread is done with a connection
+    std::mutex listMutex_;                  //!< Protects the connection lists from the connection threads
+    unsigned numStopping_;                  //!< Connections forced to disconnect whose threads haven't been joined
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -217,20 +459,46 @@ protected:
 //! Server that uses a thread pool to execute the methods
 /*!
  *  The thread-pool server creates a set of worker thread that are used to execute
- *  the methods that are called.  The main thread uses a select call to receive
+ *  the methods that are called.  The main thread uses a poller to receive
  *  from all of the connections similar to ServerST but does not execute the method.
- *  The connection is then placed in a queue for the thread pool to perform the
- *  execution.  The worker can write the result and may continue with another message
- *  if it is already in the buffer.
+ *  The connection is then submitted to a work-stealing worker pool to perform the
+ *  execution.  The worker writes the result and returns the connection, so another
+ *  message that is already in the buffer goes through the admission limit and the
+ *  lane selection like one read from the socket.
  *
  *  The number of threads for the worker pool is separately defined from the maximum
  *  number of simultaneous connections.
  *
- *  The current implementation uses a UDP socket on the same port as the main server
- *  so that the worker thread can signal to the main thread that it is finished.
- *  This allows the server to add this thread to the select call.
- *  Under Linux this could be implemented with a signal and the pselect function,
- *  but this is not portable to Windows.
+ *  When a worker thread is finished with a connection, it is pushed on a lock-free
+ *  completion queue and the main thread is woken with an eventfd (or equivalent).
+ *  The main thread then only processes the returned connections to add them
+ *  back to the poller.
+ *
+ *  Admission control limits the work given to the pool so that an overload doesn't
+ *  grow the queueing delay until every client times out.  SetMaxPending limits the
+ *  number of requests queued or executing and the main thread rejects the requests
+ *  over the limit without using the pool.  SetQueueTimeBudget rejects the requests
+ *  that waited too long in the queue instead of executing them.  A rejected request
+ *  is answered with HTTP 503 or a server busy fault for the TCP protocols.
+ *
+ *  With SetPipelining, the requests that a client sends without waiting for the
+ *  responses are each given to the pool as soon as they are read, so a single
+ *  connection can use all of the worker threads.  The responses are written in the
+ *  order that they complete.  This is used by the TCP Json and MessagePack servers
+ *  since the client matches the responses to the requests with the ids, and by the
+ *  HTTP/2 servers where each stream is a request.  The HTTP/2 servers enable it
+ *  by default; without it, the streams of a connection are executed one at a time.
+ *
+ *  Lanes keep the cheap methods from queueing behind the expensive ones.  AddLane
+ *  creates a lane with its own worker threads, and the methods assigned to it with
+ *  MethodManager::SetMethodLane are executed there, so a slow method can't use more
+ *  than its lane's share of the threads.  The method name is found with a scan of the
+ *  request by the main thread.  SetLargeRequestLane sends the requests with a large
+ *  body to a lane regardless of the method.  Everything else uses the default lane 0.
+ *
+ *  The server thread and the worker threads can be pinned to CPUs and named.
+ *  SetWorkerColocation keeps the workers on the server thread's CPUs, so a request
+ *  is executed where its data was just read, e.g. on the same socket as the NIC queue.
  *
  *  ServerTP should only be called by starting a thread and not by a direct call
  *  to Work although this is not prevented in the current implementation.
@@ -238,26 +506,87 @@ protected:
 class ANYRPC_API ServerTP : public ServerST
 {
 public:
-    ServerTP() : numThreads_(4), workerExit_(false) {}
-    ServerTP(const unsigned numThreads) : numThreads_(numThreads), workerExit_(false) {}
-
-    virtual bool BindAndListen(int port, int backlog = 5);
+    //! Counters for the admission control
+    struct AdmissionStats
+    {
+        uint64_t admitted_;         //!< Requests given to the thread pool
+        uint64_t shedLimit_;        //!< Requests rejected by the main thread since too many were pending
+        uint64_t shedExpired_;      //!< Requests rejected by a worker thread since they waited too long in the queue
+        unsigned pending_;          //!< Requests currently queued or executing
+    };
+
+    ServerTP() :
+        numThreads_(4), maxPending_(0), queueTimeBudget_(0), pipelining_(false), colocateWorkers_(false),
+        largeRequestLane_(0), largeRequestLength_(0) { ResetAdmissionStats(); }
+    ServerTP(const unsigned numThreads) :
+        numThreads_(numThreads), maxPending_(0), queueTimeBudget_(0), pipelining_(false), colocateWorkers_(false),
+        largeRequestLane_(0), largeRequestLength_(0) { ResetAdmissionStats(); }
+    virtual ~ServerTP();
+
+    virtual bool BindAndListen(int port, int backlog = DefaultBacklog);
     virtual void StartThread();
-    virtual void Work(int ms);
+
+    //! Set the number of requests that can be queued or executing, 0 for no limit
+    void SetMaxPending(unsigned maxPending) { maxPending_ = maxPending; }
+    //! Set the time in milliseconds that a request can wait in the queue before it is rejected, 0 for no limit
+    void SetQueueTimeBudget(unsigned ms) { queueTimeBudget_ = ms; }
+    //! Get the admission control counters
+    void GetAdmissionStats(AdmissionStats& stats) const;
+    //! Execute the pipelined requests of a connection concurrently if the protocol supports it - must be called before StartThread
+    void SetPipelining(bool pipelining) { pipelining_ = pipelining; }
+    //! Set the CPUs for the worker threads, assigned round robin - must be called before StartThread
+    void SetWorkerAffinity(const std::vector<std::vector<unsigned> >& cpuSets) { workers_.SetAffinity(cpuSets); }
+    //! Set the prefix for the worker thread names - must be called before StartThread
+    void SetWorkerName(const std::string& namePrefix) { workers_.SetNamePrefix(namePrefix); }
+    //! Run the worker threads on the CPUs set for the server thread - must be called before StartThread
+    void SetWorkerColocation(bool colocate) { colocateWorkers_ = colocate; }
+    //! Add a lane with its own worker threads for the methods assigned to it - must be called before StartThread.  Return the lane number.
+    unsigned AddLane(unsigned numThreads);
+    //! Execute the requests with a body of at least minLength bytes in a lane, lane 0 to disable - must be called before StartThread
+    void SetLargeRequestLane(unsigned lane, std::size_t minLength) { largeRequestLane_ = lane; largeRequestLength_ = minLength; }
+
+protected:
+    virtual void ProcessEvent(void* data);
+    virtual void FinishResponse(DeferredResponse* response);
 
 private:
-    void AcceptSignal();
+    void ProcessCompleted();
     void ThreadStarter();
-    void WorkerThread();
+    void ResetAdmissionStats();
+    //! Choose the lane's workers for the request that has been read by the connection - called for each request
+    internal::WorkerPool& SelectLane(Connection* connection);
+    //! Whether the requests of the connection are taken to execute separately
+    bool IsPipelined(Connection* connection) { return pipelining_ && connection->PipeliningSupported(); }
+    //! Read the available requests from a pipelined connection and give them to the workers
+    void ProcessPipelined(Connection* connection);
+    //! Write the completed responses of a pipelined connection
+    void ProcessPipelinedCompleted(Connection* connection);
+    //! Update the monitoring of a pipelined connection or remove it once it has closed
+    void FinishPipelined(Connection* connection);
+    static void ExecuteConnection(void* server, void* data);
+    static void ExecuteRequest(void* server, void* data);
 
     unsigned numThreads_;                   //!< Number of worker threads
-    std::vector<std::thread> workers_;      //!< List of worker threads
-
-    std::queue<Connection*> workQueue_;     //!< Connections that are ready for the worker threads but not being processed
-    std::mutex workQueueMutex_;             //!< Access mutex for the work queue
-    std::condition_variable workerBlock_;   //!< Block for the worker threads waiting for work to do
-    bool workerExit_;                       //!< Indication that the worker threads should exit
-    UdpSocket serverSignal_;                //!< Signal to the main thread that a worker thread is done with a connection
+    unsigned maxPending_;                   //!< Maximum requests queued or executing, 0 for no limit
+    unsigned queueTimeBudget_;              //!< Milliseconds a request can wait in the queue, 0 for no limit
+    std::atomic<unsigned> pending_;         //!< Requests queued or executing
+    std::atomic<uint64_t> admittedCount_;   //!< Requests given to the thread pool
+    std::atomic<uint64_t> shedLimitCount_;  //!< Requests rejected since too many were pending
+    std::atomic<uint64_t> shedExpiredCount_;    //!< Requests rejected since they waited too long
+    bool pipelining_;                       //!< Execute the pipelined requests of a connection concurrently
+    bool colocateWorkers_;                  //!< Run the worker threads on the CPUs of the server thread
+    internal::WorkerPool workers_;          //!< Worker threads that execute the methods of the default lane
+
+    struct Lane
+    {
+        unsigned numThreads_;               //!< Number of worker threads for the lane
+        internal::WorkerPool workers_;      //!< Worker threads that execute the methods of the lane
+    };
+    std::vector<Lane*> lanes_;              //!< Additional lanes - lane i is lanes_[i-1]
+    unsigned largeRequestLane_;             //!< Lane for the requests with a large body, 0 to disable
+    std::size_t largeRequestLength_;        //!< Minimum body length for the large request lane
+    internal::CompletionQueue<Connection> completed_;   //!< Connections returned by the worker threads
+    internal::Wakeup completionSignal_;     //!< Signal to the main thread that a worker thread is done with a connection
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -275,6 +604,106 @@ protected:
 private:
 };
 
+////////////////////////////////////////////////////////////////////////////////
+
+//! HTTP/2 thread-pool server that executes the streams of a connection concurrently
+class ANYRPC_API AnyHttp2ServerTP : public ServerTP
+{
+public:
+    AnyHttp2ServerTP() { AddAllHandlers(); SetPipelining(true); }
+    AnyHttp2ServerTP(const unsigned numThreads) : ServerTP(numThreads) { AddAllHandlers(); SetPipelining(true); }
+
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return new Http2Connection(fd, GetMethodManager(), GetRpcHandlerList()); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! HTTP thread-pool server that upgrades the connections that ask for a WebSocket
+class ANYRPC_API AnyWebSocketServerTP : public ServerTP
+{
+public:
+    AnyWebSocketServerTP() { AddAllHandlers(); }
+    AnyWebSocketServerTP(const unsigned numThreads) : ServerTP(numThreads) { AddAllHandlers(); }
+
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return new WebSocketConnection(fd, GetMethodManager(), GetRpcHandlerList()); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Server that uses multiple event loops (reactors) to process the connections
+/*!
+ *  The multi-reactor server creates a set of single threaded reactors that each
+ *  have their own listening socket, poller, and list of connections.  The listening
+ *  sockets are bound to the same port with SO_REUSEPORT so the kernel distributes the
+ *  new connections between the reactors.  Accepting, reading, executing, and writing
+ *  all scale with the number of reactors without any locking between them.
+ *
+ *  The first reactor is operated by the Work call.  The other reactors are operated
+ *  in their own threads that are started by the first call to Work and stopped by Shutdown.
+ *  Each reactor thread can optionally be pinned to a CPU.  With SetThreadName, the
+ *  other reactor threads are named with the reactor index appended.
+ *
+ *  The connections are created by the CreateConnection function of this server so the
+ *  protocol variants only need to provide that function.  All reactors share the
+ *  MethodManager so the methods must be safe to call from multiple threads.
+ *
+ *  The maximum number of connections is divided between the reactors when they are
+ *  started.  On platforms without SO_REUSEPORT, a single reactor is used.
+ */
+class ANYRPC_API ServerMR : public Server
+{
+public:
+    ServerMR();
+    ServerMR(const unsigned numReactors);
+    virtual ~ServerMR();
+
+    //! Pin reactor i to CPU (firstCpu + i) modulo the number of CPUs - must be called before the reactors are started
+    void SetCpuAffinity(bool pinReactors, unsigned firstCpu = 0) { pinReactors_ = pinReactors; firstCpu_ = firstCpu; }
+    //! Get the number of reactors
+    unsigned GetNumReactors() const { return numReactors_; }
+
+    virtual bool BindAndListen(int port, int backlog = DefaultBacklog);
+    virtual void Work(int ms);
+    virtual void Shutdown();
+    virtual void Exit();
+    virtual void Interrupt();
+    virtual void StartThread();
+
+    virtual void GetAcceptStats(AcceptStats& stats) const;
+    virtual bool GetMainSockInfo(std::string& ip, unsigned& port) const;
+    virtual void GetConnectionsSockInfo(std::list<std::string>& ips, std::list<unsigned>& ports) const;
+    virtual void GetConnectionsPeerInfo(std::list<std::string>& ips, std::list<unsigned>& ports) const;
+
+private:
+    class Reactor;
+
+    //! Copy the settings to the reactors
+    void ConfigureReactors();
+    //! Start the threads for all of the reactors except the first one
+    void StartReactors();
+
+    unsigned numReactors_;                  //!< Number of reactors to create
+    bool pinReactors_;                      //!< Whether to set the CPU affinity of the reactor threads
+    unsigned firstCpu_;                     //!< CPU for the first reactor when pinning
+    bool reactorsStarted_;                  //!< Whether the reactor threads are running
+    std::vector<Reactor*> reactors_;        //!< Reactors that process the connections
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! HTTP multi-reactor server that will process multiple protocols based on the content-type field of the header
+class ANYRPC_API AnyHttpServerMR : public ServerMR
+{
+public:
+    AnyHttpServerMR() { AddAllHandlers(); }
+    AnyHttpServerMR(const unsigned numReactors) : ServerMR(numReactors) { AddAllHandlers(); }
+
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return new HttpConnection(fd, GetMethodManager(), GetRpcHandlerList()); }
+};
+
 #endif // defined(ANYRPC_THREADING)
 
 } // namespace anyrpc
@@ -23,8 +23,14 @@
 
 #if !defined(WIN32)
 typedef int SOCKET;     //!< SOCKET is used by Windows instead of int
+# define ANYRPC_LOCAL_SOCKET    // Unix domain sockets are available
 #endif  // _WIN32
 
+#if defined(__linux__)
+# define ANYRPC_SHARED_MEMORY   // Unix domain sockets can carry their data in shared memory rings (memfd)
+# define ANYRPC_ZEROCOPY        // TCP sends can use the data without copying it (MSG_ZEROCOPY)
+#endif // defined(__linux__)
+
 #if defined(__CYGWIN__)
 # include <sys/select.h>
 # include <netinet/in.h>
@@ -48,10 +54,13 @@ public:
     virtual ~Socket();
 
     void Close();
+    //! Stop both directions of a connected socket without releasing the descriptor - wakes a thread waiting on it
+    int Shutdown();
 
     void SetTimeout(unsigned timeout) { timeout_ = timeout; }
 
     int SetReuseAddress(int param=1);
+    int SetReusePort(int param=1);
     int SetKeepAlive(int param=1);
     int SetKeepAliveInterval(int startTime, int interval, int probeCount);
     int SetNonBlocking();
@@ -60,6 +69,12 @@ public:
     void SetFileDescriptor(SOCKET fd);
 
     int Bind(int port, uint32_t address = 0);
+#if defined(ANYRPC_LOCAL_SOCKET)
+    //! Bind to a Unix domain socket path, or a name in the abstract namespace if it starts with '@' (Linux)
+    int BindLocal(const char* path);
+    //! Remove the socket file left by a previous server on the path - other files and abstract names are left alone
+    static int RemoveLocalPath(const char* path);
+#endif // defined(ANYRPC_LOCAL_SOCKET)
 
     bool FatalError() { return FatalError(err_); }
     bool FatalError(int err);
@@ -70,9 +85,9 @@ public:
     bool WaitReadable(int timeout=-1);
     bool WaitWritable(int timeout=-1);
 
-    //! Get information on ip and port of socket (local)
+    //! Get information on ip and port of socket (local) - a Unix domain socket gives its path and port 0
     virtual bool GetSockInfo(std::string& ip, unsigned& port) const;
-    //! Get information on ip and port of peer (remote)
+    //! Get information on ip and port of peer (remote) - a Unix domain socket gives its path and port 0
     virtual bool GetPeerInfo(std::string& ip, unsigned& port) const;
 
 protected:
@@ -87,25 +102,83 @@ protected:
 
 ////////////////////////////////////////////////////////////////////////////////
 
+namespace internal
+{
+class ShmChannel;
+class ShmRing;
+class UringChannel;
+}
+
+class WriteBufferedStream;
+
+//! A block of data for a gather write with TcpSocket::SendGather
+struct ANYRPC_API SendSegment
+{
+    SendSegment(const char* data, std::size_t length, bool zeroCopy=false) : data_(data), length_(length), zeroCopy_(zeroCopy) {}
+
+    const char* data_;          //!< Start of the data
+    std::size_t length_;        //!< Number of bytes of data
+    bool zeroCopy_;             //!< The data stays unchanged until TcpSocket::ReapZeroCopy releases it
+};
+typedef std::vector<SendSegment> SendSegmentList;
+
+//! Add the buffers of a stream, starting at the offset, to the list for a gather write
+ANYRPC_API void AppendSegments(SendSegmentList& segments, WriteBufferedStream& stream, std::size_t offset);
+
 //! The TcpSock class builds on the Socket class with Tcp specific functions
 /*!
  *  Many of the socket functions use a timeout.  The timeout can be either specified
  *  to the function or, if the timeout value is -1, default to a previously specified
  *  value from the SetTimeout function.
+ *
+ *  The same class is used for Unix domain stream sockets (CreateLocal) since only
+ *  the addressing is different.  The TCP specific options fail on those sockets.
+ *
+ *  A connected Unix domain socket can switch to shared memory rings with
+ *  ConnectRing on the client and AcceptRing on the server.  Send, Receive, and
+ *  WaitReadable then move the data through the rings and the socket only
+ *  carries a byte to wake a side that is asleep, so the poller and the
+ *  detection of a closed peer work the same way.
+ *
+ *  A socket can also be attached to an io_uring poller (Poller::Attach).  Send,
+ *  Receive, and Accept then use the data and connections the poller has already
+ *  moved through its ring and the timeouts only apply to a full send queue.
  */
 class ANYRPC_API TcpSocket : public Socket
 {
 public:
-    TcpSocket() : connected_(false) {}
+    TcpSocket() : connected_(false), channel_(0), ringExpected_(false), isClient_(false), peerClosed_(false), busyPoll_(0),
+        uring_(0), zeroCopy_(false), zeroCopySends_(0), zeroCopyCompleted_(0) {}
+    virtual ~TcpSocket();
+
+    //! Close the socket and release the shared memory rings and the buffers held for zero copy sends
+    /*! A socket with zero copy sends that have not completed is reset so the kernel drops
+     *  the data before the buffers are freed.  Use MoveZeroCopy to close it gracefully. */
+    void Close();
 
     SOCKET Create();
+#if defined(ANYRPC_LOCAL_SOCKET)
+    //! Create a Unix domain stream socket instead of a TCP socket
+    SOCKET CreateLocal();
+#endif // defined(ANYRPC_LOCAL_SOCKET)
     int SetTcpNoDelay(int param=1);
+    //! Only wake a listening socket when data arrives on a new connection (Linux TCP_DEFER_ACCEPT)
+    int SetDeferAccept(int seconds);
 
     //! Send data on the socket.  The actual number of bytes written are returned in bytesWritten.
     bool Send(const char* str, std::size_t len, std::size_t &bytesWritten, int timeout=-1);
     //! Send data on the socket.  The actual number of bytes written are returned in bytesWritten.
     bool Send(std::string const& str, std::size_t bytesWritten, int timeout=-1)
         { return Send(str.c_str(), str.length(), bytesWritten, timeout); }
+    //! Send a list of data blocks in order with as few system calls as possible (sendmsg).
+    /*! The total number of bytes written from all of the blocks is returned in bytesWritten,
+     *  so a partial write can continue by building the list again from that offset.
+     *  The blocks marked for zero copy are sent with MSG_ZEROCOPY if SetZeroCopy was successful.
+     */
+    bool SendGather(const SendSegment* segments, std::size_t count, std::size_t &bytesWritten, int timeout=-1);
+    //! Send a list of data blocks in order with as few system calls as possible (sendmsg).
+    bool SendGather(const SendSegmentList& segments, std::size_t &bytesWritten, int timeout=-1)
+        { bytesWritten = 0; return segments.empty() || SendGather(&segments[0], segments.size(), bytesWritten, timeout); }
 
     //! Receive data from the socket.
     /*! The actual number of bytes received are returned in bytesRead.
@@ -114,17 +187,99 @@ public:
     bool Receive(char* str, std::size_t maxLength, std::size_t &bytesRead, bool &eof, int timeout=-1);
 
     bool IsConnected(int timeout=-1);
+    //! Wait until data can be read - also checks the shared memory ring
+    bool WaitReadable(int timeout=-1);
 
     //! Used only by servers to listen on port after a bind
     int Listen(int backlog=5);
     //! Used only by servers to accept a connection
+    /*! The accepted socket is non-blocking and close-on-exec with TCP_NODELAY set if it
+     *  was set on the listening socket.  On Linux this only needs a single accept4 call.
+     *  Returns -1 when there are no more pending connections or on an error.
+     */
     SOCKET Accept();
 
     //! Used only by clients to connect to an IpAddress at a specified port
     int Connect(const char* ipAddress, int port);
+#if defined(ANYRPC_LOCAL_SOCKET)
+    //! Used only by clients to connect to a Unix domain socket path or '@' abstract name
+    int ConnectLocal(const char* path);
+#endif // defined(ANYRPC_LOCAL_SOCKET)
+#if defined(ANYRPC_ZEROCOPY)
+    //! Allow the kernel to send the blocks marked for zero copy from their memory (SO_ZEROCOPY).  Return 0 on success.
+    int SetZeroCopy(int param=1);
+    //! Whether the blocks marked for zero copy are sent without a copy
+    bool IsZeroCopy() const { return zeroCopy_; }
+    //! Keep the allocated buffers (released with free) until the kernel is done with the zero copy sends made so far
+    void HoldZeroCopy(std::vector<void*>& buffers);
+    //! Read the completed zero copy sends from the error queue and free the buffers that are no longer needed
+    void ReapZeroCopy();
+    //! Whether there are zero copy sends that have not completed - their completions wake a poller with an error event
+    bool IsZeroCopyPending() const { return zeroCopyCompleted_ != zeroCopySends_; }
+    //! Give the descriptor and the buffers held for zero copy sends to another socket, leaving this one closed
+    /*! Used to close the socket later without waiting for the sends (internal::ZeroCopyReaper). */
+    void MoveZeroCopy(TcpSocket& target);
+#endif // defined(ANYRPC_ZEROCOPY)
+#if defined(ANYRPC_SHARED_MEMORY)
+    //! Used only by clients to pass shared memory rings of the capacity to the server after ConnectLocal
+    bool ConnectRing(std::size_t capacity, int timeout=-1);
+    //! Used only by servers to take the rings if the client passes them before sending any data
+    void AcceptRing() { ringExpected_ = true; }
+    //! Spin for a number of microseconds waiting on a ring before going to sleep, 0 to sleep right away
+    void SetBusyPoll(unsigned microseconds) { busyPoll_ = microseconds; }
+    //! Whether the data goes through shared memory rings
+    bool IsShared() const { return channel_ != 0; }
+#endif // defined(ANYRPC_SHARED_MEMORY)
+    //! Used only by the io_uring poller to attach the channel that carries the data, or detach it with null
+    void SetUring(internal::UringChannel* channel) { uring_ = channel; }
+    //! Whether the data goes through an io_uring poller
+    bool IsUring() const { return uring_ != 0; }
 
 protected:
+    //! Send the blocks with a separate call for each one - used where there is no gather write
+    bool SendEach(const SendSegment* segments, std::size_t count, std::size_t &bytesWritten, int timeout);
+#if defined(ANYRPC_SHARED_MEMORY)
+    //! Take the rings passed by the client or keep the data if none were passed
+    bool TakeRing(char* buffer, std::size_t maxLength, std::size_t &bytesRead, bool &eof);
+    bool SendShared(const char* buffer, std::size_t length, std::size_t &bytesWritten, int timeout);
+    bool ReceiveShared(char* buffer, std::size_t maxLength, std::size_t &bytesRead, bool &eof, int timeout);
+    //! Wait for data, or for space when sending, in the ring
+    bool WaitShared(bool send, int timeout);
+    //! Ring from this side to the other
+    internal::ShmRing& OutgoingRing();
+    //! Ring from the other side to this one
+    internal::ShmRing& IncomingRing();
+    //! Wake the other side
+    void RingDoorbell();
+    //! Consume the wake ups from the other side.  Return false if the other side closed.
+    bool DrainDoorbell();
+#endif // defined(ANYRPC_SHARED_MEMORY)
+    //! Free the buffers held for zero copy sends that have completed, or all of them
+    void ReleaseZeroCopy(bool all);
+    bool SendUring(const SendSegment* segments, std::size_t count, std::size_t &bytesWritten, int timeout);
+    bool ReceiveUring(char* buffer, std::size_t maxLength, std::size_t &bytesRead, bool &eof);
+
+    //! Buffers that are needed until the zero copy sends up to a count have completed
+    struct ZeroCopyHold
+    {
+        uint32_t sends_;                //!< Number of zero copy sends when the buffers were held
+        std::vector<void*> buffers_;    //!< Allocated buffers to free
+    };
+
     bool connected_;        //!< Connect function has been called
+    internal::ShmChannel* channel_; //!< Shared memory rings that carry the data, null to use the socket
+    bool ringExpected_;     //!< The first data from the client may pass the rings
+    bool isClient_;         //!< This side sends on the request ring
+    bool peerClosed_;       //!< The other side of the rings has closed the socket
+    unsigned busyPoll_;     //!< Microseconds to spin on a ring before sleeping
+    internal::UringChannel* uring_; //!< Poller channel that carries the data, null to use the socket
+    bool zeroCopy_;         //!< SO_ZEROCOPY is set so the marked blocks are sent with MSG_ZEROCOPY
+    uint32_t zeroCopySends_;        //!< Number of zero copy sends, which the kernel numbers from 0
+    uint32_t zeroCopyCompleted_;    //!< Number of zero copy sends that have completed in order
+    std::vector<std::pair<uint32_t,uint32_t> > zeroCopyRanges_;  //!< Completed sends that are after a missing one
+    std::deque<ZeroCopyHold> zeroCopyHeld_; //!< Buffers in the order they were held
+
+    static const int MaxGatherSegments = 64;    //!< Blocks passed to a single sendmsg call
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -330,6 +330,11 @@ public:
     virtual std::size_t Length() { return length_; }
     virtual void Clear();
 
+    //! Length of the data in the first buffer, which is part of the stream object and is reused after Clear
+    std::size_t GetStaticLength() const { return buffers_.front().used_; }
+    //! Clear the stream but give the allocated buffers to the caller, who must free them, so they can outlive the stream
+    void DetachBuffers(std::vector<void*>& buffers);
+
 private:
     void AddBuffer();
 
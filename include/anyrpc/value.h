@@ -368,21 +368,21 @@ private:
     {
         InvalidFlag        = InvalidType,
         NullFlag           = NullType,
-        TrueFlag           = TrueType | BoolFlag,
-        FalseFlag          = FalseType | BoolFlag,
-        NumberIntFlag      = NumberType | NumberFlag | IntFlag | Int64Flag,
-        NumberUintFlag     = NumberType | NumberFlag | UintFlag | Uint64Flag | Int64Flag,
-        NumberInt64Flag    = NumberType | NumberFlag | Int64Flag,
-        NumberUint64Flag   = NumberType | NumberFlag | Uint64Flag,
-        NumberFloatFlag    = NumberType | NumberFlag | FloatFlag,
-        NumberDoubleFlag   = NumberType | NumberFlag | FloatFlag | DoubleFlag,
-        NumberAnyFlag      = NumberType | NumberFlag | IntFlag | Int64Flag | UintFlag | Uint64Flag | FloatFlag | DoubleFlag,
-        ConstStringFlag    = StringType | StringFlag,
-        CopyStringFlag     = StringType | StringFlag | CopyFlag,
-        ShortStringFlag    = StringType | StringFlag | CopyFlag | InlineStrFlag,
-        ConstBinaryFlag    = BinaryType | BinaryFlag,
-        CopyBinaryFlag     = BinaryType | BinaryFlag | CopyFlag,
-        ShortBinaryFlag    = BinaryType | BinaryFlag | CopyFlag | InlineStrFlag,
+        TrueFlag           = static_cast<int>(TrueType) | BoolFlag,
+        FalseFlag          = static_cast<int>(FalseType) | BoolFlag,
+        NumberIntFlag      = static_cast<int>(NumberType) | NumberFlag | IntFlag | Int64Flag,
+        NumberUintFlag     = static_cast<int>(NumberType) | NumberFlag | UintFlag | Uint64Flag | Int64Flag,
+        NumberInt64Flag    = static_cast<int>(NumberType) | NumberFlag | Int64Flag,
+        NumberUint64Flag   = static_cast<int>(NumberType) | NumberFlag | Uint64Flag,
+        NumberFloatFlag    = static_cast<int>(NumberType) | NumberFlag | FloatFlag,
+        NumberDoubleFlag   = static_cast<int>(NumberType) | NumberFlag | FloatFlag | DoubleFlag,
+        NumberAnyFlag      = static_cast<int>(NumberType) | NumberFlag | IntFlag | Int64Flag | UintFlag | Uint64Flag | FloatFlag | DoubleFlag,
+        ConstStringFlag    = static_cast<int>(StringType) | StringFlag,
+        CopyStringFlag     = static_cast<int>(StringType) | StringFlag | CopyFlag,
+        ShortStringFlag    = static_cast<int>(StringType) | StringFlag | CopyFlag | InlineStrFlag,
+        ConstBinaryFlag    = static_cast<int>(BinaryType) | BinaryFlag,
+        CopyBinaryFlag     = static_cast<int>(BinaryType) | BinaryFlag | CopyFlag,
+        ShortBinaryFlag    = static_cast<int>(BinaryType) | BinaryFlag | CopyFlag | InlineStrFlag,
         MapFlag            = MapType,
         ArrayFlag          = ArrayType,
     };
@@ -25,6 +25,8 @@ namespace anyrpc
 {
 
 ANYRPC_API bool XmlRpcHandler(MethodManager* manager, char* request, std::size_t length, Stream &response);
+ANYRPC_API bool XmlRpcFaultHandler(char* request, std::size_t length, int errorCode, std::string const& errorMsg, Stream &response);
+ANYRPC_API bool XmlRpcMethodName(const char* request, std::size_t length, std::string& methodName);
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -70,8 +72,8 @@ protected:
 class ANYRPC_API XmlHttpServerTP : public ServerTP
 {
 public:
-    XmlHttpServerTP() { AddHandler( &XmlRpcHandler, "", "text/xml" ); }
-    XmlHttpServerTP(const unsigned numThreads) : ServerTP(numThreads) { AddHandler( &XmlRpcHandler, "", "text/xml" ); }
+    XmlHttpServerTP() { AddHandler( &XmlRpcHandler, "", "text/xml", &XmlRpcMethodName ); }
+    XmlHttpServerTP(const unsigned numThreads) : ServerTP(numThreads) { AddHandler( &XmlRpcHandler, "", "text/xml", &XmlRpcMethodName ); }
 
 protected:
     virtual Connection* CreateConnection(SOCKET fd) { return new HttpConnection(fd, GetMethodManager(), GetRpcHandlerList()); }
@@ -85,6 +87,30 @@ public:
     XmlTcpServerTP() : ServerTP() {};
     XmlTcpServerTP(const unsigned numThreads) : ServerTP(numThreads) {};
 
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return new TcpConnection(fd, GetMethodManager(), &XmlRpcHandler, &XmlRpcFaultHandler, false, &XmlRpcMethodName); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+class ANYRPC_API XmlHttpServerMR : public ServerMR
+{
+public:
+    XmlHttpServerMR() { AddHandler( &XmlRpcHandler, "", "text/xml" ); }
+    XmlHttpServerMR(const unsigned numReactors) : ServerMR(numReactors) { AddHandler( &XmlRpcHandler, "", "text/xml" ); }
+
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return new HttpConnection(fd, GetMethodManager(), GetRpcHandlerList()); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+class ANYRPC_API XmlTcpServerMR : public ServerMR
+{
+public:
+    XmlTcpServerMR() : ServerMR() {};
+    XmlTcpServerMR(const unsigned numReactors) : ServerMR(numReactors) {};
+
 protected:
     virtual Connection* CreateConnection(SOCKET fd) { return new TcpConnection(fd, GetMethodManager(), &XmlRpcHandler); }
 };
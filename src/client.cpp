@@ -30,6 +30,8 @@
 #include "anyrpc/socket.h"
 #include "anyrpc/client.h"
 #include "anyrpc/internal/time.h"
+#include "anyrpc/internal/shmring.h"
+#include "anyrpc/internal/base64.h"
 
 #ifndef WIN32
 #include <sys/socket.h>
@@ -37,6 +39,8 @@
 #include <arpa/inet.h>
 #endif  // _WIN32
 
+#include <random>
+
 namespace anyrpc
 {
 
@@ -59,11 +63,16 @@ void ClientHandler::GenerateFaultResult(int errorCode, std::string const& errorM
 
 ////////////////////////////////////////////////////////////////////////////////
 
+const char* const Client::LocalPrefix = "unix:";
+const char* const Client::SharedPrefix = "shm:";
+
 Client::Client(ClientHandler* handler)
 {
     handler_ = handler;
     port_ = 0;
     timeout_ = 60000;
+    ringSize_ = internal::ShmChannel::DefaultCapacity;
+    maxContentLength_ = DefaultMaxContentLength;
     responseAllocated_ = false;
     responseProcessed_ = false;
     ResetReceiveBuffer();
@@ -76,6 +85,8 @@ Client::Client(ClientHandler* handler, const char* host, int port)
     host_ = host;
     port_ = port;
     timeout_ = 60000;
+    ringSize_ = internal::ShmChannel::DefaultCapacity;
+    maxContentLength_ = DefaultMaxContentLength;
     responseAllocated_ = false;
     responseProcessed_ = false;
     ResetReceiveBuffer();
@@ -327,19 +338,37 @@ bool Client::Connect()
     ResetReceiveBuffer();
 
     log_debug("Create a new connection");
-    socket_.Create();
-    socket_.SetNonBlocking();
+#if defined(ANYRPC_LOCAL_SOCKET)
+    if (IsLocal() || IsShared())
+    {
+        socket_.CreateLocal();
+        socket_.SetNonBlocking();
+        socket_.ConnectLocal(host_.c_str() + (IsLocal() ? LocalPrefixLength : SharedPrefixLength));
+    }
+    else
+#endif // defined(ANYRPC_LOCAL_SOCKET)
+    {
+        socket_.Create();
+        socket_.SetNonBlocking();
 
-    socket_.Connect(host_.c_str(), port_);
+        socket_.Connect(host_.c_str(), port_);
 
-    socket_.SetKeepAlive();
-    socket_.SetTcpNoDelay();
+        socket_.SetKeepAlive();
+        socket_.SetTcpNoDelay();
+    }
 
     if (!socket_.IsConnected(GetTimeLeft()))
     {
         socket_.Close();
         return false;
     }
+#if defined(ANYRPC_SHARED_MEMORY)
+    if (IsShared() && !socket_.ConnectRing(ringSize_, GetTimeLeft()))
+    {
+        socket_.Close();
+        return false;
+    }
+#endif // defined(ANYRPC_SHARED_MEMORY)
     return true;
 }
 
@@ -356,38 +385,12 @@ bool Client::WriteRequest(Value& result)
 {
     log_trace();
 
+    // write the header and the request together - both may be in several segments
+    segments_.clear();
+    AppendSegments(segments_, header_, 0);
+    AppendSegments(segments_, request_, 0);
     size_t bytesWritten;
-    size_t bytesToSend;
-
-    // write the header - it make be in several segments
-    size_t headerBytesWritten = 0;
-    while (headerBytesWritten < header_.Length())
-    {
-        const char* buffer = header_.GetBuffer(headerBytesWritten, bytesToSend);
-        if (!socket_.Send(buffer, bytesToSend, bytesWritten, GetTimeLeft()))
-            return false;
-
-        headerBytesWritten += bytesWritten;
-
-        if (bytesToSend < bytesWritten)
-            return false;   // timeout
-    }
-
-    // write the request - it make be in several segments
-    size_t requestBytesWritten = 0;
-    while (requestBytesWritten < request_.Length())
-    {
-        const char* buffer = request_.GetBuffer(requestBytesWritten, bytesToSend);
-        if (!socket_.Send(buffer, bytesToSend, bytesWritten, GetTimeLeft()))
-            return false;
-
-        requestBytesWritten += bytesWritten;
-
-        if (bytesToSend < bytesWritten)
-            return false;   // timeout
-    }
-
-    return true;
+    return socket_.SendGather(segments_, bytesWritten, GetTimeLeft());   // false on an error or timeout
 }
 
 bool Client::ReadHeader(Value& result)
@@ -461,7 +464,10 @@ bool HttpClient::GenerateHeader()
     log_trace();
     header_ << "POST /RPC2 HTTP/1.1\r\n";
     header_ << "User-Agent: " << ANYRPC_APP_NAME << " v" << ANYRPC_VERSION_STRING << "\r\n";
-    header_ << "Host: " << host_ << ":" << port_ << "\r\n";
+    if (IsLocal() || IsShared())
+        header_ << "Host: localhost\r\n";
+    else
+        header_ << "Host: " << host_ << ":" << port_ << "\r\n";
     header_ << "Content-Type: " << contentType_ << "\r\n";
     header_ << "Accept: " << contentType_ << "\r\n";
     header_ << "Content-length: " << request_.Length() << "\r\n";
@@ -470,6 +476,18 @@ bool HttpClient::GenerateHeader()
     return true;
 }
 
+void HttpClient::PreserveReceiveBuffer()
+{
+    // the data after a chunked body was already moved to the start of the buffer
+    if (httpResponseState_.GetChunked())
+    {
+        log_debug("PreserveReceiveBuffer: Keep data after chunked body: " << bufferLength_ << " bytes");
+        responseProcessed_ = true;
+        return;
+    }
+    Client::PreserveReceiveBuffer();
+}
+
 int HttpClient::ProcessHeader(bool eof)
 {
     log_trace();
@@ -483,12 +501,32 @@ int HttpClient::ProcessHeader(bool eof)
     size_t bodyStartPos = httpResponseState_.GetBodyStartPos();
     size_t bufferSpaceAvail = MaxBufferLength - bodyStartPos;
 
+    if (httpResponseState_.GetChunked())
+    {
+        // the body is decoded from the buffer into an allocated response as it arrives
+        bufferLength_ -= bodyStartPos;
+        memmove(buffer_, buffer_+bodyStartPos, bufferLength_);
+        chunkedDecoder_.Initialize();
+        contentLength_ = 0;
+        contentAvail_ = 0;
+        responseCapacity_ = 0;
+        if (!ReserveResponse(0))
+            return HEADER_FAULT;
+        response_[0] = 0;
+        if (httpResponseState_.GetResponseCode() != "200")
+        {
+            log_warn("Response code indicates problem, code = " << httpResponseState_.GetResponseCode() << ", string = " << httpResponseState_.GetResponseString());
+            return HEADER_FAULT;
+        }
+        return HEADER_COMPLETE;
+    }
+
     contentLength_ = std::max(0,httpResponseState_.GetContentLength());
     contentAvail_ = bufferLength_ - bodyStartPos;
 
-    if (contentLength_ > MaxContentLength)
+    if (contentLength_ > maxContentLength_)
     {
-        log_warn("Content-length too large=" << contentLength_ << ", max allowed=" << MaxContentLength);
+        log_warn("Content-length too large=" << contentLength_ << ", max allowed=" << maxContentLength_);
         return HEADER_FAULT;
     }
     if (contentLength_ > bufferSpaceAvail)
@@ -522,6 +560,125 @@ int HttpClient::ProcessHeader(bool eof)
     return HEADER_COMPLETE;
 }
 
+bool HttpClient::ReadResponse(Value& result)
+{
+    if (httpResponseState_.GetChunked())
+        return ReadChunkedResponse(result);
+    return Client::ReadResponse(result);
+}
+
+bool HttpClient::ReadChunkedResponse(Value& result)
+{
+    log_trace();
+    while (true)
+    {
+        // decode the data that has been read into the buffer
+        size_t position = 0;
+        while (position < bufferLength_)
+        {
+            size_t consumed;
+            const char* data;
+            size_t dataLength;
+            internal::HttpChunkedDecoder::ResultEnum state =
+                chunkedDecoder_.Process(buffer_+position, bufferLength_-position, consumed, data, dataLength);
+            position += consumed;
+            if (dataLength > 0)
+            {
+                if (!ReserveResponse(contentAvail_+dataLength))
+                {
+                    handler_->GenerateFaultResult(AnyRpcErrorTransportError,"Response too large",result);
+                    return false;
+                }
+                memcpy(response_+contentAvail_, data, dataLength);
+                contentAvail_ += dataLength;
+            }
+            if (state == internal::HttpChunkedDecoder::CHUNKED_FAULT)
+            {
+                handler_->GenerateFaultResult(AnyRpcErrorTransportError,"Invalid chunked response",result);
+                return false;
+            }
+            if (state == internal::HttpChunkedDecoder::CHUNKED_COMPLETE)
+            {
+                // keep the data after the body for the next response
+                bufferLength_ -= position;
+                memmove(buffer_, buffer_+position, bufferLength_);
+                contentLength_ = contentAvail_;
+                response_[contentAvail_] = 0;
+                return true;
+            }
+        }
+        bufferLength_ = 0;
+
+        // the data of a chunk is read straight into the response
+        size_t dataLeft = chunkedDecoder_.GetDataLeft();
+        if ((dataLeft > 0) && !ReserveResponse(contentAvail_+dataLeft))
+        {
+            handler_->GenerateFaultResult(AnyRpcErrorTransportError,"Response too large",result);
+            return false;
+        }
+        char* readStart = (dataLeft > 0) ? response_+contentAvail_ : buffer_;
+        size_t readLength = (dataLeft > 0) ? dataLeft : MaxBufferLength;
+        size_t bytesRead;
+        bool eof;
+        socket_.Receive(readStart, readLength, bytesRead, eof, 0);
+        if (socket_.FatalError())
+        {
+            handler_->GenerateFaultResult(AnyRpcErrorTransportError,"Failed reading response",result);
+            return false;
+        }
+        if (dataLeft > 0)
+        {
+            // let the decoder count the data that is already in place
+            size_t consumed;
+            const char* data;
+            size_t dataLength;
+            chunkedDecoder_.Process(readStart, bytesRead, consumed, data, dataLength);
+            contentAvail_ += bytesRead;
+        }
+        else
+            bufferLength_ = bytesRead;
+        if (bytesRead > 0)
+            continue;
+
+        if (eof)
+        {
+            handler_->GenerateFaultResult(AnyRpcErrorTransportError,"Connection closed in chunked response",result);
+            return false;
+        }
+        unsigned timeLeft = GetTimeLeft();
+        if (timeLeft == 0)
+        {
+            handler_->GenerateFaultResult(AnyRpcErrorTransportError,"Timeout reading response",result);
+            return false;
+        }
+        socket_.WaitReadable(timeLeft);
+    }
+}
+
+bool HttpClient::ReserveResponse(std::size_t length)
+{
+    if (responseAllocated_ && (length <= responseCapacity_))
+        return true;
+    if (length > maxContentLength_)
+    {
+        log_warn("Chunked response too large=" << length << ", max allowed=" << maxContentLength_);
+        return false;
+    }
+
+    size_t initialCapacity = InitialResponseCapacity;
+    size_t capacity = std::max(length, std::min(maxContentLength_, std::max(2*responseCapacity_, initialCapacity)));
+    char* response = static_cast<char*>(responseAllocated_ ? realloc(response_, capacity+1) : malloc(capacity+1));
+    if (response == 0)
+    {
+        log_warn("Could not allocate space=" << capacity);
+        return false;
+    }
+    response_ = response;
+    responseCapacity_ = capacity;
+    responseAllocated_ = true;
+    return true;
+}
+
 ProcessResponseEnum HttpClient::ProcessResponse(Value& result, bool notification)
 {
     log_trace();
@@ -608,9 +765,9 @@ int TcpClient::ProcessHeader(bool eof)
     size_t bufferSpaceAvail = buffer_ + MaxBufferLength - body;
     contentAvail_ = end - body;
 
-    if (contentLength_ > MaxContentLength)
+    if (contentLength_ > maxContentLength_)
     {
-        log_warn("String length too large=" << contentLength_ << ", max allowed=" << MaxContentLength);
+        log_warn("String length too large=" << contentLength_ << ", max allowed=" << maxContentLength_);
         return HEADER_FAULT;
     }
     if (contentLength_ > bufferSpaceAvail)
@@ -640,4 +797,780 @@ int TcpClient::ProcessHeader(bool eof)
     return HEADER_COMPLETE;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+Http2Client::Http2Client(ClientHandler* handler, std::string contentType) :
+    Client(handler), contentType_(contentType),
+    input_(internal::Http2Frame::HeaderLength + internal::Http2Frame::DefaultMaxFrameSize + 1)
+{
+    Close();
+}
+
+Http2Client::Http2Client(ClientHandler* handler, std::string contentType, const char* host, int port) :
+    Client(handler,host,port), contentType_(contentType),
+    input_(internal::Http2Frame::HeaderLength + internal::Http2Frame::DefaultMaxFrameSize + 1)
+{
+    Close();
+}
+
+void Http2Client::Close()
+{
+    Client::Close();
+    streams_.clear();
+    posted_.clear();
+    nextStreamId_ = 1;
+    sendWindow_ = internal::Http2Frame::DefaultWindowSize;
+    initialWindow_ = internal::Http2Frame::DefaultWindowSize;
+    maxFrameSize_ = internal::Http2Frame::DefaultMaxFrameSize;
+    windowUpdate_ = 0;
+    prefaceSent_ = false;
+    goAway_ = false;
+    decoder_.Reset();
+    inputLength_ = 0;
+    continuationStream_ = 0;
+    continuationEndStream_ = false;
+    headerBlock_.clear();
+    frames_.Clear();
+}
+
+bool Http2Client::Call(const char* method, Value& params, Value& result)
+{
+    log_trace();
+    gettimeofday( &startTime_, 0 );
+    result.SetInvalid();
+
+    uint32_t streamId = StartStream(method, params, result, false);
+    return (streamId != 0) && FinishStream(streamId, result);
+}
+
+bool Http2Client::Post(const char* method, Value& params, Value& result)
+{
+    log_trace();
+    gettimeofday( &startTime_, 0 );
+    result.SetInvalid();
+
+    uint32_t streamId = StartStream(method, params, result, false);
+    if (streamId == 0)
+        return false;
+    posted_.push_back(streamId);
+    return true;
+}
+
+bool Http2Client::GetPostResult(Value& result)
+{
+    log_trace();
+    gettimeofday( &startTime_, 0 );
+    result.SetInvalid();
+
+    if (posted_.empty())
+    {
+        handler_->GenerateFaultResult(AnyRpcErrorTransportError,"No posted request",result);
+        return false;
+    }
+    uint32_t streamId = posted_.front();
+    posted_.pop_front();
+    return FinishStream(streamId, result);
+}
+
+bool Http2Client::Notify(const char* method, Value& params, Value& result)
+{
+    log_trace();
+    gettimeofday( &startTime_, 0 );
+    result.SetInvalid();
+
+    uint32_t streamId = StartStream(method, params, result, true);
+    return (streamId != 0) && FinishStream(streamId, result);
+}
+
+bool Http2Client::Connect()
+{
+    log_trace();
+    // a connection that the server is ending is replaced when its streams are done
+    if (goAway_ || (nextStreamId_ > MaxStreamId))
+    {
+        if (!streams_.empty())
+            return false;
+        Close();
+    }
+    if (!Client::Connect())
+        return false;
+
+    if (!prefaceSent_)
+    {
+        // the preface and settings go before the headers of the first request
+        log_debug("Start HTTP/2 connection");
+        header_.Put(internal::Http2Frame::Preface, internal::Http2Frame::PrefaceLength);
+        internal::Http2Frame::WriteHeader(header_, 12, internal::Http2Frame::FRAME_SETTINGS, 0, 0);
+        internal::Http2Frame::WriteSetting(header_, internal::Http2Frame::SETTINGS_ENABLE_PUSH, 0);
+        internal::Http2Frame::WriteSetting(header_, internal::Http2Frame::SETTINGS_INITIAL_WINDOW_SIZE, ReceiveWindow);
+        internal::Http2Frame::WriteWindowUpdate(header_, 0, ReceiveWindow - internal::Http2Frame::DefaultWindowSize);
+        prefaceSent_ = true;
+    }
+    return true;
+}
+
+bool Http2Client::GenerateHeader()
+{
+    log_trace();
+    std::string block;
+    internal::HpackEncode(block, ":method", "POST");
+    internal::HpackEncode(block, ":scheme", "http");
+    internal::HpackEncode(block, ":path", "/RPC2");
+    if (IsLocal() || IsShared())
+        internal::HpackEncode(block, ":authority", "localhost");
+    else
+    {
+        std::ostringstream authority;
+        authority << host_ << ":" << port_;
+        internal::HpackEncode(block, ":authority", authority.str());
+    }
+    internal::HpackEncode(block, "content-type", contentType_);
+    internal::HpackEncode(block, "accept", contentType_);
+    std::ostringstream contentLength;
+    contentLength << request_.Length();
+    internal::HpackEncode(block, "content-length", contentLength.str());
+    internal::HpackEncode(block, "user-agent", ANYRPC_APP_NAME " v" ANYRPC_VERSION_STRING);
+
+    internal::Http2Frame::WriteHeaders(header_, nextStreamId_, block, request_.Length() == 0, maxFrameSize_);
+    return true;
+}
+
+uint32_t Http2Client::StartStream(const char* method, Value& params, Value& result, bool notification)
+{
+    ResetTransaction();
+    unsigned requestId = 0;
+    if (!Connect())
+    {
+        handler_->GenerateFaultResult(AnyRpcErrorTransportError,"Could not connect to server",result);
+        return 0;
+    }
+    if (!handler_->GenerateRequest(method, params, request_, requestId, notification))
+        return 0;
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (attempt > 0)
+        {
+            header_.Clear();
+            if (!Connect())
+                break;
+        }
+        uint32_t streamId = nextStreamId_;
+        GenerateHeader();
+        nextStreamId_ += 2;
+
+        StreamState& stream = streams_[streamId];
+        stream.requestId_ = requestId;
+        stream.notification_ = notification;
+        stream.sendWindow_ = initialWindow_;
+        if (SendRequest(streamId, result))
+            return streamId;
+
+        // retry the connection once if it was closed by the server
+        Close();
+    }
+    Reset();
+    if (result.IsInvalid())
+        handler_->GenerateFaultResult(AnyRpcErrorTransportError,"Failed sending request",result);
+    return 0;
+}
+
+bool Http2Client::SendRequest(uint32_t streamId, Value& result)
+{
+    log_trace();
+    size_t length = request_.Length();
+    size_t offset = 0;
+    bool headersSent = false;
+    while (true)
+    {
+        StreamMap::iterator it = streams_.find(streamId);
+        if ((it == streams_.end()) || it->second.reset_)
+            return true;    // the response reports the failure
+        StreamState& stream = it->second;
+        while ((offset < length) && (sendWindow_ > 0) && (stream.sendWindow_ > 0) && (frames_.Length() < OutputLimit))
+        {
+            size_t window = static_cast<size_t>(std::min(sendWindow_, stream.sendWindow_));
+            size_t frameLength = std::min(std::min(length - offset, maxFrameSize_), window);
+            internal::Http2Frame::WriteData(frames_, streamId, request_, offset, frameLength, offset + frameLength == length);
+            offset += frameLength;
+            sendWindow_ -= frameLength;
+            stream.sendWindow_ -= frameLength;
+        }
+
+        // the headers are sent with the first of the data
+        segments_.clear();
+        if (!headersSent)
+            AppendSegments(segments_, header_, 0);
+        AppendSegments(segments_, frames_, 0);
+        size_t bytesWritten;
+        if (!socket_.SendGather(segments_, bytesWritten, GetTimeLeft()))
+        {
+            log_warn("HTTP/2 write error " << socket_.GetLastError());
+            return false;
+        }
+        headersSent = true;
+        frames_.Clear();
+        if (offset >= length)
+            return true;
+
+        // wait for the server to open the flow control windows
+        if (((sendWindow_ <= 0) || (stream.sendWindow_ <= 0)) && !ReadFrames(result))
+            return false;
+    }
+}
+
+bool Http2Client::FinishStream(uint32_t streamId, Value& result)
+{
+    log_trace();
+    StreamMap::iterator it = streams_.find(streamId);
+    if (it == streams_.end())
+    {
+        handler_->GenerateFaultResult(AnyRpcErrorTransportError,"Stream was closed",result);
+        return false;
+    }
+    while (!it->second.complete_)
+    {
+        if (!ReadFrames(result))
+        {
+            if (GetTimeLeft() == 0)
+            {
+                // only this stream is abandoned, the connection is kept for the others
+                log_info("Cancel stream " << streamId);
+                internal::Http2Frame::WriteRstStream(frames_, streamId, internal::Http2Frame::ERR_CANCEL);
+                streams_.erase(it);
+                Flush();
+                return false;
+            }
+            Reset();
+            return false;
+        }
+    }
+
+    StreamState stream;
+    std::swap(stream, it->second);
+    streams_.erase(it);
+    if (stream.reset_)
+    {
+        handler_->GenerateFaultResult(AnyRpcErrorTransportError,"Stream reset by server",result);
+        return false;
+    }
+    if (stream.status_ != 200)
+    {
+        log_warn("Response code indicates problem, code = " << stream.status_);
+        std::ostringstream message;
+        message << "HTTP status " << stream.status_;
+        handler_->GenerateFaultResult(AnyRpcErrorTransportError,message.str(),result);
+        return false;
+    }
+    if (stream.notification_)
+    {
+        // don't process the response for a notification
+        result.SetNull();
+        return true;
+    }
+    // the result can refer to the response so it is kept until the next result is processed
+    lastResponse_.swap(stream.response_);
+    switch (handler_->ProcessResponse(&lastResponse_[0], lastResponse_.length(), result, stream.requestId_, false))
+    {
+        case ProcessResponseSuccess       : return true;
+        case ProcessResponseErrorKeepOpen : return false;
+        default                           : ; // continue processing
+    }
+    Reset();
+    return false;
+}
+
+bool Http2Client::ReadFrames(Value& result)
+{
+    log_trace();
+    unsigned timeLeft = GetTimeLeft();
+    if (timeLeft == 0)
+    {
+        handler_->GenerateFaultResult(AnyRpcErrorTransportError,"Timeout reading response",result);
+        return false;
+    }
+    socket_.WaitReadable(timeLeft);
+
+    size_t bytesRead;
+    bool eof;
+    socket_.Receive(&input_[inputLength_], input_.size()-1-inputLength_, bytesRead, eof, 0);
+    if (socket_.FatalError() || eof)
+    {
+        log_warn("error while reading frames: " << socket_.GetLastError() << ", bytesRead=" << bytesRead);
+        handler_->GenerateFaultResult(AnyRpcErrorTransportError,"Failed reading response",result);
+        return false;
+    }
+    inputLength_ += bytesRead;
+    log_info("read=" << bytesRead << ", total=" << inputLength_);
+
+    size_t headerLength = internal::Http2Frame::HeaderLength;
+    size_t position = 0;
+    internal::Http2Frame frame;
+    while (inputLength_ - position >= headerLength)
+    {
+        frame.ParseHeader(&input_[position]);
+        if (frame.length_ > internal::Http2Frame::DefaultMaxFrameSize)
+        {
+            log_warn("Frame too large=" << frame.length_);
+            handler_->GenerateFaultResult(AnyRpcErrorTransportError,"Invalid HTTP/2 frame",result);
+            return false;
+        }
+        if (inputLength_ - position - headerLength < frame.length_)
+            break;
+        if (!ProcessFrame(frame, &input_[position + headerLength]))
+        {
+            handler_->GenerateFaultResult(AnyRpcErrorTransportError,"HTTP/2 protocol error",result);
+            return false;
+        }
+        position += headerLength + frame.length_;
+    }
+    memmove(&input_[0], &input_[position], inputLength_ - position);
+    inputLength_ -= position;
+
+    // open the connection window again for the response data that was read
+    if (windowUpdate_ > 0)
+    {
+        internal::Http2Frame::WriteWindowUpdate(frames_, 0, windowUpdate_);
+        windowUpdate_ = 0;
+    }
+    return Flush();
+}
+
+bool Http2Client::ProcessFrame(internal::Http2Frame& frame, const char* payload)
+{
+    log_debug("Frame: type=" << frame.type_ << ", flags=" << frame.flags_ << ", stream=" << frame.streamId_ << ", length=" << frame.length_);
+
+    // the frames of a header block can't be interleaved with any other frames
+    if ((continuationStream_ != 0) &&
+        ((frame.type_ != internal::Http2Frame::FRAME_CONTINUATION) || (frame.streamId_ != continuationStream_)))
+        return false;
+
+    const char* data;
+    size_t dataLength;
+    StreamMap::iterator it = streams_.find(frame.streamId_);
+    switch (frame.type_)
+    {
+        case internal::Http2Frame::FRAME_DATA :
+            if ((frame.streamId_ == 0) || !frame.GetData(payload, data, dataLength))
+                return false;
+            windowUpdate_ += static_cast<uint32_t>(frame.length_);
+            // the data of a stream that was cancelled can still arrive
+            if (it == streams_.end())
+                return true;
+            if (it->second.response_.length() + dataLength > maxContentLength_)
+            {
+                log_warn("Response too large, max allowed=" << maxContentLength_);
+                internal::Http2Frame::WriteRstStream(frames_, frame.streamId_, internal::Http2Frame::ERR_CANCEL);
+                it->second.reset_ = true;
+                it->second.complete_ = true;
+                return true;
+            }
+            it->second.response_.append(data, dataLength);
+            if (frame.flags_ & internal::Http2Frame::FLAG_END_STREAM)
+                it->second.complete_ = true;
+            else if (frame.length_ > 0)
+                internal::Http2Frame::WriteWindowUpdate(frames_, frame.streamId_, static_cast<uint32_t>(frame.length_));
+            return true;
+
+        case internal::Http2Frame::FRAME_HEADERS :
+            if ((frame.streamId_ == 0) || !frame.GetData(payload, data, dataLength))
+                return false;
+            headerBlock_.assign(data, dataLength);
+            if ((frame.flags_ & internal::Http2Frame::FLAG_END_HEADERS) == 0)
+            {
+                continuationStream_ = frame.streamId_;
+                continuationEndStream_ = ((frame.flags_ & internal::Http2Frame::FLAG_END_STREAM) != 0);
+                return true;
+            }
+            return ProcessHeaderBlock(frame.streamId_, (frame.flags_ & internal::Http2Frame::FLAG_END_STREAM) != 0);
+
+        case internal::Http2Frame::FRAME_CONTINUATION :
+            if (continuationStream_ == 0)
+                return false;
+            if (headerBlock_.length() + frame.length_ > MaxHeaderBlockLength)
+            {
+                log_warn("Header block too large, max allowed=" << MaxHeaderBlockLength);
+                internal::Http2Frame::WriteGoAway(frames_, 0, internal::Http2Frame::ERR_ENHANCE_YOUR_CALM);
+                Flush();
+                return false;
+            }
+            headerBlock_.append(payload, frame.length_);
+            if ((frame.flags_ & internal::Http2Frame::FLAG_END_HEADERS) == 0)
+                return true;
+            continuationStream_ = 0;
+            return ProcessHeaderBlock(frame.streamId_, continuationEndStream_);
+
+        case internal::Http2Frame::FRAME_RST_STREAM :
+            if ((frame.streamId_ == 0) || (frame.length_ != 4))
+                return false;
+            log_info("Server reset stream " << frame.streamId_ << ", error=" << internal::Http2Frame::Get32(payload));
+            if (it != streams_.end())
+            {
+                it->second.reset_ = true;
+                it->second.complete_ = true;
+            }
+            return true;
+
+        case internal::Http2Frame::FRAME_SETTINGS :
+            return ProcessSettings(frame, payload);
+
+        case internal::Http2Frame::FRAME_PING :
+            if ((frame.streamId_ != 0) || (frame.length_ != 8))
+                return false;
+            if ((frame.flags_ & internal::Http2Frame::FLAG_ACK) == 0)
+                internal::Http2Frame::WritePing(frames_, payload, true);
+            return true;
+
+        case internal::Http2Frame::FRAME_GOAWAY :
+            if ((frame.streamId_ != 0) || (frame.length_ < 8))
+                return false;
+            {
+                // the streams after the last one that the server processes are never answered
+                uint32_t lastStreamId = internal::Http2Frame::Get32(payload) & MaxStreamId;
+                log_info("Server sent GOAWAY, last stream=" << lastStreamId << ", error=" << internal::Http2Frame::Get32(payload + 4));
+                goAway_ = true;
+                for (it = streams_.upper_bound(lastStreamId); it != streams_.end(); it++)
+                {
+                    it->second.reset_ = true;
+                    it->second.complete_ = true;
+                }
+            }
+            return true;
+
+        case internal::Http2Frame::FRAME_WINDOW_UPDATE :
+            if (frame.length_ != 4)
+                return false;
+            if (frame.streamId_ == 0)
+                sendWindow_ += internal::Http2Frame::Get32(payload) & MaxStreamId;
+            else if (it != streams_.end())
+                it->second.sendWindow_ += internal::Http2Frame::Get32(payload) & MaxStreamId;
+            return true;
+
+        case internal::Http2Frame::FRAME_PUSH_PROMISE :
+            // push was disabled by the settings
+            return false;
+
+        default :
+            // the priorities and the frames of an unknown type are ignored
+            return true;
+    }
+}
+
+bool Http2Client::ProcessSettings(internal::Http2Frame& frame, const char* payload)
+{
+    if ((frame.streamId_ != 0) || (frame.length_ % 6 != 0))
+        return false;
+    if (frame.flags_ & internal::Http2Frame::FLAG_ACK)
+        return true;
+
+    for (size_t position = 0; position < frame.length_; position += 6)
+    {
+        unsigned id = internal::Http2Frame::Get16(payload + position);
+        uint32_t value = internal::Http2Frame::Get32(payload + position + 2);
+        log_debug("Setting " << id << "=" << value);
+        if (id == internal::Http2Frame::SETTINGS_INITIAL_WINDOW_SIZE)
+        {
+            if (value > internal::Http2Frame::MaxWindowSize)
+                return false;
+            // the change applies to the streams that are already open
+            int64_t change = static_cast<int64_t>(value) - initialWindow_;
+            for (StreamMap::iterator it = streams_.begin(); it != streams_.end(); it++)
+                it->second.sendWindow_ += change;
+            initialWindow_ = value;
+        }
+        else if (id == internal::Http2Frame::SETTINGS_MAX_FRAME_SIZE)
+        {
+            if ((value < internal::Http2Frame::DefaultMaxFrameSize) || (value > internal::Http2Frame::MaxFrameSizeLimit))
+                return false;
+            maxFrameSize_ = value;
+        }
+    }
+    internal::Http2Frame::WriteHeader(frames_, 0, internal::Http2Frame::FRAME_SETTINGS, internal::Http2Frame::FLAG_ACK, 0);
+    return true;
+}
+
+bool Http2Client::ProcessHeaderBlock(uint32_t streamId, bool endStream)
+{
+    // every block is decoded to keep the dynamic table in step with the server
+    internal::HpackHeaderList headers;
+    bool decoded = decoder_.Decode(headerBlock_.data(), headerBlock_.length(), headers);
+    headerBlock_.clear();
+    if (!decoded)
+    {
+        log_warn("Invalid header block");
+        return false;
+    }
+
+    StreamMap::iterator it = streams_.find(streamId);
+    if (it == streams_.end())
+        return true;
+    for (internal::HpackHeaderList::iterator header = headers.begin(); header != headers.end(); header++)
+    {
+        // only the first block of the response has the status, the others are trailers
+        if ((header->first == ":status") && (it->second.status_ == 0))
+            it->second.status_ = atoi(header->second.c_str());
+    }
+    if (endStream)
+        it->second.complete_ = true;
+    return true;
+}
+
+bool Http2Client::Flush()
+{
+    if (frames_.Length() == 0)
+        return true;
+    segments_.clear();
+    AppendSegments(segments_, frames_, 0);
+    size_t bytesWritten;
+    bool result = socket_.SendGather(segments_, bytesWritten, GetTimeLeft());
+    frames_.Clear();
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+WebSocketClient::WebSocketClient(ClientHandler* handler, std::string protocol) :
+    Client(handler), protocol_(protocol), binary_(false), upgraded_(false)
+{
+    std::random_device device;
+    random_ = device() | 1;
+}
+
+WebSocketClient::WebSocketClient(ClientHandler* handler, std::string protocol, const char* host, int port) :
+    Client(handler, host, port), protocol_(protocol), binary_(false), upgraded_(false)
+{
+    std::random_device device;
+    random_ = device() | 1;
+}
+
+void WebSocketClient::RandomBytes(unsigned char* data, std::size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        // xorshift generator
+        random_ ^= random_ << 13;
+        random_ ^= random_ >> 17;
+        random_ ^= random_ << 5;
+        data[i] = static_cast<unsigned char>(random_);
+    }
+}
+
+bool WebSocketClient::Connect()
+{
+    log_trace();
+    if (!Client::Connect())
+        return false;
+    if (upgraded_ || Handshake())
+        return true;
+    Close();
+    return false;
+}
+
+bool WebSocketClient::Handshake()
+{
+    log_trace();
+    unsigned char nonce[16];
+    RandomBytes(nonce, sizeof(nonce));
+    WriteStringStream key;
+    internal::Base64Encode(key, nonce, sizeof(nonce));
+
+    // the request and header of the RPC call may already be generated so the handshake uses its own stream
+    WriteStringStream handshake;
+    handshake << "GET / HTTP/1.1\r\n";
+    handshake << "User-Agent: " << ANYRPC_APP_NAME << " v" << ANYRPC_VERSION_STRING << "\r\n";
+    if (IsLocal() || IsShared())
+        handshake << "Host: localhost\r\n";
+    else
+        handshake << "Host: " << host_ << ":" << port_ << "\r\n";
+    handshake << "Upgrade: websocket\r\n";
+    handshake << "Connection: Upgrade\r\n";
+    handshake << "Sec-WebSocket-Key: " << key.GetString() << "\r\n";
+    handshake << "Sec-WebSocket-Version: 13\r\n";
+    handshake << "Sec-WebSocket-Protocol: " << protocol_ << "\r\n";
+    handshake << "\r\n";
+    size_t bytesWritten;
+    if (!socket_.Send(handshake.GetString(), bytesWritten, GetTimeLeft()))
+    {
+        log_warn("error while sending handshake: " << socket_.GetLastError());
+        return false;
+    }
+
+    internal::HttpResponse httpResponse;
+    while (true)
+    {
+        size_t bytesRead;
+        bool eof;
+        socket_.Receive(buffer_+bufferLength_, MaxBufferLength-bufferLength_, bytesRead, eof, 0);
+        if (socket_.FatalError())
+        {
+            log_warn("error while reading handshake: " << socket_.GetLastError());
+            return false;
+        }
+        bufferLength_ += bytesRead;
+
+        int result = httpResponse.ProcessHeaderData(buffer_, bufferLength_, eof);
+        if (result == internal::HttpHeader::HEADER_FAULT)
+            return false;
+        if (result != internal::HttpHeader::HEADER_INCOMPLETE)
+            break;
+        unsigned timeLeft = GetTimeLeft();
+        if (timeLeft == 0)
+        {
+            log_warn("Timeout reading handshake");
+            return false;
+        }
+        socket_.WaitReadable(timeLeft);
+    }
+
+    if ((httpResponse.GetResponseCode() != "101") || (httpResponse.GetUpgrade() != "websocket") ||
+        (httpResponse.GetWebSocketAccept() != internal::WebSocketAccept(key.GetString())))
+    {
+        log_warn("WebSocket handshake failed, code = " << httpResponse.GetResponseCode() << ", string = " << httpResponse.GetResponseString());
+        return false;
+    }
+
+    // the server may already have sent frames after the handshake
+    size_t bodyStartPos = httpResponse.GetBodyStartPos();
+    bufferLength_ -= bodyStartPos;
+    memmove(buffer_, buffer_+bodyStartPos, bufferLength_);
+    log_info("WebSocket protocol: " << httpResponse.GetWebSocketProtocol());
+    upgraded_ = true;
+    return true;
+}
+
+bool WebSocketClient::GenerateHeader()
+{
+    log_trace();
+    unsigned char mask[4];
+    RandomBytes(mask, sizeof(mask));
+    unsigned opcode = binary_ ? internal::WebSocketFrame::OPCODE_BINARY : internal::WebSocketFrame::OPCODE_TEXT;
+    internal::WebSocketFrame::WriteHeader(header_, opcode, true, request_.Length(), mask);
+    log_debug("Request length=" << request_.Length());
+
+    // the request is masked in its own buffers so it isn't copied
+    size_t offset = 0;
+    while (offset < request_.Length())
+    {
+        size_t segmentLength;
+        char* segment = const_cast<char*>(request_.GetBuffer(offset, segmentLength));
+        internal::WebSocketFrame::Mask(segment, segmentLength, mask, offset);
+        offset += segmentLength;
+    }
+    return true;
+}
+
+int WebSocketClient::ProcessHeader(bool eof)
+{
+    log_trace();
+    while (true)
+    {
+        internal::WebSocketFrame frame;
+        // If we haven't gotten the entire frame header yet, return (keep reading)
+        internal::WebSocketFrame::ParseResultEnum result = frame.ParseHeader(buffer_, bufferLength_);
+        if (result == internal::WebSocketFrame::FRAME_FAULT)
+        {
+            log_warn("Invalid frame length from server");
+            return HEADER_FAULT;
+        }
+        if (result == internal::WebSocketFrame::FRAME_INCOMPLETE)
+        {
+            // EOF in the middle of a response is an error, otherwise its ok
+            if (eof)
+            {
+                log_warn("EOF while reading frame");
+                return HEADER_FAULT;
+            }
+            return HEADER_INCOMPLETE;
+        }
+        // the frames from a server are never masked
+        if (frame.masked_ || (frame.reserved_ != 0))
+        {
+            log_warn("Invalid frame from server");
+            return HEADER_FAULT;
+        }
+
+        if (frame.IsControl())
+        {
+            size_t payloadLength = static_cast<size_t>(frame.length_);
+            size_t frameLength = frame.headerLength_ + payloadLength;
+            if (!frame.fin_ || (payloadLength > internal::WebSocketFrame::MaxControlLength))
+            {
+                log_warn("Invalid control frame from server");
+                return HEADER_FAULT;
+            }
+            if (bufferLength_ < frameLength)
+            {
+                if (eof)
+                {
+                    log_warn("EOF while reading frame");
+                    return HEADER_FAULT;
+                }
+                return HEADER_INCOMPLETE;
+            }
+            if (frame.opcode_ == internal::WebSocketFrame::OPCODE_CLOSE)
+            {
+                log_warn("Server closed the WebSocket");
+                return HEADER_FAULT;
+            }
+            if (frame.opcode_ == internal::WebSocketFrame::OPCODE_PING)
+            {
+                // the pong carries the data of the ping and is masked like any other frame
+                unsigned char mask[4];
+                RandomBytes(mask, sizeof(mask));
+                char* payload = buffer_ + frame.headerLength_;
+                internal::WebSocketFrame::Mask(payload, payloadLength, mask);
+                WriteStringStream pong;
+                internal::WebSocketFrame::WriteHeader(pong, internal::WebSocketFrame::OPCODE_PONG, true, payloadLength, mask);
+                pong.Put(payload, payloadLength);
+                size_t bytesWritten;
+                if (!socket_.Send(pong.GetString(), bytesWritten, GetTimeLeft()))
+                {
+                    log_warn("error while sending pong: " << socket_.GetLastError());
+                    return HEADER_FAULT;
+                }
+            }
+            memmove(buffer_, buffer_+frameLength, bufferLength_-frameLength);
+            bufferLength_ -= frameLength;
+            continue;
+        }
+
+        if (!frame.fin_ || (frame.opcode_ == internal::WebSocketFrame::OPCODE_CONTINUATION))
+        {
+            log_warn("Fragmented response not supported");
+            return HEADER_FAULT;
+        }
+        if (frame.length_ > maxContentLength_)
+        {
+            log_warn("Frame length too large=" << frame.length_ << ", max allowed=" << maxContentLength_);
+            return HEADER_FAULT;
+        }
+        contentLength_ = static_cast<size_t>(frame.length_);
+        char* body = buffer_ + frame.headerLength_;
+        size_t bufferSpaceAvail = MaxBufferLength - frame.headerLength_;
+        contentAvail_ = bufferLength_ - frame.headerLength_;
+
+        if (contentLength_ > bufferSpaceAvail)
+        {
+            // try to malloc the buffer space needed
+            response_ = static_cast<char*>(malloc(contentLength_+1));
+            if (response_ == 0)
+            {
+                log_warn("Could not allocate space=" << contentLength_);
+                return HEADER_FAULT;
+            }
+            // copy the content that was already read to the new space
+            memcpy(response_,body,contentAvail_);
+            responseAllocated_ = true;
+        }
+        else
+        {
+            responseAllocated_ = false;
+            response_ = body;
+        }
+        response_[contentAvail_] = 0;
+        log_info("frame length is " << contentLength_);
+        return HEADER_COMPLETE;
+    }
+}
+
 } // namespace anyrpc
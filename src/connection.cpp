@@ -52,34 +52,176 @@ bool RpcContentHandler::CanProcessContentType(std::string contentType)
 
 ////////////////////////////////////////////////////////////////////////////////
 
+PipelinedRequest::PipelinedRequest(Connection* connection, const char* request, std::size_t length) :
+    connection_(connection), length_(length), queuedTime_(0), sendResponse_(false),
+    headerBytesWritten_(0), resultBytesWritten_(0),
+    nextCompleted_(0), prevListed_(0), nextListed_(0), nextWrite_(0)
+{
+    // the handlers parse the request in place so it needs its own copy
+    request_ = static_cast<char*>(malloc(length+1));
+    if (request_ == 0)
+        throw AnyRpcException(AnyRpcErrorMemoryAllocation, "Memory allocation failure for pipelined request");
+    memcpy(request_, request, length);
+    request_[length] = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void DeferredResponse::Respond(Value& result)
+{
+    result_.Assign(result);
+    Release();
+}
+
+void DeferredResponse::Fault(int errorCode, std::string const& errorMsg)
+{
+    errorCode_ = errorCode;
+    errorMsg_ = errorMsg;
+    fault_ = true;
+    Release();
+}
+
+void DeferredResponse::Release()
+{
+    // the second of the method responding and the handler returning passes the response
+    if (handoff_.fetch_add(1) == 0)
+        return;
+
+    // the server thread can delete the response as soon as it is passed,
+    // so hold the gate until the call is finished with it
+    std::shared_ptr<ResponseGate> gate(gate_);
+    if (!gate->Complete(this))
+        delete this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ResponseGate::Open()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!signal_.Create())
+        return false;
+    open_ = true;
+    return true;
+}
+
+void ResponseGate::Close()
+{
+    DeferredResponse* response;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_ = false;
+        response = completed_.PopAll();
+        signal_.Close();
+    }
+    while (response != 0)
+    {
+        DeferredResponse* next = response->GetNextCompleted();
+        delete response;
+        response = next;
+    }
+}
+
+bool ResponseGate::Complete(DeferredResponse* response)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!open_)
+        return false;
+    if (completed_.Push(response))
+        signal_.Signal();
+    return true;
+}
+
+DeferredResponse* ResponseGate::TakeCompleted()
+{
+    // Consume the signal before taking the responses so a later push will signal again
+    signal_.Drain();
+    return completed_.PopAll();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+class Connection::Deferral : public CallDeferral
+{
+public:
+    Deferral(Connection* connection, PipelinedRequest* request=0) :
+        connection_(connection), request_(request), response_(0) {}
+    //! The RPC handler has returned so the response can be passed to the server thread
+    ~Deferral() { if (response_ != 0) response_->Release(); }
+
+    //! A pipelined response is ordered with the others so it is only sent when complete
+    virtual bool SendPart() { return (request_ != 0) || connection_->SendPart(); }
+    virtual bool DiscardPart() { return connection_->DiscardPart((request_ != 0) ? request_->response_ : connection_->response_); }
+
+protected:
+    virtual MethodResponder* CreateResponder(RpcResponseEncoder* encoder, Value& id)
+    {
+        if (!connection_->responseGate_)
+            return 0;
+        // a pipelined request is already counted until it is returned
+        if (request_ == 0)
+            connection_->outstanding_.fetch_add(1);
+        response_ = new DeferredResponse(connection_->responseGate_, connection_, request_, encoder, id);
+        return response_;
+    }
+
+private:
+    Connection* connection_;        //!< Connection that is executing the request
+    PipelinedRequest* request_;     //!< Pipelined request being executed, null for the connection's request
+    DeferredResponse* response_;    //!< Responder that was created for the call, null if none
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 Connection::Connection(SOCKET fd, MethodManager* manager) :
     manager_(manager)
+{
+    timer_.data_ = this;
+    ResetState();
+
+    // TcpSocket::Accept has already made the socket non-blocking with no delay
+    socket_.SetFileDescriptor(fd);
+}
+
+void Connection::ResetState()
 {
     connectionState_ = READ_HEADER;
-    lastTransactionTime_ = time(NULL);
+    Touch();
     active_ = true;
+    nextCompleted_ = 0;
+    prevListed_ = 0;
+    nextListed_ = 0;
+    listedBusy_ = false;
+    pollEvents_ = 0;
+    timer_.prev_ = 0;
+    timer_.next_ = 0;
+    timerType_ = TIMEOUT_NONE;
+    timerRequest_ = 0;
+    idleTimeout_ = 0;
+    maxRequests_ = 0;
+    requestCount_ = 0;
+    queuedTime_ = 0;
+    zeroCopyThreshold_ = 0;
+    outstanding_ = 0;
+    completionScheduled_ = false;
+    writeHead_ = 0;
+    writeTail_ = 0;
+    parkedResponse_ = 0;
     bufferLength_ = 0;
     contentLength_ = 0;
     request_ = 0;
     requestAllocated_ = false;
+    requestCapacity_ = 0;
+    maxContentLength_ = DefaultMaxContentLength;
     keepAlive_ = false;
     contentAvail_ = 0;
     headerBytesWritten_ = 0;
     resultBytesWritten_ = 0;
 #if defined(ANYRPC_THREADING)
     threadRunning_ = false;
+    threadCallback_ = 0;
+    threadOwner_ = 0;
 #endif
-
-    socket_.SetFileDescriptor(fd);
-
-    int result;
-    result = socket_.SetNonBlocking();
-    if (result != 0)
-        log_warn("Could not set socket to non-blocking input mode: " << result);
-
-    result = socket_.SetTcpNoDelay();
-    if (result != 0)
-        log_warn("Could not set socket to no delay: " << result);
 }
 
 Connection::~Connection()
@@ -87,6 +229,12 @@ Connection::~Connection()
     log_debug("Connection destructor, fd=" << socket_.GetFileDescriptor());
     if (requestAllocated_)
         free(request_);
+    delete parkedResponse_;
+
+    // the worker threads have stopped so all of the pipelined requests are in the list
+    completedRequests_.PopAll();
+    while (!requests_.Empty())
+        DeleteRequest(requests_.Front());
 }
 
 void Connection::Initialize(bool preserveBufferData)
@@ -116,6 +264,11 @@ void Connection::Initialize(bool preserveBufferData)
         else
             log_info("Initialize: Keep previous data: " << bufferLength_ << " bytes");
     }
+    else if (preserveBufferData)
+    {
+        // the data for an allocated request was moved out of the buffer so only the data after it is left
+        log_info("Initialize: Keep data after the request: " << bufferLength_ << " bytes");
+    }
     else
     {
         log_info("Initialize: Reset buffer");
@@ -129,6 +282,7 @@ void Connection::Initialize(bool preserveBufferData)
         requestAllocated_ = false;
     }
     request_ = 0;
+    requestCapacity_ = 0;
     header_.Clear();
     response_.Clear();
     contentAvail_ = 0;
@@ -136,9 +290,35 @@ void Connection::Initialize(bool preserveBufferData)
     resultBytesWritten_ = 0;
 }
 
+void Connection::Recycle()
+{
+    log_debug("Recycle connection, fd=" << socket_.GetFileDescriptor());
+    socket_.Close();
+
+    // the connection is no longer used by any thread so all of the pipelined requests are in the list
+    completedRequests_.PopAll();
+    while (!requests_.Empty())
+        DeleteRequest(requests_.Front());
+    delete parkedResponse_;
+    responseGate_.reset();
+
+    // release an allocated request before the state forgets about it
+    Initialize();
+    ResetState();
+}
+
+void Connection::Reuse(SOCKET fd)
+{
+    // TcpSocket::Accept has already made the socket non-blocking with no delay
+    socket_.SetFileDescriptor(fd);
+    Touch();
+}
+
 #if defined(ANYRPC_THREADING)
-void Connection::StartThread()
+void Connection::StartThread(ThreadCallback* callback, void* owner)
 {
+    threadCallback_ = callback;
+    threadOwner_ = owner;
     threadRunning_ = true;
     thread_ = std::thread(&Connection::ThreadStarter,this);
 }
@@ -147,6 +327,8 @@ void Connection::StopThread(bool waitForJoin)
 {
     log_trace();
     threadRunning_ = false;
+    // wake the thread from select since it waits without a timeout
+    socket_.Shutdown();
     if (waitForJoin && thread_.joinable())
         thread_.join();
 }
@@ -156,17 +338,21 @@ void Connection::ThreadStarter()
     log_trace();
     while (threadRunning_ && !CheckClose())
     {
-        Work(100);
+        Work(-1);
     }
     log_debug("Connection thread exiting, fd=" << socket_.GetFileDescriptor());
-    // force the close to close since the thread may not be deleted right away
-    socket_.Close();
+    // let the client know the connection is closed since the thread may not be deleted right away.
+    // The descriptor is kept until the connection is deleted so StopThread can't shutdown a reused one.
+    socket_.Shutdown();
     threadRunning_ = false;
+    // the owner can join and delete the connection after this
+    if (threadCallback_ != 0)
+        threadCallback_(threadOwner_, this, true);
 }
 
 void Connection::Work(int ms)
 {
-    int timeLeft;
+    int timeLeft = ms;
     struct timeval startTime;
     struct timeval currentTime;
     gettimeofday( &startTime, 0 );
@@ -207,18 +393,30 @@ void Connection::Work(int ms)
         // Process server events
         SOCKET fd = GetFileDescriptor();
         if ((FD_ISSET(fd, &inFd )) || (FD_ISSET(fd, &outFd)))
+        {
             Process();
+            if (threadCallback_ != 0)
+                threadCallback_(threadOwner_, this, false);
+        }
 
-        gettimeofday( &currentTime, 0 );
-        timeLeft = ms - MilliTimeDiff(currentTime,startTime);
+        if (ms >= 0)
+        {
+            gettimeofday( &currentTime, 0 );
+            timeLeft = ms - MilliTimeDiff(currentTime,startTime);
+        }
 
-    } while (!CheckClose() && ((ms < 0) || (timeLeft > 0)));
+    } while (threadRunning_ && !CheckClose() && ((ms < 0) || (timeLeft > 0)));
 }
 #endif // defined(ANYRPC_THREADING)
 
 void Connection::Process(bool executeAfterRead)
 {
     log_info("Process: fd=" << socket_.GetFileDescriptor());
+#if defined(ANYRPC_ZEROCOPY)
+    // the completions are reported as an error event that repeats until they are read
+    if (socket_.IsZeroCopyPending())
+        socket_.ReapZeroCopy();
+#endif // defined(ANYRPC_ZEROCOPY)
     bool newMessage = true;
     while (newMessage)
     {
@@ -259,14 +457,230 @@ void Connection::Process(bool executeAfterRead)
     }
 }
 
+void Connection::ProcessRequest()
+{
+    log_info("ProcessRequest: fd=" << socket_.GetFileDescriptor());
+    if ((connectionState_ == EXECUTE_REQUEST) && !ExecuteRequest())
+    {
+        connectionState_ = CLOSE_CONNECTION;
+        return;
+    }
+    // the rest of a long response is written by the server thread
+    if ((connectionState_ == WRITE_RESPONSE) && !WriteResponse())
+        connectionState_ = CLOSE_CONNECTION;
+}
+
+Connection::TimeoutType Connection::GetTimeoutType()
+{
+    // no timeout while another thread owns the connection or its requests
+    if (!IsActive() || HasOutstandingRequests() || (writeHead_ != 0))
+        return TIMEOUT_NONE;
+    switch (connectionState_)
+    {
+        case READ_HEADER    : return ForcedDisconnectAllowed() ? TIMEOUT_IDLE : TIMEOUT_HEADER;
+        case READ_REQUEST   : return TIMEOUT_BODY;
+        default             : return TIMEOUT_NONE;
+    }
+}
+
+PipelinedRequest* Connection::TakeRequest()
+{
+    log_debug("Take request, fd=" << socket_.GetFileDescriptor() << ", length=" << contentLength_);
+    PipelinedRequest* request = new PipelinedRequest(this, request_, contentLength_);
+    requests_.PushBack(request);
+    outstanding_.fetch_add(1);
+
+    // keep any of the following requests that have already been read
+    connectionState_ = READ_HEADER;
+    Initialize(true);
+    return request;
+}
+
+bool Connection::CompletePipelined(PipelinedRequest* request)
+{
+    // the connection can be deleted once the count reaches zero unless it is scheduled,
+    // so the count is decremented after the last access to the connection
+    bool schedule = completedRequests_.Push(request) && !completionScheduled_.exchange(true);
+    outstanding_.fetch_sub(1);
+    return schedule;
+}
+
+bool Connection::CompleteDeferred(DeferredResponse* response)
+{
+    PipelinedRequest* request = response->GetRequest();
+    if (request != 0)
+    {
+        // return the request the same way as a worker thread
+        response->Encode(request->response_);
+        FrameResponse(request, true);
+        delete response;
+        return CompletePipelined(request);
+    }
+
+    // the response is dropped if the connection has closed while waiting
+    if (connectionState_ == WAIT_RESPONSE)
+    {
+        log_debug("Resume deferred response, fd=" << socket_.GetFileDescriptor());
+        response->Encode(response_);
+        if (!ResumeRequest())
+            connectionState_ = CLOSE_CONNECTION;
+    }
+    delete response;
+    outstanding_.fetch_sub(1);
+    return false;
+}
+
+bool Connection::WritePipelined()
+{
+    // add the returned requests to the write queue in the order that they completed
+    PipelinedRequest* request = completedRequests_.PopAll();
+    while (request != 0)
+    {
+        PipelinedRequest* next = request->GetNextCompleted();
+        request->SetNextCompleted(0);
+        QueueResponse(request);
+        request = next;
+    }
+    if (CheckClose())
+        return false;
+#if defined(ANYRPC_ZEROCOPY)
+    if (socket_.IsZeroCopyPending())
+        socket_.ReapZeroCopy();
+#endif // defined(ANYRPC_ZEROCOPY)
+
+    // send all of the queued responses together
+    segments_.clear();
+    for (request = writeHead_; request != 0; request = request->nextWrite_)
+    {
+        AppendSegments(segments_, request->header_, request->headerBytesWritten_);
+        AppendResponse(request->response_, request->resultBytesWritten_);
+    }
+    size_t bytesWritten;
+    if (!socket_.SendGather(segments_, bytesWritten) && socket_.FatalError())
+    {
+        log_warn("pipelined write error " << socket_.GetLastError());
+        return false;
+    }
+    if (bytesWritten > 0)
+        Touch();
+
+    while (writeHead_ != 0)
+    {
+        request = writeHead_;
+        if (!AdvanceStream(request->header_, request->headerBytesWritten_, bytesWritten) ||
+            !AdvanceStream(request->response_, request->resultBytesWritten_, bytesWritten))
+            // not all of the data was written, need to wait until writable again
+            return true;
+        writeHead_ = request->nextWrite_;
+        if (writeHead_ == 0)
+            writeTail_ = 0;
+        FinishResponse(request->response_);
+        DeleteRequest(request);
+    }
+
+    // close after the response to the last request allowed
+    return !RequestLimitReached() || HasOutstandingRequests();
+}
+
+void Connection::QueueResponse(PipelinedRequest* request)
+{
+    // the responses are discarded if the connection is closing
+    if (!request->sendResponse_ || CheckClose())
+    {
+        DeleteRequest(request);
+        return;
+    }
+    request->nextWrite_ = 0;
+    if (writeTail_ != 0)
+        writeTail_->nextWrite_ = request;
+    else
+        writeHead_ = request;
+    writeTail_ = request;
+}
+
+void Connection::DeleteRequest(PipelinedRequest* request)
+{
+    requests_.Remove(request);
+    delete request;
+}
+
+bool Connection::AdvanceStream(WriteSegmentedStream& stream, std::size_t& streamBytesWritten, std::size_t& bytesWritten)
+{
+    size_t streamBytes = std::min(bytesWritten, stream.Length() - streamBytesWritten);
+    streamBytesWritten += streamBytes;
+    bytesWritten -= streamBytes;
+    return streamBytesWritten >= stream.Length();
+}
+
+void Connection::AppendResponse(WriteSegmentedStream& response, std::size_t offset)
+{
+    size_t first = segments_.size();
+    AppendSegments(segments_, response, offset);
+    // the last response before the connection closes is copied so the buffers aren't needed after the close
+    if (!keepAlive_ || !UseZeroCopy(response))
+        return;
+    // the first buffer is part of the stream object and is reused so it is always copied
+    for (size_t i = first; i < segments_.size(); i++)
+    {
+        segments_[i].zeroCopy_ = (offset >= response.GetStaticLength());
+        offset += segments_[i].length_;
+    }
+}
+
+void Connection::FinishResponse(WriteSegmentedStream& response)
+{
+#if defined(ANYRPC_ZEROCOPY)
+    if (UseZeroCopy(response))
+    {
+        std::vector<void*> buffers;
+        response.DetachBuffers(buffers);
+        socket_.HoldZeroCopy(buffers);
+    }
+#endif // defined(ANYRPC_ZEROCOPY)
+}
+
+bool Connection::AttachPoller(internal::Poller* poller)
+{
+    return poller->Attach(socket_, false);
+}
+
+#if defined(ANYRPC_ZEROCOPY)
+void Connection::SetZeroCopyThreshold(std::size_t threshold)
+{
+    // Unix domain sockets don't support zero copy so their responses are always copied
+    zeroCopyThreshold_ = ((threshold > 0) && (socket_.SetZeroCopy() == 0)) ? threshold : 0;
+}
+#endif // defined(ANYRPC_ZEROCOPY)
+
 bool Connection::ReadRequest()
+{
+    if (!ReceiveRequest())
+        return false;
+    // If we haven't gotten the entire request yet, keep reading
+    if (contentAvail_ >= contentLength_)
+        CompleteRequest();
+    return true;    // Continue monitoring this source
+}
+
+bool Connection::ReceiveRequest()
 {
     // If we don't have the entire request yet, read available data
     if (contentAvail_ < contentLength_)
     {
+        size_t readEnd = contentLength_;
+        if (requestAllocated_)
+        {
+            if (!ReserveRequest(contentAvail_+1, contentLength_))
+            {
+                log_warn("Could not allocate space=" << contentLength_);
+                Initialize();
+                return false;
+            }
+            readEnd = std::min(contentLength_, requestCapacity_);
+        }
         size_t bytesRead;
         bool eof;
-        if (!socket_.Receive(request_+contentAvail_, contentLength_-contentAvail_, bytesRead, eof))
+        if (!socket_.Receive(request_+contentAvail_, readEnd-contentAvail_, bytesRead, eof))
         {
             log_warn("read error " << socket_.GetLastError());
             Initialize();
@@ -274,6 +688,8 @@ bool Connection::ReadRequest()
         }
 
         contentAvail_ += bytesRead;
+        if (bytesRead > 0)
+            Touch();
 
         // If we haven't gotten the entire request yet, return (keep reading)
         if (contentAvail_ < contentLength_)
@@ -288,59 +704,69 @@ bool Connection::ReadRequest()
             return true;  // Keep reading
         }
     }
+    return true;
+}
 
+void Connection::CompleteRequest()
+{
     // null terminate the request in case it is written to a log file
     request_[contentAvail_] = 0;
 
     // Otherwise, parse and dispatch the request
     log_info("read " << contentAvail_);
 
+    // close the connection after responding to the last request allowed
+    requestCount_++;
+    if ((maxRequests_ > 0) && (requestCount_ >= maxRequests_))
+        keepAlive_ = false;
+
     connectionState_ = EXECUTE_REQUEST;
+}
 
-    return true;    // Continue monitoring this source
+bool Connection::ReserveRequest(std::size_t length, std::size_t limit)
+{
+    if (requestAllocated_ && (length <= requestCapacity_))
+        return true;
+
+    size_t initialCapacity = InitialRequestCapacity;
+    size_t capacity = std::max(length, std::min(limit, std::max(2*requestCapacity_, initialCapacity)));
+    char* request = static_cast<char*>(requestAllocated_ ? realloc(request_, capacity+1) : malloc(capacity+1));
+    if (request == 0)
+        return false;
+    // the data in buffer_ is copied to the new space
+    if (!requestAllocated_ && (contentAvail_ > 0))
+        memcpy(request, request_, contentAvail_);
+    log_debug("Reserve request: capacity=" << capacity);
+    request_ = request;
+    requestCapacity_ = capacity;
+    requestAllocated_ = true;
+    return true;
 }
 
 bool Connection::WriteResponse()
 {
     // Try to write the response
     log_info("WriteResponse");
-    lastTransactionTime_ = time(NULL);
+    Touch();
 
+    // send the rest of the header and the result/body together
+    segments_.clear();
+    AppendSegments(segments_, header_, headerBytesWritten_);
+    AppendResponse(response_, resultBytesWritten_);
     size_t bytesWritten;
-    size_t bytesToSend;
-
-    while (headerBytesWritten_ < header_.Length())
+    if (!socket_.SendGather(segments_, bytesWritten) && socket_.FatalError())
     {
-        const char* buffer = header_.GetBuffer(resultBytesWritten_,bytesToSend);
-        if (!socket_.Send(buffer, bytesToSend, bytesWritten))
-        {
-            log_fatal("header write error " << socket_.GetLastError());
-            Initialize();
-            return false;
-        }
-        headerBytesWritten_ += bytesWritten;
-
-        if (bytesToSend < bytesWritten)
-            // not all of the data was written, need to wait until writable again
-            return true;
+        log_fatal("write error " << socket_.GetLastError());
+        Initialize();
+        return false;
     }
 
-    // write more of the result/body
-    while (resultBytesWritten_ < response_.Length())
-    {
-        const char* buffer = response_.GetBuffer(resultBytesWritten_,bytesToSend);
-        if (!socket_.Send(buffer, bytesToSend, bytesWritten))
-        {
-            log_fatal("result write error " << socket_.GetLastError());
-            Initialize();
-            return false;
-        }
-        resultBytesWritten_ += bytesWritten;
+    if (!AdvanceStream(header_, headerBytesWritten_, bytesWritten) ||
+        !AdvanceStream(response_, resultBytesWritten_, bytesWritten))
+        // not all of the data was written, need to wait until writable again
+        return true;
 
-        if (bytesToSend < bytesWritten)
-            // not all of the data was written, need to wait until writable again
-            return true;
-    }
+    FinishResponse(response_);
     connectionState_ = READ_HEADER;
     Initialize(keepAlive_);
 
@@ -353,6 +779,7 @@ void HttpConnection::Initialize(bool preserveBufferData)
 {
     Connection::Initialize(preserveBufferData);
     httpRequestState_.Initialize();
+    partSent_ = false;
 }
 
 bool HttpConnection::ReadHeader()
@@ -370,6 +797,8 @@ bool HttpConnection::ReadHeader()
         return false;
     }
     bufferLength_ += bytesRead;
+    if (bytesRead > 0)
+        Touch();
 
     log_info("read=" << bytesRead << ", total=" << bufferLength_);
     switch (httpRequestState_.ProcessHeaderData(buffer_, bufferLength_, eof))
@@ -381,34 +810,46 @@ bool HttpConnection::ReadHeader()
     size_t bodyStartPos = httpRequestState_.GetBodyStartPos();
     size_t bufferSpaceAvail = MaxBufferLength - bodyStartPos;
 
-    contentLength_ = httpRequestState_.GetContentLength();
+    // a request without a body, like OPTIONS, doesn't need a content length
+    contentLength_ = std::max(0, httpRequestState_.GetContentLength());
     contentAvail_ = bufferLength_ - bodyStartPos;
     keepAlive_ = httpRequestState_.GetKeepAlive();
 
-    if (contentLength_ > MaxContentLength)
+    if (httpRequestState_.GetChunked())
+    {
+        // the body is decoded from the start of the buffer as it arrives
+        memmove(buffer_, buffer_+bodyStartPos, contentAvail_);
+        bufferLength_ = contentAvail_;
+        contentAvail_ = 0;
+        chunkedDecoder_.Initialize();
+        if (!ReserveRequest(0, maxContentLength_))
+        {
+            log_warn("Could not allocate space for a chunked request");
+            Initialize();
+            return false;
+        }
+        log_info("chunked request");
+        connectionState_ = READ_REQUEST;
+        return true;
+    }
+    if (contentLength_ > maxContentLength_)
     {
-        log_warn("Content-length too large=" << contentLength_ << ", max allowed=" << MaxContentLength);
+        log_warn("Content-length too large=" << contentLength_ << ", max allowed=" << maxContentLength_);
         Initialize();
         return false;
     }
+    request_ = buffer_ + bodyStartPos;
+    requestAllocated_ = false;
     if (contentLength_ > bufferSpaceAvail)
     {
-        // try to malloc the buffer space needed
-        request_ = static_cast<char*>(calloc(contentLength_+1,1));
-        if (request_ == 0)
+        // move the content that was already read to allocated space that grows as the rest arrives
+        if (!ReserveRequest(contentAvail_, contentLength_))
         {
             log_warn("Could not allocate space=" << contentLength_);
             Initialize();
             return false;
         }
-        // copy the content that was already read to the new space
-        memcpy(request_,buffer_+bodyStartPos,contentAvail_);
-        requestAllocated_ = true;
-    }
-    else
-    {
-        requestAllocated_ = false;
-        request_ = buffer_ + bodyStartPos;
+        bufferLength_ = 0;
     }
     log_info("specified content length is " << contentLength_);
     log_info("KeepAlive: " << keepAlive_);
@@ -417,6 +858,86 @@ bool HttpConnection::ReadHeader()
     return true;    // Continue monitoring this source
 }
 
+bool HttpConnection::ReadRequest()
+{
+    if (httpRequestState_.GetChunked())
+        return ReadChunkedRequest();
+    return Connection::ReadRequest();
+}
+
+bool HttpConnection::ReadChunkedRequest()
+{
+    while (true)
+    {
+        // decode the data that has arrived into the request
+        size_t position = 0;
+        internal::HttpChunkedDecoder::ResultEnum result = internal::HttpChunkedDecoder::CHUNKED_INCOMPLETE;
+        while ((position < bufferLength_) && (result == internal::HttpChunkedDecoder::CHUNKED_INCOMPLETE))
+        {
+            size_t consumed;
+            const char* data;
+            size_t dataLength;
+            result = chunkedDecoder_.Process(buffer_+position, bufferLength_-position, consumed, data, dataLength);
+            position += consumed;
+            if (dataLength == 0)
+                continue;
+            if (contentAvail_ + dataLength > maxContentLength_)
+            {
+                log_warn("Chunked request too large, max allowed=" << maxContentLength_);
+                Initialize();
+                return false;
+            }
+            if (!ReserveRequest(contentAvail_ + dataLength, maxContentLength_))
+            {
+                log_warn("Could not allocate space=" << contentAvail_ + dataLength);
+                Initialize();
+                return false;
+            }
+            memcpy(request_+contentAvail_, data, dataLength);
+            contentAvail_ += dataLength;
+        }
+
+        // the data after the body is kept for the next request
+        memmove(buffer_, buffer_+position, bufferLength_-position);
+        bufferLength_ -= position;
+        if (result == internal::HttpChunkedDecoder::CHUNKED_FAULT)
+        {
+            Initialize();
+            return false;
+        }
+        if (result == internal::HttpChunkedDecoder::CHUNKED_COMPLETE)
+        {
+            log_info("chunked request length is " << contentAvail_);
+            contentLength_ = contentAvail_;
+            CompleteRequest();
+            return true;
+        }
+
+        size_t bytesRead;
+        bool eof;
+        if (!socket_.Receive(buffer_+bufferLength_, MaxBufferLength-bufferLength_, bytesRead, eof))
+        {
+            log_warn("read error " << socket_.GetLastError());
+            Initialize();
+            return false;
+        }
+        bufferLength_ += bytesRead;
+        if (bytesRead > 0)
+            Touch();
+        else
+        {
+            // EOF in the middle of a request is an error, otherwise keep reading when more data arrives
+            if (eof)
+            {
+                log_warn("EOF while reading chunked body");
+                Initialize();
+                return false;
+            }
+            return true;
+        }
+    }
+}
+
 bool HttpConnection::ExecuteRequest()
 {
     log_debug("ContentLength=" << contentLength_ << ", request=" << request_);
@@ -426,10 +947,7 @@ bool HttpConnection::ExecuteRequest()
     if (httpRequestState_.GetMethod() == "POST")
     {
         // find a handler that will work
-        RpcHandlerList::iterator it = handlers_.begin();
-        for (;it!= handlers_.end(); it++)
-            if ((*it).CanProcessContentType(requestContentType))
-                break;
+        RpcHandlerList::iterator it = FindHandler();
         if (it == handlers_.end())
         {
             log_warn("Content type not supported by server, " << requestContentType);
@@ -438,20 +956,38 @@ bool HttpConnection::ExecuteRequest()
         }
         else
         {
-            (*it).HandleRequest(manager_, request_, contentLength_, response_);
-
-            log_debug("Response length=" << response_.Length());
-
-            std::string& responseContentType = (*it).GetResponseContentType();
-            if (responseContentType.length() == 0)
-                responseContentType = requestContentType;
-            GeneratePOSTResponseHeader(response_.Length(), responseContentType);
+            Deferral deferral(this);
+            bool respond = (*it).HandleRequest(manager_, request_, contentLength_, response_);
+            if (deferral.IsDeferred())
+            {
+                // the request is kept until the method responds
+                connectionState_ = WAIT_RESPONSE;
+                return true;
+            }
+            if (partSent_)
+            {
+                if (!respond)
+                {
+                    // the method failed after part of its result was sent, so the response can't be finished
+                    log_warn("Streamed response failed");
+                    Initialize();
+                    return false;
+                }
+                // the rest of the response is the last chunk, followed by the empty chunk that ends the body
+                FrameChunk("\r\n0\r\n\r\n");
+            }
+            else
+                FinishPOSTResponse(*it);
         }
     }
     else if (httpRequestState_.GetMethod() == "OPTIONS")
     {
         GenerateOPTIONSResponseHeader();
     }
+    else if ((httpRequestState_.GetMethod() == "GET") && Upgrade())
+    {
+        log_info("Upgrade to " << httpRequestState_.GetUpgrade());
+    }
     else
     {
         GenerateErrorResponseHeader(501, "Not Implemented");
@@ -461,7 +997,107 @@ bool HttpConnection::ExecuteRequest()
     return true;
 }
 
-void HttpConnection::GeneratePOSTResponseHeader(std::size_t bodySize, std::string& contentType)
+bool HttpConnection::ResumeRequest()
+{
+    // the handler was found before the call was deferred
+    FinishPOSTResponse(*FindHandler());
+    connectionState_ = WRITE_RESPONSE;
+    return true;
+}
+
+void HttpConnection::FinishPOSTResponse(RpcContentHandler& handler)
+{
+    log_debug("Response length=" << response_.Length());
+
+    GeneratePOSTResponseHeader(response_.Length(), GetResponseContentType(handler));
+}
+
+std::string& HttpConnection::GetResponseContentType(RpcContentHandler& handler)
+{
+    std::string& responseContentType = handler.GetResponseContentType();
+    if (responseContentType.length() == 0)
+        responseContentType = httpRequestState_.GetContentType();
+    return responseContentType;
+}
+
+bool HttpConnection::SendPart()
+{
+    size_t partLength = PartLength;
+    if (response_.Length() < partLength)
+        return true;
+
+    // the header goes out with the first chunk
+    if (!partSent_)
+        GeneratePOSTResponseHeader(0, GetResponseContentType(*FindHandler()), true);
+    FrameChunk("\r\n");
+    log_debug("SendPart: length=" << response_.Length());
+
+    // the method may be running on the server thread so this only sends what the socket takes now
+    segments_.clear();
+    AppendSegments(segments_, header_, headerBytesWritten_);
+    AppendSegments(segments_, response_, 0);
+    size_t bytesWritten;
+    partSent_ = true;
+    if (!socket_.SendGather(segments_, bytesWritten, 0) && socket_.FatalError())
+    {
+        log_warn("SendPart: write error " << socket_.GetLastError());
+        return false;
+    }
+    if (bytesWritten > 0)
+        Touch();
+    if (AdvanceStream(header_, headerBytesWritten_, bytesWritten))
+    {
+        header_.Clear();
+        headerBytesWritten_ = 0;
+    }
+
+    // the rest is queued in front of the next chunk and WriteResponse sends it after the method returns
+    while (bytesWritten < response_.Length())
+    {
+        size_t segmentLength;
+        const char* buffer = response_.GetBuffer(bytesWritten, segmentLength);
+        if ((buffer == 0) || (segmentLength == 0))
+            break;
+        header_.Put(buffer, segmentLength);
+        bytesWritten += segmentLength;
+    }
+    response_.Clear();
+    return true;
+}
+
+void HttpConnection::FrameChunk(const char* following)
+{
+    if (response_.Length() > 0)
+    {
+        char size[32];
+        int sizeLength = snprintf(size, sizeof(size), "%zx\r\n", response_.Length());
+        header_.Put(size, sizeLength);
+        response_.Put(following);
+    }
+    else
+        // only the end of the body is left
+        response_.Put(following + 2);
+}
+
+RpcHandlerList::iterator HttpConnection::FindHandler()
+{
+    std::string& requestContentType = httpRequestState_.GetContentType();
+    RpcHandlerList::iterator it = handlers_.begin();
+    for (;it!= handlers_.end(); it++)
+        if ((*it).CanProcessContentType(requestContentType))
+            break;
+    return it;
+}
+
+bool HttpConnection::GetMethodName(std::string& methodName)
+{
+    if ((request_ == 0) || (httpRequestState_.GetMethod() != "POST"))
+        return false;
+    RpcHandlerList::iterator it = FindHandler();
+    return (it != handlers_.end()) && (*it).GetMethodName(request_, contentLength_, methodName);
+}
+
+void HttpConnection::GeneratePOSTResponseHeader(std::size_t bodySize, std::string& contentType, bool chunked)
 {
     header_ << "HTTP/1.1 200 OK\r\n";
     header_ << "Server: " << ANYRPC_APP_NAME << " v" << ANYRPC_VERSION_STRING << "\r\n";
@@ -470,7 +1106,10 @@ void HttpConnection::GeneratePOSTResponseHeader(std::size_t bodySize, std::strin
     else
         header_ << "Connection: close\r\n";
     header_ << "Content-Type: " << contentType << "\r\n";
-    header_ << "Content-length: " << bodySize << "\r\n";
+    if (chunked)
+        header_ << "Transfer-Encoding: chunked\r\n";
+    else
+        header_ << "Content-length: " << bodySize << "\r\n";
     header_ << "\r\n";
 }
 
@@ -482,8 +1121,19 @@ void HttpConnection::GenerateOPTIONSResponseHeader()
     header_ << "Access-Control-Max-Age: 1728000\r\n"; // 20 days max age
     header_ << "Access-Control-Allow-Headers: Content-Type\r\n";
     header_ << "Vary: Accept-Encoding, Origin\r\n";
-    header_ << "Keep-Alive: timeout=2, max=100\r\n";
-    header_ << "Connection: keep-alive\r\n";
+    if (keepAlive_)
+    {
+        // advertise the limits that the server enforces
+        if ((idleTimeout_ > 0) && (maxRequests_ > 0))
+            header_ << "Keep-Alive: timeout=" << (idleTimeout_ + 999) / 1000 << ", max=" << maxRequests_ - requestCount_ << "\r\n";
+        else if (idleTimeout_ > 0)
+            header_ << "Keep-Alive: timeout=" << (idleTimeout_ + 999) / 1000 << "\r\n";
+        else if (maxRequests_ > 0)
+            header_ << "Keep-Alive: max=" << maxRequests_ - requestCount_ << "\r\n";
+        header_ << "Connection: keep-alive\r\n";
+    }
+    else
+        header_ << "Connection: close\r\n";
     header_ << "\r\n";
 }
 
@@ -494,6 +1144,351 @@ void HttpConnection::GenerateErrorResponseHeader(int code, std::string message)
     header_ << "\r\n";
 }
 
+bool HttpConnection::RejectRequest()
+{
+    // the connection is kept so the client can retry without connecting again
+    log_debug("Reject request, fd=" << socket_.GetFileDescriptor());
+    GenerateBusyResponseHeader();
+    connectionState_ = WRITE_RESPONSE;
+    return true;
+}
+
+void HttpConnection::GenerateBusyResponseHeader()
+{
+    header_ << "HTTP/1.1 503 Service Unavailable\r\n";
+    header_ << "Server: " << ANYRPC_APP_NAME << " v" << ANYRPC_VERSION_STRING << "\r\n";
+    header_ << "Retry-After: 1\r\n";
+    if (keepAlive_)
+        header_ << "Connection: keep-alive\r\n";
+    else
+        header_ << "Connection: close\r\n";
+    header_ << "Content-length: 0\r\n";
+    header_ << "\r\n";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void WebSocketConnection::Recycle()
+{
+    HttpConnection::Recycle();
+    upgraded_ = false;
+    handler_ = 0;
+    opcode_ = 0;
+    fragmented_ = false;
+    message_.clear();
+}
+
+bool WebSocketConnection::Upgrade()
+{
+    if ((httpRequestState_.GetUpgrade() != "websocket") || !httpRequestState_.GetConnectionUpgrade() ||
+        httpRequestState_.GetWebSocketKey().empty())
+        return false;
+    if (httpRequestState_.GetWebSocketVersion() != "13")
+    {
+        // tell the client the version that is supported
+        header_ << "HTTP/1.1 426 Upgrade Required\r\n";
+        header_ << "Sec-WebSocket-Version: 13\r\n";
+        header_ << "Connection: close\r\n";
+        header_ << "\r\n";
+        keepAlive_ = false;
+        return true;
+    }
+
+    // use the first subprotocol that a handler can process
+    std::string protocol;
+    RpcHandlerList::iterator it = handlers_.end();
+    std::string& protocols = httpRequestState_.GetWebSocketProtocol();
+    size_t start = 0;
+    while ((it == handlers_.end()) && (start < protocols.length()))
+    {
+        size_t end = protocols.find(',', start);
+        if (end == std::string::npos)
+            end = protocols.length();
+        protocol = protocols.substr(start, end - start);
+        protocol.erase(0, protocol.find_first_not_of(" \t"));
+        protocol.erase(protocol.find_last_not_of(" \t") + 1);
+        for (it = handlers_.begin(); it != handlers_.end(); it++)
+            if (!protocol.empty() && (*it).CanProcessContentType(protocol))
+                break;
+        start = end + 1;
+    }
+    if (protocols.empty())
+        it = FindHandler();
+    if (it == handlers_.end())
+    {
+        log_warn("WebSocket protocol not supported by server, " << protocols);
+        GenerateErrorResponseHeader(400, "Bad Request");
+        keepAlive_ = false;
+        return true;
+    }
+
+    header_ << "HTTP/1.1 101 Switching Protocols\r\n";
+    header_ << "Server: " << ANYRPC_APP_NAME << " v" << ANYRPC_VERSION_STRING << "\r\n";
+    header_ << "Upgrade: websocket\r\n";
+    header_ << "Connection: Upgrade\r\n";
+    header_ << "Sec-WebSocket-Accept: " << internal::WebSocketAccept(httpRequestState_.GetWebSocketKey()) << "\r\n";
+    if (!protocols.empty())
+        header_ << "Sec-WebSocket-Protocol: " << protocol << "\r\n";
+    header_ << "\r\n";
+
+    upgraded_ = true;
+    handler_ = &(*it);
+    keepAlive_ = true;
+    return true;
+}
+
+bool WebSocketConnection::ReadHeader()
+{
+    if (!upgraded_)
+        return HttpConnection::ReadHeader();
+
+    // the buffer might be full of frames that arrived together
+    size_t bytesRead = 0;
+    bool eof = false;
+    if ((bufferLength_ < MaxBufferLength) &&
+        !socket_.Receive(buffer_+bufferLength_, MaxBufferLength-bufferLength_, bytesRead, eof))
+    {
+        if (eof)
+            log_info("Client disconnect: error=" << socket_.GetLastError());
+        else
+            log_warn("Error while reading frame: error=" << socket_.GetLastError() << ", bytesRead=" << bytesRead);
+        Initialize();
+        return false;
+    }
+    bufferLength_ += bytesRead;
+    if (bytesRead > 0)
+        Touch();
+
+    log_info("read=" << bytesRead << ", total=" << bufferLength_);
+    return ProcessFrames(eof);
+}
+
+bool WebSocketConnection::ProcessFrames(bool eof)
+{
+    while (true)
+    {
+        // If we haven't gotten the entire frame header yet, return (keep reading)
+        internal::WebSocketFrame::ParseResultEnum result = frame_.ParseHeader(buffer_, bufferLength_);
+        if (result == internal::WebSocketFrame::FRAME_FAULT)
+            return SendClose(internal::WebSocketFrame::CLOSE_PROTOCOL);
+        if (result == internal::WebSocketFrame::FRAME_INCOMPLETE)
+        {
+            // EOF in the middle of a frame is an error, otherwise its ok
+            if (eof)
+            {
+                log_info("Client disconnect: error=" << socket_.GetLastError());
+                Initialize();
+                return false;
+            }
+            return true;
+        }
+        // the frames from a client are always masked
+        if ((frame_.reserved_ != 0) || !frame_.masked_)
+            return SendClose(internal::WebSocketFrame::CLOSE_PROTOCOL);
+
+        if (frame_.IsControl())
+        {
+            if (!frame_.fin_ || (frame_.length_ > internal::WebSocketFrame::MaxControlLength))
+                return SendClose(internal::WebSocketFrame::CLOSE_PROTOCOL);
+            if (bufferLength_ < frame_.headerLength_ + frame_.length_)
+            {
+                if (eof)
+                {
+                    log_info("Client disconnect: error=" << socket_.GetLastError());
+                    Initialize();
+                    return false;
+                }
+                return true;
+            }
+            if (!ProcessControlFrame())
+                return true;
+            continue;
+        }
+
+        // a continuation is only allowed in a fragmented message and a new message only outside one
+        if (frame_.opcode_ == internal::WebSocketFrame::OPCODE_CONTINUATION)
+        {
+            if (!fragmented_)
+                return SendClose(internal::WebSocketFrame::CLOSE_PROTOCOL);
+        }
+        else if (((frame_.opcode_ == internal::WebSocketFrame::OPCODE_TEXT) ||
+                  (frame_.opcode_ == internal::WebSocketFrame::OPCODE_BINARY)) && !fragmented_)
+            opcode_ = frame_.opcode_;
+        else
+            return SendClose(internal::WebSocketFrame::CLOSE_PROTOCOL);
+
+        // the remaining space is compared so a huge length can't wrap around
+        if (frame_.length_ > maxContentLength_ - message_.length())
+        {
+            log_warn("Message length too large=" << frame_.length_ + message_.length() << ", max allowed=" << maxContentLength_);
+            return SendClose(internal::WebSocketFrame::CLOSE_TOO_LARGE);
+        }
+        contentLength_ = static_cast<size_t>(frame_.length_);
+        char* body = buffer_ + frame_.headerLength_;
+        size_t bufferSpaceAvail = MaxBufferLength - frame_.headerLength_;
+        contentAvail_ = bufferLength_ - frame_.headerLength_;
+
+        request_ = body;
+        requestAllocated_ = false;
+        if (contentLength_ > bufferSpaceAvail)
+        {
+            // move the content that was already read to allocated space that grows as the rest arrives
+            if (!ReserveRequest(contentAvail_, contentLength_))
+            {
+                log_warn("Could not allocate space=" << contentLength_);
+                Initialize();
+                return false;
+            }
+            bufferLength_ = 0;
+        }
+        log_info("frame length is " << contentLength_);
+
+        connectionState_ = READ_REQUEST;
+        return true;
+    }
+}
+
+bool WebSocketConnection::ProcessControlFrame()
+{
+    size_t payloadLength = static_cast<size_t>(frame_.length_);
+    size_t frameLength = frame_.headerLength_ + payloadLength;
+    char* payload = buffer_ + frame_.headerLength_;
+    internal::WebSocketFrame::Mask(payload, payloadLength, frame_.mask_);
+
+    if (frame_.opcode_ == internal::WebSocketFrame::OPCODE_CLOSE)
+    {
+        log_info("Client closed the WebSocket");
+        SendClose(internal::WebSocketFrame::CLOSE_NORMAL);
+        return false;
+    }
+    bool ping = (frame_.opcode_ == internal::WebSocketFrame::OPCODE_PING);
+    if (ping)
+    {
+        // the pong carries the data of the ping
+        internal::WebSocketFrame::WriteHeader(header_, internal::WebSocketFrame::OPCODE_PONG, true, payloadLength);
+        header_.Put(payload, payloadLength);
+        connectionState_ = WRITE_RESPONSE;
+    }
+    memmove(buffer_, buffer_+frameLength, bufferLength_-frameLength);
+    bufferLength_ -= frameLength;
+    return !ping;
+}
+
+bool WebSocketConnection::ReadRequest()
+{
+    if (!upgraded_)
+        return HttpConnection::ReadRequest();
+
+    while (true)
+    {
+        if (!ReceiveRequest())
+            return false;
+        // If we haven't gotten the entire frame yet, keep reading
+        if (contentAvail_ < contentLength_)
+            return true;
+
+        internal::WebSocketFrame::Mask(request_, contentLength_, frame_.mask_);
+        fragmented_ = !frame_.fin_;
+        if (!fragmented_ && message_.empty())
+            break;
+
+        // collect the fragment and keep the data that follows it
+        message_.append(request_, contentLength_);
+        Initialize(true);
+        if (!fragmented_)
+        {
+            // the assembled message is the request
+            request_ = static_cast<char*>(malloc(message_.length()+1));
+            if (request_ == 0)
+            {
+                log_warn("Could not allocate space=" << message_.length());
+                Initialize();
+                return false;
+            }
+            memcpy(request_, message_.data(), message_.length());
+            requestAllocated_ = true;
+            requestCapacity_ = message_.length();
+            contentLength_ = message_.length();
+            contentAvail_ = contentLength_;
+            message_.clear();
+            break;
+        }
+
+        // the next fragment might already be in the buffer
+        connectionState_ = READ_HEADER;
+        if (!ProcessFrames(false))
+            return false;
+        if (connectionState_ != READ_REQUEST)
+            return true;
+    }
+
+    CompleteRequest();
+    return true;    // Continue monitoring this source
+}
+
+bool WebSocketConnection::ExecuteRequest()
+{
+    if (!upgraded_)
+        return HttpConnection::ExecuteRequest();
+
+    log_debug("ContentLength=" << contentLength_ << ", request=" << request_);
+    Deferral deferral(this);
+    bool sendResponse = handler_->HandleRequest(manager_, request_, contentLength_, response_);
+    if (deferral.IsDeferred())
+    {
+        // the following messages wait in the buffer until the method responds
+        connectionState_ = WAIT_RESPONSE;
+        return true;
+    }
+    return FinishRequest(sendResponse);
+}
+
+bool WebSocketConnection::FinishRequest(bool sendResponse)
+{
+    if (sendResponse)
+    {
+        // the response is a single frame of the same type as the request
+        log_debug("Response length=" << response_.Length());
+        internal::WebSocketFrame::WriteHeader(header_, opcode_, true, response_.Length());
+        connectionState_ = WRITE_RESPONSE;
+    }
+    else
+    {
+        // a notification may have been the last request allowed
+        if (!keepAlive_)
+            return false;
+        connectionState_ = READ_HEADER;
+        Initialize(true);
+    }
+    return true;
+}
+
+bool WebSocketConnection::SendClose(unsigned code)
+{
+    log_info("Close WebSocket: code=" << code);
+    Initialize();
+    internal::WebSocketFrame::WriteClose(header_, code);
+    keepAlive_ = false;
+    connectionState_ = WRITE_RESPONSE;
+    return true;
+}
+
+bool WebSocketConnection::RejectRequest()
+{
+    if (!upgraded_)
+        return HttpConnection::RejectRequest();
+    // the client is asked to connect again later
+    log_debug("Reject request, fd=" << socket_.GetFileDescriptor());
+    return SendClose(internal::WebSocketFrame::CLOSE_TRY_AGAIN);
+}
+
+bool WebSocketConnection::GetMethodName(std::string& methodName)
+{
+    if (!upgraded_)
+        return HttpConnection::GetMethodName(methodName);
+    return (request_ != 0) && handler_->GetMethodName(request_, contentLength_, methodName);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 bool TcpConnection::ReadHeader()
@@ -511,6 +1506,8 @@ bool TcpConnection::ReadHeader()
         return false;
     }
     bufferLength_ += bytesRead;
+    if (bytesRead > 0)
+        Touch();
 
     log_info("read=" << bytesRead << ", total=" << bufferLength_);
 
@@ -564,30 +1561,24 @@ bool TcpConnection::ReadHeader()
     size_t bufferSpaceAvail = buffer_ + MaxBufferLength - body;
     contentAvail_ = end - body;
 
-    if (contentLength_ > MaxContentLength)
+    if (contentLength_ > maxContentLength_)
     {
-        log_warn("String length too large=" << contentLength_ << ", max allowed=" << MaxContentLength);
+        log_warn("String length too large=" << contentLength_ << ", max allowed=" << maxContentLength_);
         Initialize();
         return false;
     }
+    request_ = body;
+    requestAllocated_ = false;
     if (contentLength_ > bufferSpaceAvail)
     {
-        // try to malloc the buffer space needed
-        request_ = static_cast<char*>(malloc(contentLength_+1));
-        if (request_ == 0)
+        // move the content that was already read to allocated space that grows as the rest arrives
+        if (!ReserveRequest(contentAvail_, contentLength_))
         {
             log_warn("Could not allocate space=" << contentLength_);
             Initialize();
             return false;
         }
-        // copy the content that was already read to the new space
-        memcpy(request_,body,contentAvail_);
-        requestAllocated_ = true;
-    }
-    else
-    {
-        requestAllocated_ = false;
-        request_ = body;
+        bufferLength_ = 0;
     }
     request_[contentAvail_] = 0;
     log_info("specified content length is " << contentLength_);
@@ -605,8 +1596,56 @@ bool TcpConnection::ReadHeader()
 bool TcpConnection::ExecuteRequest()
 {
     log_debug("ContentLength=" << contentLength_ << ", request=" << request_);
+    Deferral deferral(this);
     bool sendResponse = handler_(manager_, request_, contentLength_, response_);
+    if (deferral.IsDeferred())
+    {
+        // the following requests wait in the buffer until the method responds
+        connectionState_ = WAIT_RESPONSE;
+        return true;
+    }
+    return FinishRequest(sendResponse);
+}
+
+bool TcpConnection::RejectRequest()
+{
+    if (faultHandler_ == 0)
+        return false;
+    log_debug("Reject request, fd=" << socket_.GetFileDescriptor());
+    return FinishRequest(faultHandler_(request_, contentLength_, AnyRpcErrorServerBusy, "Server busy", response_));
+}
+
+bool TcpConnection::ExecutePipelined(PipelinedRequest* request)
+{
+    Deferral deferral(this, request);
+    bool sendResponse = handler_(manager_, request->request_, request->length_, request->response_);
+    // a deferred request can be returned by the server thread at any time so it isn't touched again
+    if (deferral.IsDeferred())
+        return false;
+    FrameResponse(request, sendResponse);
+    return true;
+}
+
+void TcpConnection::RejectPipelined(PipelinedRequest* request)
+{
+    if (faultHandler_ == 0)
+        request->sendResponse_ = false;
+    else
+        FrameResponse(request, faultHandler_(request->request_, request->length_, AnyRpcErrorServerBusy, "Server busy", request->response_));
+}
+
+void TcpConnection::FrameResponse(PipelinedRequest* request, bool sendResponse)
+{
+    request->sendResponse_ = sendResponse;
+    if (sendResponse)
+    {
+        request->header_ << request->response_.Length() << ":";
+        request->response_.Put(',');
+    }
+}
 
+bool TcpConnection::FinishRequest(bool sendResponse)
+{
     if (sendResponse)
     {
         // generate the header and add comma separator for netstrings format
@@ -618,10 +1657,655 @@ bool TcpConnection::ExecuteRequest()
     }
     else
     {
+        // a notification may have been the last request allowed
+        if (!keepAlive_)
+            return false;
         connectionState_ = READ_HEADER;
         Initialize(true);
     }
     return true;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+Http2Connection::Http2Connection(SOCKET fd, MethodManager* manager, RpcHandlerList& handlers) :
+    Connection(fd, manager), handlers_(handlers),
+    input_(internal::Http2Frame::HeaderLength + internal::Http2Frame::DefaultMaxFrameSize + 1)
+{
+    ResetStreams();
+}
+
+void Http2Connection::ResetStreams()
+{
+    decoder_.Reset();
+    inputLength_ = 0;
+    prefaceReceived_ = false;
+    output_.Clear();
+    outputBytesWritten_ = 0;
+    streams_.clear();
+    readyStreams_.clear();
+    lastStreamId_ = 0;
+    continuationStream_ = 0;
+    continuationEndStream_ = false;
+    headerBlock_.clear();
+    sendWindow_ = internal::Http2Frame::DefaultWindowSize;
+    initialWindow_ = internal::Http2Frame::DefaultWindowSize;
+    maxFrameSize_ = internal::Http2Frame::DefaultMaxFrameSize;
+    windowUpdate_ = 0;
+    goAway_ = false;
+}
+
+void Http2Connection::Recycle()
+{
+    Connection::Recycle();
+    ResetStreams();
+}
+
+void Http2Connection::Process(bool executeAfterRead)
+{
+    log_info("Process: fd=" << socket_.GetFileDescriptor());
+    if (WaitForReadability() && !ReadHeader())
+    {
+        connectionState_ = CLOSE_CONNECTION;
+        return;
+    }
+    // When operating a thread pool, the main thread gives the streams to the workers
+    // and writes the responses when they are returned
+    if (executeAfterRead)
+    {
+        bool executed = ExecuteRequest();
+        // there are no other threads to schedule the writes of the returned requests
+        ClearCompletionScheduled();
+        if (!executed || !WritePipelined())
+            connectionState_ = CLOSE_CONNECTION;
+    }
+}
+
+bool Http2Connection::WaitForWritability()
+{
+    return IsActive() && (connectionState_ != CLOSE_CONNECTION) &&
+           ((outputBytesWritten_ < output_.Length()) || CanFrameResponse());
+}
+
+bool Http2Connection::ForcedDisconnectAllowed()
+{
+    return !HasOutstandingRequests() && (writeHead_ == 0) && streams_.empty() && (inputLength_ == 0) &&
+           (outputBytesWritten_ >= output_.Length());
+}
+
+bool Http2Connection::GetMethodName(std::string& methodName)
+{
+    if (readyStreams_.empty())
+        return false;
+    RpcContentHandler* handler = streams_[readyStreams_.front()].handler_;
+    return (handler != 0) && handler->GetMethodName(request_, contentLength_, methodName);
+}
+
+bool Http2Connection::ReadHeader()
+{
+    // Read available data
+    size_t bytesRead;
+    bool eof;
+    if (!socket_.Receive(&input_[inputLength_], input_.size()-1-inputLength_, bytesRead, eof))
+    {
+        if (eof)
+            log_info("Client disconnect: error=" << socket_.GetLastError());
+        else
+            log_warn("Error while reading frames: error=" << socket_.GetLastError() << ", bytesRead=" << bytesRead);
+        return false;
+    }
+    inputLength_ += bytesRead;
+    if (bytesRead > 0)
+        Touch();
+    log_info("read=" << bytesRead << ", total=" << inputLength_);
+
+    size_t position = 0;
+    if (!prefaceReceived_)
+    {
+        size_t prefaceLength = internal::Http2Frame::PrefaceLength;
+        if (memcmp(&input_[0], internal::Http2Frame::Preface, std::min(inputLength_, prefaceLength)) != 0)
+        {
+            log_warn("Invalid HTTP/2 connection preface");
+            return false;
+        }
+        if (inputLength_ < prefaceLength)
+            return true;    // Keep reading
+        position = prefaceLength;
+        prefaceReceived_ = true;
+
+        // the server's settings are the first frame that it sends
+        internal::Http2Frame::WriteHeader(output_, 6, internal::Http2Frame::FRAME_SETTINGS, 0, 0);
+        internal::Http2Frame::WriteSetting(output_, internal::Http2Frame::SETTINGS_MAX_CONCURRENT_STREAMS, MaxStreams);
+    }
+
+    // process the complete frames and keep the rest for the next read
+    size_t headerLength = internal::Http2Frame::HeaderLength;
+    internal::Http2Frame frame;
+    while (inputLength_ - position >= headerLength)
+    {
+        frame.ParseHeader(&input_[position]);
+        if (frame.length_ > internal::Http2Frame::DefaultMaxFrameSize)
+            return Fail(internal::Http2Frame::ERR_FRAME_SIZE, "Frame too large");
+        if (inputLength_ - position - headerLength < frame.length_)
+            break;
+        if (!ProcessFrame(frame, &input_[position + headerLength]))
+            return false;
+        position += headerLength + frame.length_;
+    }
+    memmove(&input_[0], &input_[position], inputLength_ - position);
+    inputLength_ -= position;
+
+    // open the connection window again for the request data that was read
+    if (windowUpdate_ > 0)
+    {
+        internal::Http2Frame::WriteWindowUpdate(output_, 0, windowUpdate_);
+        windowUpdate_ = 0;
+    }
+    SelectReadyStream();
+    return true;    // Continue monitoring this source
+}
+
+bool Http2Connection::ProcessFrame(internal::Http2Frame& frame, const char* payload)
+{
+    log_debug("Frame: type=" << frame.type_ << ", flags=" << frame.flags_ << ", stream=" << frame.streamId_ << ", length=" << frame.length_);
+
+    // the frames of a header block can't be interleaved with any other frames
+    if ((continuationStream_ != 0) &&
+        ((frame.type_ != internal::Http2Frame::FRAME_CONTINUATION) || (frame.streamId_ != continuationStream_)))
+        return Fail(internal::Http2Frame::ERR_PROTOCOL, "Expected CONTINUATION frame");
+
+    const char* data;
+    size_t dataLength;
+    StreamMap::iterator it;
+    switch (frame.type_)
+    {
+        case internal::Http2Frame::FRAME_DATA :
+            return ProcessData(frame, payload);
+
+        case internal::Http2Frame::FRAME_HEADERS :
+            if ((frame.streamId_ == 0) || !frame.GetData(payload, data, dataLength))
+                return Fail(internal::Http2Frame::ERR_PROTOCOL, "Invalid HEADERS frame");
+            headerBlock_.assign(data, dataLength);
+            if ((frame.flags_ & internal::Http2Frame::FLAG_END_HEADERS) == 0)
+            {
+                continuationStream_ = frame.streamId_;
+                continuationEndStream_ = ((frame.flags_ & internal::Http2Frame::FLAG_END_STREAM) != 0);
+                return true;
+            }
+            return ProcessHeaderBlock(frame.streamId_, (frame.flags_ & internal::Http2Frame::FLAG_END_STREAM) != 0);
+
+        case internal::Http2Frame::FRAME_CONTINUATION :
+            if (continuationStream_ == 0)
+                return Fail(internal::Http2Frame::ERR_PROTOCOL, "Unexpected CONTINUATION frame");
+            if (headerBlock_.length() + frame.length_ > MaxHeaderBlockLength)
+                return Fail(internal::Http2Frame::ERR_ENHANCE_YOUR_CALM, "Header block too large");
+            headerBlock_.append(payload, frame.length_);
+            if ((frame.flags_ & internal::Http2Frame::FLAG_END_HEADERS) == 0)
+                return true;
+            continuationStream_ = 0;
+            return ProcessHeaderBlock(frame.streamId_, continuationEndStream_);
+
+        case internal::Http2Frame::FRAME_PRIORITY :
+            // the priorities are not used
+            if ((frame.streamId_ == 0) || (frame.length_ != 5))
+                return Fail(internal::Http2Frame::ERR_PROTOCOL, "Invalid PRIORITY frame");
+            return true;
+
+        case internal::Http2Frame::FRAME_RST_STREAM :
+            if ((frame.streamId_ == 0) || (frame.length_ != 4))
+                return Fail(internal::Http2Frame::ERR_PROTOCOL, "Invalid RST_STREAM frame");
+            log_debug("Client reset stream " << frame.streamId_);
+            it = streams_.find(frame.streamId_);
+            if (it != streams_.end())
+                DropStream(it);
+            return true;
+
+        case internal::Http2Frame::FRAME_SETTINGS :
+            return ProcessSettings(frame, payload);
+
+        case internal::Http2Frame::FRAME_PING :
+            if ((frame.streamId_ != 0) || (frame.length_ != 8))
+                return Fail(internal::Http2Frame::ERR_PROTOCOL, "Invalid PING frame");
+            if ((frame.flags_ & internal::Http2Frame::FLAG_ACK) == 0)
+                internal::Http2Frame::WritePing(output_, payload, true);
+            return true;
+
+        case internal::Http2Frame::FRAME_GOAWAY :
+            // the streams that are open are still answered
+            log_info("Client sent GOAWAY, fd=" << socket_.GetFileDescriptor());
+            goAway_ = true;
+            return true;
+
+        case internal::Http2Frame::FRAME_WINDOW_UPDATE :
+            return ProcessWindowUpdate(frame, payload);
+
+        case internal::Http2Frame::FRAME_PUSH_PROMISE :
+            return Fail(internal::Http2Frame::ERR_PROTOCOL, "Client sent PUSH_PROMISE");
+
+        default :
+            // frames of an unknown type are ignored
+            return true;
+    }
+}
+
+bool Http2Connection::ProcessSettings(internal::Http2Frame& frame, const char* payload)
+{
+    if (frame.streamId_ != 0)
+        return Fail(internal::Http2Frame::ERR_PROTOCOL, "Invalid SETTINGS frame");
+    if (frame.flags_ & internal::Http2Frame::FLAG_ACK)
+        return (frame.length_ == 0) || Fail(internal::Http2Frame::ERR_FRAME_SIZE, "Invalid SETTINGS acknowledgement");
+    if (frame.length_ % 6 != 0)
+        return Fail(internal::Http2Frame::ERR_FRAME_SIZE, "Invalid SETTINGS frame");
+
+    for (size_t position = 0; position < frame.length_; position += 6)
+    {
+        unsigned id = internal::Http2Frame::Get16(payload + position);
+        uint32_t value = internal::Http2Frame::Get32(payload + position + 2);
+        log_debug("Setting " << id << "=" << value);
+        if (id == internal::Http2Frame::SETTINGS_INITIAL_WINDOW_SIZE)
+        {
+            if (value > internal::Http2Frame::MaxWindowSize)
+                return Fail(internal::Http2Frame::ERR_FLOW_CONTROL, "Invalid initial window size");
+            // the change applies to the streams that are already open
+            int64_t change = static_cast<int64_t>(value) - initialWindow_;
+            for (StreamMap::iterator it = streams_.begin(); it != streams_.end(); it++)
+                it->second.sendWindow_ += change;
+            initialWindow_ = value;
+        }
+        else if (id == internal::Http2Frame::SETTINGS_MAX_FRAME_SIZE)
+        {
+            if ((value < internal::Http2Frame::DefaultMaxFrameSize) || (value > internal::Http2Frame::MaxFrameSizeLimit))
+                return Fail(internal::Http2Frame::ERR_PROTOCOL, "Invalid max frame size");
+            maxFrameSize_ = value;
+        }
+        // the other settings don't affect the server
+    }
+    internal::Http2Frame::WriteHeader(output_, 0, internal::Http2Frame::FRAME_SETTINGS, internal::Http2Frame::FLAG_ACK, 0);
+    return true;
+}
+
+bool Http2Connection::ProcessWindowUpdate(internal::Http2Frame& frame, const char* payload)
+{
+    if (frame.length_ != 4)
+        return Fail(internal::Http2Frame::ERR_FRAME_SIZE, "Invalid WINDOW_UPDATE frame");
+    uint32_t increment = internal::Http2Frame::Get32(payload) & internal::Http2Frame::MaxWindowSize;
+    if (frame.streamId_ == 0)
+    {
+        sendWindow_ += increment;
+        if ((increment == 0) || (sendWindow_ > internal::Http2Frame::MaxWindowSize))
+            return Fail(internal::Http2Frame::ERR_FLOW_CONTROL, "Invalid connection window update");
+        return true;
+    }
+
+    // the window of a stream that has been answered can still be updated
+    StreamMap::iterator it = streams_.find(frame.streamId_);
+    if (it == streams_.end())
+        return true;
+    it->second.sendWindow_ += increment;
+    if ((increment == 0) || (it->second.sendWindow_ > internal::Http2Frame::MaxWindowSize))
+        ResetStream(it, internal::Http2Frame::ERR_FLOW_CONTROL);
+    return true;
+}
+
+bool Http2Connection::ProcessData(internal::Http2Frame& frame, const char* payload)
+{
+    const char* data;
+    size_t dataLength;
+    if ((frame.streamId_ == 0) || !frame.GetData(payload, data, dataLength))
+        return Fail(internal::Http2Frame::ERR_PROTOCOL, "Invalid DATA frame");
+
+    // all of the frame counts against the connection window, including the padding
+    windowUpdate_ += static_cast<uint32_t>(frame.length_);
+    StreamMap::iterator it = streams_.find(frame.streamId_);
+    if (it == streams_.end())
+    {
+        // the data of a stream that was reset can still arrive
+        if (frame.streamId_ > lastStreamId_)
+            return Fail(internal::Http2Frame::ERR_PROTOCOL, "DATA frame for an idle stream");
+        return true;
+    }
+    StreamState& stream = it->second;
+    if (stream.endStream_)
+    {
+        ResetStream(it, internal::Http2Frame::ERR_STREAM_CLOSED);
+        return true;
+    }
+    if (stream.body_.length() + dataLength > maxContentLength_)
+    {
+        log_warn("Request too large for stream " << frame.streamId_ << ", max allowed=" << maxContentLength_);
+        ResetStream(it, internal::Http2Frame::ERR_CANCEL);
+        return true;
+    }
+    // the data of a request that is answered with an error status isn't kept
+    if (stream.handler_ != 0)
+        stream.body_.append(data, dataLength);
+    if (frame.flags_ & internal::Http2Frame::FLAG_END_STREAM)
+        FinishStream(frame.streamId_, stream);
+    else if (frame.length_ > 0)
+        internal::Http2Frame::WriteWindowUpdate(output_, frame.streamId_, static_cast<uint32_t>(frame.length_));
+    return true;
+}
+
+bool Http2Connection::ProcessHeaderBlock(uint32_t streamId, bool endStream)
+{
+    // the block is decoded even for a refused stream to keep the dynamic table in step with the client
+    internal::HpackHeaderList headers;
+    bool decoded = decoder_.Decode(headerBlock_.data(), headerBlock_.length(), headers);
+    headerBlock_.clear();
+    if (!decoded)
+        return Fail(internal::Http2Frame::ERR_COMPRESSION, "Invalid header block");
+
+    StreamMap::iterator it = streams_.find(streamId);
+    if (it != streams_.end())
+    {
+        // trailers end the request
+        if (it->second.endStream_ || !endStream)
+            return Fail(internal::Http2Frame::ERR_PROTOCOL, "Unexpected HEADERS frame");
+        FinishStream(streamId, it->second);
+        return true;
+    }
+    if (((streamId & 1) == 0) || (streamId <= lastStreamId_))
+        return Fail(internal::Http2Frame::ERR_PROTOCOL, "Invalid stream id");
+    lastStreamId_ = streamId;
+    if (goAway_ || (streams_.size() >= MaxStreams))
+    {
+        log_info("Refuse stream " << streamId);
+        internal::Http2Frame::WriteRstStream(output_, streamId, internal::Http2Frame::ERR_REFUSED_STREAM);
+        return true;
+    }
+
+    // the streams are counted as the requests, so the last one allowed ends the connection
+    requestCount_++;
+    if (RequestLimitReached())
+    {
+        goAway_ = true;
+        internal::Http2Frame::WriteGoAway(output_, lastStreamId_, internal::Http2Frame::ERR_NONE);
+    }
+
+    std::string method;
+    std::string contentType;
+    for (internal::HpackHeaderList::iterator header = headers.begin(); header != headers.end(); header++)
+    {
+        if (header->first == ":method")
+            method = header->second;
+        else if (header->first == "content-type")
+            contentType = header->second;
+    }
+    log_debug("Open stream " << streamId << ", method=" << method << ", content-type=" << contentType);
+
+    StreamState& stream = streams_[streamId];
+    stream.sendWindow_ = initialWindow_;
+    if (method != "POST")
+        stream.status_ = 501;
+    else
+    {
+        // find a handler that will work
+        RpcHandlerList::iterator handler = handlers_.begin();
+        while ((handler != handlers_.end()) && !handler->CanProcessContentType(contentType))
+            handler++;
+        if (handler == handlers_.end())
+        {
+            log_warn("Content type not supported by server, " << contentType);
+            stream.status_ = 415;
+        }
+        else
+        {
+            stream.handler_ = &(*handler);
+            const std::string& responseContentType = handler->GetResponseContentType();
+            stream.contentType_ = responseContentType.empty() ? contentType : responseContentType;
+        }
+    }
+    if (endStream)
+        FinishStream(streamId, stream);
+    return true;
+}
+
+void Http2Connection::FinishStream(uint32_t streamId, StreamState& stream)
+{
+    stream.endStream_ = true;
+    if (stream.handler_ == 0)
+        QueueStatus(streamId, stream.status_);
+    else
+    {
+        log_info("read stream " << streamId << ", length=" << stream.body_.length());
+        readyStreams_.push_back(streamId);
+    }
+}
+
+void Http2Connection::SelectReadyStream()
+{
+    if (readyStreams_.empty())
+    {
+        request_ = 0;
+        contentLength_ = 0;
+        return;
+    }
+    std::string& body = streams_[readyStreams_.front()].body_;
+    request_ = &body[0];
+    contentLength_ = body.length();
+}
+
+void Http2Connection::QueueStatus(uint32_t streamId, unsigned status)
+{
+    Http2Request* request = new Http2Request(this, "", 0, streamId, 0);
+    request->status_ = status;
+    request->sendResponse_ = true;
+    requests_.PushBack(request);
+    streams_[streamId].taken_ = true;
+    QueueResponse(request);
+}
+
+void Http2Connection::DropStream(StreamMap::iterator it)
+{
+    // the response of a stream that was taken is dropped when it is framed
+    if (it->second.taken_)
+    {
+        it->second.reset_ = true;
+        return;
+    }
+    std::deque<uint32_t>::iterator ready = std::find(readyStreams_.begin(), readyStreams_.end(), it->first);
+    if (ready != readyStreams_.end())
+        readyStreams_.erase(ready);
+    streams_.erase(it);
+    SelectReadyStream();
+}
+
+void Http2Connection::ResetStream(StreamMap::iterator it, unsigned errorCode)
+{
+    log_info("Reset stream " << it->first << ", error=" << errorCode);
+    internal::Http2Frame::WriteRstStream(output_, it->first, errorCode);
+    DropStream(it);
+}
+
+PipelinedRequest* Http2Connection::TakeRequest()
+{
+    uint32_t streamId = readyStreams_.front();
+    readyStreams_.pop_front();
+    StreamState& stream = streams_[streamId];
+    log_debug("Take stream " << streamId << ", fd=" << socket_.GetFileDescriptor() << ", length=" << stream.body_.length());
+    Http2Request* request = new Http2Request(this, stream.body_.data(), stream.body_.length(), streamId, stream.handler_);
+    std::string().swap(stream.body_);
+    stream.taken_ = true;
+    requests_.PushBack(request);
+    outstanding_.fetch_add(1);
+    SelectReadyStream();
+    return request;
+}
+
+bool Http2Connection::ExecutePipelined(PipelinedRequest* request)
+{
+    Deferral deferral(this, request);
+    static_cast<Http2Request*>(request)->handler_->HandleRequest(manager_, request->request_, request->length_, request->response_);
+    // a deferred request can be returned by the server thread at any time so it isn't touched again
+    if (deferral.IsDeferred())
+        return false;
+    FrameResponse(request, true);
+    return true;
+}
+
+void Http2Connection::RejectPipelined(PipelinedRequest* request)
+{
+    static_cast<Http2Request*>(request)->status_ = 503;
+    request->response_.Clear();
+    request->sendResponse_ = true;
+}
+
+bool Http2Connection::ExecuteRequest()
+{
+    while (CheckExecuteState())
+    {
+        PipelinedRequest* request = TakeRequest();
+        try
+        {
+            if (!ExecutePipelined(request))
+                // the request is returned by the server thread when the method responds
+                continue;
+        }
+        catch (AnyRpcException&)
+        {
+            // anyrpc exceptions shouldn't get to this point but attempt to handle gracefully
+            request->sendResponse_ = false;
+        }
+        CompletePipelined(request);
+    }
+    return true;
+}
+
+bool Http2Connection::WritePipelined()
+{
+    // add the returned requests to the write queue in the order that they completed
+    PipelinedRequest* request = completedRequests_.PopAll();
+    while (request != 0)
+    {
+        PipelinedRequest* next = request->GetNextCompleted();
+        request->SetNextCompleted(0);
+        if (!request->sendResponse_)
+        {
+            // the stream is still answered when the request failed
+            static_cast<Http2Request*>(request)->status_ = 500;
+            request->response_.Clear();
+            request->sendResponse_ = true;
+        }
+        QueueResponse(request);
+        request = next;
+    }
+    if (CheckClose())
+        return false;
+
+    while (true)
+    {
+        // frame more of the responses once the previous frames have been written
+        if (outputBytesWritten_ >= output_.Length())
+        {
+            output_.Clear();
+            outputBytesWritten_ = 0;
+            FrameResponses();
+            if (output_.Length() == 0)
+                break;
+        }
+        segments_.clear();
+        AppendSegments(segments_, output_, outputBytesWritten_);
+        size_t bytesWritten;
+        if (!socket_.SendGather(segments_, bytesWritten) && socket_.FatalError())
+        {
+            log_warn("HTTP/2 write error " << socket_.GetLastError());
+            return false;
+        }
+        if (bytesWritten > 0)
+            Touch();
+        outputBytesWritten_ += bytesWritten;
+        if (outputBytesWritten_ < output_.Length())
+            // not all of the data was written, need to wait until writable again
+            return true;
+    }
+
+    // close once all of the streams are answered after a GOAWAY
+    return !Finished();
+}
+
+void Http2Connection::FrameResponses()
+{
+    PipelinedRequest* previous = 0;
+    PipelinedRequest* request = writeHead_;
+    while ((request != 0) && (output_.Length() < OutputLimit))
+    {
+        PipelinedRequest* next = request->nextWrite_;
+        Http2Request* http2Request = static_cast<Http2Request*>(request);
+        StreamMap::iterator it = streams_.find(http2Request->streamId_);
+        // the response of a stream that the client reset is dropped
+        if ((it == streams_.end()) || it->second.reset_ || FrameStream(http2Request, it->second))
+        {
+            if (it != streams_.end())
+                streams_.erase(it);
+            if (previous == 0)
+                writeHead_ = next;
+            else
+                previous->nextWrite_ = next;
+            if (writeTail_ == request)
+                writeTail_ = previous;
+            DeleteRequest(request);
+        }
+        else
+            previous = request;
+        request = next;
+    }
+}
+
+bool Http2Connection::FrameStream(Http2Request* request, StreamState& stream)
+{
+    size_t length = request->response_.Length();
+    if (!request->headersSent_)
+    {
+        char status[16];
+        snprintf(status, sizeof(status), "%u", request->status_);
+        std::string block;
+        internal::HpackEncode(block, ":status", status);
+        if (length > 0)
+            internal::HpackEncode(block, "content-type", stream.contentType_);
+        if (request->status_ == 503)
+            internal::HpackEncode(block, "retry-after", "1");
+        internal::Http2Frame::WriteHeaders(output_, request->streamId_, block, length == 0, maxFrameSize_);
+        request->headersSent_ = true;
+    }
+
+    // the count of the bytes written is used for the data that has been framed
+    size_t& framed = request->resultBytesWritten_;
+    while ((framed < length) && (sendWindow_ > 0) && (stream.sendWindow_ > 0) && (output_.Length() < OutputLimit))
+    {
+        size_t window = static_cast<size_t>(std::min(sendWindow_, stream.sendWindow_));
+        size_t frameLength = std::min(std::min(length - framed, maxFrameSize_), window);
+        internal::Http2Frame::WriteData(output_, request->streamId_, request->response_, framed, frameLength, framed + frameLength == length);
+        framed += frameLength;
+        sendWindow_ -= frameLength;
+        stream.sendWindow_ -= frameLength;
+    }
+    return (framed >= length);
+}
+
+bool Http2Connection::CanFrameResponse()
+{
+    for (PipelinedRequest* request = writeHead_; request != 0; request = request->nextWrite_)
+    {
+        Http2Request* http2Request = static_cast<Http2Request*>(request);
+        if (!http2Request->headersSent_)
+            return true;
+        StreamMap::iterator it = streams_.find(http2Request->streamId_);
+        if ((it == streams_.end()) || it->second.reset_ || ((sendWindow_ > 0) && (it->second.sendWindow_ > 0)))
+            return true;
+    }
+    return false;
+}
+
+bool Http2Connection::Fail(unsigned errorCode, const char* reason)
+{
+    log_warn("HTTP/2 connection error=" << errorCode << ", " << reason << ", fd=" << socket_.GetFileDescriptor());
+    // the GOAWAY frame is only sent if the socket takes it right away
+    internal::Http2Frame::WriteGoAway(output_, lastStreamId_, errorCode);
+    segments_.clear();
+    AppendSegments(segments_, output_, outputBytesWritten_);
+    size_t bytesWritten;
+    socket_.SendGather(segments_, bytesWritten);
+    return false;
+}
+
 } // namespace anyrpc
@@ -0,0 +1,299 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "anyrpc/coroutine.h"
+#include "anyrpc/internal/time.h"
+
+namespace anyrpc
+{
+
+namespace
+{
+//! Coroutine that starts immediately and frees itself when it finishes
+struct DetachedCoroutine
+{
+    struct promise_type
+    {
+        DetachedCoroutine get_return_object() { return DetachedCoroutine(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+//! Run the method's coroutine and use the responder with the result
+DetachedCoroutine RespondWithCoroutine(CoroutineMethod* method, Value params, MethodResponder* responder)
+{
+    Value result;
+    bool faulted = false;
+    int errorCode = AnyRpcErrorNone;
+    std::string errorMsg;
+    try
+    {
+        result = co_await method->ExecuteCoroutine(params);
+    }
+    catch (const AnyRpcException& fault)
+    {
+        faulted = true;
+        errorCode = fault.GetCode();
+        errorMsg = fault.GetMessage();
+    }
+    catch (const std::exception& ex)
+    {
+        faulted = true;
+        errorCode = AnyRpcErrorInternalError;
+        errorMsg = ex.what();
+    }
+    if (faulted)
+        responder->Fault(errorCode, errorMsg);
+    else
+        responder->Respond(result);
+}
+} // namespace
+
+void CoroutineMethod::ExecuteAsync(Value& params, MethodResponder* responder)
+{
+    RespondWithCoroutine(this, params, responder);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool CoroutineExecutor::Awaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    waiter_.handle_ = handle;
+    return executor_->Submit(&waiter_);
+}
+
+CoroutineExecutor::CoroutineExecutor() :
+    poller_(0), running_(false), stop_(false)
+{
+}
+
+CoroutineExecutor::~CoroutineExecutor()
+{
+    Stop();
+    delete poller_;
+}
+
+bool CoroutineExecutor::Start()
+{
+    if (thread_.joinable())
+        return true;
+
+    delete poller_;
+    poller_ = internal::Poller::Create();
+    if (!wakeup_.Create() ||
+        !poller_->Add(wakeup_.GetFileDescriptor(), internal::Poller::EVENT_READ, &wakeup_))
+    {
+        log_warn("Unable to create the executor wakeup");
+        wakeup_.Close();
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = true;
+        stop_ = false;
+    }
+    thread_ = std::thread(&CoroutineExecutor::Run, this);
+    return true;
+}
+
+void CoroutineExecutor::Stop()
+{
+    if (!thread_.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wakeup_.Signal();
+    thread_.join();
+    wakeup_.Close();
+    delete poller_;
+    poller_ = 0;
+}
+
+bool CoroutineExecutor::IsRunning()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return running_;
+}
+
+CoroutineExecutor::Awaiter CoroutineExecutor::Wait(SOCKET fd, int ms, bool read)
+{
+    Awaiter awaiter(this);
+    awaiter.waiter_.fd_ = fd;
+    awaiter.waiter_.events_ = read ? internal::Poller::EVENT_READ : internal::Poller::EVENT_WRITE;
+    if (ms >= 0)
+        awaiter.waiter_.deadline_ = MonotonicMicroTime() + static_cast<int64_t>(ms) * 1000;
+    return awaiter;
+}
+
+bool CoroutineExecutor::Submit(internal::CoroutineWaiter* waiter)
+{
+    bool wasEmpty;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_)
+            return false;
+        wasEmpty = incoming_.empty();
+        incoming_.push_back(waiter);
+    }
+    // the waiter can be resumed and gone as soon as the lock is released
+    if (wasEmpty)
+        wakeup_.Signal();
+    return true;
+}
+
+void CoroutineExecutor::Register(std::vector<internal::CoroutineWaiter*>& ready)
+{
+    std::vector<internal::CoroutineWaiter*> incoming;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        incoming.swap(incoming_);
+    }
+    for (std::size_t i=0; i<incoming.size(); i++)
+    {
+        internal::CoroutineWaiter* waiter = incoming[i];
+        if (waiter->events_ == internal::Poller::EVENT_NONE)
+        {
+            // only scheduled on this thread
+            waiter->ready_ = true;
+            ready.push_back(waiter);
+        }
+        else if (!poller_->Add(waiter->fd_, waiter->events_, waiter))
+        {
+            log_warn("Unable to wait for socket, fd=" << waiter->fd_);
+            ready.push_back(waiter);
+        }
+        else
+        {
+            waiting_.insert(waiter);
+            if (waiter->deadline_ != 0)
+                deadlines_.insert(std::make_pair(waiter->deadline_, waiter));
+        }
+    }
+}
+
+void CoroutineExecutor::Unregister(internal::CoroutineWaiter* waiter)
+{
+    poller_->Remove(waiter->fd_);
+    waiting_.erase(waiter);
+    if (waiter->deadline_ != 0)
+    {
+        auto range = deadlines_.equal_range(waiter->deadline_);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second == waiter)
+            {
+                deadlines_.erase(it);
+                break;
+            }
+        }
+    }
+}
+
+void CoroutineExecutor::Run()
+{
+    log_trace();
+    std::vector<internal::CoroutineWaiter*> ready;
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stop_)
+                break;
+        }
+        int timeout = -1;
+        if (!deadlines_.empty())
+        {
+            int64_t timeLeft = deadlines_.begin()->first - MonotonicMicroTime();
+            timeout = (timeLeft <= 0) ? 0 : static_cast<int>((timeLeft + 999) / 1000);
+        }
+        int numEvents = poller_->Wait(timeout);
+        for (int i=0; i<numEvents; i++)
+        {
+            void* data = poller_->GetData(i);
+            if (data == &wakeup_)
+            {
+                wakeup_.Drain();
+                continue;
+            }
+            internal::CoroutineWaiter* waiter = static_cast<internal::CoroutineWaiter*>(data);
+            Unregister(waiter);
+            waiter->ready_ = true;
+            ready.push_back(waiter);
+        }
+        int64_t now = MonotonicMicroTime();
+        while (!deadlines_.empty() && (deadlines_.begin()->first <= now))
+        {
+            internal::CoroutineWaiter* waiter = deadlines_.begin()->second;
+            Unregister(waiter);
+            ready.push_back(waiter);
+        }
+        Register(ready);
+
+        // the resumed coroutines can queue new waiters
+        for (std::size_t i=0; i<ready.size(); i++)
+            ready[i]->handle_.resume();
+        ready.clear();
+    }
+
+    // the remaining coroutines resume without success
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+        ready.swap(incoming_);
+    }
+    while (!waiting_.empty())
+    {
+        internal::CoroutineWaiter* waiter = *waiting_.begin();
+        Unregister(waiter);
+        ready.push_back(waiter);
+    }
+    for (std::size_t i=0; i<ready.size(); i++)
+        ready[i]->handle_.resume();
+    log_debug("Executor stopped");
+}
+
+Task<bool> CoroutineExecutor::Call(Client& client, const char* method, Value& params, Value& result)
+{
+    bool success = client.Post(method, params, result);
+    if (success)
+    {
+        bool ready = co_await Readable(client.GetFileDescriptor(), static_cast<int>(client.GetTimeout()));
+        if (ready)
+            success = client.GetPostResult(result);
+        else
+        {
+            // the response might still arrive so the connection can't be used again
+            client.Close();
+            result.SetInvalid();
+            result["code"] = AnyRpcErrorTransportError;
+            result["message"] = "Timeout waiting for response";
+            success = false;
+        }
+    }
+    co_return success;
+}
+
+} // namespace anyrpc
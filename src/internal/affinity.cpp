@@ -0,0 +1,143 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "anyrpc/api.h"
+#include "anyrpc/logger.h"
+#include "anyrpc/internal/affinity.h"
+
+#if defined(ANYRPC_THREADING)
+
+#if defined(__linux__)
+# include <pthread.h>  // for pthread_setaffinity_np, pthread_setname_np
+# include <sched.h>
+#endif // defined(__linux__)
+
+namespace anyrpc
+{
+namespace internal
+{
+
+log_define("AnyRPC.Affinity");
+
+#if defined(__linux__)
+static bool FillCpuSet(const CpuSet& cpus, cpu_set_t& cpuSet)
+{
+    CPU_ZERO(&cpuSet);
+    for (std::size_t i=0; i<cpus.size(); i++)
+    {
+        if (cpus[i] >= CPU_SETSIZE)
+        {
+            log_warn("Cpu " << cpus[i] << " is out of range");
+            return false;
+        }
+        CPU_SET(cpus[i], &cpuSet);
+    }
+    return !cpus.empty();
+}
+
+static bool SetAffinity(pthread_t handle, const CpuSet& cpus)
+{
+    cpu_set_t cpuSet;
+    if (!FillCpuSet(cpus, cpuSet))
+        return false;
+    int result = pthread_setaffinity_np(handle, sizeof(cpuSet), &cpuSet);
+    if (result != 0)
+    {
+        log_warn("Could not set the thread affinity: " << result);
+        return false;
+    }
+    return true;
+}
+
+static bool SetName(pthread_t handle, const std::string& name)
+{
+    // the name including the terminator is limited to 16 characters
+    std::string shortName = name.substr(0, 15);
+    int result = pthread_setname_np(handle, shortName.c_str());
+    if (result != 0)
+    {
+        log_warn("Could not set the thread name to " << shortName << ": " << result);
+        return false;
+    }
+    return true;
+}
+#endif // defined(__linux__)
+
+bool SetThreadAffinity(std::thread& thread, const CpuSet& cpus)
+{
+#if defined(__linux__)
+    return SetAffinity(thread.native_handle(), cpus);
+#else
+    log_warn("Setting the thread affinity is not supported on this platform");
+    return false;
+#endif // defined(__linux__)
+}
+
+bool SetCurrentThreadAffinity(const CpuSet& cpus)
+{
+#if defined(__linux__)
+    return SetAffinity(pthread_self(), cpus);
+#else
+    log_warn("Setting the thread affinity is not supported on this platform");
+    return false;
+#endif // defined(__linux__)
+}
+
+bool GetCurrentThreadAffinity(CpuSet& cpus)
+{
+    cpus.clear();
+#if defined(__linux__)
+    cpu_set_t cpuSet;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) != 0)
+        return false;
+    for (unsigned cpu=0; cpu<CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &cpuSet))
+            cpus.push_back(cpu);
+    return true;
+#else
+    return false;
+#endif // defined(__linux__)
+}
+
+bool SetThreadName(std::thread& thread, const std::string& name)
+{
+#if defined(__linux__)
+    return SetName(thread.native_handle(), name);
+#else
+    log_debug("Setting the thread name is not supported on this platform");
+    return false;
+#endif // defined(__linux__)
+}
+
+bool SetCurrentThreadName(const std::string& name)
+{
+#if defined(__linux__)
+    return SetName(pthread_self(), name);
+#else
+    log_debug("Setting the thread name is not supported on this platform");
+    return false;
+#endif // defined(__linux__)
+}
+
+} // namespace internal
+} // namespace anyrpc
+
+#endif // defined(ANYRPC_THREADING)
@@ -39,6 +39,10 @@ void HttpHeader::Initialize()
     contentType_.clear();
     contentLength_ = -1;
     keepAlive_ = true;
+    chunked_ = false;
+    upgrade_.clear();
+    connectionUpgrade_ = false;
+    webSocketProtocol_.clear();
     headerResult_ = HEADER_INCOMPLETE;
 }
 
@@ -79,6 +83,51 @@ HttpHeader::ResultEnum HttpHeader::ProcessHeaderData(const char* buffer, size_t
     return headerResult_;
 }
 
+HttpHeader::ResultEnum HttpHeader::ProcessTransferEncoding(std::string &value)
+{
+    // make value lower case
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+
+    // compressed bodies are not supported so chunked must be the only encoding
+    if (value.compare("chunked") != 0)
+    {
+        log_warn("Transfer-encoding not supported: " << value);
+        return HEADER_FAULT;
+    }
+    chunked_ = true;
+    return HEADER_INCOMPLETE;
+}
+
+HttpHeader::ResultEnum HttpHeader::VerifyBodyLength(bool required)
+{
+    if (chunked_ && (contentLength_ >= 0))
+    {
+        // a message with both could be read differently by a proxy
+        log_warn("Content length specified with chunked transfer encoding");
+        return HEADER_FAULT;
+    }
+    if ((contentLength_ < 0) && !chunked_ && required)
+    {
+        log_warn("Invalid content length: " << contentLength_);
+        return HEADER_FAULT;
+    }
+    return HEADER_COMPLETE;
+}
+
+bool HttpHeader::ProcessUpgradeLine(std::string &key, std::string &value)
+{
+    if (key.compare("upgrade") == 0)
+    {
+        upgrade_ = value;
+        std::transform(upgrade_.begin(), upgrade_.end(), upgrade_.begin(), ::tolower);
+    }
+    else if (key.compare("sec-websocket-protocol") == 0)
+        webSocketProtocol_ = value;
+    else
+        return false;
+    return true;
+}
+
 const char* HttpHeader::FindChar(const char* str, size_t length, char c)
 {
     while (length > 0)
@@ -165,6 +214,8 @@ void HttpRequest::Initialize()
     method_.clear();
     requestUri_.clear();
     host_.clear();
+    webSocketKey_.clear();
+    webSocketVersion_.clear();
 }
 
 HttpHeader::ResultEnum HttpRequest::ProcessFirstLine(std::string &first, std::string &second, std::string &third)
@@ -195,6 +246,9 @@ HttpHeader::ResultEnum HttpRequest::ProcessFirstLine(std::string &first, std::st
 HttpHeader::ResultEnum HttpRequest::ProcessLine(std::string &key, std::string &value)
 {
     log_trace();
+    if (ProcessUpgradeLine(key, value))
+        return HEADER_INCOMPLETE;
+
     if (key.compare("content-length") == 0)
     {
         if (contentLength_ != -1)
@@ -209,6 +263,10 @@ HttpHeader::ResultEnum HttpRequest::ProcessLine(std::string &key, std::string &v
             return HEADER_FAULT;
         }
     }
+    else if (key.compare("sec-websocket-key") == 0)
+        webSocketKey_ = value;
+    else if (key.compare("sec-websocket-version") == 0)
+        webSocketVersion_ = value;
     else if (key.compare("host") == 0)
     {
         if (host_.length() > 0)
@@ -235,7 +293,11 @@ HttpHeader::ResultEnum HttpRequest::ProcessLine(std::string &key, std::string &v
             keepAlive_ = true;
         else if (value.compare("close") == 0)
             keepAlive_ = false;
+        if (value.find("upgrade") != std::string::npos)
+            connectionUpgrade_ = true;
     }
+    else if (key.compare("transfer-encoding") == 0)
+        return ProcessTransferEncoding(value);
 
     return HEADER_INCOMPLETE;
 }
@@ -251,12 +313,7 @@ HttpHeader::ResultEnum HttpRequest::Verify()
             return HEADER_FAULT;
         }
     }
-    if ((contentLength_ < 0) && (method_ == "POST"))
-    {
-        log_warn("Invalid content length: " << contentLength_);
-        return HEADER_FAULT;
-    }
-    return HEADER_COMPLETE;
+    return VerifyBodyLength(method_ == "POST");
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -266,6 +323,7 @@ void HttpResponse::Initialize()
     HttpHeader::Initialize();
     responseCode_.clear();
     responseString_.clear();
+    webSocketAccept_.clear();
 }
 
 HttpHeader::ResultEnum HttpResponse::ProcessFirstLine(std::string &first, std::string &second, std::string &third)
@@ -291,6 +349,9 @@ HttpHeader::ResultEnum HttpResponse::ProcessFirstLine(std::string &first, std::s
 
 HttpHeader::ResultEnum HttpResponse::ProcessLine(std::string &key, std::string &value)
 {
+    if (ProcessUpgradeLine(key, value))
+        return HEADER_INCOMPLETE;
+
     if (key.compare("content-length") == 0)
     {
         if (contentLength_ != -1)
@@ -323,19 +384,176 @@ HttpHeader::ResultEnum HttpResponse::ProcessLine(std::string &key, std::string &
             keepAlive_ = true;
         else if (value.compare("close") == 0)
             keepAlive_ = false;
+        if (value.find("upgrade") != std::string::npos)
+            connectionUpgrade_ = true;
     }
+    else if (key.compare("transfer-encoding") == 0)
+        return ProcessTransferEncoding(value);
+    else if (key.compare("sec-websocket-accept") == 0)
+        webSocketAccept_ = value;
 
     return HEADER_INCOMPLETE;
 }
 
 HttpHeader::ResultEnum HttpResponse::Verify()
 {
-    if (contentLength_ < 0)
+    // the switching protocols response is followed by the data of the new protocol
+    return VerifyBodyLength(responseCode_ != "101");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void HttpChunkedDecoder::Initialize()
+{
+    state_ = CHUNK_SIZE;
+    chunkSize_ = 0;
+    sizeDigits_ = 0;
+    sizeEnded_ = false;
+    lineEnd_ = false;
+    lineLength_ = 0;
+}
+
+void HttpChunkedDecoder::EndSizeLine()
+{
+    if (sizeDigits_ == 0)
     {
-        log_warn("Invalid content length: " << contentLength_);
-        return HEADER_FAULT;
+        log_warn("Missing chunk size");
+        state_ = FAULT;
+    }
+    else
+    {
+        // the last chunk has a size of 0 and is followed by the trailer
+        log_debug("Chunk size=" << chunkSize_);
+        state_ = (chunkSize_ > 0) ? CHUNK_DATA : TRAILER;
+        lineLength_ = 0;
+    }
+}
+
+void HttpChunkedDecoder::EndLine()
+{
+    switch (state_)
+    {
+        case CHUNK_SIZE:
+        case CHUNK_EXTENSION:
+            EndSizeLine();
+            break;
+        case CHUNK_END:
+            state_ = CHUNK_SIZE;
+            sizeDigits_ = 0;
+            sizeEnded_ = false;
+            break;
+        case TRAILER:
+            // an empty line ends the trailer fields and the body
+            if (lineLength_ == 0)
+                state_ = DONE;
+            lineLength_ = 0;
+            break;
+        default:
+            break;
+    }
+}
+
+HttpChunkedDecoder::ResultEnum HttpChunkedDecoder::Process(const char* buffer, size_t length, size_t& consumed,
+                                                          const char*& data, size_t& dataLength)
+{
+    consumed = 0;
+    data = 0;
+    dataLength = 0;
+    while ((consumed < length) && (state_ != DONE) && (state_ != FAULT))
+    {
+        if (state_ == CHUNK_DATA)
+        {
+            // return the data in the chunk that is available
+            data = buffer + consumed;
+            dataLength = std::min(chunkSize_, length - consumed);
+            consumed += dataLength;
+            chunkSize_ -= dataLength;
+            if (chunkSize_ == 0)
+                state_ = CHUNK_END;
+            break;
+        }
+
+        // every line ends with CRLF - a CR can't be part of the line and a bare LF isn't accepted
+        char c = buffer[consumed++];
+        if (lineEnd_)
+        {
+            lineEnd_ = false;
+            if (c == '\n')
+                EndLine();
+            else
+            {
+                log_warn("Missing LF after CR in chunked body");
+                state_ = FAULT;
+            }
+            continue;
+        }
+        if (c == '\r')
+        {
+            lineEnd_ = true;
+            continue;
+        }
+        if (c == '\n')
+        {
+            log_warn("Line in chunked body ends without CR");
+            state_ = FAULT;
+            break;
+        }
+
+        switch (state_)
+        {
+            case CHUNK_SIZE:
+                if (isxdigit(static_cast<unsigned char>(c)) && !sizeEnded_)
+                {
+                    if (sizeDigits_ >= MaxSizeDigits)
+                    {
+                        log_warn("Chunk size too large");
+                        state_ = FAULT;
+                        break;
+                    }
+                    int digit = isdigit(static_cast<unsigned char>(c)) ? c - '0' : tolower(c) - 'a' + 10;
+                    chunkSize_ = chunkSize_ * 16 + digit;
+                    sizeDigits_++;
+                }
+                else if (c == ';')
+                    state_ = CHUNK_EXTENSION;
+                else if (((c == ' ') || (c == '\t')) && (sizeDigits_ > 0))
+                    // whitespace is only allowed between the size and the extension or line end
+                    sizeEnded_ = true;
+                else
+                {
+                    log_warn("Invalid character in chunk size: " << static_cast<int>(c));
+                    state_ = FAULT;
+                }
+                break;
+            case CHUNK_EXTENSION:
+                if (++lineLength_ > MaxLineLength)
+                {
+                    log_warn("Chunk extension too long");
+                    state_ = FAULT;
+                }
+                break;
+            case CHUNK_END:
+                // the data is followed directly by CRLF
+                log_warn("Missing line end after chunk data");
+                state_ = FAULT;
+                break;
+            case TRAILER:
+                if (++lineLength_ > MaxLineLength)
+                {
+                    log_warn("Trailer field too long");
+                    state_ = FAULT;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    switch (state_)
+    {
+        case DONE   : return CHUNKED_COMPLETE;
+        case FAULT  : return CHUNKED_FAULT;
+        default     : return CHUNKED_INCOMPLETE;
     }
-    return HEADER_COMPLETE;
 }
 
 } // namespace internal
@@ -0,0 +1,553 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "anyrpc/api.h"
+#include "anyrpc/logger.h"
+#include "anyrpc/error.h"
+#include "anyrpc/stream.h"
+#include "anyrpc/internal/http2.h"
+
+namespace anyrpc
+{
+namespace internal
+{
+
+const char* const Http2Frame::Preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+static void Put32(Stream& os, uint32_t value)
+{
+    os.Put(static_cast<char>(value >> 24));
+    os.Put(static_cast<char>(value >> 16));
+    os.Put(static_cast<char>(value >> 8));
+    os.Put(static_cast<char>(value));
+}
+
+void Http2Frame::ParseHeader(const char* data)
+{
+    const unsigned char* header = reinterpret_cast<const unsigned char*>(data);
+    length_ = (static_cast<std::size_t>(header[0]) << 16) | (header[1] << 8) | header[2];
+    type_ = header[3];
+    flags_ = header[4];
+    // the reserved bit is ignored
+    streamId_ = Get32(data+5) & MaxWindowSize;
+}
+
+bool Http2Frame::GetData(const char* payload, const char*& data, std::size_t& length) const
+{
+    std::size_t start = 0;
+    std::size_t padding = 0;
+    if ((flags_ & FLAG_PADDED) && ((type_ == FRAME_DATA) || (type_ == FRAME_HEADERS)))
+    {
+        if (length_ < 1)
+            return false;
+        padding = static_cast<unsigned char>(payload[0]);
+        start = 1;
+    }
+    // the priority of a stream is not used
+    if ((flags_ & FLAG_PRIORITY) && (type_ == FRAME_HEADERS))
+        start += 5;
+    if (start + padding > length_)
+        return false;
+    data = payload + start;
+    length = length_ - start - padding;
+    return true;
+}
+
+uint32_t Http2Frame::Get32(const char* data)
+{
+    const unsigned char* value = reinterpret_cast<const unsigned char*>(data);
+    return (static_cast<uint32_t>(value[0]) << 24) | (value[1] << 16) | (value[2] << 8) | value[3];
+}
+
+unsigned Http2Frame::Get16(const char* data)
+{
+    const unsigned char* value = reinterpret_cast<const unsigned char*>(data);
+    return (value[0] << 8) | value[1];
+}
+
+void Http2Frame::WriteHeader(Stream& os, std::size_t length, unsigned type, unsigned flags, uint32_t streamId)
+{
+    os.Put(static_cast<char>(length >> 16));
+    os.Put(static_cast<char>(length >> 8));
+    os.Put(static_cast<char>(length));
+    os.Put(static_cast<char>(type));
+    os.Put(static_cast<char>(flags));
+    Put32(os, streamId);
+}
+
+void Http2Frame::WriteSetting(Stream& os, unsigned id, uint32_t value)
+{
+    os.Put(static_cast<char>(id >> 8));
+    os.Put(static_cast<char>(id));
+    Put32(os, value);
+}
+
+void Http2Frame::WriteWindowUpdate(Stream& os, uint32_t streamId, uint32_t increment)
+{
+    WriteHeader(os, 4, FRAME_WINDOW_UPDATE, 0, streamId);
+    Put32(os, increment);
+}
+
+void Http2Frame::WriteRstStream(Stream& os, uint32_t streamId, unsigned errorCode)
+{
+    WriteHeader(os, 4, FRAME_RST_STREAM, 0, streamId);
+    Put32(os, errorCode);
+}
+
+void Http2Frame::WriteGoAway(Stream& os, uint32_t lastStreamId, unsigned errorCode)
+{
+    WriteHeader(os, 8, FRAME_GOAWAY, 0, 0);
+    Put32(os, lastStreamId);
+    Put32(os, errorCode);
+}
+
+void Http2Frame::WritePing(Stream& os, const char* data, bool ack)
+{
+    WriteHeader(os, 8, FRAME_PING, ack ? FLAG_ACK : 0, 0);
+    os.Put(data, 8);
+}
+
+void Http2Frame::WriteHeaders(Stream& os, uint32_t streamId, const std::string& block, bool endStream, std::size_t maxFrameSize)
+{
+    std::size_t length = std::min(block.length(), maxFrameSize);
+    unsigned flags = (endStream ? FLAG_END_STREAM : 0) | ((length == block.length()) ? FLAG_END_HEADERS : 0);
+    WriteHeader(os, length, FRAME_HEADERS, flags, streamId);
+    os.Put(block.data(), length);
+    for (std::size_t position = length; position < block.length(); position += length)
+    {
+        length = std::min(block.length() - position, maxFrameSize);
+        WriteHeader(os, length, FRAME_CONTINUATION, (position + length == block.length()) ? FLAG_END_HEADERS : 0, streamId);
+        os.Put(block.data() + position, length);
+    }
+}
+
+void Http2Frame::WriteData(Stream& os, uint32_t streamId, WriteBufferedStream& data, std::size_t offset, std::size_t length, bool endStream)
+{
+    WriteHeader(os, length, FRAME_DATA, endStream ? FLAG_END_STREAM : 0, streamId);
+    while (length > 0)
+    {
+        std::size_t segmentLength;
+        const char* buffer = data.GetBuffer(offset, segmentLength);
+        if ((buffer == 0) || (segmentLength == 0))
+            break;
+        segmentLength = std::min(segmentLength, length);
+        os.Put(buffer, segmentLength);
+        offset += segmentLength;
+        length -= segmentLength;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Table of the header fields that are indexed from 1 without being added by the encoder
+struct StaticEntry
+{
+    const char* name_;
+    const char* value_;
+};
+
+static const StaticEntry StaticTable[] =
+{
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+static const std::size_t StaticTableLength = sizeof(StaticTable) / sizeof(StaticTable[0]);
+
+static const std::size_t MaxHeaderListSize = 64*1024;   //!< Largest header list that a block can decode to
+
+bool HpackDecoder::Decode(const char* block, std::size_t length, HpackHeaderList& headers)
+{
+    const unsigned char* pos = reinterpret_cast<const unsigned char*>(block);
+    const unsigned char* end = pos + length;
+    std::size_t listSize = 0;
+    bool fieldDecoded = false;
+    while (pos < end)
+    {
+        std::string name;
+        std::string value;
+        std::size_t index;
+        if (*pos & 0x80)
+        {
+            // indexed field
+            if (!DecodeInteger(pos, end, 7, index) || !GetEntry(index, name, value))
+                return false;
+        }
+        else if ((*pos & 0xe0) == 0x20)
+        {
+            // a table size update is only allowed at the start of a block and within the size from the settings
+            if (fieldDecoded || !DecodeInteger(pos, end, 5, index) || (index > DefaultTableSize))
+                return false;
+            maxTableSize_ = index;
+            EvictEntries(maxTableSize_);
+            continue;
+        }
+        else
+        {
+            // literal field that is added to the table (6 bit prefix), or not added (4 bit prefix)
+            bool addEntry = ((*pos & 0xc0) == 0x40);
+            if (!DecodeInteger(pos, end, addEntry ? 6 : 4, index))
+                return false;
+            if (index == 0)
+            {
+                if (!DecodeString(pos, end, name))
+                    return false;
+            }
+            else if (!GetEntry(index, name, value))
+                return false;
+            if (!DecodeString(pos, end, value))
+                return false;
+            if (addEntry)
+                AddEntry(name, value);
+        }
+        // a small block can refer to the large table entries many times
+        listSize += name.length() + value.length() + EntryOverhead;
+        if (listSize > MaxHeaderListSize)
+        {
+            log_warn("Header list too large");
+            return false;
+        }
+        fieldDecoded = true;
+        headers.push_back(std::make_pair(name, value));
+    }
+    return true;
+}
+
+bool HpackDecoder::DecodeInteger(const unsigned char*& pos, const unsigned char* end, unsigned prefixBits, std::size_t& value)
+{
+    if (pos >= end)
+        return false;
+    std::size_t prefixMax = (1u << prefixBits) - 1;
+    value = *pos++ & prefixMax;
+    if (value < prefixMax)
+        return true;
+    for (unsigned shift = 0; (pos < end) && (shift <= 28); shift += 7)
+    {
+        unsigned char byte = *pos++;
+        value += static_cast<std::size_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool HpackDecoder::DecodeString(const unsigned char*& pos, const unsigned char* end, std::string& str)
+{
+    if (pos >= end)
+        return false;
+    bool huffman = ((*pos & 0x80) != 0);
+    std::size_t length;
+    if (!DecodeInteger(pos, end, 7, length) || (length > static_cast<std::size_t>(end - pos)))
+        return false;
+    if (huffman)
+    {
+        str.clear();
+        if (!HuffmanDecode(pos, length, str))
+            return false;
+    }
+    else
+        str.assign(reinterpret_cast<const char*>(pos), length);
+    pos += length;
+    return true;
+}
+
+bool HpackDecoder::GetEntry(std::size_t index, std::string& name, std::string& value)
+{
+    if (index == 0)
+        return false;
+    if (index <= StaticTableLength)
+    {
+        name = StaticTable[index-1].name_;
+        value = StaticTable[index-1].value_;
+        return true;
+    }
+    index -= StaticTableLength + 1;
+    if (index >= table_.size())
+        return false;
+    name = table_[index].first;
+    value = table_[index].second;
+    return true;
+}
+
+void HpackDecoder::AddEntry(const std::string& name, const std::string& value)
+{
+    // an entry larger than the table empties it
+    std::size_t size = name.length() + value.length() + EntryOverhead;
+    if (size > maxTableSize_)
+    {
+        EvictEntries(0);
+        return;
+    }
+    EvictEntries(maxTableSize_ - size);
+    table_.push_front(std::make_pair(name, value));
+    tableSize_ += size;
+}
+
+void HpackDecoder::EvictEntries(std::size_t size)
+{
+    while (tableSize_ > size)
+    {
+        tableSize_ -= table_.back().first.length() + table_.back().second.length() + EntryOverhead;
+        table_.pop_back();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void EncodeInteger(std::string& block, unsigned char pattern, unsigned prefixBits, std::size_t value)
+{
+    std::size_t prefixMax = (1u << prefixBits) - 1;
+    if (value < prefixMax)
+    {
+        block += static_cast<char>(pattern | value);
+        return;
+    }
+    block += static_cast<char>(pattern | prefixMax);
+    for (value -= prefixMax; value >= 0x80; value >>= 7)
+        block += static_cast<char>((value & 0x7f) | 0x80);
+    block += static_cast<char>(value);
+}
+
+static void EncodeString(std::string& block, const std::string& str)
+{
+    std::size_t huffmanLength = HuffmanEncodedLength(str);
+    if (huffmanLength < str.length())
+    {
+        EncodeInteger(block, 0x80, 7, huffmanLength);
+        HuffmanEncode(str, block);
+    }
+    else
+    {
+        EncodeInteger(block, 0, 7, str.length());
+        block += str;
+    }
+}
+
+void HpackEncode(std::string& block, const std::string& name, const std::string& value)
+{
+    std::size_t nameIndex = 0;
+    for (std::size_t i = 0; i < StaticTableLength; i++)
+    {
+        if (name != StaticTable[i].name_)
+            continue;
+        if (value == StaticTable[i].value_)
+        {
+            EncodeInteger(block, 0x80, 7, i+1);
+            return;
+        }
+        if (nameIndex == 0)
+            nameIndex = i+1;
+    }
+    // literal without indexing
+    EncodeInteger(block, 0, 4, nameIndex);
+    if (nameIndex == 0)
+        EncodeString(block, name);
+    EncodeString(block, value);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Length in bits of the Huffman code for each byte value and the end of string symbol (256)
+static const unsigned char HuffmanLengths[257] =
+{
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+//! The HPACK Huffman code is canonical so the codes are assigned from the lengths
+/*!
+ *  The codes of each length are consecutive, in the order of the symbols, and
+ *  follow the codes of the shorter lengths.
+ */
+struct HuffmanCode
+{
+    HuffmanCode();
+
+    static const unsigned MaxLength = 30;
+    static const unsigned Eos = 256;
+
+    uint32_t code_[Eos+1];              //!< Code for each symbol
+    uint32_t firstCode_[MaxLength+1];   //!< First code with each length
+    unsigned count_[MaxLength+1];       //!< Number of codes with each length
+    unsigned offset_[MaxLength+1];      //!< Position in symbols_ of the first code with each length
+    unsigned symbols_[Eos+1];           //!< Symbols in the order of their codes
+};
+
+HuffmanCode::HuffmanCode()
+{
+    unsigned position = 0;
+    uint32_t code = 0;
+    for (unsigned length = 0; length <= MaxLength; length++)
+    {
+        offset_[length] = position;
+        firstCode_[length] = code;
+        count_[length] = 0;
+        for (unsigned symbol = 0; symbol <= Eos; symbol++)
+        {
+            if (HuffmanLengths[symbol] != length)
+                continue;
+            code_[symbol] = code++;
+            symbols_[position++] = symbol;
+            count_[length]++;
+        }
+        code <<= 1;
+    }
+}
+
+static const HuffmanCode& GetHuffmanCode()
+{
+    static const HuffmanCode huffmanCode;
+    return huffmanCode;
+}
+
+bool HuffmanDecode(const unsigned char* data, std::size_t length, std::string& str)
+{
+    const HuffmanCode& huffman = GetHuffmanCode();
+    uint32_t code = 0;
+    unsigned codeLength = 0;
+    for (std::size_t i = 0; i < length; i++)
+    {
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            code = (code << 1) | ((data[i] >> bit) & 1);
+            codeLength++;
+            if ((code >= huffman.firstCode_[codeLength]) && (code - huffman.firstCode_[codeLength] < huffman.count_[codeLength]))
+            {
+                unsigned symbol = huffman.symbols_[huffman.offset_[codeLength] + code - huffman.firstCode_[codeLength]];
+                if (symbol == HuffmanCode::Eos)
+                    return false;
+                str += static_cast<char>(symbol);
+                code = 0;
+                codeLength = 0;
+            }
+            else if (codeLength >= HuffmanCode::MaxLength)
+                return false;
+        }
+    }
+    // the padding is shorter than a byte and is the start of the end of string symbol, all ones
+    return (codeLength < 8) && (code == (1u << codeLength) - 1);
+}
+
+void HuffmanEncode(const std::string& str, std::string& out)
+{
+    const HuffmanCode& huffman = GetHuffmanCode();
+    uint64_t bits = 0;
+    unsigned bitCount = 0;
+    for (std::size_t i = 0; i < str.length(); i++)
+    {
+        unsigned char symbol = static_cast<unsigned char>(str[i]);
+        bits = (bits << HuffmanLengths[symbol]) | huffman.code_[symbol];
+        bitCount += HuffmanLengths[symbol];
+        while (bitCount >= 8)
+        {
+            bitCount -= 8;
+            out += static_cast<char>(bits >> bitCount);
+        }
+        bits &= (static_cast<uint64_t>(1) << bitCount) - 1;
+    }
+    // pad with the start of the end of string symbol
+    if (bitCount > 0)
+        out += static_cast<char>((bits << (8 - bitCount)) | ((1u << (8 - bitCount)) - 1));
+}
+
+std::size_t HuffmanEncodedLength(const std::string& str)
+{
+    std::size_t bitCount = 0;
+    for (std::size_t i = 0; i < str.length(); i++)
+        bitCount += HuffmanLengths[static_cast<unsigned char>(str[i])];
+    return (bitCount + 7) / 8;
+}
+
+} // namespace internal
+} // namespace anyrpc
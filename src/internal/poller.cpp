@@ -0,0 +1,1153 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "anyrpc/api.h"
+#include "anyrpc/logger.h"
+#include "anyrpc/socket.h"
+#include "anyrpc/internal/time.h"
+#include "anyrpc/internal/poller.h"
+
+#if !defined(WIN32)
+# include <unistd.h>
+# include <errno.h>
+# include <sys/select.h>
+#endif // !defined(WIN32)
+
+#if defined(ANYRPC_URING)
+# include <poll.h>
+# include <signal.h>
+# include <sys/mman.h>
+# include <sys/socket.h>
+# include <sys/syscall.h>
+#endif // defined(ANYRPC_URING)
+
+namespace anyrpc
+{
+namespace internal
+{
+
+Poller* Poller::Create(PollerType type)
+{
+#if defined(ANYRPC_URING)
+    if (type == POLLER_URING)
+    {
+        UringPoller* uringPoller = new UringPoller();
+        if (uringPoller->IsValid())
+            return uringPoller;
+        log_warn("Could not create io_uring instance, using epoll");
+        delete uringPoller;
+    }
+#endif // defined(ANYRPC_URING)
+#if defined(ANYRPC_EPOLL)
+    if (type != POLLER_SELECT)
+    {
+        EpollPoller* epollPoller = new EpollPoller();
+        if (epollPoller->IsValid())
+            return epollPoller;
+        log_warn("Could not create epoll instance, using select");
+        delete epollPoller;
+    }
+#endif // defined(ANYRPC_EPOLL)
+    return new SelectPoller();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool SelectPoller::Add(SOCKET fd, unsigned events, void* data)
+{
+    if (entries_.find(fd) != entries_.end())
+    {
+        log_warn("Add: fd already registered, fd=" << fd);
+        return false;
+    }
+    entries_[fd] = Entry(events, data);
+    return true;
+}
+
+bool SelectPoller::Modify(SOCKET fd, unsigned events, void* data)
+{
+    EntryMap::iterator it = entries_.find(fd);
+    if (it == entries_.end())
+    {
+        log_warn("Modify: fd not registered, fd=" << fd);
+        return false;
+    }
+    it->second = Entry(events, data);
+    return true;
+}
+
+bool SelectPoller::Remove(SOCKET fd)
+{
+    return (entries_.erase(fd) > 0);
+}
+
+int SelectPoller::Wait(int ms)
+{
+    ready_.clear();
+
+    // Construct the sets of descriptors we are interested in
+    fd_set inFd, outFd;
+    FD_ZERO(&inFd);
+    FD_ZERO(&outFd);
+
+    SOCKET maxFd = 0;
+    for (EntryMap::iterator it = entries_.begin(); it != entries_.end(); ++it)
+    {
+        if (it->second.events_ & EVENT_READ)
+            FD_SET(it->first, &inFd);
+        if (it->second.events_ & EVENT_WRITE)
+            FD_SET(it->first, &outFd);
+        maxFd = std::max(it->first, maxFd);
+    }
+
+    // Check for events
+    int nEvents;
+    if (ms < 0)
+        nEvents = select(static_cast<int>(maxFd) + 1, &inFd, &outFd, NULL, NULL);
+    else
+    {
+        struct timeval tv;
+        tv.tv_sec = ms / 1000;
+        tv.tv_usec = (ms - tv.tv_sec*1000) * 1000;
+        nEvents = select(static_cast<int>(maxFd) + 1, &inFd, &outFd, NULL, &tv);
+    }
+
+    if (nEvents < 0)
+    {
+#if !defined(WIN32)
+        if (errno == EINTR)
+            return 0;
+#endif // !defined(WIN32)
+        log_warn("select failed, result=" << nEvents);
+        return -1;
+    }
+
+    for (EntryMap::iterator it = entries_.begin(); (it != entries_.end()) && (nEvents > 0); ++it)
+    {
+        unsigned events = EVENT_NONE;
+        if (FD_ISSET(it->first, &inFd))
+            events |= EVENT_READ;
+        if (FD_ISSET(it->first, &outFd))
+            events |= EVENT_WRITE;
+        if (events != EVENT_NONE)
+            ready_.push_back(Entry(events, it->second.data_));
+    }
+    return static_cast<int>(ready_.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(ANYRPC_EPOLL)
+EpollPoller::EpollPoller()
+{
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    log_debug("EpollPoller: epfd=" << epfd_);
+}
+
+EpollPoller::~EpollPoller()
+{
+    if (epfd_ >= 0)
+        close(epfd_);
+}
+
+bool EpollPoller::Control(int operation, SOCKET fd, unsigned events, void* data)
+{
+    struct epoll_event event;
+    event.events = 0;
+    if (events & EVENT_READ)
+        event.events |= EPOLLIN;
+    if (events & EVENT_WRITE)
+        event.events |= EPOLLOUT;
+    event.data.ptr = data;
+
+    int result = epoll_ctl(epfd_, operation, fd, &event);
+    if (result != 0)
+    {
+        log_warn("epoll_ctl failed, operation=" << operation << ", fd=" << fd << ", errno=" << errno);
+        return false;
+    }
+    return true;
+}
+
+bool EpollPoller::Add(SOCKET fd, unsigned events, void* data)
+{
+    return Control(EPOLL_CTL_ADD, fd, events, data);
+}
+
+bool EpollPoller::Modify(SOCKET fd, unsigned events, void* data)
+{
+    return Control(EPOLL_CTL_MOD, fd, events, data);
+}
+
+bool EpollPoller::Remove(SOCKET fd)
+{
+    return Control(EPOLL_CTL_DEL, fd, EVENT_NONE, 0);
+}
+
+int EpollPoller::Wait(int ms)
+{
+    int nEvents = epoll_wait(epfd_, events_, MaxEvents, ms);
+    if ((nEvents < 0) && (errno == EINTR))
+        return 0;
+    if (nEvents < 0)
+        log_warn("epoll_wait failed, errno=" << errno);
+    return nEvents;
+}
+
+unsigned EpollPoller::GetEvents(int index)
+{
+    unsigned events = EVENT_NONE;
+    uint32_t epollEvents = events_[index].events;
+    if (epollEvents & EPOLLIN)
+        events |= EVENT_READ;
+    if (epollEvents & EPOLLOUT)
+        events |= EVENT_WRITE;
+    if (epollEvents & (EPOLLERR | EPOLLHUP))
+        events |= EVENT_ERROR;
+    return events;
+}
+#endif // defined(ANYRPC_EPOLL)
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(ANYRPC_URING)
+static const unsigned UringEntries = 256;
+
+// The low bits of the user data for a channel operation tell which one completed,
+// and are 0 for a poll request of a registration
+static const uintptr_t TagMask = 3;
+static const unsigned TagRecv = 1;
+static const unsigned TagSend = 2;
+static const unsigned TagAccept = 3;
+// Milliseconds that deleting the poller waits for the sends in the ring to complete
+static const int FlushTimeout = 100;
+
+static unsigned PollEvents(unsigned events)
+{
+    unsigned pollEvents = 0;
+    if (events & Poller::EVENT_READ)
+        pollEvents |= POLLIN;
+    if (events & Poller::EVENT_WRITE)
+        pollEvents |= POLLOUT;
+    return pollEvents;
+}
+
+UringPoller::UringPoller() :
+    ringFd_(-1), sqRing_(MAP_FAILED), sqRingSize_(0), cqRing_(MAP_FAILED), cqRingSize_(0),
+    sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)), sqesSize_(0), sqLocalTail_(0),
+    bufferRing_(MAP_FAILED), bufferRingSize_(0), buffers_(0), bufferTail_(0), buffersExhausted_(false), multishotRecv_(true)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd_ = static_cast<int>(syscall(__NR_io_uring_setup, UringEntries, &params));
+    if (ringFd_ < 0)
+    {
+        log_info("io_uring_setup failed, errno=" << errno);
+        return;
+    }
+
+    // The wait with a timeout requires the extended argument and poll requests are
+    // not resubmitted so completions must never be dropped.  There is no feature flag
+    // for updating the events of a poll request (5.13) so use one from the same release.
+    unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS;
+    if ((params.features & required) != required)
+    {
+        log_info("io_uring does not support the required features=" << params.features);
+        Close();
+        return;
+    }
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    sqRing_ = mmap(0, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+    if (sqRing_ == MAP_FAILED)
+    {
+        log_warn("io_uring ring mmap failed, errno=" << errno);
+        Close();
+        return;
+    }
+    cqRing_ = sqRing_;
+
+    sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = static_cast<struct io_uring_sqe*>(mmap(0, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES));
+    if (sqes_ == MAP_FAILED)
+    {
+        log_warn("io_uring sqe mmap failed, errno=" << errno);
+        Close();
+        return;
+    }
+
+    char* sq = static_cast<char*>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqEntries_ = params.sq_entries;
+    sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqLocalTail_ = *sqTail_;
+
+    char* cq = static_cast<char*>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    log_debug("UringPoller: ringFd=" << ringFd_ << ", sqEntries=" << params.sq_entries << ", cqEntries=" << params.cq_entries);
+
+    // Without the buffers the poller still works but the sockets can't be attached
+    SetupBuffers();
+}
+
+bool UringPoller::SetupBuffers()
+{
+    // The ring of buffer entries is shared with the kernel so it has its own page aligned mapping
+    bufferRingSize_ = BufferCount * sizeof(struct io_uring_buf);
+    bufferRing_ = mmap(0, bufferRingSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufferRing_ == MAP_FAILED)
+    {
+        log_warn("io_uring buffer ring mmap failed, errno=" << errno);
+        return false;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uintptr_t>(bufferRing_);
+    reg.ring_entries = BufferCount;
+    reg.bgid = BufferGroup;
+    if (syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+    {
+        log_info("io_uring provided buffer rings not supported, errno=" << errno);
+        munmap(bufferRing_, bufferRingSize_);
+        bufferRing_ = MAP_FAILED;
+        return false;
+    }
+
+    // The buffers are only backed by memory as they are used
+    void* buffers = mmap(0, BufferCount * BufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED)
+    {
+        log_warn("io_uring buffers mmap failed, errno=" << errno);
+        return false;
+    }
+    buffers_ = static_cast<char*>(buffers);
+    for (unsigned i=0; i<BufferCount; i++)
+        ReturnBuffer(static_cast<unsigned short>(i));
+    return true;
+}
+
+void UringPoller::ReturnBuffer(unsigned short bufferId)
+{
+    // The tail overlays the reserved field of the first entry so only the other fields are written.
+    // The entries are indexed directly since io_uring_buf_ring has a different layout in C++.
+    struct io_uring_buf* bufs = static_cast<struct io_uring_buf*>(bufferRing_);
+    struct io_uring_buf* buf = &bufs[bufferTail_ & (BufferCount - 1)];
+    buf->addr = reinterpret_cast<uintptr_t>(GetBuffer(bufferId));
+    buf->len = BufferSize;
+    buf->bid = bufferId;
+    bufferTail_++;
+    __atomic_store_n(&bufs[0].resv, bufferTail_, __ATOMIC_RELEASE);
+    buffersExhausted_ = false;
+}
+
+UringPoller::~UringPoller()
+{
+    // The poll requests hold references to the sockets and closing the ring releases
+    // them asynchronously, so cancel them first to allow the caller to rebind the
+    // server port as soon as the poller is deleted
+    for (RegistrationMap::iterator it = registrations_.begin(); it != registrations_.end(); ++it)
+    {
+        Registration* registration = it->second;
+        if (registration->armed_)
+        {
+            registration->removed_ = true;
+            retired_.push_back(registration);
+            struct io_uring_sqe* sqe = GetSqe();
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = reinterpret_cast<uintptr_t>(registration);
+        }
+        else if (!registration->queued_)
+            delete registration;
+    }
+    registrations_.clear();
+    for (std::size_t i=0; i<armList_.size(); i++)
+        if (!armList_[i]->armed_)
+            delete armList_[i];
+    armList_.clear();
+
+    StopChannels();
+
+    bool busy = false;
+    for (int i=0; i<10; i++)
+    {
+        busy = false;
+        for (std::size_t j=0; j<closing_.size(); j++)
+            busy = busy || closing_[j]->IsBusy();
+        if ((!busy && retired_.empty()) || (Enter(1, 100) < 0))
+            break;
+        Reap();
+    }
+
+    Close();
+    for (std::size_t i=0; i<retired_.size(); i++)
+        delete retired_[i];
+    for (std::size_t i=0; i<closing_.size(); i++)
+    {
+        UringChannel* channel = closing_[i];
+        if (channel->fd_ >= 0)
+            close(channel->fd_);
+        // the kernel could still use the memory of an operation that never completed
+        if (!channel->IsBusy())
+            delete channel;
+    }
+    if (busy)
+        log_warn("io_uring operations not complete, buffers kept");
+    else if (buffers_ != 0)
+        munmap(buffers_, BufferCount * BufferSize);
+    if (bufferRing_ != MAP_FAILED)
+        munmap(bufferRing_, bufferRingSize_);
+}
+
+void UringPoller::StopChannels()
+{
+    // The sockets that are still attached close their own descriptors
+    for (ChannelMap::iterator it = channels_.begin(); it != channels_.end(); ++it)
+    {
+        UringChannel* channel = it->second;
+        channel->socket_->SetUring(0);
+        channel->socket_ = 0;
+        channel->closed_ = true;
+        channel->fd_ = static_cast<SOCKET>(-1);
+        closing_.push_back(channel);
+    }
+    channels_.clear();
+    channelList_.clear();
+
+    // The receives and accepts hold references to the sockets so they are canceled right away
+    bool sending = false;
+    for (std::size_t i=0; i<closing_.size(); i++)
+    {
+        UringChannel* channel = closing_[i];
+        channel->listed_ = true;    // so the completions don't list it again
+        if (channel->recvArmed_)
+            Cancel(channel, TagRecv);
+        if (channel->acceptArmed_)
+            Cancel(channel, TagAccept);
+        while (!channel->accepted_.empty())
+        {
+            close(channel->accepted_.front());
+            channel->accepted_.pop_front();
+        }
+        channel->output_.clear();
+        sending = sending || channel->sendArmed_;
+    }
+
+    // The sends in the ring get a short time to complete so the last responses are not cut off
+    int64_t endTime = MonotonicMicroTime() / 1000 + FlushTimeout;
+    while (sending)
+    {
+        int timeLeft = static_cast<int>(endTime - MonotonicMicroTime() / 1000);
+        if ((timeLeft <= 0) || (Enter(1, timeLeft) < 0))
+            break;
+        Reap();
+        sending = false;
+        for (std::size_t i=0; i<closing_.size(); i++)
+            sending = sending || closing_[i]->sendArmed_;
+    }
+    for (std::size_t i=0; i<closing_.size(); i++)
+    {
+        UringChannel* channel = closing_[i];
+        channel->sending_.clear();
+        channel->sent_ = 0;
+        if (channel->sendArmed_)
+            Cancel(channel, TagSend);
+    }
+}
+
+void UringPoller::Close()
+{
+    if (sqes_ != MAP_FAILED)
+        munmap(sqes_, sqesSize_);
+    if (sqRing_ != MAP_FAILED)
+        munmap(sqRing_, sqRingSize_);
+    sqes_ = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+    sqRing_ = cqRing_ = MAP_FAILED;
+    if (ringFd_ >= 0)
+        close(ringFd_);
+    ringFd_ = -1;
+}
+
+bool UringPoller::Add(SOCKET fd, unsigned events, void* data)
+{
+    ChannelMap::iterator channel = channels_.find(fd);
+    if (channel != channels_.end())
+    {
+        if (channel->second->registered_)
+        {
+            log_warn("Add: fd already registered, fd=" << fd);
+            return false;
+        }
+        channel->second->registered_ = true;
+        channel->second->events_ = events;
+        channel->second->data_ = data;
+        QueueChannel(channel->second);
+        return true;
+    }
+    if (registrations_.find(fd) != registrations_.end())
+    {
+        log_warn("Add: fd already registered, fd=" << fd);
+        return false;
+    }
+    Registration* registration = new Registration(fd, events, data);
+    registrations_[fd] = registration;
+    QueueArm(registration);
+    return true;
+}
+
+bool UringPoller::Modify(SOCKET fd, unsigned events, void* data)
+{
+    ChannelMap::iterator channel = channels_.find(fd);
+    if ((channel != channels_.end()) && channel->second->registered_)
+    {
+        channel->second->events_ = events;
+        channel->second->data_ = data;
+        QueueChannel(channel->second);
+        return true;
+    }
+    RegistrationMap::iterator it = registrations_.find(fd);
+    if (it == registrations_.end())
+    {
+        log_warn("Modify: fd not registered, fd=" << fd);
+        return false;
+    }
+    Registration* registration = it->second;
+    registration->events_ = events;
+    registration->data_ = data;
+    if (registration->armed_)
+    {
+        // Update the events of the armed poll request in place.  If it has already
+        // completed, then the update fails and the rearm will use the new events.
+        struct io_uring_sqe* sqe = GetSqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uintptr_t>(registration);
+        sqe->len = IORING_POLL_UPDATE_EVENTS;
+        sqe->poll32_events = PollEvents(events);
+    }
+    else
+        QueueArm(registration);
+    return true;
+}
+
+bool UringPoller::Remove(SOCKET fd)
+{
+    ChannelMap::iterator channel = channels_.find(fd);
+    if (channel != channels_.end())
+    {
+        // The receive stays armed until the socket is closed or holds too much data
+        bool registered = channel->second->registered_;
+        channel->second->registered_ = false;
+        channel->second->events_ = EVENT_NONE;
+        return registered;
+    }
+    RegistrationMap::iterator it = registrations_.find(fd);
+    if (it == registrations_.end())
+        return false;
+    Registration* registration = it->second;
+    registrations_.erase(it);
+
+    if (!registration->armed_)
+    {
+        // Only in the arm list so the next Wait call will discard it
+        registration->removed_ = true;
+        if (!registration->queued_)
+            delete registration;
+        return true;
+    }
+
+    // The poll request holds a reference to the socket so the cancel is submitted
+    // immediately so the socket is released when the caller closes it
+    registration->removed_ = true;
+    retired_.push_back(registration);
+    struct io_uring_sqe* sqe = GetSqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uintptr_t>(registration);
+    Enter(0, 0);
+    return true;
+}
+
+void UringPoller::QueueArm(Registration* registration)
+{
+    if (!registration->queued_)
+    {
+        registration->queued_ = true;
+        armList_.push_back(registration);
+    }
+}
+
+struct io_uring_sqe* UringPoller::GetSqe()
+{
+    // Submit the pending entries if the ring is full
+    while (sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_)
+    {
+        if (Enter(0, 0) < 0)
+            Reap();   // the completion ring needs space before more entries can be submitted
+    }
+
+    unsigned index = sqLocalTail_ & sqMask_;
+    struct io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    sqLocalTail_++;
+    return sqe;
+}
+
+int UringPoller::Enter(unsigned minComplete, int ms)
+{
+    // Publish the new entries to the kernel
+    __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+    unsigned toSubmit = sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (minComplete > 0)
+    {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (ms >= 0)
+        {
+            ts.tv_sec = ms / 1000;
+            ts.tv_nsec = (ms % 1000) * 1000000LL;
+            arg.ts = reinterpret_cast<uintptr_t>(&ts);
+        }
+    }
+    else if (toSubmit == 0)
+        return 0;
+    arg.sigmask_sz = _NSIG / 8;
+
+    int result = static_cast<int>(syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete, flags, &arg, sizeof(arg)));
+    if ((result < 0) && ((errno == ETIME) || (errno == EINTR)))
+        return 0;
+    if (result < 0)
+        log_warn("io_uring_enter failed, errno=" << errno);
+    return result;
+}
+
+int UringPoller::Wait(int ms)
+{
+    ready_.clear();
+
+    // Arm the poll requests for new registrations and ones that returned events.
+    // The list is swapped out since flushing a full ring may queue more registrations.
+    std::vector<Registration*> armList;
+    armList.swap(armList_);
+    for (std::size_t i=0; i<armList.size(); i++)
+    {
+        Registration* registration = armList[i];
+        registration->queued_ = false;
+        if (registration->removed_)
+        {
+            delete registration;
+            continue;
+        }
+        struct io_uring_sqe* sqe = GetSqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = static_cast<int>(registration->fd_);
+        sqe->poll32_events = PollEvents(registration->events_);
+        sqe->user_data = reinterpret_cast<uintptr_t>(registration);
+        registration->armed_ = true;
+    }
+
+    // Arm the receives and accepts and submit the queued data of the channels, which
+    // are level triggered so one that is already ready means not waiting
+    unsigned minComplete = 1;
+    for (std::size_t i=0; i<channelList_.size(); i++)
+    {
+        PrepareChannel(channelList_[i]);
+        if (ChannelEvents(channelList_[i]) != EVENT_NONE)
+            minComplete = 0;
+    }
+
+    // Check whether there are completions already available before waiting
+    if ((ms == 0) || (__atomic_load_n(cqTail_, __ATOMIC_ACQUIRE) != *cqHead_))
+        minComplete = 0;
+    if (Enter(minComplete, ms) < 0)
+        return -1;
+
+    Reap();
+
+    // Return the channels that are ready and keep the ones that still need to be prepared
+    std::size_t kept = 0;
+    for (std::size_t i=0; i<channelList_.size(); i++)
+    {
+        UringChannel* channel = channelList_[i];
+        if (channel->closed_)
+        {
+            if (!channel->IsBusy())
+            {
+                closing_.erase(std::find(closing_.begin(), closing_.end(), channel));
+                if (channel->fd_ >= 0)
+                    close(channel->fd_);
+                delete channel;
+            }
+            else
+                channel->listed_ = false;
+            continue;
+        }
+        unsigned events = ChannelEvents(channel);
+        if (events != EVENT_NONE)
+            ready_.push_back(Ready(events, channel->data_));
+        if ((events != EVENT_NONE) || NeedsPrepare(channel))
+            channelList_[kept++] = channel;
+        else
+            channel->listed_ = false;
+    }
+    channelList_.resize(kept);
+    return static_cast<int>(ready_.size());
+}
+
+void UringPoller::Submit()
+{
+    for (std::size_t i=0; i<channelList_.size(); i++)
+        PrepareChannel(channelList_[i]);
+    Enter(0, 0);
+}
+
+void UringPoller::Reap()
+{
+    // Each completion is consumed before it is processed since the processing
+    // can submit entries, and flushing a full ring may reap again
+    unsigned head;
+    while ((head = *cqHead_) != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE))
+    {
+        struct io_uring_cqe entry = cqes_[head & cqMask_];
+        struct io_uring_cqe* cqe = &entry;
+        __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+        uintptr_t userData = static_cast<uintptr_t>(cqe->user_data);
+        if (userData == 0)
+            continue;   // result of a poll remove or cancel request
+        if ((userData & TagMask) != 0)
+        {
+            ReapChannel(entry);
+            continue;
+        }
+        Registration* registration = reinterpret_cast<Registration*>(userData);
+
+        registration->armed_ = false;
+        if (registration->removed_)
+        {
+            retired_.erase(std::find(retired_.begin(), retired_.end(), registration));
+            delete registration;
+            continue;
+        }
+
+        if (cqe->res > 0)
+        {
+            unsigned events = EVENT_NONE;
+            if (cqe->res & POLLIN)
+                events |= EVENT_READ;
+            if (cqe->res & POLLOUT)
+                events |= EVENT_WRITE;
+            if (cqe->res & (POLLERR | POLLHUP))
+                events |= EVENT_ERROR;
+            ready_.push_back(Ready(events, registration->data_));
+        }
+        else if (cqe->res != -ECANCELED)
+        {
+            log_warn("io_uring poll failed, fd=" << registration->fd_ << ", result=" << cqe->res);
+            ready_.push_back(Ready(EVENT_ERROR, registration->data_));
+        }
+        QueueArm(registration);
+    }
+}
+
+bool UringPoller::Attach(TcpSocket& socket, bool listening)
+{
+    if (buffers_ == 0)
+        return false;
+    SOCKET fd = socket.GetFileDescriptor();
+    if (channels_.find(fd) != channels_.end())
+    {
+        log_warn("Attach: fd already attached, fd=" << fd);
+        return false;
+    }
+    UringChannel* channel = new UringChannel(this, &socket, fd, listening);
+    channels_[fd] = channel;
+    socket.SetUring(channel);
+    return true;
+}
+
+void UringPoller::QueueChannel(UringChannel* channel)
+{
+    if (!channel->listed_)
+    {
+        channel->listed_ = true;
+        channelList_.push_back(channel);
+    }
+}
+
+bool UringPoller::NeedsPrepare(UringChannel* channel)
+{
+    if (channel->closed_)
+        return false;
+    if (!channel->sendArmed_ && !channel->output_.empty())
+        return true;
+    bool reading = channel->registered_ && ((channel->events_ & EVENT_READ) != 0);
+    if (channel->listening_)
+        return reading && !channel->acceptArmed_ && (channel->acceptError_ == 0);
+    if (!reading)
+        return !channel->input_.empty();
+    // a receive that found no buffers stays listed until it can be armed again
+    return !channel->recvArmed_ && !channel->ended_ && (channel->error_ == 0) && (channel->InputLength() < InputLimit);
+}
+
+void UringPoller::PrepareChannel(UringChannel* channel)
+{
+    if (channel->closed_)
+        return;
+    bool reading = channel->registered_ && ((channel->events_ & EVENT_READ) != 0);
+    if (channel->listening_)
+    {
+        if (reading && !channel->acceptArmed_ && (channel->acceptError_ == 0))
+        {
+            struct io_uring_sqe* sqe = GetSqe();
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = static_cast<int>(channel->fd_);
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+            sqe->user_data = reinterpret_cast<uintptr_t>(channel) | TagAccept;
+            channel->acceptArmed_ = true;
+        }
+        return;
+    }
+
+    // A socket that is not reading copies its data out so it doesn't hold the buffers the others need
+    if (!reading && !channel->input_.empty())
+    {
+        channel->spill_.erase(0, channel->spillOffset_);
+        channel->spillOffset_ = 0;
+        while (!channel->input_.empty())
+        {
+            UringChannel::Input& input = channel->input_.front();
+            channel->spill_.append(GetBuffer(input.bufferId_) + input.offset_, input.length_ - input.offset_);
+            ReturnBuffer(input.bufferId_);
+            channel->input_.pop_front();
+        }
+    }
+
+    std::size_t inputLength = channel->InputLength();
+    if (reading && !channel->recvArmed_ && !channel->ended_ && (channel->error_ == 0) && !buffersExhausted_ &&
+        (inputLength < InputLimit))
+    {
+        struct io_uring_sqe* sqe = GetSqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = static_cast<int>(channel->fd_);
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BufferGroup;
+        if (multishotRecv_)
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->user_data = reinterpret_cast<uintptr_t>(channel) | TagRecv;
+        channel->recvArmed_ = true;
+        channel->recvCanceled_ = false;
+    }
+    else if (channel->recvArmed_ && !channel->recvCanceled_ && (inputLength >= InputLimit))
+    {
+        // The receive is armed again once the data has been read
+        Cancel(channel, TagRecv);
+        channel->recvCanceled_ = true;
+    }
+
+    SubmitSend(channel);
+}
+
+void UringPoller::SubmitSend(UringChannel* channel)
+{
+    if (channel->sendArmed_ || (channel->fd_ < 0))
+        return;
+    if (channel->sending_.empty())
+    {
+        if (channel->output_.empty())
+            return;
+        // Only the data in the ring has to stay unchanged, so new data is queued in the other string
+        channel->sending_.swap(channel->output_);
+        channel->sent_ = 0;
+    }
+    struct io_uring_sqe* sqe = GetSqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = static_cast<int>(channel->fd_);
+    sqe->addr = reinterpret_cast<uintptr_t>(channel->sending_.data() + channel->sent_);
+    sqe->len = static_cast<unsigned>(channel->sending_.length() - channel->sent_);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = reinterpret_cast<uintptr_t>(channel) | TagSend;
+    channel->sendArmed_ = true;
+}
+
+void UringPoller::Cancel(UringChannel* channel, unsigned tag)
+{
+    struct io_uring_sqe* sqe = GetSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uintptr_t>(channel) | tag;
+}
+
+unsigned UringPoller::ChannelEvents(UringChannel* channel)
+{
+    if (channel->closed_ || !channel->registered_)
+        return EVENT_NONE;
+    unsigned events = EVENT_NONE;
+    if (channel->events_ & EVENT_READ)
+    {
+        if (channel->listening_)
+        {
+            if (!channel->accepted_.empty() || (channel->acceptError_ != 0))
+                events |= EVENT_READ;
+        }
+        else if ((channel->InputLength() > 0) || channel->ended_ || (channel->error_ != 0))
+            events |= EVENT_READ;
+    }
+    if ((channel->events_ & EVENT_WRITE) && ((channel->OutputLength() < OutputLimit) || (channel->error_ != 0)))
+        events |= EVENT_WRITE;
+    if (channel->error_ != 0)
+        events |= EVENT_ERROR;
+    return events;
+}
+
+void UringPoller::WaitOutput(UringChannel* channel, int timeout)
+{
+    // The other completions are only processed so they are returned by the next Wait call
+    int64_t endTime = MonotonicMicroTime() / 1000 + timeout;
+    SubmitSend(channel);
+    while ((channel->OutputLength() >= OutputLimit) && (channel->error_ == 0))
+    {
+        int timeLeft = static_cast<int>(endTime - MonotonicMicroTime() / 1000);
+        if ((timeLeft <= 0) || (Enter(1, timeLeft) < 0))
+            break;
+        Reap();
+        SubmitSend(channel);
+    }
+}
+
+void UringPoller::CloseChannel(UringChannel* channel)
+{
+    channels_.erase(channel->fd_);
+    closing_.push_back(channel);
+    channel->closed_ = true;
+    channel->registered_ = false;
+
+    // The data that was not read is discarded
+    while (!channel->input_.empty())
+    {
+        ReturnBuffer(channel->input_.front().bufferId_);
+        channel->input_.pop_front();
+    }
+    channel->spill_.clear();
+    channel->spillOffset_ = 0;
+    while (!channel->accepted_.empty())
+    {
+        close(channel->accepted_.front());
+        channel->accepted_.pop_front();
+    }
+
+    // The operations hold references to the socket, so the receive and accept are canceled
+    // right away and the socket is closed once the data queued before Close has been sent
+    if (channel->recvArmed_)
+        Cancel(channel, TagRecv);
+    if (channel->acceptArmed_)
+        Cancel(channel, TagAccept);
+    if (channel->error_ != 0)
+        channel->output_.clear();
+    SubmitSend(channel);
+    if (!channel->sendArmed_)
+    {
+        close(channel->fd_);
+        channel->fd_ = static_cast<SOCKET>(-1);
+    }
+    QueueChannel(channel);
+    Enter(0, 0);
+}
+
+void UringPoller::ReapChannel(const struct io_uring_cqe& cqe)
+{
+    UringChannel* channel = reinterpret_cast<UringChannel*>(static_cast<uintptr_t>(cqe.user_data) & ~TagMask);
+    unsigned tag = static_cast<unsigned>(cqe.user_data & TagMask);
+    bool more = ((cqe.flags & IORING_CQE_F_MORE) != 0);
+
+    if (tag == TagRecv)
+    {
+        if (!more)
+            channel->recvArmed_ = false;
+        if (cqe.flags & IORING_CQE_F_BUFFER)
+        {
+            unsigned short bufferId = static_cast<unsigned short>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            if ((cqe.res > 0) && !channel->closed_)
+                channel->input_.push_back(UringChannel::Input(bufferId, static_cast<unsigned>(cqe.res)));
+            else
+                ReturnBuffer(bufferId);
+        }
+        if (cqe.res == 0)
+            channel->ended_ = true;
+        else if (cqe.res == -ENOBUFS)
+            buffersExhausted_ = true;   // armed again when a buffer is returned
+        else if ((cqe.res == -EINVAL) && multishotRecv_)
+        {
+            log_info("io_uring multishot receive not supported");
+            multishotRecv_ = false;
+        }
+        else if ((cqe.res < 0) && (cqe.res != -ECANCELED) && (cqe.res != -EAGAIN) && (cqe.res != -EINTR))
+            channel->error_ = -cqe.res;
+    }
+    else if (tag == TagSend)
+    {
+        channel->sendArmed_ = false;
+        if (cqe.res >= 0)
+            channel->sent_ += cqe.res;
+        else if ((cqe.res != -EAGAIN) && (cqe.res != -EINTR))
+        {
+            if (cqe.res != -ECANCELED)
+                channel->error_ = -cqe.res;
+            channel->sent_ = channel->sending_.length();
+            channel->output_.clear();
+        }
+        if (channel->sent_ >= channel->sending_.length())
+        {
+            channel->sending_.clear();
+            channel->sent_ = 0;
+        }
+        // The rest of a partial send continues right away as does the data of a closed socket
+        if (!channel->sending_.empty() || channel->closed_)
+            SubmitSend(channel);
+        if (channel->closed_ && !channel->sendArmed_ && (channel->fd_ >= 0))
+        {
+            close(channel->fd_);
+            channel->fd_ = static_cast<SOCKET>(-1);
+        }
+    }
+    else
+    {
+        if (!more)
+            channel->acceptArmed_ = false;
+        if (cqe.res >= 0)
+        {
+            if (channel->closed_)
+                close(cqe.res);
+            else
+                channel->accepted_.push_back(static_cast<SOCKET>(cqe.res));
+        }
+        else if ((cqe.res != -ECANCELED) && (cqe.res != -EAGAIN) && (cqe.res != -EINTR))
+            channel->acceptError_ = -cqe.res;
+    }
+    QueueChannel(channel);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+UringChannel::UringChannel(UringPoller* poller, TcpSocket* socket, SOCKET fd, bool listening) :
+    poller_(poller), socket_(socket), fd_(fd), listening_(listening), events_(Poller::EVENT_NONE), data_(0),
+    registered_(false), listed_(false), closed_(false), spillOffset_(0), ended_(false), error_(0),
+    recvArmed_(false), recvCanceled_(false), sent_(0), sendArmed_(false), acceptError_(0), acceptArmed_(false)
+{
+}
+
+std::size_t UringChannel::InputLength() const
+{
+    std::size_t length = spill_.length() - spillOffset_;
+    for (std::deque<Input>::const_iterator it = input_.begin(); it != input_.end(); ++it)
+        length += it->length_ - it->offset_;
+    return length;
+}
+
+std::size_t UringChannel::Read(char* buffer, std::size_t maxLength)
+{
+    // The spilled data arrived before the data still in the buffers
+    std::size_t bytesRead = std::min(maxLength, spill_.length() - spillOffset_);
+    if (bytesRead > 0)
+    {
+        memcpy(buffer, spill_.data() + spillOffset_, bytesRead);
+        spillOffset_ += bytesRead;
+        if (spillOffset_ >= spill_.length())
+        {
+            spill_.clear();
+            spillOffset_ = 0;
+        }
+    }
+    while ((bytesRead < maxLength) && !input_.empty())
+    {
+        Input& input = input_.front();
+        std::size_t length = std::min(maxLength - bytesRead, static_cast<std::size_t>(input.length_ - input.offset_));
+        memcpy(buffer + bytesRead, poller_->GetBuffer(input.bufferId_) + input.offset_, length);
+        bytesRead += length;
+        input.offset_ += static_cast<unsigned>(length);
+        if (input.offset_ >= input.length_)
+        {
+            poller_->ReturnBuffer(input.bufferId_);
+            input_.pop_front();
+        }
+    }
+    // A receive that stopped for lack of room is armed again by the next Wait call
+    if (!recvArmed_)
+        poller_->QueueChannel(this);
+    return bytesRead;
+}
+
+bool UringChannel::Write(const SendSegment* segments, std::size_t count, int timeout)
+{
+    if ((OutputLength() >= UringPoller::OutputLimit) && (timeout > 0))
+        poller_->WaitOutput(this, timeout);
+    if ((error_ != 0) || (OutputLength() >= UringPoller::OutputLimit))
+        return false;
+    for (std::size_t i=0; i<count; i++)
+        output_.append(segments[i].data_, segments[i].length_);
+    poller_->QueueChannel(this);
+    if (timeout > 0)
+    {
+        // A caller that is willing to wait, like a method streaming its response, sends right away
+        poller_->SubmitSend(this);
+        poller_->Enter(0, 0);
+    }
+    return true;
+}
+
+SOCKET UringChannel::Accept(int& err)
+{
+    if (!acceptArmed_)
+        poller_->QueueChannel(this);
+    if (!accepted_.empty())
+    {
+        SOCKET fd = accepted_.front();
+        accepted_.pop_front();
+        err = 0;
+        return fd;
+    }
+    // An error is returned once and then the accept is armed again
+    err = (acceptError_ != 0) ? acceptError_ : EAGAIN;
+    acceptError_ = 0;
+    return static_cast<SOCKET>(-1);
+}
+
+void UringChannel::Close()
+{
+    socket_ = 0;
+    poller_->CloseChannel(this);
+}
+#endif // defined(ANYRPC_URING)
+
+} // namespace internal
+} // namespace anyrpc
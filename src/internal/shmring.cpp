@@ -0,0 +1,202 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "anyrpc/api.h"
+#include "anyrpc/logger.h"
+#include "anyrpc/socket.h"
+#include "anyrpc/internal/shmring.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(ANYRPC_SHARED_MEMORY)
+# include <unistd.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+
+namespace anyrpc
+{
+namespace internal
+{
+
+//! Start of the segment, followed by the data of the rings at DataOffset
+struct ShmHeader
+{
+    uint32_t magic_;                //!< Identifies the segment
+    uint32_t version_;              //!< Layout of the segment
+    uint64_t capacity_;             //!< Size of each ring
+    char pad_[64 - 2*sizeof(uint32_t) - sizeof(uint64_t)];
+    ShmRingControl rings_[2];       //!< Request ring then response ring
+};
+
+static const uint32_t ShmMagic = 0x43505241;    // "ARPC"
+static const uint32_t ShmVersion = 1;
+static const uint64_t DataOffset = 4096;        // the header is alone on the first page
+static const uint64_t MinCapacity = 4096;
+
+bool ShmRing::Write(const char* buffer, std::size_t length, std::size_t& bytesWritten)
+{
+    bytesWritten = 0;
+    uint64_t tail = control_->tail_.load(std::memory_order_relaxed);
+    uint64_t used = tail - control_->head_.load(std::memory_order_acquire);
+    if (used > capacity_)
+        return false;
+
+    bytesWritten = static_cast<std::size_t>(std::min<uint64_t>(length, capacity_ - used));
+    std::size_t offset = static_cast<std::size_t>(tail & (capacity_ - 1));
+    std::size_t first = std::min(bytesWritten, static_cast<std::size_t>(capacity_) - offset);
+    memcpy(data_ + offset, buffer, first);
+    memcpy(data_, buffer + first, bytesWritten - first);
+    control_->tail_.store(tail + bytesWritten, std::memory_order_release);
+    return true;
+}
+
+bool ShmRing::Read(char* buffer, std::size_t maxLength, std::size_t& bytesRead)
+{
+    bytesRead = 0;
+    uint64_t head = control_->head_.load(std::memory_order_relaxed);
+    uint64_t available = control_->tail_.load(std::memory_order_acquire) - head;
+    if (available > capacity_)
+        return false;
+
+    bytesRead = static_cast<std::size_t>(std::min<uint64_t>(maxLength, available));
+    std::size_t offset = static_cast<std::size_t>(head & (capacity_ - 1));
+    std::size_t first = std::min(bytesRead, static_cast<std::size_t>(capacity_) - offset);
+    memcpy(buffer, data_ + offset, first);
+    memcpy(buffer + first, data_, bytesRead - first);
+    control_->head_.store(head + bytesRead, std::memory_order_release);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ShmChannel::Create(std::size_t capacity)
+{
+    Close();
+    uint64_t ringCapacity = MinCapacity;
+    while (ringCapacity < capacity)
+        ringCapacity <<= 1;
+    std::size_t size = static_cast<std::size_t>(DataOffset + 2*ringCapacity);
+
+    fd_ = memfd_create("anyrpc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd_ < 0)
+    {
+        log_warn("Could not create the shared memory: " << errno);
+        return false;
+    }
+    // the server relies on the seals so the segment can't shrink under its mapping
+    if ((ftruncate(fd_, static_cast<off_t>(size)) != 0) ||
+        (fcntl(fd_, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0))
+    {
+        log_warn("Could not size and seal the shared memory: " << errno);
+        Close();
+        return false;
+    }
+    memory_ = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (memory_ == MAP_FAILED)
+    {
+        log_warn("Could not map the shared memory: " << errno);
+        memory_ = 0;
+        Close();
+        return false;
+    }
+    size_ = size;
+
+    // a new memfd is zero filled so the positions and flags start at zero
+    ShmHeader* header = static_cast<ShmHeader*>(memory_);
+    header->magic_ = ShmMagic;
+    header->version_ = ShmVersion;
+    header->capacity_ = ringCapacity;
+    InitializeRings(ringCapacity);
+    log_debug("Create: fd=" << fd_ << ", capacity=" << ringCapacity);
+    return true;
+}
+
+bool ShmChannel::Attach(int fd)
+{
+    Close();
+    struct stat status;
+    int seals = fcntl(fd, F_GET_SEALS);
+    if ((fstat(fd, &status) != 0) || (seals < 0) || ((seals & F_SEAL_SHRINK) == 0) ||
+        (static_cast<uint64_t>(status.st_size) < DataOffset + 2*MinCapacity))
+    {
+        log_warn("Shared memory from the client is not a sealed segment");
+        close(fd);
+        return false;
+    }
+    std::size_t size = static_cast<std::size_t>(status.st_size);
+    void* memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        log_warn("Could not map the shared memory: " << errno);
+        return false;
+    }
+    memory_ = memory;
+    size_ = size;
+
+    const ShmHeader* header = static_cast<const ShmHeader*>(memory_);
+    uint64_t capacity = header->capacity_;
+    if ((header->magic_ != ShmMagic) || (header->version_ != ShmVersion) || (capacity < MinCapacity) ||
+        ((capacity & (capacity - 1)) != 0) || (DataOffset + 2*capacity != size))
+    {
+        log_warn("Shared memory from the client has an unknown layout");
+        Close();
+        return false;
+    }
+    InitializeRings(capacity);
+
+    // the server's poller only sees the socket so it always needs to be woken for a request
+    requests_.SetConsumerWaiting(true);
+    log_debug("Attach: capacity=" << capacity);
+    return true;
+}
+
+void ShmChannel::InitializeRings(uint64_t capacity)
+{
+    ShmHeader* header = static_cast<ShmHeader*>(memory_);
+    char* data = static_cast<char*>(memory_) + DataOffset;
+    requests_.Initialize(&header->rings_[0], data, capacity);
+    responses_.Initialize(&header->rings_[1], data + capacity, capacity);
+}
+
+void ShmChannel::Close()
+{
+    CloseFileDescriptor();
+    if (memory_ != 0)
+        munmap(memory_, size_);
+    memory_ = 0;
+    size_ = 0;
+}
+
+void ShmChannel::CloseFileDescriptor()
+{
+    if (fd_ >= 0)
+        close(fd_);
+    fd_ = -1;
+}
+
+} // namespace internal
+} // namespace anyrpc
+
+#endif // defined(ANYRPC_SHARED_MEMORY)
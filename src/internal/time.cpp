@@ -77,6 +77,22 @@ int64_t MicroTimeDiff( struct timeval &time1, struct timeval &time2 )
     return (int64_t)(time1.tv_sec - time2.tv_sec) * 1000000 + (int64_t)(time1.tv_usec - time2.tv_usec);
 }
 
+int64_t MonotonicMicroTime()
+{
+#if defined(_MSC_VER) || defined(__MINGW32__)
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (int64_t)(counter.QuadPart / frequency.QuadPart) * 1000000 +
+           (int64_t)(counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
 void MilliSleep(unsigned ms)
 {
 #if defined(_MSC_VER) || defined(__MINGW32__)
@@ -0,0 +1,180 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "anyrpc/api.h"
+#include "anyrpc/internal/timerwheel.h"
+
+namespace anyrpc
+{
+namespace internal
+{
+
+TimerWheel::TimerWheel() : current_(0), size_(0)
+{
+    Clear();
+}
+
+void TimerWheel::Clear()
+{
+    for (int level=0; level<NumLevels; level++)
+        for (int slot=0; slot<SlotsPerLevel; slot++)
+            slots_[level][slot].prev_ = slots_[level][slot].next_ = &slots_[level][slot];
+    expired_.prev_ = expired_.next_ = &expired_;
+    size_ = 0;
+}
+
+void TimerWheel::Link(TimerEntry* head, TimerEntry* entry)
+{
+    entry->prev_ = head->prev_;
+    entry->next_ = head;
+    head->prev_->next_ = entry;
+    head->prev_ = entry;
+}
+
+void TimerWheel::Unlink(TimerEntry* entry)
+{
+    entry->prev_->next_ = entry->next_;
+    entry->next_->prev_ = entry->prev_;
+    entry->prev_ = entry->next_ = 0;
+}
+
+void TimerWheel::Schedule(TimerEntry* entry, int64_t now, unsigned ms)
+{
+    Cancel(entry);
+
+    // an empty wheel can jump to the current time instead of ticking up to it
+    if (size_ == 0)
+        current_ = std::max(current_, now);
+
+    entry->expiry_ = now + ms;
+    Insert(entry);
+    size_++;
+}
+
+void TimerWheel::Cancel(TimerEntry* entry)
+{
+    if (entry->IsScheduled())
+    {
+        Unlink(entry);
+        size_--;
+    }
+}
+
+void TimerWheel::Insert(TimerEntry* entry)
+{
+    int64_t delay = entry->expiry_ - current_;
+    if (delay <= 0)
+    {
+        Link(&expired_, entry);
+        return;
+    }
+
+    // timers that are too far away are placed in the last slot of the top level and
+    // moved down when they get closer
+    int64_t expiry = entry->expiry_;
+    if (delay > MaxDelay)
+    {
+        delay = MaxDelay;
+        expiry = current_ + MaxDelay;
+    }
+
+    int level = 0;
+    while ((level < NumLevels - 1) && (delay >= (int64_t(1) << (LevelBits * (level + 1)))))
+        level++;
+    int slot = static_cast<int>((expiry >> (LevelBits * level)) & SlotMask);
+    Link(&slots_[level][slot], entry);
+}
+
+void TimerWheel::Cascade(int level, int slot)
+{
+    TimerEntry* head = &slots_[level][slot];
+    while (!IsEmpty(head))
+    {
+        TimerEntry* entry = head->next_;
+        Unlink(entry);
+        Insert(entry);
+    }
+}
+
+void TimerWheel::Tick()
+{
+    current_++;
+
+    // when a level wraps around, move the timers down from the next slot of the level above
+    for (int level=1; level<NumLevels; level++)
+    {
+        if ((current_ & ((int64_t(1) << (LevelBits * level)) - 1)) != 0)
+            break;
+        Cascade(level, static_cast<int>((current_ >> (LevelBits * level)) & SlotMask));
+    }
+
+    // the timers in the current slot have expired
+    TimerEntry* head = &slots_[0][current_ & SlotMask];
+    while (!IsEmpty(head))
+    {
+        TimerEntry* entry = head->next_;
+        Unlink(entry);
+        Link(&expired_, entry);
+    }
+}
+
+TimerEntry* TimerWheel::Expire(int64_t now)
+{
+    if (size_ == 0)
+    {
+        current_ = std::max(current_, now);
+        return 0;
+    }
+
+    while (IsEmpty(&expired_) && (current_ < now))
+    {
+        // skip the empty slots up to the next wrap around since nothing changes for them
+        int64_t next = current_ + 1;
+        while (((next & SlotMask) != 0) && (next < now) && IsEmpty(&slots_[0][next & SlotMask]))
+            next++;
+        current_ = next - 1;
+        Tick();
+    }
+    if (IsEmpty(&expired_))
+        return 0;
+
+    TimerEntry* entry = expired_.next_;
+    Unlink(entry);
+    size_--;
+    return entry;
+}
+
+int TimerWheel::GetTimeout(int64_t now) const
+{
+    if (size_ == 0)
+        return -1;
+    if (!IsEmpty(&expired_))
+        return 0;
+
+    // look for the next slot with timers in the lowest level, but stop when it wraps
+    // around since timers may be moved down from the higher levels at that time
+    int64_t time = current_ + 1;
+    while (((time & SlotMask) != 0) && IsEmpty(&slots_[0][time & SlotMask]))
+        time++;
+    return static_cast<int>(std::max(int64_t(0), time - now));
+}
+
+} // namespace internal
+} // namespace anyrpc
@@ -0,0 +1,181 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "anyrpc/api.h"
+#include "anyrpc/logger.h"
+#include "anyrpc/socket.h"
+#include "anyrpc/internal/wakeup.h"
+
+#if defined(WIN32)
+# include <ws2tcpip.h>
+#else
+# include <unistd.h>
+# include <errno.h>
+# include <fcntl.h>
+# if defined(__linux__)
+#  include <sys/eventfd.h>
+# endif // defined(__linux__)
+#endif // defined(WIN32)
+
+namespace anyrpc
+{
+namespace internal
+{
+
+Wakeup::Wakeup()
+{
+    readFd_ = static_cast<SOCKET>(-1);
+#if defined(WIN32)
+    port_ = 0;
+#else
+    writeFd_ = -1;
+#endif // defined(WIN32)
+}
+
+Wakeup::~Wakeup()
+{
+    Close();
+}
+
+#if defined(WIN32)
+bool Wakeup::Create()
+{
+    Close();
+
+    // A socket bound to an ephemeral loopback port that sends datagrams to itself
+    readFd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (readFd_ == INVALID_SOCKET)
+    {
+        log_warn("Could not create wakeup socket: " << WSAGetLastError());
+        return false;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    int addrLength = sizeof(addr);
+    u_long nonBlocking = 1;
+    if ((bind(readFd_, (struct sockaddr*)&addr, sizeof(addr)) != 0) ||
+        (getsockname(readFd_, (struct sockaddr*)&addr, &addrLength) != 0) ||
+        (ioctlsocket(readFd_, FIONBIO, &nonBlocking) != 0))
+    {
+        log_warn("Could not setup wakeup socket: " << WSAGetLastError());
+        Close();
+        return false;
+    }
+    port_ = ntohs(addr.sin_port);
+    return true;
+}
+
+void Wakeup::Close()
+{
+    if (readFd_ != INVALID_SOCKET)
+        closesocket(readFd_);
+    readFd_ = INVALID_SOCKET;
+}
+
+void Wakeup::Signal()
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<u_short>(port_));
+    char buffer = 0;
+    sendto(readFd_, &buffer, 1, 0, (struct sockaddr*)&addr, sizeof(addr));
+}
+
+void Wakeup::Drain()
+{
+    char buffer[64];
+    while (recv(readFd_, buffer, sizeof(buffer), 0) > 0)
+        ;
+}
+
+#else
+bool Wakeup::Create()
+{
+    Close();
+
+#if defined(__linux__)
+    readFd_ = writeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (readFd_ < 0)
+    {
+        log_warn("Could not create eventfd: " << errno);
+        return false;
+    }
+#else
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        log_warn("Could not create wakeup pipe: " << errno);
+        return false;
+    }
+    readFd_ = fds[0];
+    writeFd_ = fds[1];
+    for (int i=0; i<2; i++)
+    {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+#endif // defined(__linux__)
+    return true;
+}
+
+void Wakeup::Close()
+{
+    if ((writeFd_ >= 0) && (writeFd_ != readFd_))
+        close(writeFd_);
+    if (readFd_ >= 0)
+        close(readFd_);
+    readFd_ = writeFd_ = -1;
+}
+
+void Wakeup::Signal()
+{
+    // A full pipe or eventfd counter is already readable so a failed write can be ignored
+#if defined(__linux__)
+    uint64_t value = 1;
+    ssize_t result = write(writeFd_, &value, sizeof(value));
+#else
+    char value = 0;
+    ssize_t result = write(writeFd_, &value, sizeof(value));
+#endif // defined(__linux__)
+    (void)result;
+}
+
+void Wakeup::Drain()
+{
+#if defined(__linux__)
+    uint64_t value;
+    ssize_t result = read(readFd_, &value, sizeof(value));
+    (void)result;
+#else
+    char buffer[64];
+    while (read(readFd_, buffer, sizeof(buffer)) > 0)
+        ;
+#endif // defined(__linux__)
+}
+#endif // defined(WIN32)
+
+} // namespace internal
+} // namespace anyrpc
@@ -0,0 +1,195 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "anyrpc/api.h"
+#include "anyrpc/logger.h"
+#include "anyrpc/error.h"
+#include "anyrpc/stream.h"
+#include "anyrpc/internal/base64.h"
+#include "anyrpc/internal/websocket.h"
+
+namespace anyrpc
+{
+namespace internal
+{
+
+WebSocketFrame::ParseResultEnum WebSocketFrame::ParseHeader(const char* data, std::size_t length)
+{
+    if (length < 2)
+        return FRAME_INCOMPLETE;
+    const unsigned char* header = reinterpret_cast<const unsigned char*>(data);
+    fin_ = (header[0] & 0x80) != 0;
+    reserved_ = (header[0] >> 4) & 0x7;
+    opcode_ = header[0] & 0xf;
+    masked_ = (header[1] & 0x80) != 0;
+    length_ = header[1] & 0x7f;
+
+    headerLength_ = 2;
+    std::size_t extendedLength = 0;
+    if (length_ == 126)
+        extendedLength = 2;
+    else if (length_ == 127)
+        extendedLength = 8;
+    if (length < headerLength_ + extendedLength + (masked_ ? 4 : 0))
+        return FRAME_INCOMPLETE;
+    if (extendedLength > 0)
+    {
+        // the most significant bit of a 64 bit length must be 0
+        if ((extendedLength == 8) && ((header[headerLength_] & 0x80) != 0))
+            return FRAME_FAULT;
+        length_ = 0;
+        for (std::size_t i = 0; i < extendedLength; i++)
+            length_ = (length_ << 8) | header[headerLength_ + i];
+        headerLength_ += extendedLength;
+    }
+    if (masked_)
+    {
+        memcpy(mask_, header + headerLength_, 4);
+        headerLength_ += 4;
+    }
+    return FRAME_COMPLETE;
+}
+
+void WebSocketFrame::WriteHeader(Stream& os, unsigned opcode, bool fin, uint64_t length, const unsigned char* mask)
+{
+    os.Put(static_cast<char>((fin ? 0x80 : 0) | opcode));
+    char maskBit = (mask != 0) ? static_cast<char>(0x80) : 0;
+    if (length < 126)
+        os.Put(static_cast<char>(maskBit | length));
+    else if (length <= 0xffff)
+    {
+        os.Put(static_cast<char>(maskBit | 126));
+        os.Put(static_cast<char>(length >> 8));
+        os.Put(static_cast<char>(length));
+    }
+    else
+    {
+        os.Put(static_cast<char>(maskBit | 127));
+        for (int shift = 56; shift >= 0; shift -= 8)
+            os.Put(static_cast<char>(length >> shift));
+    }
+    if (mask != 0)
+        os.Put(reinterpret_cast<const char*>(mask), 4);
+}
+
+void WebSocketFrame::WriteClose(Stream& os, unsigned code)
+{
+    WriteHeader(os, OPCODE_CLOSE, true, 2);
+    os.Put(static_cast<char>(code >> 8));
+    os.Put(static_cast<char>(code));
+}
+
+void WebSocketFrame::Mask(char* data, std::size_t length, const unsigned char* mask, std::size_t offset)
+{
+    for (std::size_t i = 0; i < length; i++)
+        data[i] ^= mask[(offset + i) & 3];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t RotateLeft(uint32_t value, unsigned bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static void Sha1Block(uint32_t state[5], const unsigned char* block)
+{
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++)
+        w[i] = (static_cast<uint32_t>(block[4*i]) << 24) | (block[4*i+1] << 16) | (block[4*i+2] << 8) | block[4*i+3];
+    for (int i = 16; i < 80; i++)
+        w[i] = RotateLeft(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; i++)
+    {
+        uint32_t f, k;
+        if (i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        }
+        else if (i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        }
+        else if (i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        uint32_t temp = RotateLeft(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = RotateLeft(b, 30);
+        b = a;
+        a = temp;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void Sha1(const char* data, std::size_t length, unsigned char digest[20])
+{
+    uint32_t state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    const unsigned char* input = reinterpret_cast<const unsigned char*>(data);
+    std::size_t remaining = length;
+    for (; remaining >= 64; remaining -= 64, input += 64)
+        Sha1Block(state, input);
+
+    // the last block is padded with a 1 bit, zeros, and the length in bits
+    unsigned char block[128];
+    memset(block, 0, sizeof(block));
+    memcpy(block, input, remaining);
+    block[remaining] = 0x80;
+    std::size_t blockLength = (remaining < 56) ? 64 : 128;
+    uint64_t bits = static_cast<uint64_t>(length) * 8;
+    for (int i = 0; i < 8; i++)
+        block[blockLength - 1 - i] = static_cast<unsigned char>(bits >> (8 * i));
+    for (std::size_t offset = 0; offset < blockLength; offset += 64)
+        Sha1Block(state, block + offset);
+
+    for (int i = 0; i < 20; i++)
+        digest[i] = static_cast<unsigned char>(state[i/4] >> (24 - 8 * (i % 4)));
+}
+
+std::string WebSocketAccept(const std::string& key)
+{
+    // the key is combined with the GUID that identifies the WebSocket protocol
+    std::string accept = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    unsigned char digest[20];
+    Sha1(accept.data(), accept.length(), digest);
+    WriteStringStream os;
+    Base64Encode(os, digest, sizeof(digest));
+    return os.GetString();
+}
+
+} // namespace internal
+} // namespace anyrpc
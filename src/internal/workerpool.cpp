@@ -0,0 +1,358 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "anyrpc/api.h"
+#include "anyrpc/logger.h"
+#include "anyrpc/error.h"
+#include "anyrpc/internal/workerpool.h"
+
+#if defined(ANYRPC_THREADING)
+
+namespace anyrpc
+{
+namespace internal
+{
+
+log_define("AnyRPC.WorkerPool");
+
+TaskQueue::TaskQueue(std::size_t capacity)
+{
+    anyrpc_assert((capacity >= 2) && ((capacity & (capacity - 1)) == 0), AnyRpcErrorIllegalCall, "Capacity must be a power of two");
+    cells_ = new Cell[capacity];
+    for (std::size_t i=0; i<capacity; i++)
+        cells_[i].sequence_.store(i, std::memory_order_relaxed);
+    mask_ = capacity - 1;
+    enqueuePos_.store(0, std::memory_order_relaxed);
+    dequeuePos_.store(0, std::memory_order_relaxed);
+}
+
+TaskQueue::~TaskQueue()
+{
+    delete [] cells_;
+}
+
+bool TaskQueue::Push(const Task& task)
+{
+    Cell* cell;
+    std::size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+    while (true)
+    {
+        cell = &cells_[pos & mask_];
+        std::size_t sequence = cell->sequence_.load(std::memory_order_acquire);
+        std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+        if (diff == 0)
+        {
+            // the cell is free so try to claim it
+            if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return false;   // the cell still has the task from the previous lap
+        else
+            pos = enqueuePos_.load(std::memory_order_relaxed);
+    }
+    cell->task_ = task;
+    cell->sequence_.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool TaskQueue::Pop(Task& task)
+{
+    Cell* cell;
+    std::size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+    while (true)
+    {
+        cell = &cells_[pos & mask_];
+        std::size_t sequence = cell->sequence_.load(std::memory_order_acquire);
+        std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+        if (diff == 0)
+        {
+            // the cell has a task so try to claim it
+            if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return false;   // the cell has not been written yet
+        else
+            pos = dequeuePos_.load(std::memory_order_relaxed);
+    }
+    task = cell->task_;
+    cell->sequence_.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+}
+
+bool TaskQueue::Empty() const
+{
+    return (enqueuePos_.load(std::memory_order_relaxed) == dequeuePos_.load(std::memory_order_relaxed));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TaskDeque::TaskDeque()
+{
+    top_.store(0, std::memory_order_relaxed);
+    bottom_.store(0, std::memory_order_relaxed);
+}
+
+void TaskDeque::Store(int64_t position, const Task& task)
+{
+    Slot& slot = slots_[position % Capacity];
+    slot.function_.store(task.function_, std::memory_order_relaxed);
+    slot.context_.store(task.context_, std::memory_order_relaxed);
+    slot.argument_.store(task.argument_, std::memory_order_relaxed);
+}
+
+void TaskDeque::Load(int64_t position, Task& task)
+{
+    Slot& slot = slots_[position % Capacity];
+    task.function_ = slot.function_.load(std::memory_order_relaxed);
+    task.context_ = slot.context_.load(std::memory_order_relaxed);
+    task.argument_ = slot.argument_.load(std::memory_order_relaxed);
+}
+
+bool TaskDeque::Push(const Task& task)
+{
+    int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    int64_t top = top_.load(std::memory_order_acquire);
+    if (bottom - top >= static_cast<int64_t>(Capacity))
+        return false;
+    Store(bottom, task);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+    return true;
+}
+
+bool TaskDeque::Pop(Task& task)
+{
+    int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = top_.load(std::memory_order_relaxed);
+    if (top > bottom)
+    {
+        // empty
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+        return false;
+    }
+    Load(bottom, task);
+    if (top == bottom)
+    {
+        // last task so race with the thieves for it
+        bool won = top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+bool TaskDeque::Steal(Task& task)
+{
+    int64_t top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = bottom_.load(std::memory_order_acquire);
+    if (top >= bottom)
+        return false;
+    Load(top, task);
+    return top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+bool TaskDeque::Empty() const
+{
+    return (bottom_.load(std::memory_order_relaxed) <= top_.load(std::memory_order_relaxed));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Identify the pool and worker for the current thread so submissions from a worker use its deque
+struct CurrentWorker
+{
+    WorkerPool* pool_;
+    unsigned index_;
+};
+static thread_local CurrentWorker currentWorker = { 0, 0 };
+
+WorkerPool::WorkerPool() :
+    inject_(InjectCapacity), exit_(false), searching_(0), sleepers_(0)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    Stop();
+}
+
+void WorkerPool::Start(unsigned numThreads)
+{
+    Stop();
+    exit_ = false;
+
+    // create all of the deques before starting any threads since the workers steal from each other
+    for (unsigned i=0; i<std::max(1u, numThreads); i++)
+        workers_.push_back(new Worker);
+    for (unsigned i=0; i<workers_.size(); i++)
+        workers_[i]->thread_ = std::thread(&WorkerPool::WorkerThread, this, i);
+}
+
+void WorkerPool::Stop()
+{
+    if (workers_.empty())
+        return;
+
+    exit_ = true;
+    {
+        std::lock_guard<std::mutex> lock(parkMutex_);
+        parkCondition_.notify_all();
+    }
+    for (unsigned i=0; i<workers_.size(); i++)
+    {
+        workers_[i]->thread_.join();
+        delete workers_[i];
+    }
+    workers_.clear();
+
+    // discard the tasks that were not started
+    Task task;
+    while (inject_.Pop(task))
+        ;
+}
+
+void WorkerPool::Submit(const Task& task)
+{
+    // a task submitted by a worker is kept local unless its deque is full
+    if ((currentWorker.pool_ != this) || !workers_[currentWorker.index_]->deque_.Push(task))
+    {
+        while (!inject_.Push(task))
+            std::this_thread::yield();  // the workers are behind so wait for space
+    }
+    Notify();
+}
+
+void WorkerPool::Notify()
+{
+    // pairs with the fence in the worker after it registers as a sleeper
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if ((searching_.load(std::memory_order_relaxed) == 0) && (sleepers_.load(std::memory_order_relaxed) > 0))
+    {
+        std::lock_guard<std::mutex> lock(parkMutex_);
+        parkCondition_.notify_one();
+    }
+}
+
+bool WorkerPool::WorkAvailable() const
+{
+    if (!inject_.Empty())
+        return true;
+    for (unsigned i=0; i<workers_.size(); i++)
+        if (!workers_[i]->deque_.Empty())
+            return true;
+    return false;
+}
+
+bool WorkerPool::FindTask(unsigned index, Task& task)
+{
+    Worker* self = workers_[index];
+    if (self->deque_.Pop(task))
+        return true;
+
+    // take a batch from the injection queue and make the extra tasks available for stealing
+    if (inject_.Pop(task))
+    {
+        Task extra;
+        unsigned count = 1;
+        while ((count < InjectBatch) && inject_.Pop(extra))
+        {
+            self->deque_.Push(extra);   // the deque was empty so this can't fail
+            count++;
+        }
+        if (count > 1)
+            Notify();
+        return true;
+    }
+
+    // steal from the other workers
+    unsigned numWorkers = static_cast<unsigned>(workers_.size());
+    for (unsigned i=1; i<numWorkers; i++)
+    {
+        if (workers_[(index + i) % numWorkers]->deque_.Steal(task))
+            return true;
+    }
+    return false;
+}
+
+void WorkerPool::WorkerThread(unsigned index)
+{
+    log_trace();
+    currentWorker.pool_ = this;
+    currentWorker.index_ = index;
+
+    // place the thread before it executes any tasks
+    if (!cpuSets_.empty())
+        SetCurrentThreadAffinity(cpuSets_[index % cpuSets_.size()]);
+    if (!namePrefix_.empty())
+        SetCurrentThreadName(namePrefix_ + std::to_string(index));
+
+    Task task;
+    while (!exit_.load(std::memory_order_relaxed))
+    {
+        if (FindTask(index, task))
+        {
+            task.function_(task.context_, task.argument_);
+            continue;
+        }
+
+        // spin for a short time before parking since more work is likely to arrive soon
+        bool found = false;
+        searching_.fetch_add(1);
+        for (unsigned i=0; (i<SpinCount) && !exit_.load(std::memory_order_relaxed); i++)
+        {
+            if (FindTask(index, task))
+            {
+                found = true;
+                break;
+            }
+            std::this_thread::yield();
+        }
+        // the last searching worker to find work wakes another one if there is more work
+        if ((searching_.fetch_sub(1) == 1) && found && WorkAvailable())
+            Notify();
+        if (found)
+        {
+            task.function_(task.context_, task.argument_);
+            continue;
+        }
+
+        // park until there is work - the fence pairs with the one in Notify so either the
+        // submitter sees this worker as a sleeper or this worker sees the submitted task
+        std::unique_lock<std::mutex> lock(parkMutex_);
+        sleepers_.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!exit_.load(std::memory_order_relaxed) && !WorkAvailable())
+            parkCondition_.wait(lock);
+        sleepers_.fetch_sub(1);
+    }
+
+    currentWorker.pool_ = 0;
+}
+
+} // namespace internal
+} // namespace anyrpc
+
+#endif // defined(ANYRPC_THREADING)
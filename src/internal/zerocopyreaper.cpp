@@ -0,0 +1,93 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "anyrpc/api.h"
+#include "anyrpc/logger.h"
+#include "anyrpc/socket.h"
+#include "anyrpc/internal/timerwheel.h"
+#include "anyrpc/internal/zerocopyreaper.h"
+
+#if defined(ANYRPC_ZEROCOPY)
+
+namespace anyrpc
+{
+namespace internal
+{
+
+bool ZeroCopyReaper::Add(TcpSocket& socket, int64_t now)
+{
+    if (!socket.IsZeroCopyPending())
+        return false;
+    // the completions that have already arrived may leave nothing to wait for
+    socket.ReapZeroCopy();
+    if (!socket.IsZeroCopyPending())
+        return false;
+
+    Entry* entry = new Entry();
+    socket.MoveZeroCopy(entry->socket_);
+    entry->timer_.data_ = entry;
+    entry->deadline_ = now + Deadline;
+    entry->interval_ = 1;
+    entries_.push_back(entry);
+    timers_.Schedule(&entry->timer_, now, entry->interval_);
+    log_debug("Add: fd=" << entry->socket_.GetFileDescriptor() << ", sockets=" << entries_.size());
+    return true;
+}
+
+void ZeroCopyReaper::Reap(int64_t now)
+{
+    TimerEntry* timer;
+    while ((timer = timers_.Expire(now)) != 0)
+    {
+        Entry* entry = static_cast<Entry*>(timer->data_);
+        entry->socket_.ReapZeroCopy();
+        if (entry->socket_.IsZeroCopyPending() && (now < entry->deadline_))
+        {
+            entry->interval_ *= 2;
+            if (entry->interval_ > MaxInterval)
+                entry->interval_ = MaxInterval;
+            unsigned timeLeft = static_cast<unsigned>(entry->deadline_ - now);
+            timers_.Schedule(&entry->timer_, now, std::min(entry->interval_, timeLeft));
+            continue;
+        }
+        Remove(entry);
+    }
+}
+
+void ZeroCopyReaper::Clear()
+{
+    while (!entries_.empty())
+        Remove(entries_.back());
+    timers_.Clear();
+}
+
+void ZeroCopyReaper::Remove(Entry* entry)
+{
+    // closing a socket with sends still pending resets it before the buffers are freed
+    log_debug("Remove: fd=" << entry->socket_.GetFileDescriptor() << ", pending=" << entry->socket_.IsZeroCopyPending());
+    timers_.Cancel(&entry->timer_);
+    entries_.erase(std::find(entries_.begin(), entries_.end(), entry));
+    delete entry;
+}
+
+} // namespace internal
+} // namespace anyrpc
+
+#endif // defined(ANYRPC_ZEROCOPY)
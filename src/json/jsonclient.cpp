@@ -56,6 +56,20 @@ JsonTcpClient::JsonTcpClient(const char* host, int port) :
 
 ////////////////////////////////////////////////////////////////////////////////
 
+JsonHttp2Client::JsonHttp2Client() : Http2Client(&jsonClientHandler, "application/json-rpc") {}
+
+JsonHttp2Client::JsonHttp2Client(const char* host, int port) :
+        Http2Client(&jsonClientHandler, "application/json-rpc", host, port) {}
+
+////////////////////////////////////////////////////////////////////////////////
+
+JsonWebSocketClient::JsonWebSocketClient() : WebSocketClient(&jsonClientHandler, "json-rpc") {}
+
+JsonWebSocketClient::JsonWebSocketClient(const char* host, int port) :
+        WebSocketClient(&jsonClientHandler, "json-rpc", host, port) {}
+
+////////////////////////////////////////////////////////////////////////////////
+
 bool JsonClientHandler::GenerateRequest(const char* method, Value& params, Stream& os, unsigned& requestId, bool notification)
 {
     log_trace();
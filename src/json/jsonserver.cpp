@@ -37,7 +37,8 @@
 namespace anyrpc
 {
 
-static void JsonExecuteSingleRequest(MethodManager* manager, Value& message, Value& response);
+static bool JsonExecuteSingleRequest(MethodManager* manager, Value& message, Value& response, Stream* stream);
+static void JsonEncodeResponse(Value& id, Value* result, int errorCode, std::string const& errorMsg, Stream& response);
 static void JsonGenerateResponse(Value& result, Value& id, Value& response);
 static void JsonGenerateFaultResponse(int errorCode, std::string const& errorMsg, Value& id, Value& response);
 
@@ -45,6 +46,45 @@ log_define("AnyRPC.RpcHandler");
 
 ////////////////////////////////////////////////////////////////////////////////
 
+//! Encodes the result of a StreamMethod as a json-rpc response while it is produced
+class JsonStreamedResult : public StreamedResult
+{
+public:
+    JsonStreamedResult(Value& id, Stream& response) : id_(id), writer_(response) {}
+
+protected:
+    virtual void EncodeStart()
+    {
+        // the same members as JsonGenerateResponse with the result array left open
+        writer_.StartMap();
+        writer_.Key("jsonrpc", 7);
+        writer_.String("2.0", 3);
+        writer_.MapSeparator();
+        writer_.Key("id", 2);
+        id_.Traverse(writer_);
+        writer_.MapSeparator();
+        writer_.Key("result", 6);
+        writer_.StartArray(0);
+    }
+    virtual void EncodeElement(Value& element, std::size_t index)
+    {
+        if (index > 0)
+            writer_.ArraySeparator();
+        element.Traverse(writer_);
+    }
+    virtual void EncodeEnd(std::size_t count)
+    {
+        writer_.EndArray(count);
+        writer_.EndMap(3);
+    }
+
+private:
+    Value& id_;                     //!< Id of the call
+    JsonWriter writer_;             //!< Writer for the response stream
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 bool JsonRpcHandler(MethodManager* manager, char* request, size_t length, Stream &response)
 {
     Document doc;
@@ -64,7 +104,8 @@ bool JsonRpcHandler(MethodManager* manager, char* request, size_t length, Stream
 
         if (message.IsMap())
         {
-            JsonExecuteSingleRequest(manager,message,valueResponse);
+            if (JsonExecuteSingleRequest(manager,message,valueResponse,&response))
+                return true;    // the response was encoded as the result was produced
         }
         else if (message.IsArray() && (message.Size() > 0))
         {
@@ -73,7 +114,7 @@ bool JsonRpcHandler(MethodManager* manager, char* request, size_t length, Stream
             for (int i=0; i<(int)message.Size(); i++)
             {
                 Value singleResponse;
-                JsonExecuteSingleRequest(manager,message[i],singleResponse);
+                JsonExecuteSingleRequest(manager,message[i],singleResponse,0);
                 if (singleResponse.IsValid())
                     valueResponse[outIndex++].Assign(singleResponse);
             }
@@ -95,7 +136,89 @@ bool JsonRpcHandler(MethodManager* manager, char* request, size_t length, Stream
     return true;
 }
 
-static void JsonExecuteSingleRequest(MethodManager* manager, Value& message, Value& response)
+bool JsonRpcFaultHandler(char* request, size_t length, int errorCode, std::string const& errorMsg, Stream &response)
+{
+    Document doc;
+    Value valueResponse;
+    Value nullValue;
+    nullValue.SetNull();
+
+    // only the ids are needed to address the faults
+    InSituStringStream sstream(request, length);
+    JsonReader reader(sstream);
+    reader.ParseStream(doc);
+    if (reader.HasParseError())
+        JsonGenerateFaultResponse(AnyRpcErrorParseError, "Parse error", nullValue, valueResponse);
+    else
+    {
+        Value message;
+        message.Assign( doc.GetValue() );
+
+        if (message.IsMap())
+        {
+            if (message["id"].IsValid())
+                JsonGenerateFaultResponse(errorCode, errorMsg, message["id"], valueResponse);
+        }
+        else if (message.IsArray() && (message.Size() > 0))
+        {
+            // multi-call request
+            int outIndex = 0;
+            for (int i=0; i<(int)message.Size(); i++)
+            {
+                Value& id = message[i]["id"];
+                if (id.IsValid())
+                    JsonGenerateFaultResponse(errorCode, errorMsg, id, valueResponse[outIndex++]);
+            }
+        }
+        else
+            JsonGenerateFaultResponse(AnyRpcErrorInvalidRequest, "Invalid Request", nullValue, valueResponse);
+    }
+
+    if (valueResponse.IsInvalid())
+        // notification doesn't produce a response message
+        return false;
+
+    JsonWriter jsonStrWriter(response);
+    valueResponse.Traverse(jsonStrWriter);
+
+    return true;
+}
+
+bool JsonRpcMethodName(const char* request, size_t length, std::string& methodName)
+{
+    // scan for the method member since the handler parses the request in place later.
+    // This is only a hint for scheduling so a "method" key inside the params may be found instead.
+    static const char key[] = "\"method\"";
+    const char* end = request + length;
+    const char* pos = std::search(request, end, key, key + sizeof(key) - 1);
+    if (pos == end)
+        return false;
+    pos += sizeof(key) - 1;
+    while ((pos < end) && isspace(static_cast<unsigned char>(*pos)))
+        pos++;
+    if ((pos == end) || (*pos != ':'))
+        return false;
+    pos++;
+    while ((pos < end) && isspace(static_cast<unsigned char>(*pos)))
+        pos++;
+    if ((pos == end) || (*pos != '"'))
+        return false;
+    const char* start = ++pos;
+    while ((pos < end) && (*pos != '"'))
+    {
+        // escaped method names are not expected
+        if (*pos == '\\')
+            return false;
+        pos++;
+    }
+    if (pos == end)
+        return false;
+    methodName.assign(start, pos - start);
+    return true;
+}
+
+//! Execute a call.  Return true if the response was encoded into the stream, which is null for the calls of a batch.
+static bool JsonExecuteSingleRequest(MethodManager* manager, Value& message, Value& response, Stream* stream)
 {
     Value& method = message["method"];
     Value& id = message["id"];
@@ -114,18 +237,53 @@ static void JsonExecuteSingleRequest(MethodManager* manager, Value& message, Val
         result.SetNull();
 
         std::string methodName = method.GetString();
+
+        // the responses of a batch are sent together so only a single call can be deferred or streamed
+        CallDeferral* deferral = (stream != 0) ? CallDeferral::Current() : 0;
+        std::unique_ptr<JsonStreamedResult> streamedResult;
+        if (deferral != 0)
+        {
+            if (id.IsValid())
+                streamedResult.reset(new JsonStreamedResult(id, *stream));
+            deferral->SetCall(&JsonEncodeResponse, id, methodName, streamedResult.get());
+        }
+
         try
         {
             if (!manager->ExecuteMethod(methodName, params, result))
                 JsonGenerateFaultResponse(AnyRpcErrorMethodNotFound, "Method not found", id, response);
+            else if ((deferral != 0) && deferral->IsDeferred())
+                response.SetInvalid();  // the connection sends the response when the method responds
+            else if ((deferral != 0) && deferral->IsStreamed())
+            {
+                streamedResult->Finish();
+                return true;
+            }
             else if (id.IsValid())
                 JsonGenerateResponse(result, id, response);
         }
         catch (const AnyRpcException& fault)
         {
-            JsonGenerateFaultResponse(fault.GetCode(), fault.GetMessage(), id, response);
+            // once part of a streamed result has been sent, the connection is closed instead
+            if (!streamedResult || streamedResult->Discard())
+                JsonGenerateFaultResponse(fault.GetCode(), fault.GetMessage(), id, response);
+            else
+                response.SetInvalid();
         }
     }
+    return false;
+}
+
+static void JsonEncodeResponse(Value& id, Value* result, int errorCode, std::string const& errorMsg, Stream& response)
+{
+    Value valueResponse;
+    if (result != 0)
+        JsonGenerateResponse(*result, id, valueResponse);
+    else
+        JsonGenerateFaultResponse(errorCode, errorMsg, id, valueResponse);
+
+    JsonWriter jsonStrWriter(response);
+    valueResponse.Traverse(jsonStrWriter);
 }
 
 static void JsonGenerateResponse(Value& result, Value& id, Value& response)
@@ -55,6 +55,19 @@ MessagePackTcpClient::MessagePackTcpClient(const char* host, int port) :
 
 ////////////////////////////////////////////////////////////////////////////////
 
+MessagePackWebSocketClient::MessagePackWebSocketClient() : WebSocketClient(&mpackClientHandler, "messagepack-rpc")
+{
+    SetBinary(true);
+}
+
+MessagePackWebSocketClient::MessagePackWebSocketClient(const char* host, int port) :
+        WebSocketClient(&mpackClientHandler, "messagepack-rpc", host, port)
+{
+    SetBinary(true);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 bool MessagePackClientHandler::GenerateRequest(const char* method, Value& params, Stream& os, unsigned& requestId, bool notification)
 {
     log_trace();
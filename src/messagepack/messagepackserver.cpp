@@ -37,6 +37,7 @@
 namespace anyrpc
 {
 
+static void MessagePackEncodeResponse(Value& id, Value* result, int errorCode, std::string const& errorMsg, Stream& response);
 static void MessagePackGenerateResponse(Value& result, Value& id, Value& response);
 static void MessagePackGenerateFaultResponse(int errorCode, std::string const& errorMsg, Value& id, Value& response);
 
@@ -44,6 +45,50 @@ log_define("AnyRPC.RpcHandler");
 
 ////////////////////////////////////////////////////////////////////////////////
 
+//! Encodes the result of a StreamMethod as a MessagePack-RPC response
+/*!
+ *  The array header holds the number of elements, so the elements are encoded
+ *  into a separate stream and the response is only encoded when the method is done.
+ *  This still avoids holding the whole result as a Value.
+ */
+class MessagePackStreamedResult : public StreamedResult
+{
+public:
+    MessagePackStreamedResult(Value& id, Stream& response) : id_(id), response_(response), elementWriter_(elements_) {}
+
+protected:
+    virtual void EncodeStart() {}
+    virtual void EncodeElement(Value& element, std::size_t /* index */) { element.Traverse(elementWriter_); }
+    virtual void EncodeEnd(std::size_t count)
+    {
+        // the same layout as MessagePackGenerateResponse
+        MessagePackWriter writer(response_);
+        writer.StartArray(4);
+        writer.Int(1);
+        id_.Traverse(writer);
+        writer.Null();
+        writer.StartArray(count);
+        size_t offset = 0;
+        size_t segmentLength;
+        const char* segment;
+        while ((segment = elements_.GetBuffer(offset, segmentLength)) != 0)
+        {
+            response_.Put(segment, segmentLength);
+            offset += segmentLength;
+        }
+        writer.EndArray(count);
+        writer.EndArray(4);
+    }
+
+private:
+    Value& id_;                         //!< Id of the call
+    Stream& response_;                  //!< Stream for the response
+    WriteSegmentedStream elements_;     //!< Encoded elements of the result
+    MessagePackWriter elementWriter_;   //!< Writer for the elements
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 bool MessagePackRpcHandler(MethodManager* manager, char* request, size_t length, Stream &response)
 {
     log_trace();
@@ -83,10 +128,22 @@ bool MessagePackRpcHandler(MethodManager* manager, char* request, size_t length,
                 result.SetNull();
 
                 std::string methodName = method.GetString();
+                MessagePackStreamedResult streamedResult(id, response);
+                CallDeferral* deferral = CallDeferral::Current();
+                if (deferral != 0)
+                    deferral->SetCall(&MessagePackEncodeResponse, id, methodName, &streamedResult);
+
                 try
                 {
                     if (!manager->ExecuteMethod(methodName, params, result))
                         MessagePackGenerateFaultResponse(AnyRpcErrorMethodNotFound, "Method not found", id, valueResponse);
+                    else if ((deferral != 0) && deferral->IsDeferred())
+                        return false;   // the connection sends the response when the method responds
+                    else if ((deferral != 0) && deferral->IsStreamed())
+                    {
+                        streamedResult.Finish();
+                        return true;
+                    }
                     else
                         MessagePackGenerateResponse(result, id, valueResponse);
                 }
@@ -122,7 +179,13 @@ bool MessagePackRpcHandler(MethodManager* manager, char* request, size_t length,
                 Value id;
                 id.SetNull();
 
+                // there is no response so an asynchronous method isn't waited for
                 std::string methodName = method.GetString();
+                Value notificationId;
+                CallDeferral* deferral = CallDeferral::Current();
+                if (deferral != 0)
+                    deferral->SetCall(&MessagePackEncodeResponse, notificationId, methodName);
+
                 try
                 {
                     manager->ExecuteMethod(methodName, params, result);
@@ -152,6 +215,106 @@ bool MessagePackRpcHandler(MethodManager* manager, char* request, size_t length,
     return true;
 }
 
+bool MessagePackRpcFaultHandler(char* request, size_t length, int errorCode, std::string const& errorMsg, Stream &response)
+{
+    Document doc;
+    Value valueResponse;
+    Value nullValue;
+    nullValue.SetNull();
+
+    // only the id is needed to address the fault
+    InSituStringStream sstream(request, length);
+    MessagePackReader reader(sstream);
+    reader.ParseStream(doc);
+    if (reader.HasParseError())
+        MessagePackGenerateFaultResponse(AnyRpcErrorParseError, "Parse error", nullValue, valueResponse);
+    else
+    {
+        Value message;
+        message.Assign( doc.GetValue() );
+
+        if (message.IsArray() && (message.Size() == 4) && message[1].IsUint())
+            MessagePackGenerateFaultResponse(errorCode, errorMsg, message[1], valueResponse);
+        else if (message.IsArray() && (message.Size() == 3))
+            // notification doesn't produce a response message
+            return false;
+        else
+            MessagePackGenerateFaultResponse(AnyRpcErrorInvalidRequest, "Invalid Request", nullValue, valueResponse);
+    }
+
+    MessagePackWriter mpackStrWriter(response);
+    valueResponse.Traverse(mpackStrWriter);
+
+    return true;
+}
+
+bool MessagePackRpcMethodName(const char* request, size_t length, std::string& methodName)
+{
+    // decode only the start of [type, msgid, method, params] or [type, method, params]
+    // since the handler parses the request in place later
+    const unsigned char* pos = reinterpret_cast<const unsigned char*>(request);
+    const unsigned char* end = pos + length;
+    if ((pos == end) || ((*pos != 0x94) && (*pos != 0x93)))
+        return false;
+    bool notification = (*pos++ == 0x93);
+    if ((pos == end) || (*pos++ != (notification ? 2 : 0)))
+        return false;
+    if (!notification)
+    {
+        // skip the message id
+        if (pos == end)
+            return false;
+        unsigned char idType = *pos++;
+        std::size_t idLength = 0;
+        if ((idType == 0xcc) || (idType == 0xd0))
+            idLength = 1;
+        else if ((idType == 0xcd) || (idType == 0xd1))
+            idLength = 2;
+        else if ((idType == 0xce) || (idType == 0xd2))
+            idLength = 4;
+        else if ((idType == 0xcf) || (idType == 0xd3))
+            idLength = 8;
+        else if ((idType >= 0x80) && (idType < 0xe0))
+            return false;
+        if (static_cast<std::size_t>(end - pos) < idLength)
+            return false;
+        pos += idLength;
+    }
+
+    // the method name is a string
+    if (pos == end)
+        return false;
+    unsigned char strType = *pos++;
+    std::size_t nameLength;
+    if ((strType & 0xe0) == 0xa0)
+        nameLength = strType & 0x1f;
+    else if ((strType == 0xd9) && (pos < end))
+        nameLength = *pos++;
+    else if ((strType == 0xda) && (end - pos >= 2))
+    {
+        nameLength = (static_cast<std::size_t>(pos[0]) << 8) | pos[1];
+        pos += 2;
+    }
+    else
+        return false;
+    if (static_cast<std::size_t>(end - pos) < nameLength)
+        return false;
+    methodName.assign(reinterpret_cast<const char*>(pos), nameLength);
+    return true;
+}
+
+static void MessagePackEncodeResponse(Value& id, Value* result, int errorCode, std::string const& errorMsg, Stream& response)
+{
+    Value valueResponse;
+    if (result != 0)
+        MessagePackGenerateResponse(*result, id, valueResponse);
+    else
+        MessagePackGenerateFaultResponse(errorCode, errorMsg, id, valueResponse);
+
+    MessagePackWriter mpackStrWriter(response);
+    valueResponse.Traverse(mpackStrWriter);
+}
+
 static void MessagePackGenerateResponse(Value& result, Value& id, Value& response)
 {
     response.SetSize(4);
@@ -27,6 +27,192 @@
 namespace anyrpc
 {
 
+//! Deferral for the call being executed by this thread
+static thread_local CallDeferral* currentDeferral = 0;
+
+CallDeferral::CallDeferral() :
+    previous_(currentDeferral), encoder_(0), id_(0), methodName_(0), streamedResult_(0), deferred_(false), streamed_(false)
+{
+    currentDeferral = this;
+}
+
+CallDeferral::~CallDeferral()
+{
+    currentDeferral = previous_;
+}
+
+CallDeferral* CallDeferral::Current()
+{
+    return currentDeferral;
+}
+
+//! Responder for a notification - there is nothing to send so the result is dropped
+class DiscardResponder : public MethodResponder
+{
+public:
+    virtual void Respond(Value& /* result */) { delete this; }
+    virtual void Fault(int /* errorCode */, std::string const& /* errorMsg */) { delete this; }
+};
+
+MethodResponder* CallDeferral::Defer(std::string const& methodName)
+{
+    // only the described call can be deferred, not a method that it calls directly
+    if ((encoder_ == 0) || (methodName != *methodName_))
+        return 0;
+    RpcResponseEncoder* encoder = encoder_;
+    encoder_ = 0;
+    streamedResult_ = 0;
+    if (id_->IsInvalid())
+        return new DiscardResponder;
+
+    MethodResponder* responder = CreateResponder(encoder, *id_);
+    deferred_ = (responder != 0);
+    return responder;
+}
+
+ResultWriter* CallDeferral::StreamResult(std::string const& methodName)
+{
+    // only the described call can be streamed, not a method that it calls directly
+    if ((streamedResult_ == 0) || (methodName != *methodName_))
+        return 0;
+    ResultWriter* writer = streamedResult_;
+    encoder_ = 0;
+    streamedResult_ = 0;
+    streamed_ = true;
+    return writer;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void StreamedResult::Write(Value& element)
+{
+    if (count_ == 0)
+        EncodeStart();
+    EncodeElement(element, count_++);
+
+    // the connection can send what has been encoded while the method continues
+    CallDeferral* deferral = CallDeferral::Current();
+    if ((deferral != 0) && !deferral->SendPart())
+        anyrpc_throw(AnyRpcErrorTransportError, "Failed sending the result");
+}
+
+void StreamedResult::Finish()
+{
+    if (count_ == 0)
+        EncodeStart();
+    EncodeEnd(count_);
+    finished_ = true;
+}
+
+bool StreamedResult::Discard()
+{
+    if (count_ == 0)
+        return true;
+    CallDeferral* deferral = CallDeferral::Current();
+    return (deferral != 0) && deferral->DiscardPart();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Responder that the executing thread waits on when the call can't be deferred
+class WaitingResponder : public MethodResponder
+{
+public:
+    WaitingResponder(Value& result) : result_(result), done_(false), errorCode_(0), fault_(false) {}
+
+    virtual void Respond(Value& result)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        result_.Assign(result);
+        done_ = true;
+        condition_.notify_one();
+    }
+
+    virtual void Fault(int errorCode, std::string const& errorMsg)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        errorCode_ = errorCode;
+        errorMsg_ = errorMsg;
+        fault_ = true;
+        done_ = true;
+        condition_.notify_one();
+    }
+
+    //! Wait for the responder to be used and throw the fault if there was one
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!done_)
+            condition_.wait(lock);
+        if (fault_)
+            throw AnyRpcException(errorCode_, errorMsg_);
+    }
+
+private:
+    Value& result_;                     //!< Result of the executing call
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool done_;                         //!< Whether Respond or Fault has been called
+    int errorCode_;                     //!< Code of the fault
+    std::string errorMsg_;              //!< Message of the fault
+    bool fault_;                        //!< Whether Fault was called
+};
+
+//! Writer that collects the elements into the result when the call can't be streamed
+class CollectingWriter : public ResultWriter
+{
+public:
+    CollectingWriter(Value& result) : result_(result), count_(0) { result_.SetArray(); }
+
+    virtual void Write(Value& element) { result_[count_++].Assign(element); }
+
+private:
+    Value& result_;                     //!< Result of the executing call
+    std::size_t count_;                 //!< Number of elements written
+};
+
+void StreamMethod::Execute(Value& params, Value& result)
+{
+    CallDeferral* deferral = CallDeferral::Current();
+    ResultWriter* writer = (deferral != 0) ? deferral->StreamResult(Name()) : 0;
+    if (writer != 0)
+    {
+        // the RPC handler encodes the elements into the response
+        ExecuteStream(params, *writer);
+        return;
+    }
+
+    CollectingWriter collector(result);
+    ExecuteStream(params, collector);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void AsyncMethod::Execute(Value& params, Value& result)
+{
+    CallDeferral* deferral = CallDeferral::Current();
+    MethodResponder* responder = (deferral != 0) ? deferral->Defer(Name()) : 0;
+    if (responder != 0)
+    {
+        // the connection writes the response when the responder is used
+        try
+        {
+            ExecuteAsync(params, responder);
+        }
+        catch (const AnyRpcException& fault)
+        {
+            responder->Fault(fault.GetCode(), fault.GetMessage());
+        }
+        return;
+    }
+
+    WaitingResponder waiter(result);
+    ExecuteAsync(params, &waiter);
+    waiter.Wait();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 void ListMethod::Execute(Value& params, Value& result)
 {
     if (manager_)
@@ -77,6 +263,40 @@ void MethodManager::AddFunction(Function* function, std::string const& name, std
     }
 }
 
+void MethodManager::AddAsyncFunction(AsyncFunction* function, std::string const& name, std::string const& help)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    MethodMap::const_iterator it = methods_.find(name);
+    if (it == methods_.end())
+    {
+        // not found so add new method
+        methods_[name] = new AsyncMethodFunction(function,name,help);
+    }
+    else
+    {
+        // function already defined, throw exception
+        // the user can catch and ignore the exception if this behavior is desired
+        anyrpc_throw(AnyRpcErrorFunctionRedefine, "Attempt to redefine function name: " + name);
+    }
+}
+
+void MethodManager::AddStreamFunction(StreamFunction* function, std::string const& name, std::string const& help)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    MethodMap::const_iterator it = methods_.find(name);
+    if (it == methods_.end())
+    {
+        // not found so add new method
+        methods_[name] = new StreamMethodFunction(function,name,help);
+    }
+    else
+    {
+        // function already defined, throw exception
+        // the user can catch and ignore the exception if this behavior is desired
+        anyrpc_throw(AnyRpcErrorFunctionRedefine, "Attempt to redefine function name: " + name);
+    }
+}
+
 void MethodManager::AddMethod(Method* method)
 {
     std::lock_guard<std::mutex> lock(mutex_);
@@ -124,6 +344,25 @@ bool MethodManager::RemoveMethod(std::string const& name, bool WaitForDelayedRem
     return true;
 }
 
+bool MethodManager::SetMethodLane(std::string const& name, unsigned lane)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    MethodMap::const_iterator it = methods_.find(name);
+    if (it == methods_.end())
+        return false;
+    it->second->SetLane(lane);
+    return true;
+}
+
+unsigned MethodManager::GetMethodLane(std::string const& name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    MethodMap::const_iterator it = methods_.find(name);
+    if (it == methods_.end())
+        return 0;
+    return it->second->Lane();
+}
+
 bool MethodManager::ExecuteMethod(std::string const& name, Value& params, Value& result)
 {
     std::unique_lock<std::mutex> lock(mutex_);
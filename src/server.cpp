@@ -61,18 +61,69 @@ Server::Server()
     maxConnections_ = 8;
     port_ = 0;
     address_ = INADDR_ANY;
+    sharedMemory_ = false;
+    zeroCopyThreshold_ = 0;
     forcedDisconnectAllowed_ = true;
+    idleTimeout_ = 0;
+    headerTimeout_ = 0;
+    bodyTimeout_ = 0;
+    maxRequests_ = 0;
+    maxContentLength_ = DefaultMaxContentLength;
+    acceptBatch_ = 16;
+    deferAccept_ = 0;
+    acceptedCount_ = 0;
+    rejectedCount_ = 0;
+    acceptErrors_ = 0;
+    acceptWakeups_ = 0;
+    connectionPoolSize_ = 0;
+    connectionPrewarm_ = 0;
+    pooledConnections_ = 0;
+    numPooledConnections_ = 0;
+    now_ = MonotonicMicroTime() / 1000;
+    poller_ = 0;
+    pollerType_ = internal::Poller::POLLER_DEFAULT;
+    pollerIo_ = false;
+    reusePort_ = false;
 
 #if defined(ANYRPC_THREADING)
     threadRunning_ = false;
 #endif // defined(ANYRPC_THREADING)
 }
 
-bool Server::BindAndListen(int port, int backlog)
+Server::~Server()
 {
-    int result;
+    delete poller_;
+    poller_ = 0;
+    Shutdown();
+    DeletePooledConnections();
+}
 
-    port_ = port;
+bool Server::BindAndListenLocal(const std::string& path, int backlog)
+{
+    localPath_ = path;
+    return BindAndListen(LocalPort, backlog);
+}
+
+bool Server::CreateListener(int port, int backlog)
+{
+    if (!((port == LocalPort) ? BindLocalSocket() : BindTcpSocket(port)))
+        return false;
+
+    // Set in listening mode
+    int result = socket_.Listen(backlog);
+    if (result != 0)
+    {
+        socket_.Close();
+        log_warn("Could not set socket in listening mode: " << result);
+        return false;
+    }
+
+    return true;
+}
+
+bool Server::BindTcpSocket(int port)
+{
+    int result;
 
     // Recreate the sockets in case this is a second call
     socket_.Create();
@@ -95,6 +146,27 @@ bool Server::BindAndListen(int port, int backlog)
         return false;
     }
 
+    // Allow several sockets to bind the port with the kernel distributing the connections
+    if (reusePort_)
+    {
+        result = socket_.SetReusePort();
+        if (result != 0)
+        {
+            socket_.Close();
+            log_warn("Could not set SO_REUSEPORT socket option: " << result);
+            return false;
+        }
+    }
+
+    // The accepted sockets inherit this on Linux so it does not need to be set for each one
+    result = socket_.SetTcpNoDelay();
+    if (result != 0)
+        log_warn("Could not set TCP_NODELAY socket option: " << result);
+
+    // Don't wake for a new connection until the client has sent a request
+    if ((deferAccept_ > 0) && (socket_.SetDeferAccept(deferAccept_) != 0))
+        log_warn("Could not set TCP_DEFER_ACCEPT socket option");
+
     // Bind to the specified port on the default interface
     result = socket_.Bind(port, address_);
     if (result != 0)
@@ -104,23 +176,92 @@ bool Server::BindAndListen(int port, int backlog)
         return false;
     }
 
-    // Set in listening mode
-    result = socket_.Listen(backlog);
+    return true;
+}
+
+bool Server::BindLocalSocket()
+{
+#if defined(ANYRPC_LOCAL_SOCKET)
+    socket_.CreateLocal();
+
+    // Don't block on reads/writes
+    int result = socket_.SetNonBlocking();
+    if (result != 0)
+    {
+        CloseListener();
+        log_warn("Could not set socket to non-blocking input mode: " << result);
+        return false;
+    }
+
+    // A socket file left by a server that is no longer running would make the bind fail
+    TcpSocket probe;
+    if (probe.ConnectLocal(localPath_.c_str()) != 0)
+        Socket::RemoveLocalPath(localPath_.c_str());
+    probe.Close();
+
+    result = socket_.BindLocal(localPath_.c_str());
     if (result != 0)
     {
         socket_.Close();
-        log_warn("Could not set socket in listening mode: " << result);
+        log_warn("Could not bind to path " << localPath_ << " : " << result);
+        return false;
+    }
+    return true;
+#else
+    log_warn("Unix domain sockets are not supported on this platform");
+    return false;
+#endif // defined(ANYRPC_LOCAL_SOCKET)
+}
+
+void Server::CloseListener()
+{
+#if defined(ANYRPC_LOCAL_SOCKET)
+    // remove the path while this server is still bound to it so it can't be another server's file
+    if ((port_ == LocalPort) && !localPath_.empty() && (socket_.GetFileDescriptor() >= 0))
+        Socket::RemoveLocalPath(localPath_.c_str());
+#endif // defined(ANYRPC_LOCAL_SOCKET)
+    socket_.Close();
+}
+
+bool Server::BindAndListen(int port, int backlog)
+{
+    port_ = port;
+    if (port != LocalPort)
+        localPath_.clear();
+
+    if (!CreateListener(port, backlog))
+        return false;
+
+    // Register the server socket with a new poller - the connections are added as they are accepted
+    delete poller_;
+    poller_ = internal::Poller::Create(pollerType_);
+    if (pollerIo_)
+        poller_->Attach(socket_, true);
+    if (!poller_->Add(socket_.GetFileDescriptor(), internal::Poller::EVENT_READ, &socket_))
+    {
+        CloseListener();
+        log_warn("Could not register socket with the poller");
+        return false;
+    }
+    if (!AddWakeup())
+    {
+        CloseListener();
         return false;
     }
 
-    log_info("Server listening on port " << port << ", fd " << socket_.GetFileDescriptor());
+    if (port == LocalPort)
+        log_info("Server listening on path " << localPath_ << ", fd " << socket_.GetFileDescriptor());
+    else
+        log_info("Server listening on port " << port << ", fd " << socket_.GetFileDescriptor());
+    PrewarmConnections();
 
     return true;
 }
 
-void Server::AddHandler(RpcHandler* handler, std::string requestContentType, std::string responseContentType)
+void Server::AddHandler(RpcHandler* handler, std::string requestContentType, std::string responseContentType,
+                        RpcMethodNameHandler* methodNameHandler)
 {
-    handlers_.push_back(RpcContentHandler(handler,requestContentType,responseContentType));
+    handlers_.push_back(RpcContentHandler(handler,requestContentType,responseContentType,methodNameHandler));
 }
 
 void Server::AddAllHandlers()
@@ -128,29 +269,29 @@ void Server::AddAllHandlers()
 #if defined(ANYRPC_REGEX)
 // Need c++11 compiler to support regular expression
 # if defined(ANYRPC_INCLUDE_JSON)
-    AddHandler( &JsonRpcHandler, "(.*)(json-rpc)", "application/json-rpc" );
+    AddHandler( &JsonRpcHandler, "(.*)(json-rpc)", "application/json-rpc", &JsonRpcMethodName );
 # endif // defined(ANYRPC_INCLUDE_JSON)
 
 # if defined(ANYRPC_INCLUDE_XML)
-    AddHandler( &XmlRpcHandler, "(.*)(xml)", "text/xml" );
+    AddHandler( &XmlRpcHandler, "(.*)(xml)", "text/xml", &XmlRpcMethodName );
 # endif // defined(ANYRPC_INCLUDE_XML)
 
 # if defined(ANYRPC_INCLUDE_MESSAGEPACK)
-    AddHandler( &MessagePackRpcHandler, "(.*)(messagepack-rpc)", "application/messagepack-rpc" );
+    AddHandler( &MessagePackRpcHandler, "(.*)(messagepack-rpc)", "application/messagepack-rpc", &MessagePackRpcMethodName );
 # endif // defined(ANYRPC_INCLUDE_MESSAGEPACK)
 
 #else
 // Without c++11 compiler, use sub string find
 # if defined(ANYRPC_INCLUDE_JSON)
-    AddHandler( &JsonRpcHandler, "json-rpc", "application/json-rpc" );
+    AddHandler( &JsonRpcHandler, "json-rpc", "application/json-rpc", &JsonRpcMethodName );
 # endif // defined(ANYRPC_INCLUDE_JSON)
 
 # if defined(ANYRPC_INCLUDE_XML)
-    AddHandler( &XmlRpcHandler, "xml", "text/xml" );
+    AddHandler( &XmlRpcHandler, "xml", "text/xml", &XmlRpcMethodName );
 # endif // defined(ANYRPC_INCLUDE_XML)
 
 # if defined(ANYRPC_INCLUDE_MESSAGEPACK)
-    AddHandler( &MessagePackRpcHandler, "messagepack-rpc", "application/messagepack-rpc" );
+    AddHandler( &MessagePackRpcHandler, "messagepack-rpc", "application/messagepack-rpc", &MessagePackRpcMethodName );
 # endif // defined(ANYRPC_INCLUDE_MESSAGEPACK)
 
 #endif //defined(ANYRPC_REGEX)
@@ -162,6 +303,26 @@ void Server::Exit()
 #if defined(ANYRPC_THREADING)
     threadRunning_ = false;
 #endif // defined(ANYRPC_THREADING)
+    Interrupt();
+}
+
+void Server::Interrupt()
+{
+    wakeup_.Signal();
+}
+
+bool Server::AddWakeup()
+{
+    // The descriptor is created once and never closed while the server exists so another
+    // thread can signal it at any time without the risk of writing to a reused descriptor
+    if (!wakeup_.IsOpen() && !wakeup_.Create())
+        return false;
+    if (!poller_->Add(wakeup_.GetFileDescriptor(), internal::Poller::EVENT_READ, &wakeup_))
+    {
+        log_warn("Could not register wakeup with the poller");
+        return false;
+    }
+    return true;
 }
 
 #if defined(ANYRPC_THREADING)
@@ -175,622 +336,1417 @@ void Server::StartThread()
 void Server::StopThread()
 {
     log_trace();
-    if (threadRunning_)
-    {
-        threadRunning_ = false;
+    // the thread may have already stopped from a call to Exit but still needs to be joined
+    threadRunning_ = false;
+    Interrupt();
+    if (thread_.joinable())
         thread_.join();
-    }
 }
 
 void Server::ThreadStarter()
 {
     log_trace();
+    PlaceThread();
+    // Work only returns when woken by Exit, StopThread, or Interrupt
     while (threadRunning_ && !exit_)
     {
-        Work(100);
+        Work(-1);
     }
     Shutdown();
     threadRunning_ = false;
 }
-#endif // defined(ANYRPC_THREADING)
 
-void Server::GetConnectionsSockInfo(std::list<std::string>& ips, std::list<unsigned>& ports) const
+void Server::PlaceThread()
 {
-    std::string ip;
-    unsigned port;
-    for (auto& client : connections_)
-    {
-        client->GetSockInfo(ip, port);
-        ips.push_back(ip);
-        ports.push_back(port);
-    }
+    // placing the thread from the inside means it never runs on the wrong CPU after StartThread returns
+    if (!threadCpus_.empty())
+        internal::SetCurrentThreadAffinity(threadCpus_);
+    if (!threadName_.empty())
+        internal::SetCurrentThreadName(threadName_);
 }
+#endif // defined(ANYRPC_THREADING)
 
-void Server::GetConnectionsPeerInfo(std::list<std::string>& ips, std::list<unsigned>& ports) const
+SOCKET Server::AcceptSocket()
 {
-    std::string ip;
-    unsigned port;
-    for (auto& client : connections_)
+    SOCKET fd = socket_.Accept();
+    if (fd < 0)
     {
-        client->GetPeerInfo(ip, port);
-        ips.push_back(ip);
-        ports.push_back(port);
+        // running out of pending connections is the normal end of a batch
+        if (socket_.FatalError())
+        {
+            acceptErrors_.fetch_add(1, std::memory_order_relaxed);
+            log_warn("Could not accept connection, error=" << socket_.GetLastError());
+        }
+        return fd;
     }
+    acceptedCount_.fetch_add(1, std::memory_order_relaxed);
+    return fd;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-void ServerST::Work(int ms)
+void Server::RejectSocket(SOCKET fd)
 {
-    int timeLeft;
-    struct timeval startTime;
-    struct timeval currentTime;
-    gettimeofday( &startTime, 0 );
+    rejectedCount_.fetch_add(1, std::memory_order_relaxed);
+#ifdef WIN32
+    closesocket(fd);
+#else
+    close(fd);
+#endif // WIN32
+}
 
-    working_ = true;
+void Server::AcceptConnections()
+{
+    acceptWakeups_.fetch_add(1, std::memory_order_relaxed);
 
-    do
+    // drain the pending connections up to the batch limit so a burst of connections
+    // doesn't take a wakeup for each one but also doesn't delay the other events
+    for (unsigned i=0; i<acceptBatch_; i++)
     {
-        // Construct the sets of descriptors we are interested in
-        fd_set inFd, outFd;
-        FD_ZERO(&inFd);
-        FD_ZERO(&outFd);
-
-        // add server socket
-        SOCKET maxFd = socket_.GetFileDescriptor();
-        FD_SET(maxFd, &inFd);
-
-        // add connection sockets
-        for (ConnectionList::iterator it = connections_.begin(); it != connections_.end(); it++)
-        {
-            Connection* connection = *it;
-            SOCKET fd = connection->GetFileDescriptor();
-            if (connection->WaitForReadability())
-            {
-                FD_SET(fd, &inFd);
-                maxFd = std::max(fd, maxFd);
-            }
-            if (connection->WaitForWritability())
-            {
-                FD_SET(fd, &outFd);
-                maxFd = std::max(fd, maxFd);
-            }
-        }
-
-        // Check for events
-        int nEvents;
-        if (ms < 0)
-            nEvents = select(static_cast<int>(maxFd) + 1, &inFd, &outFd, NULL, NULL);
-        else
-        {
-            gettimeofday( &currentTime, 0 );
-            timeLeft = ms - MilliTimeDiff(currentTime,startTime);
-
-            struct timeval tv;
-            tv.tv_sec = timeLeft / 1000;
-            tv.tv_usec = (timeLeft - tv.tv_sec*1000) * 1000;
-            nEvents = select(static_cast<int>(maxFd) + 1, &inFd, &outFd, NULL, &tv);
-        }
-
-        if (nEvents < 0)
+        SOCKET fd = AcceptSocket();
+        if (fd < 0)
+            return;
+        if (!MakeRoomForConnection())
         {
-            break;
+            // could not find one to disconnect
+            log_debug( "Can't accept the connection, too many active connections" );
+            RejectSocket(fd);
+            continue;
         }
+        // Listen for input on this source when we are in work()
+        log_info("Creating a connection, fd=" << fd);
+        AddConnection( AcquireConnection(fd) );
+    }
+}
 
-        // Process server events
-        if (FD_ISSET(socket_.GetFileDescriptor(), &inFd))
-            AcceptConnection();
+void Server::GetAcceptStats(AcceptStats& stats) const
+{
+    stats.accepted_ = acceptedCount_.load(std::memory_order_relaxed);
+    stats.rejected_ = rejectedCount_.load(std::memory_order_relaxed);
+    stats.errors_ = acceptErrors_.load(std::memory_order_relaxed);
+    stats.wakeups_ = acceptWakeups_.load(std::memory_order_relaxed);
+}
 
-        // Process connection events
-        for (ConnectionList::iterator it = connections_.begin(); it != connections_.end();)
-        {
-            // save this iterator position and move to the next so you can erase if needed
-            Connection* connection = *it;
-            SOCKET fd = connection->GetFileDescriptor();
-            if (fd <= maxFd)
-            {
-                if ((FD_ISSET(fd, &inFd)) || (FD_ISSET(fd, &outFd)))
-                {
-                    try
-                    {
-                        connection->Process();
-                    }
-                    catch (AnyRpcException&)
-                    {
-                        // anyrpc exceptions shouldn't get to this point but attempt to handle gracefully
-                        connection->SetCloseState();
-                    }
-                }
-            }
-            if (connection->CheckClose())
-            {
-                log_info("Stop monitoring fd=" << connection->GetFileDescriptor());
-                delete connection;
-                it = connections_.erase(it);
-            }
-            else
-                it++;
-        }
+void Server::AddConnection(Connection* connection)
+{
+    connection->SetKeepAliveLimits(idleTimeout_, maxRequests_);
+    connection->SetResponseGate(responseGate_);
+    // the shared memory rings are passed with the first data so it has to be read from the socket
+    if (pollerIo_ && !(sharedMemory_ && (port_ == LocalPort)))
+        connection->AttachPoller(poller_);
+    connection->SetListedBusy(false);
+    connections_.PushBack(connection);
+    UpdateConnectionEvents(connection);
+}
 
-        gettimeofday( &currentTime, 0 );
-        timeLeft = ms - MilliTimeDiff(currentTime,startTime);
+void Server::RemoveConnection(Connection* connection)
+{
+    if ((poller_ != 0) && (connection->GetPollEvents() != internal::Poller::EVENT_NONE))
+        poller_->Remove(connection->GetFileDescriptor());
+    timers_.Cancel(connection->GetTimer());
+    UnlistConnection(connection);
+    ReleaseConnection(connection);
+}
 
-    } while (!exit_ && ((ms < 0) || (timeLeft > 0)));
+Connection* Server::AcquireConnection(SOCKET fd)
+{
+    Connection* connection = pooledConnections_;
+    if (connection == 0)
+        connection = CreateConnection(fd);
+    else
+    {
+        pooledConnections_ = connection->GetNextListed();
+        numPooledConnections_--;
+        connection->SetNextListed(0);
+        connection->Reuse(fd);
+    }
+    connection->SetMaxContentLength(maxContentLength_);
+#if defined(ANYRPC_SHARED_MEMORY)
+    if (sharedMemory_ && (port_ == LocalPort))
+        connection->AcceptSharedMemory();
+#endif // defined(ANYRPC_SHARED_MEMORY)
+#if defined(ANYRPC_ZEROCOPY)
+    if ((zeroCopyThreshold_ > 0) && (port_ != LocalPort))
+        connection->SetZeroCopyThreshold(zeroCopyThreshold_);
+#endif // defined(ANYRPC_ZEROCOPY)
+    return connection;
+}
 
-    working_ = false;
+void Server::ReleaseConnection(Connection* connection)
+{
+#if defined(ANYRPC_ZEROCOPY)
+    // the socket is closed from the work loop once the kernel is done with its buffers
+    connection->LingerZeroCopy(zeroCopyReaper_, now_);
+#endif // defined(ANYRPC_ZEROCOPY)
+    if (numPooledConnections_ >= connectionPoolSize_)
+    {
+        delete connection;
+        return;
+    }
+    // closes the socket so the client sees the disconnect right away
+    connection->Recycle();
+    connection->SetNextListed(pooledConnections_);
+    pooledConnections_ = connection;
+    numPooledConnections_++;
 }
 
-void ServerST::Shutdown()
+void Server::PrewarmConnections()
 {
-    anyrpc_assert(!working_, AnyRpcErrorShutdown, "Illegal call to Shutdown");
-    if (!working_)
+    unsigned prewarm = std::min(connectionPrewarm_, connectionPoolSize_);
+    while (numPooledConnections_ < prewarm)
     {
-        for (ConnectionList::iterator it = connections_.begin(); it != connections_.end(); ++it)
-            delete *it;
-        connections_.clear();
-        socket_.Close();
+        Connection* connection = CreateConnection(static_cast<SOCKET>(-1));
+        connection->SetNextListed(pooledConnections_);
+        pooledConnections_ = connection;
+        numPooledConnections_++;
     }
 }
 
-void ServerST::AcceptConnection()
+void Server::DeletePooledConnections()
 {
-    SOCKET fd = socket_.Accept();
-    if (fd < 0)
+    while (pooledConnections_ != 0)
     {
-        log_warn("Could not accept connection, error=" << socket_.GetLastError());
-        return;
+        Connection* next = pooledConnections_->GetNextListed();
+        delete pooledConnections_;
+        pooledConnections_ = next;
     }
-    // this should only loop through once unless maxConnections was changed while running
-    while (connections_.size() >= maxConnections_)
+    numPooledConnections_ = 0;
+}
+
+void Server::DeleteConnections()
+{
+    ConnectionList* lists[2] = { &connections_, &busyConnections_ };
+    for (int i=0; i<2; i++)
     {
-        // find connection that has been used the least recent
-        ConnectionList::iterator targetIt = connections_.end();
-        time_t targetTime = 0;
-        for (ConnectionList::iterator it = connections_.begin(); it != connections_.end(); ++it)
-        {
-            Connection* connection = *it;
-            if (forcedDisconnectAllowed_ && connection->ForcedDisconnectAllowed())
-            {
-                time_t lastTime = connection->GetLastTransactionTime();
-                if ((targetTime == 0) || (lastTime < targetTime))
-                {
-                    // keep a reference to this one
-                    targetIt = it;
-                    targetTime = lastTime;
-                }
-            }
-        }
-        if (targetIt == connections_.end())
+        Connection* connection = lists[i]->Front();
+        while (connection != 0)
         {
-            // could not find one to disconnect
-            log_debug( "Can't accept the connection, too many active connections" );
-#ifdef WIN32
-            closesocket(fd);
-#else
-            close(fd);
-#endif // WIN32
-            return;
+            Connection* next = ConnectionList::Next(connection);
+            delete connection;
+            connection = next;
         }
-        log_debug("Force connection to close, fd=" << (*targetIt)->GetFileDescriptor());
-        delete *targetIt;
-        connections_.erase(targetIt);
+        lists[i]->Clear();
     }
-    // Listen for input on this source when we are in work()
-    log_info("Creating a connection, fd=" << fd);
-    Connection* connection = CreateConnection(fd);
-    connections_.push_back( connection );
+    timers_.Clear();
+#if defined(ANYRPC_ZEROCOPY)
+    zeroCopyReaper_.Clear();
+#endif // defined(ANYRPC_ZEROCOPY)
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-#if defined(ANYRPC_THREADING)
-void ServerMT::Work(int ms)
+bool Server::MakeRoomForConnection()
 {
-    int timeLeft;
-    struct timeval startTime;
-    struct timeval currentTime;
-    gettimeofday( &startTime, 0 );
-
-    working_ = true;
-
-    do
+    // this should only loop through once unless maxConnections was changed while running
+    while (NumConnections() >= maxConnections_)
     {
-        // Construct the sets of descriptors we are interested in
-        fd_set inFd;
-        FD_ZERO(&inFd);
+        // the connections that can be disconnected are kept in the order they were used so the
+        // first one is the least recently used - connections owned by a worker thread or in the
+        // middle of a request are in the busy list so this never waits for them
+        Connection* target = forcedDisconnectAllowed_ ? connections_.Front() : 0;
+        if (target == 0)
+            return false;
+
+        log_debug("Force connection to close, fd=" << target->GetFileDescriptor());
+        RemoveConnection(target);
+    }
+    return true;
+}
 
-        // add server socket
-        SOCKET maxFd = socket_.GetFileDescriptor();
-        FD_SET(maxFd, &inFd);
+void Server::UpdateConnectionEvents(Connection* connection)
+{
+    UpdateConnectionList(connection);
+    UpdateConnectionTimer(connection);
+    if (poller_ == 0)
+        return;
 
-        // Check for events
-        int nEvents;
-        if (ms < 0)
-            nEvents = select(static_cast<int>(maxFd) + 1, &inFd, NULL, NULL, NULL);
-        else
-        {
-            gettimeofday( &currentTime, 0 );
-            timeLeft = ms - MilliTimeDiff(currentTime,startTime);
+    unsigned events = internal::Poller::EVENT_NONE;
+    if (connection->WaitForReadability())
+        events |= internal::Poller::EVENT_READ;
+    if (connection->WaitForWritability())
+        events |= internal::Poller::EVENT_WRITE;
 
-            struct timeval tv;
-            tv.tv_sec = timeLeft / 1000;
-            tv.tv_usec = (timeLeft - tv.tv_sec*1000) * 1000;
-            nEvents = select(static_cast<int>(maxFd) + 1, &inFd, NULL, NULL, &tv);
-        }
+    unsigned pollEvents = connection->GetPollEvents();
+    if (events == pollEvents)
+        return;
 
-        if (nEvents < 0)
-            break;
+    // A connection without any events is removed from the poller so error and hangup
+    // conditions are not reported while another thread is processing the connection
+    SOCKET fd = connection->GetFileDescriptor();
+    log_debug("Update poll events, fd=" << fd << ", events=" << events);
+    bool result;
+    if (events == internal::Poller::EVENT_NONE)
+        result = poller_->Remove(fd);
+    else if (pollEvents == internal::Poller::EVENT_NONE)
+        result = poller_->Add(fd, events, connection);
+    else
+        result = poller_->Modify(fd, events, connection);
 
-        // Process server events
-        if (FD_ISSET(socket_.GetFileDescriptor(), &inFd))
-            AcceptConnection();
+    if (result)
+        connection->SetPollEvents(events);
+    else
+        connection->SetCloseState();
+}
 
-        gettimeofday( &currentTime, 0 );
-        timeLeft = ms - MilliTimeDiff(currentTime,startTime);
+void Server::UpdateConnectionList(Connection* connection)
+{
+    bool busy = !connection->IsActive() || !connection->ForcedDisconnectAllowed();
+    if (busy == connection->IsListedBusy())
+        return;
+    // a connection that becomes idle was just used so it is the last to be forced to disconnect
+    UnlistConnection(connection);
+    connection->SetListedBusy(busy);
+    if (busy)
+        busyConnections_.PushBack(connection);
+    else
+        connections_.PushBack(connection);
+}
 
-    } while (!exit_ && ((ms < 0) || (timeLeft > 0)));
+void Server::UpdateConnectionTimer(Connection* connection)
+{
+    // the timer is only set when the connection changes to a new state or a new request so
+    // the time limit applies to the whole idle period or the whole request
+    unsigned requestCount = connection->GetRequestCount();
+    unsigned timerRequest;
+    Connection::TimeoutType type = connection->GetTimeoutType();
+    if ((type == connection->GetTimerType(timerRequest)) && (requestCount == timerRequest))
+        return;
 
-    working_ = false;
+    unsigned timeout = 0;
+    switch (type)
+    {
+        case Connection::TIMEOUT_IDLE   : timeout = idleTimeout_; break;
+        case Connection::TIMEOUT_HEADER : timeout = headerTimeout_; break;
+        case Connection::TIMEOUT_BODY   : timeout = bodyTimeout_; break;
+        default                         : break;
+    }
+    if (timeout > 0)
+        timers_.Schedule(connection->GetTimer(), now_, timeout);
+    else
+        timers_.Cancel(connection->GetTimer());
+    connection->SetTimerType(type, requestCount);
 }
 
-void ServerMT::Shutdown()
+void Server::ExpireConnections()
 {
-    log_trace();
-    // tell all connections to shutdown
-    for (ConnectionList::iterator it = connections_.begin(); it != connections_.end(); ++it)
+    internal::TimerEntry* timer;
+    while ((timer = timers_.Expire(now_)) != 0)
     {
-        (*it)->StopThread();
-        delete *it;
+        Connection* connection = static_cast<Connection*>(timer->data_);
+        log_info("Connection timed out, fd=" << connection->GetFileDescriptor());
+        RemoveConnection(connection);
     }
+#if defined(ANYRPC_ZEROCOPY)
+    zeroCopyReaper_.Reap(now_);
+#endif // defined(ANYRPC_ZEROCOPY)
+}
 
-    connections_.clear();
-    socket_.Close();
+int Server::GetPollTimeout(int ms, int timeLeft)
+{
+    int timeout = (ms < 0) ? -1 : std::max(0,timeLeft);
+    int timerTimeout = timers_.GetTimeout(now_);
+    if ((timerTimeout >= 0) && ((timeout < 0) || (timerTimeout < timeout)))
+        timeout = timerTimeout;
+#if defined(ANYRPC_ZEROCOPY)
+    int reapTimeout = zeroCopyReaper_.GetTimeout(now_);
+    if ((reapTimeout >= 0) && ((timeout < 0) || (reapTimeout < timeout)))
+        timeout = reapTimeout;
+#endif // defined(ANYRPC_ZEROCOPY)
+    return timeout;
 }
 
-void ServerMT::AcceptConnection()
+void Server::GetConnectionsSockInfo(std::list<std::string>& ips, std::list<unsigned>& ports) const
 {
-    log_trace();
-    SOCKET fd = socket_.Accept();
-    if (fd < 0)
-    {
-        log_warn("Could not accept connection, error=" << socket_.GetLastError());
-        return;
-    }
-    // check if any of the threads have stopped running
-    for (ConnectionList::iterator it = connections_.begin(); it != connections_.end();)
+    std::string ip;
+    unsigned port;
+    const ConnectionList* lists[2] = { &connections_, &busyConnections_ };
+    for (int i=0; i<2; i++)
     {
-        if (!(*it)->IsThreadRunning())
+        for (Connection* client = lists[i]->Front(); client != 0; client = ConnectionList::Next(client))
         {
-            log_debug("Thread has already stopped");
-            // not running but this will call join
-            (*it)->StopThread();
-            delete *it;
-            it = connections_.erase(it);
+            client->GetSockInfo(ip, port);
+            ips.push_back(ip);
+            ports.push_back(port);
         }
-        else
-            it++;
     }
-    // check if any can be forced to disconnect
-    if (connections_.size() >= maxConnections_)
+}
+
+void Server::GetConnectionsPeerInfo(std::list<std::string>& ips, std::list<unsigned>& ports) const
+{
+    std::string ip;
+    unsigned port;
+    const ConnectionList* lists[2] = { &connections_, &busyConnections_ };
+    for (int i=0; i<2; i++)
     {
-        // find connection that has been used the least recent
-        ConnectionList::iterator targetIt = connections_.end();
-        time_t targetTime = 0;
-        for (ConnectionList::iterator it = connections_.begin(); it != connections_.end(); ++it)
-        {
-            Connection* connection = *it;
-            if (forcedDisconnectAllowed_ && connection->ForcedDisconnectAllowed())
-            {
-                time_t lastTime = connection->GetLastTransactionTime();
-                if ((targetTime == 0) || (lastTime < targetTime))
-                {
-                    // keep a reference to this one
-                    targetIt = it;
-                    targetTime = lastTime;
-                }
-            }
-        }
-        if (targetIt != connections_.end())
+        for (Connection* client = lists[i]->Front(); client != 0; client = ConnectionList::Next(client))
         {
-            // indicate that this connection should close and then wait for it
-            Connection* connection = *targetIt;
-            log_debug("Force connection to close, fd=" << connection->GetFileDescriptor());
-            connection->StopThread(false);
-            unsigned delay = 5;
-            for (unsigned i=0; i<(200/delay); i++)
-            {
-                if (!connection->IsThreadRunning())
-                    break;
-                MilliSleep(delay);
-            }
-            // check if it is still running
-            if (!connection->IsThreadRunning())
-            {
-                connection->StopThread();
-                delete *targetIt;
-                connections_.erase(targetIt);
-            }
+            client->GetPeerInfo(ip, port);
+            ips.push_back(ip);
+            ports.push_back(port);
         }
     }
-    if (connections_.size() >= maxConnections_)
-    {
-        log_debug( "Can't accept the connection, too many active connections" );
-#ifdef WIN32
-        closesocket(fd);
-#else
-        close(fd);
-#endif // WIN32
-    }
-    else
-    {
-        log_info("Creating a connection: " << fd);
-        Connection* connection = CreateConnection(fd);
-        connections_.push_back(connection);
-        connection->StartThread();
-    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void ServerTP::StartThread()
+ServerST::~ServerST()
 {
-    log_trace();
-    threadRunning_ = true;
-    thread_ = std::thread(&ServerTP::ThreadStarter, this);
+    // the outstanding responders may still use the gate but must not reach this server
+    if (responseGate_)
+        responseGate_->Close();
 }
 
-void ServerTP::ThreadStarter()
+bool ServerST::BindAndListen(int port, int backlog)
 {
-    log_trace();
+    if (!Server::BindAndListen(port, backlog))
+        return false;
 
-    // start the worker threads
-    workerExit_ = false;
-    for (unsigned i=0; i<numThreads_; i++)
-        workers_.emplace_back( &ServerTP::WorkerThread, this );
+    // A new gate for each call so the responders of any previous connections can't reach the new ones
+    if (responseGate_)
+        responseGate_->Close();
+    responseGate_ = std::make_shared<ResponseGate>();
+    if (!responseGate_->Open() ||
+        !poller_->Add(responseGate_->GetFileDescriptor(), internal::Poller::EVENT_READ, responseGate_.get()))
+    {
+        responseGate_.reset();
+        CloseListener();
+        log_warn("Could not register response gate with the poller");
+        return false;
+    }
+    return true;
+}
 
-    // run the system
-    while (threadRunning_ && !exit_)
+void ServerST::Work(int ms)
+{
+    if (poller_ == 0)
     {
-        Work(100);
+        log_warn("BindAndListen must be called before Work");
+        return;
     }
 
-    // stop the worker threads
-    workerExit_ = true;
-    workerBlock_.notify_all();
-    for (std::thread &worker: workers_)
-        worker.join();
-    workers_.clear();
-    
-    // shutdown the rest of the system
-    Shutdown();
-    threadRunning_ = false;
+    int timeLeft = ms;
+    bool interrupted = false;
+    int64_t startTime = MonotonicMicroTime() / 1000;
+    now_ = startTime;
+
+    working_ = true;
+
+    do
+    {
+        // Check for events
+        int nEvents = poller_->Wait(GetPollTimeout(ms, timeLeft));
+        if (nEvents < 0)
+        {
+            break;
+        }
+        now_ = MonotonicMicroTime() / 1000;
+
+        // Process connection events before accepting a new connection since a forced
+        // disconnect could delete a connection that still has an event to process
+        bool acceptReady = false;
+        for (int i=0; i<nEvents; i++)
+        {
+            void* data = poller_->GetData(i);
+            if (data == &socket_)
+                acceptReady = true;
+            else if (data == &wakeup_)
+                interrupted = true;
+            else if (data == responseGate_.get())
+                ProcessResponses();
+            else
+                ProcessEvent(data);
+        }
+
+        // Process server events
+        if (acceptReady)
+            AcceptConnections();
+
+        // Close the connections that have been idle or reading a request for too long
+        ExpireConnections();
+
+        // Return to the caller after the events from this wait are processed
+        if (interrupted)
+        {
+            wakeup_.Drain();
+            break;
+        }
+
+        now_ = MonotonicMicroTime() / 1000;
+        timeLeft = ms - static_cast<int>(now_ - startTime);
+
+    } while (!exit_ && ((ms < 0) || (timeLeft > 0)));
+
+    // the responses written since the last wait are sent without waiting for the next Work call
+    poller_->Submit();
+    working_ = false;
 }
 
-////////////////////////////////////////////////////////////////////////////////
+void ServerST::ProcessConnection(Connection* connection)
+{
+    try
+    {
+        connection->Process();
+    }
+    catch (AnyRpcException&)
+    {
+        // anyrpc exceptions shouldn't get to this point but attempt to handle gracefully
+        connection->SetCloseState();
+    }
+    if (connection->CheckClose())
+    {
+        // a method that is going to respond refers to the connection so wait for it
+        if (connection->HasOutstandingRequests())
+        {
+            UpdateConnectionEvents(connection);
+            return;
+        }
+        log_info("Stop monitoring fd=" << connection->GetFileDescriptor());
+        RemoveConnection(connection);
+    }
+    else
+    {
+        // the connection was just used so it is the last to be forced to disconnect
+        TouchConnection(connection);
+        UpdateConnectionEvents(connection);
+    }
+}
 
-bool ServerTP::BindAndListen(int port, int backlog)
+void ServerST::ProcessResponses()
 {
-    int result;
+    DeferredResponse* response = responseGate_->TakeCompleted();
+    while (response != 0)
+    {
+        DeferredResponse* next = response->GetNextCompleted();
+        response->SetNextCompleted(0);
+        // a worker thread may not have returned the connection yet
+        Connection* connection = response->GetConnection();
+        if (connection->IsActive())
+            FinishResponse(response);
+        else
+            connection->ParkResponse(response);
+        response = next;
+    }
+}
 
-    // Setup the signal socket as UDP on the same port as the main socket
-    // Recreate the sockets in case this is a second call
-    serverSignal_.Create();
+void ServerST::FinishResponse(DeferredResponse* response)
+{
+    Connection* connection = response->GetConnection();
+    connection->CompleteDeferred(response);
+    // write the response and continue with any requests that waited for it
+    ProcessConnection(connection);
+}
 
-    // Don't block on reads/writes
-    result = serverSignal_.SetNonBlocking();
-    if (result != 0)
+void ServerST::Shutdown()
+{
+    anyrpc_assert(!working_, AnyRpcErrorShutdown, "Illegal call to Shutdown");
+    if (!working_)
     {
-        serverSignal_.Close();
-        log_warn("Could not set socket to non-blocking input mode: " << result);
-        return false;
+        // the responders that finish later must not refer to the connections
+        if (responseGate_)
+            responseGate_->Close();
+
+        // release the poller first since it may hold references to the sockets
+        delete poller_;
+        poller_ = 0;
+        DeleteConnections();
+        CloseListener();
     }
+}
 
-    // Allow this port to be re-bound immediately so server re-starts are not delayed
-    result = serverSignal_.SetReuseAddress();
-    if (result != 0)
-    {
-        serverSignal_.Close();
-        log_warn("Could not set SO_REUSEADDR socket option: " << result);
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(ANYRPC_THREADING)
+bool ServerMT::BindAndListen(int port, int backlog)
+{
+    if (!Server::BindAndListen(port, backlog))
         return false;
-    }
 
-    // Bind to the specified port on the default interface
-    result = serverSignal_.Bind(port, htonl(INADDR_LOOPBACK));
-    if (result != 0)
+    // Recreate the signal in case this is a second call and register it with the poller that was just created
+    if (!completionSignal_.Create() ||
+        !poller_->Add(completionSignal_.GetFileDescriptor(), internal::Poller::EVENT_READ, &completionSignal_))
     {
-        serverSignal_.Close();
-        log_warn("Could not bind to specified port " << port << ": " << result);
+        completionSignal_.Close();
+        CloseListener();
+        log_warn("Could not register completion signal with the poller");
         return false;
     }
-
-    return Server::BindAndListen(port, backlog);
+    numStopping_ = 0;
+    if (poolSize_ == 0)
+        return true;
+    if (colocateWorkers_ && !threadCpus_.empty())
+        workers_.SetAffinity(std::vector<internal::CpuSet>(1, threadCpus_));
+    workers_.Start(poolSize_);
+    return true;
 }
 
-void ServerTP::Work(int ms)
+void ServerMT::Work(int ms)
 {
-    int timeLeft;
-    struct timeval startTime;
-    struct timeval currentTime;
-    gettimeofday( &startTime, 0 );
+    if (poller_ == 0)
+    {
+        log_warn("BindAndListen must be called before Work");
+        return;
+    }
+
+    int timeLeft = ms;
+    bool interrupted = false;
+    int64_t startTime = MonotonicMicroTime() / 1000;
+    now_ = startTime;
 
     working_ = true;
 
     do
     {
-        // Construct the sets of descriptors we are interested in
-        fd_set inFd, outFd;
-        FD_ZERO(&inFd);
-        FD_ZERO(&outFd);
+        // Check for events - only the server socket is registered unless using the thread pool
+        int nEvents = poller_->Wait(GetPollTimeout(ms, timeLeft));
+        if (nEvents < 0)
+            break;
+        now_ = MonotonicMicroTime() / 1000;
 
-        // add server socket
-        SOCKET maxFd = socket_.GetFileDescriptor();
-        FD_SET(maxFd, &inFd);
+        // Process connection events before accepting a new connection since a forced
+        // disconnect could delete a connection that still has an event to process
+        bool acceptReady = false;
+        for (int i=0; i<nEvents; i++)
+        {
+            void* data = poller_->GetData(i);
+            if (data == &socket_)
+                acceptReady = true;
+            else if (data == &wakeup_)
+                interrupted = true;
+            else
+                ProcessPoolEvent(data);
+        }
 
-        // add signal socket
-        SOCKET fd = serverSignal_.GetFileDescriptor();
-        maxFd = std::max(fd, maxFd);
-        FD_SET(fd, &inFd);
+        // Process server events
+        if (acceptReady)
+        {
+            if (poolSize_ == 0)
+                AcceptConnection();
+            else
+                AcceptConnections();
+        }
+
+        // Close the connections that have been idle or reading a request for too long
+        ExpireConnections();
 
-        // add connection sockets
-        for (ConnectionList::iterator it = connections_.begin(); it != connections_.end(); it++)
+        // Return to the caller after the events from this wait are processed
+        if (interrupted)
         {
-            Connection* connection = *it;
-            fd = connection->GetFileDescriptor();
-            if (connection->WaitForReadability())
-            {
-                log_debug("Wait for readability, fd=" << fd);
-                FD_SET(fd, &inFd);
-                maxFd = std::max(fd, maxFd);
-            }
-            if (connection->WaitForWritability())
+            wakeup_.Drain();
+            break;
+        }
+
+        now_ = MonotonicMicroTime() / 1000;
+        timeLeft = ms - static_cast<int>(now_ - startTime);
+
+    } while (!exit_ && ((ms < 0) || (timeLeft > 0)));
+
+    working_ = false;
+}
+
+void ServerMT::Shutdown()
+{
+    log_trace();
+    // stop the pool threads so none of the connections are in use
+    workers_.Stop();
+
+    // release the poller first since it may hold a reference to the server socket
+    delete poller_;
+    poller_ = 0;
+
+    // tell all connection threads to stop - after this they don't change the lists
+    ConnectionList* lists[2] = { &connections_, &busyConnections_ };
+    {
+        std::lock_guard<std::mutex> lock(listMutex_);
+        for (int i=0; i<2; i++)
+            for (Connection* connection = lists[i]->Front(); connection != 0; connection = ConnectionList::Next(connection))
+                connection->StopThread(false);
+    }
+    for (int i=0; i<2; i++)
+        for (Connection* connection = lists[i]->Front(); connection != 0; connection = ConnectionList::Next(connection))
+            connection->StopThread();
+    DeleteConnections();
+
+    completed_.PopAll();
+    completionSignal_.Close();
+    CloseListener();
+}
+
+void ServerMT::AcceptConnection()
+{
+    log_trace();
+    acceptWakeups_.fetch_add(1, std::memory_order_relaxed);
+    for (unsigned i=0; i<acceptBatch_; i++)
+    {
+        SOCKET fd = AcceptSocket();
+        if (fd < 0)
+            return;
+        StartConnectionThread(fd);
+    }
+}
+
+void ServerMT::StartConnectionThread(SOCKET fd)
+{
+    Connection* connection = 0;
+    {
+        std::lock_guard<std::mutex> lock(listMutex_);
+        // the connections that were told to stop are not counted while their threads finish
+        while (forcedDisconnectAllowed_ && (NumConnections() - numStopping_ >= maxConnections_))
+        {
+            Connection* target = connections_.Front();
+            if (target == 0)
+                break;
+            if (!target->ForcedDisconnectAllowed())
             {
-                log_debug("Wait for writability, fd=" << fd);
-                FD_SET(fd, &outFd);
-                maxFd = std::max(fd, maxFd);
+                // the thread started a request since it was listed, so it is moved back when done
+                UpdateConnectionList(target);
+                continue;
             }
+            // the thread reports when it has stopped so it is joined without waiting here
+            log_debug("Force connection to close, fd=" << target->GetFileDescriptor());
+            target->StopThread(false);
+            target->SetActive(false);
+            UpdateConnectionList(target);
+            numStopping_++;
         }
-
-        // Check for events
-        int nEvents;
-        if (ms < 0)
-            nEvents = select(static_cast<int>(maxFd) + 1, &inFd, &outFd, NULL, NULL);
-        else
+        if (NumConnections() - numStopping_ < maxConnections_)
         {
-            gettimeofday( &currentTime, 0 );
-            timeLeft = ms - MilliTimeDiff(currentTime,startTime);
+            log_info("Creating a connection: " << fd);
+            connection = AcquireConnection(fd);
+            connection->SetKeepAliveLimits(idleTimeout_, maxRequests_);
+            connection->SetListedBusy(false);
+            connections_.PushBack(connection);
+        }
+    }
+    if (connection == 0)
+    {
+        log_debug( "Can't accept the connection, too many active connections" );
+        RejectSocket(fd);
+        return;
+    }
+    connection->StartThread(&ServerMT::ConnectionThreadEvent, this);
+}
+
+void ServerMT::ConnectionThreadEvent(void* server, Connection* connection, bool stopped)
+{
+    ServerMT* self = static_cast<ServerMT*>(server);
+    if (stopped)
+    {
+        // the main thread joins the thread and releases the connection
+        if (self->completed_.Push(connection))
+            self->completionSignal_.Signal();
+        return;
+    }
+
+    // a connection that was told to stop is no longer kept in order
+    std::lock_guard<std::mutex> lock(self->listMutex_);
+    if (!connection->IsThreadRunning())
+        return;
+    self->UpdateConnectionList(connection);
+    self->TouchConnection(connection);
+}
 
-            struct timeval tv;
-            tv.tv_sec = timeLeft / 1000;
-            tv.tv_usec = (timeLeft - tv.tv_sec*1000) * 1000;
-            nEvents = select(static_cast<int>(maxFd) + 1, &inFd, &outFd, NULL, &tv);
+void ServerMT::ProcessStopped()
+{
+    // Consume the signal before taking the connections so a later push will signal again
+    completionSignal_.Drain();
+
+    Connection* connection = completed_.PopAll();
+    while (connection != 0)
+    {
+        Connection* next = connection->GetNextCompleted();
+        connection->SetNextCompleted(0);
+        {
+            std::lock_guard<std::mutex> lock(listMutex_);
+            UnlistConnection(connection);
+            // only the connections that were forced to disconnect are inactive
+            if (!connection->IsActive())
+                numStopping_--;
         }
+        log_debug("Thread has stopped, fd=" << connection->GetFileDescriptor());
+        connection->StopThread();
+        ReleaseConnection(connection);
+        connection = next;
+    }
+}
 
-        if (nEvents < 0)
+void ServerMT::ProcessPoolEvent(void* data)
+{
+    if (data == &completionSignal_)
+    {
+        if (poolSize_ == 0)
+            ProcessStopped();
+        else
+            ProcessCompleted();
+        return;
+    }
+
+    // hand the connection to a worker and stop monitoring it until it is returned
+    Connection* connection = static_cast<Connection*>(data);
+    log_info("Send connection to thread pool, fd=" << connection->GetFileDescriptor());
+    connection->SetActive(false);
+    UpdateConnectionEvents(connection);
+    workers_.Submit(&ServerMT::ExecuteConnection, this, connection);
+}
+
+void ServerMT::ProcessCompleted()
+{
+    // Consume the signal before taking the connections so a later push will signal again
+    completionSignal_.Drain();
+
+    // Register the connections that have been returned by the worker threads
+    Connection* connection = completed_.PopAll();
+    while (connection != 0)
+    {
+        Connection* next = connection->GetNextCompleted();
+        connection->SetNextCompleted(0);
+        connection->SetActive();
+        if (connection->CheckClose())
         {
-            break;
+            log_info("Stop monitoring fd=" << connection->GetFileDescriptor());
+            RemoveConnection(connection);
+        }
+        else
+        {
+            TouchConnection(connection);
+            UpdateConnectionEvents(connection);
         }
+        connection = next;
+    }
+}
 
-        // Process server events
-        if (FD_ISSET(socket_.GetFileDescriptor(), &inFd))
-            AcceptConnection();
+void ServerMT::ExecuteConnection(void* server, void* data)
+{
+    ServerMT* self = static_cast<ServerMT*>(server);
+    Connection* connection = static_cast<Connection*>(data);
+
+    // read, execute, and write until the connection would block
+    try
+    {
+        connection->Process();
+    }
+    catch (AnyRpcException&)
+    {
+        // anyrpc exceptions shouldn't get to this point but attempt to handle gracefully
+        connection->SetCloseState();
+    }
 
-        if (FD_ISSET(serverSignal_.GetFileDescriptor(), &inFd))
-            AcceptSignal();
+    // return the connection to the main thread and wake the poller if it
+    // is not already going to process other returned connections
+    if (self->completed_.Push(connection))
+        self->completionSignal_.Signal();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ServerTP::~ServerTP()
+{
+    for (unsigned i=0; i<lanes_.size(); i++)
+        delete lanes_[i];
+}
+
+unsigned ServerTP::AddLane(unsigned numThreads)
+{
+    Lane* lane = new Lane;
+    lane->numThreads_ = numThreads;
+    lanes_.push_back(lane);
+    return static_cast<unsigned>(lanes_.size());
+}
+
+internal::WorkerPool& ServerTP::SelectLane(Connection* connection)
+{
+    if (lanes_.empty())
+        return workers_;
+    unsigned lane = 0;
+    std::string methodName;
+    if ((largeRequestLane_ > 0) && (connection->GetContentLength() >= largeRequestLength_))
+        lane = largeRequestLane_;
+    else if (connection->GetMethodName(methodName))
+        lane = GetMethodManager()->GetMethodLane(methodName);
+    if ((lane == 0) || (lane > lanes_.size()))
+        return workers_;
+    return lanes_[lane-1]->workers_;
+}
+
+void ServerTP::StartThread()
+{
+    log_trace();
+    threadRunning_ = true;
+    thread_ = std::thread(&ServerTP::ThreadStarter, this);
+}
+
+void ServerTP::ThreadStarter()
+{
+    log_trace();
+
+    // start the worker threads before placing this thread so they don't inherit its affinity
+    if (colocateWorkers_ && !threadCpus_.empty())
+        workers_.SetAffinity(std::vector<internal::CpuSet>(1, threadCpus_));
+    workers_.Start(numThreads_);
+    for (unsigned i=0; i<lanes_.size(); i++)
+    {
+        if (colocateWorkers_ && !threadCpus_.empty())
+            lanes_[i]->workers_.SetAffinity(std::vector<internal::CpuSet>(1, threadCpus_));
+        lanes_[i]->workers_.Start(lanes_[i]->numThreads_);
+    }
+    PlaceThread();
 
-        // Process connection events
-        for (ConnectionList::iterator it = connections_.begin(); it != connections_.end();)
+    // run the system until woken by Exit or StopThread
+    while (threadRunning_ && !exit_)
+    {
+        Work(-1);
+    }
+
+    // stop the worker threads - the connections they returned are deleted with the rest
+    workers_.Stop();
+    for (unsigned i=0; i<lanes_.size(); i++)
+        lanes_[i]->workers_.Stop();
+    completed_.PopAll();
+
+    // shutdown the rest of the system
+    Shutdown();
+    threadRunning_ = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ServerTP::BindAndListen(int port, int backlog)
+{
+    if (!ServerST::BindAndListen(port, backlog))
+        return false;
+
+    // Recreate the signal in case this is a second call and register it with the poller that was just created
+    if (!completionSignal_.Create() ||
+        !poller_->Add(completionSignal_.GetFileDescriptor(), internal::Poller::EVENT_READ, &completionSignal_))
+    {
+        completionSignal_.Close();
+        CloseListener();
+        log_warn("Could not register completion signal with the poller");
+        return false;
+    }
+    return true;
+}
+
+void ServerTP::ProcessEvent(void* data)
+{
+    if (data == &completionSignal_)
+    {
+        ProcessCompleted();
+        return;
+    }
+
+    Connection* connection = static_cast<Connection*>(data);
+    if (IsPipelined(connection))
+    {
+        ProcessPipelined(connection);
+        return;
+    }
+
+    // process the message but only until the execute stage
+    try
+    {
+        connection->Process( false );
+
+        // shed the requests over the limit from this thread - the rejection is written the same
+        // way as a response so there may be another request from the connection to check
+        while (connection->CheckExecuteState() && (maxPending_ > 0) &&
+               (pending_.load(std::memory_order_relaxed) >= maxPending_))
         {
-            // save this iterator position and move to the next so you can erase if needed
-            Connection* connection = *it;
-            fd = connection->GetFileDescriptor();
-            if (fd <= maxFd)
+            shedLimitCount_.fetch_add(1, std::memory_order_relaxed);
+            if (!connection->RejectRequest())
             {
-                if ((FD_ISSET(fd, &inFd)) || (FD_ISSET(fd, &outFd)))
-                {
-                    // process the message but only until the execute stage
-                    try
-                    {
-                        connection->Process( false );
-                    }
-                    catch (AnyRpcException&)
-                    {
-                        // anyrpc exceptions shouldn't get to this point but attempt to handle gracefully
-                        connection->SetCloseState();
-                    }
-                    if (connection->CheckExecuteState())
-                    {
-                        // add the connection to the queue for the thread pool
-                        log_info("Send connection to thread pool, fd=" << connection->GetFileDescriptor());
-                        // used to indicate that the connection should not be part of the main thread select
-                        connection->SetActive(false);
-                        // add to the work queue and signal a worker
-                        std::unique_lock<std::mutex> lock(workQueueMutex_);
-                        workQueue_.push(connection);
-                        workerBlock_.notify_one();
-                    }
-                }
+                connection->SetCloseState();
+                break;
             }
-            if (connection->CheckClose())
+            connection->Process( false );
+        }
+    }
+    catch (AnyRpcException&)
+    {
+        // anyrpc exceptions shouldn't get to this point but attempt to handle gracefully
+        connection->SetCloseState();
+    }
+    if (connection->CheckExecuteState())
+    {
+        // add the connection to the queue for the thread pool
+        log_info("Send connection to thread pool, fd=" << connection->GetFileDescriptor());
+        // used to indicate that the connection should not be monitored by the main thread
+        connection->SetActive(false);
+        UpdateConnectionEvents(connection);
+        pending_.fetch_add(1, std::memory_order_relaxed);
+        admittedCount_.fetch_add(1, std::memory_order_relaxed);
+        if (queueTimeBudget_ > 0)
+            connection->SetQueuedTime(MonotonicMicroTime());
+        SelectLane(connection).Submit(&ServerTP::ExecuteConnection, this, connection);
+    }
+    else if (connection->CheckClose())
+    {
+        // this connection has closed so removed from monitoring and delete
+        log_info("Stop monitoring fd=" << connection->GetFileDescriptor());
+        RemoveConnection(connection);
+    }
+    else
+    {
+        // the connection was just used so it is the last to be forced to disconnect
+        TouchConnection(connection);
+        UpdateConnectionEvents(connection);
+    }
+}
+
+void ServerTP::ProcessCompleted()
+{
+    // Consume the signal before taking the connections so a later push will signal again
+    completionSignal_.Drain();
+    log_info("Process completed connections");
+
+    // Register the connections that have been returned by the worker threads
+    Connection* connection = completed_.PopAll();
+    while (connection != 0)
+    {
+        Connection* next = connection->GetNextCompleted();
+        connection->SetNextCompleted(0);
+        if (IsPipelined(connection))
+            ProcessPipelinedCompleted(connection);
+        else
+        {
+            connection->SetActive();
+            DeferredResponse* response = connection->TakeParkedResponse();
+            if (response != 0)
+                // the method responded before the worker thread returned the connection
+                FinishResponse(response);
+            else if (connection->CheckClose() && !connection->HasOutstandingRequests())
             {
-                // this connection has closed so removed from monitoring and delete
                 log_info("Stop monitoring fd=" << connection->GetFileDescriptor());
-                delete connection;
-                // delete from list and move the iterator to the next value
-                it = connections_.erase(it);
+                RemoveConnection(connection);
             }
+            else if (connection->HasBufferedRequest())
+                // the next request is admitted and given a lane the same way as one read from the socket
+                ProcessEvent(connection);
             else
-                // move the iterator to the next value
-                it++;
+            {
+                TouchConnection(connection);
+                UpdateConnectionEvents(connection);
+            }
         }
+        connection = next;
+    }
+}
 
-        gettimeofday( &currentTime, 0 );
-        timeLeft = ms - MilliTimeDiff(currentTime,startTime);
+void ServerTP::ProcessPipelined(Connection* connection)
+{
+    try
+    {
+        // give each of the requests that have been read to the workers and continue reading
+        if (connection->WaitForReadability())
+            connection->Process( false );
+        while (connection->CheckExecuteState())
+        {
+            // the lane is chosen while the request is still in the connection
+            internal::WorkerPool& workers = SelectLane(connection);
+            PipelinedRequest* request = connection->TakeRequest();
+            if ((maxPending_ > 0) && (pending_.load(std::memory_order_relaxed) >= maxPending_))
+            {
+                shedLimitCount_.fetch_add(1, std::memory_order_relaxed);
+                connection->RejectPipelined(request);
+                if (connection->CompletePipelined(request) && completed_.Push(connection))
+                    completionSignal_.Signal();
+            }
+            else
+            {
+                pending_.fetch_add(1, std::memory_order_relaxed);
+                admittedCount_.fetch_add(1, std::memory_order_relaxed);
+                if (queueTimeBudget_ > 0)
+                    request->queuedTime_ = MonotonicMicroTime();
+                workers.Submit(&ServerTP::ExecuteRequest, this, request);
+            }
+            if (connection->WaitForReadability())
+                connection->Process( false );
+        }
 
-    } while (!exit_ && ((ms < 0) || (timeLeft > 0)));
+        // write the responses that are ready
+        if (!connection->WritePipelined())
+            connection->SetCloseState();
+    }
+    catch (AnyRpcException&)
+    {
+        // anyrpc exceptions shouldn't get to this point but attempt to handle gracefully
+        connection->SetCloseState();
+    }
+    FinishPipelined(connection);
+}
 
-    working_ = false;
+void ServerTP::ProcessPipelinedCompleted(Connection* connection)
+{
+    // a request returned after this will schedule the connection again
+    connection->ClearCompletionScheduled();
+    if (!connection->WritePipelined())
+        connection->SetCloseState();
+    FinishPipelined(connection);
 }
 
-void ServerTP::AcceptSignal()
+void ServerTP::FinishResponse(DeferredResponse* response)
 {
-    char buffer[256];
-    int bytesRead;
-    bool eof;
-    std::string ipAddress;
-    int port;
+    Connection* connection = response->GetConnection();
+    if (IsPipelined(connection))
+    {
+        if (connection->CompleteDeferred(response))
+            ProcessPipelinedCompleted(connection);
+        return;
+    }
 
-    // Read the message out although you don't really need the information
-    serverSignal_.Receive(buffer, sizeof(buffer), bytesRead, eof, ipAddress, port);
-    log_info("Accept signal");
+    // write the response and give any request that waited for it to the workers
+    connection->CompleteDeferred(response);
+    ProcessEvent(connection);
 }
 
-void ServerTP::WorkerThread()
+void ServerTP::FinishPipelined(Connection* connection)
 {
-    log_trace();
+    if (connection->CheckClose())
+    {
+        // the requests still executing refer to the connection so wait for them to be returned
+        if (connection->HasOutstandingRequests())
+        {
+            UpdateConnectionEvents(connection);
+            return;
+        }
+        log_info("Stop monitoring fd=" << connection->GetFileDescriptor());
+        RemoveConnection(connection);
+    }
+    else
+    {
+        TouchConnection(connection);
+        UpdateConnectionEvents(connection);
+    }
+}
 
-    UdpSocket signal;
-    char buffer = 0;
-    size_t bytesWritten;
-    const char* ipAddress = "127.0.0.1";
+void ServerTP::ExecuteRequest(void* server, void* data)
+{
+    ServerTP* self = static_cast<ServerTP*>(server);
+    PipelinedRequest* request = static_cast<PipelinedRequest*>(data);
+    Connection* connection = request->connection_;
 
-    while (true)
+    try
+    {
+        // the client has probably given up on a request that waited too long
+        if ((self->queueTimeBudget_ > 0) &&
+            (MonotonicMicroTime() - request->queuedTime_ > 1000 * static_cast<int64_t>(self->queueTimeBudget_)))
+        {
+            self->shedExpiredCount_.fetch_add(1, std::memory_order_relaxed);
+            connection->RejectPipelined(request);
+        }
+        else if (!connection->ExecutePipelined(request))
+        {
+            // the request is returned by the server thread when the method responds
+            self->pending_.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    catch (AnyRpcException&)
     {
-        std::unique_lock<std::mutex> lock(workQueueMutex_);
+        // anyrpc exceptions shouldn't get to this point but attempt to handle gracefully
+        request->sendResponse_ = false;
+    }
 
-        // wait until signaled that there is work or need to exit
-        workerBlock_.wait(lock, [this]{ return this->workerExit_ || !this->workQueue_.empty();});
+    // return the request to the connection and wake the main thread if the connection
+    // needs to write and the main thread is not already going to process other connections
+    self->pending_.fetch_sub(1, std::memory_order_relaxed);
+    if (connection->CompletePipelined(request) && self->completed_.Push(connection))
+        self->completionSignal_.Signal();
+}
 
-        // check if worker should exit - don't worry about whether the work queue is empty
-        if (workerExit_)
-            return;
+void ServerTP::ExecuteConnection(void* server, void* data)
+{
+    ServerTP* self = static_cast<ServerTP*>(server);
+    Connection* connection = static_cast<Connection*>(data);
+
+    // execute only this request - the server thread admits the next one
+    log_info("Process from thread pool, fd=" << connection->GetFileDescriptor());
+    try
+    {
+        // the client has probably given up on a request that waited too long
+        if ((self->queueTimeBudget_ > 0) &&
+            (MonotonicMicroTime() - connection->GetQueuedTime() > 1000 * static_cast<int64_t>(self->queueTimeBudget_)))
+        {
+            self->shedExpiredCount_.fetch_add(1, std::memory_order_relaxed);
+            if (!connection->RejectRequest())
+                connection->SetCloseState();
+        }
+        connection->ProcessRequest();
+    }
+    catch (AnyRpcException&)
+    {
+        // anyrpc exceptions shouldn't get to this point but attempt to handle gracefully
+        connection->SetCloseState();
+    }
+
+    // return the connection to the main thread and wake the poller if it
+    // is not already going to process other returned connections
+    log_info("Finished with connection from thread pool, fd=" << connection->GetFileDescriptor());
+    self->pending_.fetch_sub(1, std::memory_order_relaxed);
+    if (self->completed_.Push(connection))
+        self->completionSignal_.Signal();
+}
+
+void ServerTP::ResetAdmissionStats()
+{
+    pending_ = 0;
+    admittedCount_ = 0;
+    shedLimitCount_ = 0;
+    shedExpiredCount_ = 0;
+}
+
+void ServerTP::GetAdmissionStats(AdmissionStats& stats) const
+{
+    stats.admitted_ = admittedCount_.load(std::memory_order_relaxed);
+    stats.shedLimit_ = shedLimitCount_.load(std::memory_order_relaxed);
+    stats.shedExpired_ = shedExpiredCount_.load(std::memory_order_relaxed);
+    stats.pending_ = pending_.load(std::memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! Single threaded server used by ServerMR for one event loop
+class ServerMR::Reactor : public ServerST
+{
+public:
+    Reactor(ServerMR* server) : server_(server), sharedListener_(-1) { reusePort_ = true; }
 
-        // get the next item from the work queue and release the lock
-        Connection* connection = workQueue_.front();
-        workQueue_.pop();
-        lock.unlock();
+    //! Copy the settings from the parent server - the connection limits are divided between the reactors
+    void Configure(unsigned maxConnections, unsigned numReactors)
+    {
+        maxConnections_ = maxConnections;
+        forcedDisconnectAllowed_ = server_->forcedDisconnectAllowed_;
+        address_ = server_->address_;
+        pollerType_ = server_->pollerType_;
+        idleTimeout_ = server_->idleTimeout_;
+        headerTimeout_ = server_->headerTimeout_;
+        bodyTimeout_ = server_->bodyTimeout_;
+        maxRequests_ = server_->maxRequests_;
+        maxContentLength_ = server_->maxContentLength_;
+        connectionPoolSize_ = (server_->connectionPoolSize_ + numReactors - 1) / numReactors;
+        connectionPrewarm_ = (server_->connectionPrewarm_ + numReactors - 1) / numReactors;
+        acceptBatch_ = server_->acceptBatch_;
+        deferAccept_ = server_->deferAccept_;
+        sharedMemory_ = server_->sharedMemory_;
+        zeroCopyThreshold_ = server_->zeroCopyThreshold_;
+    }
+
+    //! Listen on a copy of another reactor's socket since a local path can only be bound once
+    void ShareListener(SOCKET listener) { sharedListener_ = listener; }
+    //! Get the listening socket
+    SOCKET GetListener() { return socket_.GetFileDescriptor(); }
+
+protected:
+    virtual Connection* CreateConnection(SOCKET fd) { return server_->CreateConnection(fd); }
 
-        // process the connection method and continue until it will block
-        log_info("Process from thread pool, fd=" << connection->GetFileDescriptor());
-        try
+    virtual bool CreateListener(int port, int backlog)
+    {
+#if defined(ANYRPC_LOCAL_SOCKET)
+        // Every reactor polls the same socket and a nonblocking accept that loses the race returns no connection
+        if ((port == LocalPort) && (sharedListener_ >= 0))
         {
-            connection->Process();
+            socket_.SetFileDescriptor(dup(sharedListener_));
+            if (socket_.GetFileDescriptor() < 0)
+            {
+                log_warn("Could not duplicate the listening socket");
+                return false;
+            }
+            return true;
         }
-        catch (AnyRpcException&)
+#endif // defined(ANYRPC_LOCAL_SOCKET)
+        return ServerST::CreateListener(port, backlog);
+    }
+
+private:
+    ServerMR* server_;              //!< Server that provides the connection type
+    SOCKET sharedListener_;         //!< Listening socket of another reactor, -1 to create one
+};
+
+static unsigned DefaultNumReactors()
+{
+    unsigned numCpus = std::thread::hardware_concurrency();
+    return (numCpus > 0) ? numCpus : 4;
+}
+
+//! CPU set with a single CPU for pinning the reactors
+static internal::CpuSet ReactorCpu(unsigned cpu)
+{
+    unsigned numCpus = std::max(1u, std::thread::hardware_concurrency());
+    return internal::CpuSet(1, cpu % numCpus);
+}
+
+ServerMR::ServerMR() :
+    numReactors_(DefaultNumReactors()), pinReactors_(false), firstCpu_(0), reactorsStarted_(false)
+{
+}
+
+ServerMR::ServerMR(const unsigned numReactors) :
+    numReactors_(std::max(1u, numReactors)), pinReactors_(false), firstCpu_(0), reactorsStarted_(false)
+{
+}
+
+ServerMR::~ServerMR()
+{
+    Shutdown();
+}
+
+bool ServerMR::BindAndListen(int port, int backlog)
+{
+    log_trace();
+    Shutdown();
+    port_ = port;
+    if (port != LocalPort)
+        localPath_.clear();
+
+    unsigned numReactors = numReactors_;
+#if !defined(SO_REUSEPORT)
+    if ((numReactors > 1) && (port != LocalPort))
+    {
+        log_warn("SO_REUSEPORT is not supported so only a single reactor is used");
+        numReactors = 1;
+    }
+#endif // !defined(SO_REUSEPORT)
+
+    for (unsigned i=0; i<numReactors; i++)
+        reactors_.push_back(new Reactor(this));
+    ConfigureReactors();
+
+    for (unsigned i=0; i<numReactors; i++)
+    {
+        // The first reactor binds the path and owns the socket file
+        bool started;
+        if (port == LocalPort)
         {
-            // anyrpc exceptions shouldn't get to this point but attempt to handle gracefully
-            connection->SetCloseState();
+            if (i > 0)
+                reactors_[i]->ShareListener(reactors_[0]->GetListener());
+            started = reactors_[i]->BindAndListenLocal((i == 0) ? localPath_ : std::string(), backlog);
+        }
+        else
+            started = reactors_[i]->BindAndListen(port, backlog);
+        if (!started)
+        {
+            log_warn("Could not start reactor " << i);
+            Shutdown();
+            return false;
         }
+        // An ephemeral port is picked by the first bind and the other reactors share it
+        std::string ip;
+        unsigned boundPort;
+        if ((i == 0) && (port == 0) && reactors_[0]->GetMainSockInfo(ip, boundPort))
+            port = static_cast<int>(boundPort);
+    }
+    return true;
+}
 
-        // return the connection to active status so it will be processed by the main thread
-        log_info("Finished with connection from thread pool, fd=" << connection->GetFileDescriptor());
-        connection->SetActive();
+void ServerMR::ConfigureReactors()
+{
+    // divide the connections between the reactors
+    unsigned numReactors = static_cast<unsigned>(reactors_.size());
+    unsigned maxConnections = std::max(1u, (maxConnections_ + numReactors - 1) / numReactors);
+    for (unsigned i=0; i<numReactors; i++)
+        reactors_[i]->Configure(maxConnections, numReactors);
+}
+
+void ServerMR::StartReactors()
+{
+    // the settings may have been changed after BindAndListen
+    ConfigureReactors();
+    for (unsigned i=1; i<reactors_.size(); i++)
+    {
+        if (pinReactors_)
+            reactors_[i]->SetThreadAffinity(ReactorCpu(firstCpu_ + i));
+        if (!threadName_.empty())
+            reactors_[i]->SetThreadName(threadName_ + "-" + std::to_string(i));
+        reactors_[i]->StartThread();
+    }
+    reactorsStarted_ = true;
+}
+
+void ServerMR::Work(int ms)
+{
+    if (reactors_.empty())
+    {
+        log_warn("BindAndListen must be called before Work");
+        return;
+    }
+    if (!reactorsStarted_)
+        StartReactors();
+
+    working_ = true;
+    reactors_[0]->Work(ms);
+    working_ = false;
+}
+
+void ServerMR::Shutdown()
+{
+    log_trace();
+    anyrpc_assert(!working_, AnyRpcErrorShutdown, "Illegal call to Shutdown");
+    if (working_)
+        return;
 
-        // send signal to main thread so that it will interrupt the select call
-        log_info("Send signal");
-        signal.Send(&buffer, 1, bytesWritten, ipAddress, port_);
+    // the reactor threads shutdown their own connections when they exit
+    for (unsigned i=1; i<reactors_.size(); i++)
+        reactors_[i]->StopThread();
+    for (unsigned i=0; i<reactors_.size(); i++)
+    {
+        reactors_[i]->Shutdown();
+        delete reactors_[i];
+    }
+    reactors_.clear();
+    reactorsStarted_ = false;
+}
+
+void ServerMR::Exit()
+{
+    Server::Exit();
+    if (!reactors_.empty())
+        reactors_[0]->Exit();
+}
+
+void ServerMR::Interrupt()
+{
+    // the first reactor runs the work loop for this server
+    if (!reactors_.empty())
+        reactors_[0]->Interrupt();
+}
+
+void ServerMR::StartThread()
+{
+    log_trace();
+    if (pinReactors_)
+        SetThreadAffinity(ReactorCpu(firstCpu_));
+    Server::StartThread();
+}
+
+void ServerMR::GetAcceptStats(AcceptStats& stats) const
+{
+    // the reactors do the accepting
+    Server::GetAcceptStats(stats);
+    for (unsigned i=0; i<reactors_.size(); i++)
+    {
+        AcceptStats reactorStats;
+        reactors_[i]->GetAcceptStats(reactorStats);
+        stats.accepted_ += reactorStats.accepted_;
+        stats.rejected_ += reactorStats.rejected_;
+        stats.errors_ += reactorStats.errors_;
+        stats.wakeups_ += reactorStats.wakeups_;
     }
 }
 
+bool ServerMR::GetMainSockInfo(std::string& ip, unsigned& port) const
+{
+    if (reactors_.empty())
+        return false;
+    return reactors_[0]->GetMainSockInfo(ip, port);
+}
+
+void ServerMR::GetConnectionsSockInfo(std::list<std::string>& ips, std::list<unsigned>& ports) const
+{
+    for (unsigned i=0; i<reactors_.size(); i++)
+        reactors_[i]->GetConnectionsSockInfo(ips, ports);
+}
+
+void ServerMR::GetConnectionsPeerInfo(std::list<std::string>& ips, std::list<unsigned>& ports) const
+{
+    for (unsigned i=0; i<reactors_.size(); i++)
+        reactors_[i]->GetConnectionsPeerInfo(ips, ports);
+}
+
 #endif // defined(ANYRPC_THREADING)
 
 } // namespace anyrpc
@@ -20,8 +20,12 @@
 
 #include "anyrpc/api.h"
 #include "anyrpc/logger.h"
+#include "anyrpc/error.h"
+#include "anyrpc/stream.h"
 #include "anyrpc/socket.h"
 #include "anyrpc/internal/time.h"
+#include "anyrpc/internal/shmring.h"
+#include "anyrpc/internal/poller.h"
 
 #if defined(_MSC_VER)
 # pragma warning(disable:4996)	// inet_addr is marked as deprecated
@@ -33,18 +37,86 @@ extern "C"
 # include <unistd.h>
 # include <sys/types.h>
 # include <sys/socket.h>
+# include <sys/uio.h>
 # include <netinet/in.h>
 # include <netinet/tcp.h>
 # include <arpa/inet.h>
 # include <netdb.h>
 # include <errno.h>
 # include <fcntl.h>
+# include <stddef.h>
+# include <sys/un.h>
+# include <sys/stat.h>
 }
 #endif  // _WIN32
 
+#if defined(ANYRPC_ZEROCOPY)
+# include <linux/errqueue.h>
+# if !defined(SO_ZEROCOPY)
+#  define SO_ZEROCOPY 60
+# endif
+# if !defined(MSG_ZEROCOPY)
+#  define MSG_ZEROCOPY 0x4000000
+# endif
+#endif // defined(ANYRPC_ZEROCOPY)
+
 namespace anyrpc
 {
 
+#if defined(ANYRPC_LOCAL_SOCKET)
+//! Fill in the address for a Unix domain socket - a leading '@' is the abstract namespace on Linux
+static bool LocalAddress(const char* path, struct sockaddr_un& address, socklen_t& length)
+{
+    size_t pathLength = strlen(path);
+    if ((pathLength == 0) || (pathLength >= sizeof(address.sun_path)))
+        return false;
+
+    memset( &address, 0, sizeof(address) );
+    address.sun_family = AF_UNIX;
+    memcpy( address.sun_path, path, pathLength );
+    length = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + pathLength + 1);
+# if defined(__linux__)
+    if (path[0] == '@')
+    {
+        // the abstract name is the exact length without a terminating null
+        address.sun_path[0] = 0;
+        length--;
+    }
+# endif // defined(__linux__)
+    return true;
+}
+#endif // defined(ANYRPC_LOCAL_SOCKET)
+
+//! Convert a socket address to the ip and port or the Unix domain socket path with port 0
+static bool AddressInfo(const struct sockaddr_storage& address, socklen_t length, std::string& ip, unsigned& port)
+{
+    if (address.ss_family == AF_INET)
+    {
+        const struct sockaddr_in& sa = reinterpret_cast<const struct sockaddr_in&>(address);
+        char ipStr[20];
+        inet_ntop(sa.sin_family, (void*)&sa.sin_addr, ipStr, sizeof(ipStr));
+        ip = ipStr;
+        port = ntohs(sa.sin_port);
+        return true;
+    }
+#if defined(ANYRPC_LOCAL_SOCKET)
+    if (address.ss_family == AF_UNIX)
+    {
+        const struct sockaddr_un& sa = reinterpret_cast<const struct sockaddr_un&>(address);
+        size_t pathLength = length - offsetof(struct sockaddr_un, sun_path);
+        if ((length <= offsetof(struct sockaddr_un, sun_path)) || (pathLength == 0))
+            ip.clear();     // unnamed, such as the client end of a connection
+        else if (sa.sun_path[0] == 0)
+            ip = "@" + std::string(sa.sun_path + 1, pathLength - 1);
+        else
+            ip = std::string(sa.sun_path, strnlen(sa.sun_path, pathLength));
+        port = 0;
+        return true;
+    }
+#endif // defined(ANYRPC_LOCAL_SOCKET)
+    return false;
+}
+
 Socket::Socket()
 {
 #if defined(WIN32)
@@ -81,6 +153,17 @@ void Socket::Close()
     }
 }
 
+int Socket::Shutdown()
+{
+#if defined(WIN32)
+    int result = shutdown(fd_, SD_BOTH);
+#else
+    int result = shutdown(fd_, SHUT_RDWR);
+#endif // WIN32
+    log_debug( "Shutdown: fd=" << fd_ << ", result=" << result);
+    return result;
+}
+
 int Socket::SetReuseAddress(int param)
 {
     int result = setsockopt( fd_, SOL_SOCKET, SO_REUSEADDR, (char*)&param, sizeof(param) );
@@ -88,6 +171,17 @@ int Socket::SetReuseAddress(int param)
     return result;
 }
 
+int Socket::SetReusePort(int param)
+{
+#if defined(SO_REUSEPORT)
+    int result = setsockopt( fd_, SOL_SOCKET, SO_REUSEPORT, (char*)&param, sizeof(param) );
+#else
+    int result = -1;
+#endif // defined(SO_REUSEPORT)
+    log_debug( "SetReusePort: param=" << param << ", result=" << result);
+    return result;
+}
+
 int Socket::SetKeepAlive(int param)
 {
     int result = setsockopt( fd_, SOL_SOCKET, SO_KEEPALIVE, (char*)&param, sizeof(param) );
@@ -172,6 +266,33 @@ int Socket::Bind( int port, uint32_t address )
     return result;
 }
 
+#if defined(ANYRPC_LOCAL_SOCKET)
+int Socket::BindLocal(const char* path)
+{
+    struct sockaddr_un sockAddress;
+    socklen_t length;
+    if (!LocalAddress(path, sockAddress, length))
+    {
+        log_warn("Invalid Unix domain socket path: " << path);
+        err_ = EINVAL;
+        return -1;
+    }
+
+    int result = bind(fd_, (struct sockaddr*)&sockAddress, length);
+    SetLastError();  // the logging system may reset errno in Linux
+    log_debug("BindLocal: path=" << path << ", result=" << result << ", err=" << err_);
+    return result;
+}
+
+int Socket::RemoveLocalPath(const char* path)
+{
+    struct stat status;
+    if ((path[0] == '@') || (stat(path, &status) != 0) || !S_ISSOCK(status.st_mode))
+        return 0;
+    return unlink(path);
+}
+#endif // defined(ANYRPC_LOCAL_SOCKET)
+
 bool Socket::FatalError(int err)
 {
 #ifdef WIN32
@@ -264,18 +385,16 @@ bool Socket::WaitWritable(int timeout)
 bool Socket::GetSockInfo(std::string& ip, unsigned& port) const
 {
     // get socket local ip and local port
-    sockaddr_in sa;
-    socklen_t len = sizeof(struct sockaddr_in);
+    struct sockaddr_storage sa;
+    socklen_t len = sizeof(sa);
     if (getsockname(fd_, (struct sockaddr *) &sa, &len) != 0)
     {
         log_warn("Error while calling getsockname (code " << errno << "). Could not identify local ip and port of socket.");
         return false;
     }
     // convert information
-    char ipStr[20];
-    inet_ntop(sa.sin_family, &sa.sin_addr, ipStr, sizeof(ipStr));
-    ip = ipStr;
-    port = ntohs(sa.sin_port);
+    if (!AddressInfo(sa, len, ip, port))
+        return false;
     log_debug("Socket information: " << ip << " on port " << port );
     return true;
 }
@@ -283,24 +402,83 @@ bool Socket::GetSockInfo(std::string& ip, unsigned& port) const
 bool Socket::GetPeerInfo(std::string& ip, unsigned& port) const
 {
     // get ip and port of connected peer
-    struct sockaddr_in sa;
-    socklen_t len = sizeof(struct sockaddr_in);
+    struct sockaddr_storage sa;
+    socklen_t len = sizeof(sa);
     if (getpeername(fd_, (struct sockaddr *)&sa, &len) != 0)
     {
         log_warn("Error while calling getpeername (code " << errno << "). Could not identify ip and port of peer.");
         return false;
     }
     // convert information
-    char ipStr[20];
-    inet_ntop(sa.sin_family, &sa.sin_addr, ipStr, sizeof(ipStr));
-    ip = ipStr;
-    port = ntohs(sa.sin_port);
+    if (!AddressInfo(sa, len, ip, port))
+        return false;
     log_debug("Peer information: " << ip << " on port " << port);
     return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+void AppendSegments(SendSegmentList& segments, WriteBufferedStream& stream, size_t offset)
+{
+    while (offset < stream.Length())
+    {
+        size_t segmentLength;
+        const char* buffer = stream.GetBuffer(offset, segmentLength);
+        if ((buffer == 0) || (segmentLength == 0))
+            break;
+        segments.push_back(SendSegment(buffer, segmentLength));
+        offset += segmentLength;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TcpSocket::~TcpSocket()
+{
+    Close();
+}
+
+void TcpSocket::Close()
+{
+#if defined(ANYRPC_URING)
+    if (uring_ != 0)
+    {
+        // the channel closes the descriptor once the data queued in the poller has been sent
+        uring_->Close();
+        uring_ = 0;
+        fd_ = static_cast<SOCKET>(-1);
+    }
+#endif // defined(ANYRPC_URING)
+#if defined(ANYRPC_SHARED_MEMORY)
+    delete channel_;
+    channel_ = 0;
+    ringExpected_ = false;
+    peerClosed_ = false;
+#endif // defined(ANYRPC_SHARED_MEMORY)
+#if defined(ANYRPC_ZEROCOPY)
+    if (IsZeroCopyPending() && (fd_ != static_cast<SOCKET>(-1)))
+    {
+        // the kernel can still be sending from the held buffers, so the connection is reset
+        // to make it drop the data instead of sending what replaces it after they are freed
+        ReapZeroCopy();
+        if (IsZeroCopyPending())
+        {
+            log_warn("Close: zero copy sends not complete, resetting fd=" << fd_);
+            struct linger lingerOption;
+            lingerOption.l_onoff = 1;
+            lingerOption.l_linger = 0;
+            setsockopt( fd_, SOL_SOCKET, SO_LINGER, (char*)&lingerOption, sizeof(lingerOption) );
+        }
+    }
+#endif // defined(ANYRPC_ZEROCOPY)
+    ReleaseZeroCopy(true);
+    zeroCopy_ = false;
+    zeroCopySends_ = 0;
+    zeroCopyCompleted_ = 0;
+    zeroCopyRanges_.clear();
+    Socket::Close();
+}
+
 SOCKET TcpSocket::Create()
 {
     Close();
@@ -310,6 +488,17 @@ SOCKET TcpSocket::Create()
     return fd_;
 }
 
+#if defined(ANYRPC_LOCAL_SOCKET)
+SOCKET TcpSocket::CreateLocal()
+{
+    Close();
+    fd_ = socket( AF_UNIX, SOCK_STREAM, 0 );
+    connected_ = false;
+    log_debug( "CreateLocal: fd=" << fd_);
+    return fd_;
+}
+#endif // defined(ANYRPC_LOCAL_SOCKET)
+
 int TcpSocket::SetTcpNoDelay(int param)
 {
     int result = setsockopt( fd_, IPPROTO_TCP, TCP_NODELAY, (char*)&param, sizeof(param) );
@@ -317,12 +506,34 @@ int TcpSocket::SetTcpNoDelay(int param)
     return result;
 }
 
+int TcpSocket::SetDeferAccept(int seconds)
+{
+#if defined(TCP_DEFER_ACCEPT)
+    int result = setsockopt( fd_, IPPROTO_TCP, TCP_DEFER_ACCEPT, (char*)&seconds, sizeof(seconds) );
+#else
+    int result = -1;
+#endif // defined(TCP_DEFER_ACCEPT)
+    log_debug( "SetDeferAccept: seconds=" << seconds << ", result=" << result);
+    return result;
+}
+
 bool TcpSocket::Send(const char* buffer, size_t length, size_t &bytesWritten, int timeout)
 {
     log_debug("Send: length=" << length << ", buffer=" << buffer);
 
     if (timeout < 0) timeout = timeout_;    // default to the set timeout value
     timeout = std::max(0,timeout);          // timeout can't be negative
+#if defined(ANYRPC_SHARED_MEMORY)
+    if (channel_ != 0)
+        return SendShared(buffer, length, bytesWritten, timeout);
+#endif // defined(ANYRPC_SHARED_MEMORY)
+#if defined(ANYRPC_URING)
+    if (uring_ != 0)
+    {
+        SendSegment segment(buffer, length);
+        return SendUring(&segment, 1, bytesWritten, timeout);
+    }
+#endif // defined(ANYRPC_URING)
 
     bytesWritten = 0;
     struct timeval startTime;
@@ -343,6 +554,7 @@ bool TcpSocket::Send(const char* buffer, size_t length, size_t &bytesWritten, in
         }
         else
         {
+            err_ = 0;   // errno is only set by a failure
             bytesWritten += numBytes;
             if (bytesWritten >= length)
                 return true;
@@ -361,10 +573,226 @@ bool TcpSocket::Send(const char* buffer, size_t length, size_t &bytesWritten, in
     return false;
 }
 
+bool TcpSocket::SendGather(const SendSegment* segments, size_t count, size_t &bytesWritten, int timeout)
+{
+    log_debug("SendGather: count=" << count);
+
+    if (timeout < 0) timeout = timeout_;    // default to the set timeout value
+    timeout = std::max(0,timeout);          // timeout can't be negative
+    bytesWritten = 0;
+#if defined(ANYRPC_SHARED_MEMORY)
+    if (channel_ != 0)
+        // copying into the ring doesn't need a system call for each block
+        return SendEach(segments, count, bytesWritten, timeout);
+#endif // defined(ANYRPC_SHARED_MEMORY)
+#if defined(ANYRPC_URING)
+    if (uring_ != 0)
+        return SendUring(segments, count, bytesWritten, timeout);
+#endif // defined(ANYRPC_URING)
+#if defined(WIN32)
+    return SendEach(segments, count, bytesWritten, timeout);
+#else
+    size_t segment = 0;     // first block with data left to send
+    size_t offset = 0;      // bytes of that block already sent
+    struct timeval startTime;
+    gettimeofday( &startTime, 0 );
+    while (true)
+    {
+        // skip the blocks that have been sent, including empty ones
+        while ((segment < count) && (offset >= segments[segment].length_))
+        {
+            offset -= segments[segment].length_;
+            segment++;
+        }
+        if (segment >= count)
+            return true;
+
+        // a call either copies all of its blocks or sends all of them with zero copy
+        bool zeroCopy = zeroCopy_ && segments[segment].zeroCopy_;
+        struct iovec iov[MaxGatherSegments];
+        int iovCount = 0;
+        size_t bytesToSend = 0;
+        for (size_t i = segment; (i < count) && (iovCount < MaxGatherSegments); i++)
+        {
+            if (zeroCopy_ && (segments[i].zeroCopy_ != zeroCopy))
+                break;
+            size_t skip = (i == segment) ? offset : 0;
+            iov[iovCount].iov_base = const_cast<char*>(segments[i].data_ + skip);
+            iov[iovCount].iov_len = segments[i].length_ - skip;
+            bytesToSend += iov[iovCount].iov_len;
+            iovCount++;
+        }
+        struct msghdr message;
+        memset( &message, 0, sizeof(message) );
+        message.msg_iov = iov;
+        message.msg_iovlen = iovCount;
+# ifdef MSG_NOSIGNAL
+        int flags = MSG_NOSIGNAL;
+# else
+        int flags = SO_NOSIGPIPE;
+# endif
+# if defined(ANYRPC_ZEROCOPY)
+        if (zeroCopy)
+            flags |= MSG_ZEROCOPY;
+# endif // defined(ANYRPC_ZEROCOPY)
+        ssize_t numBytes = sendmsg( fd_, &message, flags );
+        SetLastError();
+        log_debug("SendGather: iovCount=" << iovCount << ", numBytes=" << numBytes << ", err=" << err_);
+        if (numBytes < 0)
+        {
+            if (FatalError())
+                return false;
+        }
+        else
+        {
+            err_ = 0;   // errno is only set by a failure
+            bytesWritten += numBytes;
+            offset += numBytes;
+            // the kernel numbers each zero copy send that took data for its completions
+            if (zeroCopy && (numBytes > 0))
+                zeroCopySends_++;
+            if (static_cast<size_t>(numBytes) == bytesToSend)
+                // there may be more blocks than fit in one call
+                continue;
+        }
+        struct timeval currentTime;
+        gettimeofday( &currentTime, 0 );
+        int timeLeft = timeout - MilliTimeDiff(currentTime,startTime);
+        if (timeLeft <= 0)
+            break;
+        // wait until space to write more data
+        if (!WaitWritable(timeLeft))
+            break;
+    }
+    // user timeout condition
+    err_ = EAGAIN;
+    return false;
+#endif // defined(WIN32)
+}
+
+#if defined(ANYRPC_ZEROCOPY)
+int TcpSocket::SetZeroCopy(int param)
+{
+    int result = setsockopt( fd_, SOL_SOCKET, SO_ZEROCOPY, (char*)&param, sizeof(param) );
+    zeroCopy_ = (result == 0) && (param != 0);
+    log_debug( "SetZeroCopy: param=" << param << ", result=" << result);
+    return result;
+}
+
+void TcpSocket::HoldZeroCopy(std::vector<void*>& buffers)
+{
+    if (buffers.empty())
+        return;
+    zeroCopyHeld_.push_back(ZeroCopyHold());
+    zeroCopyHeld_.back().sends_ = zeroCopySends_;
+    zeroCopyHeld_.back().buffers_.swap(buffers);
+    ReleaseZeroCopy(false);
+}
+
+void TcpSocket::ReapZeroCopy()
+{
+    while (true)
+    {
+        char control[256];
+        struct msghdr message;
+        memset( &message, 0, sizeof(message) );
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg( fd_, &message, MSG_ERRQUEUE ) < 0)
+            break;      // the error queue is empty
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != 0; cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            if (!((cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == IP_RECVERR)) &&
+                !((cmsg->cmsg_level == SOL_IPV6) && (cmsg->cmsg_type == IPV6_RECVERR)))
+                continue;
+            struct sock_extended_err error;
+            memcpy( &error, CMSG_DATA(cmsg), sizeof(error) );
+            if ((error.ee_errno != 0) || (error.ee_origin != SO_EE_ORIGIN_ZEROCOPY))
+                continue;
+
+            // the sends from ee_info to ee_data have completed - usually the next ones in order
+            log_debug("ReapZeroCopy: first=" << error.ee_info << ", last=" << error.ee_data);
+            zeroCopyRanges_.push_back(std::make_pair(error.ee_info, error.ee_data));
+            bool merged = true;
+            while (merged)
+            {
+                merged = false;
+                for (size_t i=0; i<zeroCopyRanges_.size(); i++)
+                {
+                    if (static_cast<int32_t>(zeroCopyRanges_[i].first - zeroCopyCompleted_) <= 0)
+                    {
+                        if (static_cast<int32_t>(zeroCopyRanges_[i].second + 1 - zeroCopyCompleted_) > 0)
+                            zeroCopyCompleted_ = zeroCopyRanges_[i].second + 1;
+                        zeroCopyRanges_.erase(zeroCopyRanges_.begin() + i);
+                        merged = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    ReleaseZeroCopy(false);
+}
+
+void TcpSocket::MoveZeroCopy(TcpSocket& target)
+{
+    target.Close();
+    target.fd_ = fd_;
+    target.zeroCopy_ = zeroCopy_;
+    target.zeroCopySends_ = zeroCopySends_;
+    target.zeroCopyCompleted_ = zeroCopyCompleted_;
+    target.zeroCopyRanges_.swap(zeroCopyRanges_);
+    target.zeroCopyHeld_.swap(zeroCopyHeld_);
+    fd_ = static_cast<SOCKET>(-1);
+    Close();
+}
+#endif // defined(ANYRPC_ZEROCOPY)
+
+void TcpSocket::ReleaseZeroCopy(bool all)
+{
+    while (!zeroCopyHeld_.empty() &&
+           (all || (static_cast<int32_t>(zeroCopyCompleted_ - zeroCopyHeld_.front().sends_) >= 0)))
+    {
+        std::vector<void*>& buffers = zeroCopyHeld_.front().buffers_;
+        for (size_t i=0; i<buffers.size(); i++)
+            free(buffers[i]);
+        zeroCopyHeld_.pop_front();
+    }
+}
+
+bool TcpSocket::SendEach(const SendSegment* segments, size_t count, size_t &bytesWritten, int timeout)
+{
+    struct timeval startTime;
+    gettimeofday( &startTime, 0 );
+    for (size_t i = 0; i < count; i++)
+    {
+        struct timeval currentTime;
+        gettimeofday( &currentTime, 0 );
+        int timeLeft = std::max(0, timeout - MilliTimeDiff(currentTime,startTime));
+        size_t segmentBytesWritten;
+        bool result = Send(segments[i].data_, segments[i].length_, segmentBytesWritten, timeLeft);
+        bytesWritten += segmentBytesWritten;
+        if (!result)
+            return false;
+    }
+    return true;
+}
+
 bool TcpSocket::Receive(char* buffer, size_t maxLength, size_t &bytesRead, bool &eof, int timeout)
 {
     if (timeout < 0) timeout = timeout_;    // default to the set timeout value
     timeout = std::max(0,timeout);          // timeout can't be negative
+#if defined(ANYRPC_SHARED_MEMORY)
+    if (ringExpected_)
+        return TakeRing(buffer, maxLength, bytesRead, eof);
+    if (channel_ != 0)
+        return ReceiveShared(buffer, maxLength, bytesRead, eof, timeout);
+#endif // defined(ANYRPC_SHARED_MEMORY)
+#if defined(ANYRPC_URING)
+    if (uring_ != 0)
+        return ReceiveUring(buffer, maxLength, bytesRead, eof);
+#endif // defined(ANYRPC_URING)
 
     struct timeval startTime;
     gettimeofday( &startTime, 0 );
@@ -387,6 +815,7 @@ bool TcpSocket::Receive(char* buffer, size_t maxLength, size_t &bytesRead, bool
         }
         else
         {
+            err_ = 0;   // errno is only set by a failure
             bytesRead += numBytes;
             buffer[bytesRead] = 0;
             log_debug( "Receive: data=" << buffer);
@@ -407,6 +836,55 @@ bool TcpSocket::Receive(char* buffer, size_t maxLength, size_t &bytesRead, bool
     return true;
 }
 
+#if defined(ANYRPC_URING)
+bool TcpSocket::SendUring(const SendSegment* segments, size_t count, size_t &bytesWritten, int timeout)
+{
+    // the data is copied for the poller so it is either all written or none of it
+    bytesWritten = 0;
+    if (!uring_->Write(segments, count, timeout))
+    {
+        err_ = (uring_->GetError() != 0) ? uring_->GetError() : EAGAIN;
+        log_debug("SendUring: err=" << err_);
+        return false;
+    }
+    for (size_t i=0; i<count; i++)
+        bytesWritten += segments[i].length_;
+    err_ = 0;
+    log_debug("SendUring: bytesWritten=" << bytesWritten);
+    return true;
+}
+
+bool TcpSocket::ReceiveUring(char* buffer, size_t maxLength, size_t &bytesRead, bool &eof)
+{
+    bytesRead = uring_->Read(buffer, maxLength);
+    buffer[bytesRead] = 0;
+    eof = false;
+    log_debug( "ReceiveUring: bytesRead=" << bytesRead);
+    if (bytesRead >= maxLength)
+    {
+        err_ = 0;
+        return true;
+    }
+
+    // like recv, the end of the data or an error is only returned after the data before it
+    err_ = uring_->GetError();
+    eof = uring_->IsEnded() || ConnectionResetError(err_);
+    if (eof || (err_ != 0))
+        return false;
+    err_ = EAGAIN;
+    return true;
+}
+#endif // defined(ANYRPC_URING)
+
+bool TcpSocket::WaitReadable(int timeout)
+{
+#if defined(ANYRPC_SHARED_MEMORY)
+    if (channel_ != 0)
+        return WaitShared(false, timeout);
+#endif // defined(ANYRPC_SHARED_MEMORY)
+    return Socket::WaitReadable(timeout);
+}
+
 bool TcpSocket::IsConnected(int timeout)
 {
     if (fd_ < 0)
@@ -462,9 +940,36 @@ int TcpSocket::Listen(int backlog)
 
 SOCKET TcpSocket::Accept()
 {
+#if defined(ANYRPC_URING)
+    if (uring_ != 0)
+    {
+        // the poller accepted the connection with the same flags as accept4
+        SOCKET result = uring_->Accept(err_);
+        log_debug("Accept: result=" << result);
+        return result;
+    }
+#endif // defined(ANYRPC_URING)
+#if defined(__linux__)
+    // Linux sockets inherit TCP_NODELAY from the listening socket so only the flags are needed
+    SOCKET result = accept4( fd_, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC );
+    SetLastError();
+#else
     SOCKET result = accept( fd_, 0, 0 );
-    log_debug("Accept: result=" << result);
     SetLastError();
+    if (result >= 0)
+    {
+# if defined(WIN32)
+        unsigned long flag = 1;
+        ioctlsocket(result, FIONBIO, &flag);
+# else
+        fcntl(result, F_SETFL, O_NONBLOCK);
+        fcntl(result, F_SETFD, FD_CLOEXEC);
+# endif // defined(WIN32)
+        int param = 1;
+        setsockopt(result, IPPROTO_TCP, TCP_NODELAY, (char*)&param, sizeof(param));
+    }
+#endif // defined(__linux__)
+    log_debug("Accept: result=" << result);
     return result;
 }
 
@@ -487,6 +992,301 @@ int TcpSocket::Connect(const char* ipAddress, int port)
     return result;
 }
 
+#if defined(ANYRPC_LOCAL_SOCKET)
+int TcpSocket::ConnectLocal(const char* path)
+{
+    if (fd_ < 0)
+        CreateLocal();
+
+    struct sockaddr_un connectedAddr;
+    socklen_t length;
+    if (!LocalAddress(path, connectedAddr, length))
+    {
+        log_warn("Invalid Unix domain socket path: " << path);
+        err_ = EINVAL;
+        return -1;
+    }
+
+    int result = connect(fd_, (sockaddr*)&connectedAddr, length);
+    SetLastError();
+    // a Unix domain connect either completes or fails right away - EAGAIN is a full backlog, not in progress
+    connected_ = (result == 0);
+    log_debug("ConnectLocal: path=" << path << ", result=" << result << ", err=" << err_);
+    return result;
+}
+#endif // defined(ANYRPC_LOCAL_SOCKET)
+
+#if defined(ANYRPC_SHARED_MEMORY)
+//! Control data with space for a single descriptor
+union DescriptorControl
+{
+    struct cmsghdr header_;
+    char data_[CMSG_SPACE(sizeof(int))];
+};
+
+bool TcpSocket::ConnectRing(size_t capacity, int timeout)
+{
+    internal::ShmChannel* channel = new internal::ShmChannel;
+    if (!channel->Create(capacity))
+    {
+        delete channel;
+        err_ = ENOMEM;
+        return false;
+    }
+
+    // the descriptor is passed with a single null byte, which doesn't start a request in any of the protocols
+    char handshake = 0;
+    struct iovec iov;
+    iov.iov_base = &handshake;
+    iov.iov_len = 1;
+    DescriptorControl control;
+    memset( &control, 0, sizeof(control) );
+    struct msghdr msg;
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data_;
+    msg.msg_controllen = sizeof(control.data_);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    int fd = channel->GetFileDescriptor();
+    memcpy( CMSG_DATA(cmsg), &fd, sizeof(int) );
+    ssize_t numBytes = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+    SetLastError();
+    channel->CloseFileDescriptor();
+
+    // the server answers with a null byte once it has mapped the rings, or closes the socket if it doesn't take them
+    char ack = 1;
+    if ((numBytes != 1) || !Socket::WaitReadable(timeout) || (recv(fd_, &ack, 1, 0) != 1) || (ack != 0))
+    {
+        log_warn("The server did not take the shared memory rings");
+        delete channel;
+        err_ = ECONNREFUSED;
+        return false;
+    }
+    channel_ = channel;
+    isClient_ = true;
+    peerClosed_ = false;
+    log_debug("ConnectRing: fd=" << fd_ << ", capacity=" << capacity);
+    return true;
+}
+
+bool TcpSocket::TakeRing(char* buffer, size_t maxLength, size_t &bytesRead, bool &eof)
+{
+    bytesRead = 0;
+    eof = false;
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = maxLength;
+    DescriptorControl control;
+    struct msghdr msg;
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data_;
+    msg.msg_controllen = sizeof(control.data_);
+    ssize_t numBytes = recvmsg(fd_, &msg, MSG_CMSG_CLOEXEC);
+    SetLastError();
+    if (numBytes <= 0)
+    {
+        eof = (numBytes == 0) || ConnectionResetError(err_);
+        return !eof && !FatalError();
+    }
+    ringExpected_ = false;
+
+    int fd = -1;
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if ((cmsg != 0) && (cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS) &&
+        (cmsg->cmsg_len == CMSG_LEN(sizeof(int))))
+        memcpy( &fd, CMSG_DATA(cmsg), sizeof(int) );
+    if (fd < 0)
+    {
+        // a client that sends its data on the socket
+        bytesRead = numBytes;
+        buffer[bytesRead] = 0;
+        return true;
+    }
+
+    if ((numBytes != 1) || (buffer[0] != 0))
+    {
+        log_warn("Unexpected data with the shared memory");
+        close(fd);
+        err_ = EPROTO;
+        return false;
+    }
+    internal::ShmChannel* channel = new internal::ShmChannel;
+    char ack = 0;
+    if (!channel->Attach(fd) || (send(fd_, &ack, 1, MSG_NOSIGNAL) != 1))
+    {
+        delete channel;
+        err_ = EPROTO;
+        return false;
+    }
+    channel_ = channel;
+    isClient_ = false;
+    peerClosed_ = false;
+    log_debug("TakeRing: fd=" << fd_);
+    return true;
+}
+
+internal::ShmRing& TcpSocket::OutgoingRing()
+{
+    return isClient_ ? channel_->GetRequestRing() : channel_->GetResponseRing();
+}
+
+internal::ShmRing& TcpSocket::IncomingRing()
+{
+    return isClient_ ? channel_->GetResponseRing() : channel_->GetRequestRing();
+}
+
+bool TcpSocket::SendShared(const char* buffer, size_t length, size_t &bytesWritten, int timeout)
+{
+    internal::ShmRing& ring = OutgoingRing();
+    err_ = 0;
+    bytesWritten = 0;
+    struct timeval startTime;
+    gettimeofday( &startTime, 0 );
+    while (true)
+    {
+        size_t numBytes;
+        if (!ring.Write(buffer+bytesWritten, length-bytesWritten, numBytes))
+        {
+            log_warn("The shared memory ring is corrupt");
+            err_ = EPROTO;
+            return false;
+        }
+        bytesWritten += numBytes;
+        if ((numBytes > 0) && ring.IsConsumerWaiting())
+            RingDoorbell();
+        if (bytesWritten >= length)
+            return true;
+        if (peerClosed_)
+        {
+            err_ = EPIPE;
+            return false;
+        }
+        struct timeval currentTime;
+        gettimeofday( &currentTime, 0 );
+        int timeLeft = timeout - MilliTimeDiff(currentTime,startTime);
+        if (timeLeft <= 0)
+            break;
+        // wait until the other side has read some of the data
+        if (!WaitShared(true, timeLeft))
+            break;
+    }
+    // user timeout condition
+    err_ = EAGAIN;
+    return false;
+}
+
+bool TcpSocket::ReceiveShared(char* buffer, size_t maxLength, size_t &bytesRead, bool &eof, int timeout)
+{
+    internal::ShmRing& ring = IncomingRing();
+    err_ = 0;
+    struct timeval startTime;
+    gettimeofday( &startTime, 0 );
+    bytesRead = 0;
+    eof = false;
+    while (bytesRead < maxLength)
+    {
+        size_t numBytes;
+        if (!ring.Read(buffer+bytesRead, maxLength-bytesRead, numBytes))
+        {
+            log_warn("The shared memory ring is corrupt");
+            err_ = EPROTO;
+            return false;
+        }
+        bytesRead += numBytes;
+        buffer[bytesRead] = 0;
+        if ((numBytes > 0) && ring.IsProducerWaiting())
+            RingDoorbell();
+        if (bytesRead >= maxLength)
+            return true;
+
+        // The server is woken for every request, so consume the wake ups for the data that has
+        // been read and check again for data written before the last one
+        if (!isClient_)
+        {
+            DrainDoorbell();
+            if (ring.IsReadable())
+                continue;
+        }
+        if (peerClosed_)
+        {
+            // the data is returned first and the close is seen by the next call
+            if (bytesRead > 0)
+                return true;
+            eof = true;
+            err_ = ECONNRESET;
+            return false;
+        }
+        struct timeval currentTime;
+        gettimeofday( &currentTime, 0 );
+        int timeLeft = timeout - MilliTimeDiff(currentTime,startTime);
+        if (timeLeft <= 0)
+            break;
+        // wait until more data is available
+        if (!WaitShared(false, timeLeft))
+            break;
+    }
+    // user timeout condition
+    err_ = EAGAIN;
+    return true;
+}
+
+bool TcpSocket::WaitShared(bool send, int timeout)
+{
+    if (timeout < 0) timeout = timeout_;    // default to the set timeout value
+    timeout = std::max(0,timeout);          // timeout can't be negative
+
+    internal::ShmRing& ring = send ? OutgoingRing() : IncomingRing();
+    int64_t startTime = MonotonicMicroTime();
+    int64_t endTime = startTime + static_cast<int64_t>(timeout) * 1000;
+    int64_t spinTime = std::min(endTime, startTime + busyPoll_);
+    while (true)
+    {
+        if ((send ? ring.IsWritable() : ring.IsReadable()) || peerClosed_)
+            return true;
+        int64_t currentTime = MonotonicMicroTime();
+        if (currentTime >= endTime)
+            return false;
+        if (currentTime < spinTime)
+            continue;
+
+        // go to sleep on the socket - the flag is set before checking the ring again so the other side can't miss it
+        if (send)
+            ring.SetProducerWaiting(true);
+        else
+            ring.SetConsumerWaiting(true);
+        bool ready = send ? ring.IsWritable() : ring.IsReadable();
+        if (!ready && Socket::WaitReadable(static_cast<int>((endTime - currentTime + 999) / 1000)))
+            DrainDoorbell();
+        if (send)
+            ring.SetProducerWaiting(false);
+        else if (isClient_)
+            ring.SetConsumerWaiting(false);
+    }
+}
+
+void TcpSocket::RingDoorbell()
+{
+    // a full socket buffer already has a wake up waiting so a failed send can be ignored
+    char bell = 0;
+    send(fd_, &bell, 1, MSG_NOSIGNAL);
+}
+
+bool TcpSocket::DrainDoorbell()
+{
+    char bells[64];
+    int numBytes = recv(fd_, bells, sizeof(bells), 0);
+    if ((numBytes == 0) || ((numBytes < 0) && FatalError(errno)))
+        peerClosed_ = true;
+    return !peerClosed_;
+}
+#endif // defined(ANYRPC_SHARED_MEMORY)
+
 ////////////////////////////////////////////////////////////////////////////////
 
 SOCKET UdpSocket::Create()
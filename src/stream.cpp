@@ -339,6 +339,17 @@ void WriteSegmentedStream::Clear()
     length_ = 0;
 }
 
+void WriteSegmentedStream::DetachBuffers(std::vector<void*>& buffers)
+{
+    for (BufferList::iterator it = buffers_.begin(); it != buffers_.end(); ++it)
+        if (it->allocated_)
+            buffers.push_back(it->buffer_);
+
+    // the buffers belong to the caller now so Clear won't free them
+    buffers_.clear();
+    Clear();
+}
+
 void WriteSegmentedStream::Put(char c)
 {
     // check if enough room in the current allocation
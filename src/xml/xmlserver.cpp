@@ -38,6 +38,7 @@ namespace anyrpc
 {
 
 static void XmlExecuteMultiCall(MethodManager* manager, Value &params, Value &result);
+static void XmlEncodeResponse(Value& id, Value* result, int errorCode, std::string const& errorMsg, Stream& response);
 static void XmlGenerateResponse(Value &result, Stream &response);
 static void XmlGenerateFaultResponse(int errorCode, std::string const& errorMsg, Stream &response);
 static void XmlGenerateFaultValue(int errorCode, std::string const& errorMsg, Value &faultValue);
@@ -46,6 +47,37 @@ log_define("AnyRPC.RpcHandler");
 
 ////////////////////////////////////////////////////////////////////////////////
 
+//! Encodes the result of a StreamMethod as an xml-rpc response while it is produced
+class XmlStreamedResult : public StreamedResult
+{
+public:
+    XmlStreamedResult(Stream& response) : response_(response), writer_(response) {}
+
+protected:
+    virtual void EncodeStart()
+    {
+        response_.Put("<?xml version=\"1.0\" encoding=\"utf-8\" ?>\r\n<methodResponse><params><param>");
+        writer_.StartArray(0);
+    }
+    virtual void EncodeElement(Value& element, std::size_t index)
+    {
+        if (index > 0)
+            writer_.ArraySeparator();
+        element.Traverse(writer_);
+    }
+    virtual void EncodeEnd(std::size_t count)
+    {
+        writer_.EndArray(count);
+        response_.Put("</param></params></methodResponse>\r\n");
+    }
+
+private:
+    Stream& response_;              //!< Stream for the response
+    XmlWriter writer_;              //!< Writer for the response stream
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 bool XmlRpcHandler(MethodManager* manager, char* request, size_t length, Stream &response)
 {
     InSituStringStream sstream(request, length);
@@ -78,19 +110,34 @@ bool XmlRpcHandler(MethodManager* manager, char* request, size_t length, Stream
         }
         else
         {
+            // xml-rpc responses don't carry an id
+            Value id;
+            id.SetNull();
+            XmlStreamedResult streamedResult(response);
+            CallDeferral* deferral = CallDeferral::Current();
+            if (deferral != 0)
+                deferral->SetCall(&XmlEncodeResponse, id, methodName, &streamedResult);
+
             try
             {
-                if (manager->ExecuteMethod(methodName,params,result))
+                if (!manager->ExecuteMethod(methodName,params,result))
+                    XmlGenerateFaultResponse(AnyRpcErrorMethodNotFound, "Method not found", response);
+                else if ((deferral != 0) && deferral->IsDeferred())
+                    return false;   // the connection sends the response when the method responds
+                else if ((deferral != 0) && deferral->IsStreamed())
+                    streamedResult.Finish();
+                else
                 {
                     if (result.IsInvalid())
                         result = "";
                     XmlGenerateResponse(result, response);
                 }
-                else
-                    XmlGenerateFaultResponse(AnyRpcErrorMethodNotFound, "Method not found", response);
             }
             catch (const AnyRpcException& fault)
             {
+                // once part of a streamed result has been sent, the connection is closed instead
+                if (!streamedResult.Discard())
+                    return false;
                 XmlGenerateFaultResponse(fault.GetCode(), fault.GetMessage(), response);
             }
         }
@@ -98,6 +145,35 @@ bool XmlRpcHandler(MethodManager* manager, char* request, size_t length, Stream
     return true;
 }
 
+bool XmlRpcFaultHandler(char* /* request */, size_t /* length */, int errorCode, std::string const& errorMsg, Stream &response)
+{
+    // the fault doesn't refer to the request so it isn't parsed
+    XmlGenerateFaultResponse(errorCode, errorMsg, response);
+    return true;
+}
+
+bool XmlRpcMethodName(const char* request, size_t length, std::string& methodName)
+{
+    // scan for the methodName element since the handler parses the request in place later
+    static const char tag[] = "<methodName>";
+    const char* end = request + length;
+    const char* start = std::search(request, end, tag, tag + sizeof(tag) - 1);
+    if (start == end)
+        return false;
+    start += sizeof(tag) - 1;
+    const char* stop = std::find(start, end, '<');
+    if (stop == end)
+        return false;
+    while ((start < stop) && isspace(static_cast<unsigned char>(*start)))
+        start++;
+    while ((stop > start) && isspace(static_cast<unsigned char>(*(stop-1))))
+        stop--;
+    if (start == stop)
+        return false;
+    methodName.assign(start, stop - start);
+    return true;
+}
+
 static void XmlExecuteMultiCall(MethodManager* manager, Value &params, Value &result)
 {
     log_debug("ExecuteMultiCall: params= " << params);
@@ -137,6 +213,18 @@ static void XmlExecuteMultiCall(MethodManager* manager, Value &params, Value &re
     log_debug("ExecuteMultiCall: result= " << result);
 }
 
+static void XmlEncodeResponse(Value& /* id */, Value* result, int errorCode, std::string const& errorMsg, Stream& response)
+{
+    if (result == 0)
+        XmlGenerateFaultResponse(errorCode, errorMsg, response);
+    else
+    {
+        if (result->IsInvalid())
+            *result = "";
+        XmlGenerateResponse(*result, response);
+    }
+}
+
 static void XmlGenerateResponse(Value &result, Stream &response)
 {
     response.Put("<?xml version=\"1.0\" encoding=\"utf-8\" ?>\r\n<methodResponse><params><param>");
@@ -0,0 +1,189 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "anyrpc/coroutine.h"
+#include "anyrpc/internal/time.h"
+
+#include <gtest/gtest.h>
+
+using namespace std;
+using namespace anyrpc;
+
+static const int FrontendPort = 9100;
+static const int BackendPort = 9101;
+static const char* ServerIpAddress = "127.0.0.1";
+
+static CoroutineExecutor* testExecutor = 0;
+static internal::Wakeup testWakeup;
+
+static Task<double> Square(double value)
+{
+    co_return value * value;
+}
+
+static Task<Value> SumOfSquares(Value& params)
+{
+    if (!params.IsArray())
+        throw AnyRpcException(AnyRpcErrorInvalidParams, "Invalid parameters");
+    double sum = 0;
+    for (size_t i=0; i<params.Size(); i++)
+        sum += co_await Square(params[i].GetDouble());
+    co_return Value(sum);
+}
+
+//! Resume on the executor thread and return whether the thread changed
+static Task<Value> OtherThread(Value& /* params */)
+{
+    std::thread::id before = std::this_thread::get_id();
+    bool scheduled = co_await testExecutor->Schedule();
+    co_return Value(scheduled && (std::this_thread::get_id() != before));
+}
+
+//! Wait up to params[0] milliseconds for the wakeup to be signaled
+static Task<Value> WaitForWakeup(Value& params)
+{
+    bool ready = co_await testExecutor->Readable(testWakeup.GetFileDescriptor(), params[0].GetInt());
+    testWakeup.Drain();
+    co_return Value(ready);
+}
+
+//! Forward the call to the backend server
+static Task<Value> Forward(Value& params)
+{
+    JsonTcpClient client(ServerIpAddress, BackendPort);
+    client.SetTimeout(2000);
+    Value result;
+    bool success = co_await testExecutor->Call(client, "sleep", params, result);
+    if (!success)
+        throw AnyRpcException(AnyRpcErrorApplicationError, "Backend call failed");
+    co_return result;
+}
+
+static void Sleep(Value& params, Value& result)
+{
+    MilliSleep(params[0].GetInt());
+    result = params[0];
+}
+
+static void ForwardCaller(int ms)
+{
+    JsonTcpClient client(ServerIpAddress, FrontendPort);
+    client.SetTimeout(2000);
+    Value params;
+    Value result;
+    params.SetArray();
+    params[0] = ms;
+    EXPECT_TRUE(client.Call("forward", params, result));
+    EXPECT_EQ(result.GetInt(), ms);
+}
+
+TEST(Coroutine,Method)
+{
+    MethodManager manager;
+    AddCoroutineFunction(&manager, &SumOfSquares, "sumOfSquares", "Sum the squares of the numbers");
+
+    Value params;
+    Value result;
+    params.SetArray();
+    params[0] = 1;
+    params[1] = 2;
+    params[2] = 3;
+    EXPECT_TRUE(manager.ExecuteMethod("sumOfSquares", params, result));
+    EXPECT_EQ(result.GetDouble(), 14);
+
+    // an exception from the coroutine is a fault
+    params.SetNull();
+    EXPECT_THROW(manager.ExecuteMethod("sumOfSquares", params, result), AnyRpcException);
+}
+
+TEST(Coroutine,Executor)
+{
+    CoroutineExecutor executor;
+    MethodManager manager;
+    Value params;
+    Value result;
+
+    testExecutor = &executor;
+    ASSERT_TRUE(testWakeup.Create());
+    AddCoroutineFunction(&manager, &OtherThread, "otherThread", "Check that the coroutine moved to the executor");
+    AddCoroutineFunction(&manager, &WaitForWakeup, "waitForWakeup", "Wait for the wakeup to be readable");
+    ASSERT_TRUE(executor.Start());
+
+    EXPECT_TRUE(manager.ExecuteMethod("otherThread", params, result));
+    EXPECT_TRUE(result.GetBool());
+
+    // resumes when the socket is readable
+    std::thread signaler([]() { MilliSleep(50); testWakeup.Signal(); });
+    params.SetArray();
+    params[0] = 1000;
+    int64_t startTime = MonotonicMicroTime();
+    EXPECT_TRUE(manager.ExecuteMethod("waitForWakeup", params, result));
+    EXPECT_TRUE(result.GetBool());
+    EXPECT_LT(MonotonicMicroTime() - startTime, 500000);
+    signaler.join();
+
+    // or when the timeout expires
+    params[0] = 50;
+    startTime = MonotonicMicroTime();
+    EXPECT_TRUE(manager.ExecuteMethod("waitForWakeup", params, result));
+    EXPECT_FALSE(result.GetBool());
+    EXPECT_GE(MonotonicMicroTime() - startTime, 45000);
+
+    // waits fail once the executor is stopped
+    executor.Stop();
+    EXPECT_FALSE(executor.IsRunning());
+    EXPECT_TRUE(manager.ExecuteMethod("otherThread", params, result));
+    EXPECT_FALSE(result.GetBool());
+
+    testWakeup.Close();
+    testExecutor = 0;
+}
+
+TEST(Coroutine,Forward)
+{
+    CoroutineExecutor executor;
+    JsonTcpServerTP backend(4);
+    JsonTcpServerTP frontend(1);
+
+    testExecutor = &executor;
+    ASSERT_TRUE(executor.Start());
+    backend.BindAndListen(BackendPort);
+    backend.GetMethodManager()->AddFunction(&Sleep, "sleep", "Sleep for a number of milliseconds");
+    backend.StartThread();
+    frontend.BindAndListen(FrontendPort);
+    AddCoroutineFunction(frontend.GetMethodManager(), &Forward, "forward", "Forward the call to the backend");
+    frontend.StartThread();
+
+    // the single frontend worker isn't held while the backend calls are outstanding
+    int64_t startTime = MonotonicMicroTime();
+    std::thread caller1(&ForwardCaller, 200);
+    std::thread caller2(&ForwardCaller, 200);
+    std::thread caller3(&ForwardCaller, 200);
+    caller1.join();
+    caller2.join();
+    caller3.join();
+    EXPECT_LT(MonotonicMicroTime() - startTime, 450000);
+
+    frontend.StopThread();
+    backend.StopThread();
+    executor.Stop();
+    testExecutor = 0;
+}
@@ -20,6 +20,8 @@
 
 #include "anyrpc/anyrpc.h"
 #include "anyrpc/internal/http.h"
+#include "anyrpc/internal/http2.h"
+#include "anyrpc/internal/websocket.h"
 
 #include <gtest/gtest.h>
 #include <fstream>
@@ -206,3 +208,269 @@ TEST(HttpHeader,ResponseMultipleRead)
     EXPECT_TRUE(response.GetKeepAlive());
 }
 
+TEST(HttpHeader,RequestChunked)
+{
+    const char* inString =  "POST /RPC2 HTTP/1.1\r\n"
+                            " Host: 192.168.1.1:5000\r\n"
+                            " Transfer-Encoding: Chunked\r\n"
+                            " Content-type: text/xml\r\n"
+                            "\r\n";
+
+    HttpRequest request;
+    bool eof=false;
+    EXPECT_EQ(request.ProcessHeaderData(inString, strlen(inString), eof), HttpHeader::HEADER_COMPLETE);
+    EXPECT_TRUE(request.GetChunked());
+    EXPECT_EQ(request.GetContentLength(), -1);
+
+    // a content length can't also be given, and other encodings are not supported
+    const char* bothString =    "POST /RPC2 HTTP/1.1\r\n"
+                                " Host: 192.168.1.1:5000\r\n"
+                                " Content-length: 47\r\n"
+                                " Transfer-Encoding: chunked\r\n"
+                                "\r\n";
+    request.Initialize();
+    EXPECT_EQ(request.ProcessHeaderData(bothString, strlen(bothString), eof), HttpHeader::HEADER_FAULT);
+    const char* gzipString =    "POST /RPC2 HTTP/1.1\r\n"
+                                " Host: 192.168.1.1:5000\r\n"
+                                " Transfer-Encoding: gzip, chunked\r\n"
+                                "\r\n";
+    request.Initialize();
+    EXPECT_EQ(request.ProcessHeaderData(gzipString, strlen(gzipString), eof), HttpHeader::HEADER_FAULT);
+}
+
+//! Decode the encoded data passed in pieces of the length.  Return the final state.
+static HttpChunkedDecoder::ResultEnum DecodeChunked(const std::string& encoded, size_t pieceLength, std::string& decoded, size_t& used)
+{
+    HttpChunkedDecoder decoder;
+    HttpChunkedDecoder::ResultEnum result = HttpChunkedDecoder::CHUNKED_INCOMPLETE;
+    used = 0;
+    while ((used < encoded.length()) && (result == HttpChunkedDecoder::CHUNKED_INCOMPLETE))
+    {
+        size_t length = std::min(pieceLength, encoded.length() - used);
+        size_t position = 0;
+        while ((position < length) && (result == HttpChunkedDecoder::CHUNKED_INCOMPLETE))
+        {
+            size_t consumed;
+            const char* data;
+            size_t dataLength;
+            result = decoder.Process(encoded.c_str() + used + position, length - position, consumed, data, dataLength);
+            decoded.append(data == 0 ? "" : data, dataLength);
+            position += consumed;
+        }
+        used += position;
+    }
+    return result;
+}
+
+TEST(HttpChunkedDecoder,Pieces)
+{
+    std::string encoded = "5 ;name=value\r\nHello\r\n"
+                          "0A\t\r\n, chunked!\r\n"
+                          "1\r\n \r\n"
+                          "0\r\n"
+                          "X-Trailer: value\r\n"
+                          "\r\n"
+                          "next";
+    // the result doesn't depend on how the data arrives
+    for (size_t pieceLength = 1; pieceLength <= encoded.length(); pieceLength++)
+    {
+        std::string decoded;
+        size_t used;
+        EXPECT_EQ(DecodeChunked(encoded, pieceLength, decoded, used), HttpChunkedDecoder::CHUNKED_COMPLETE);
+        EXPECT_EQ(decoded, "Hello, chunked! ");
+        // the data after the body is left for the next message
+        EXPECT_EQ(encoded.substr(used), "next");
+    }
+}
+
+TEST(HttpChunkedDecoder,Faults)
+{
+    std::string decoded;
+    size_t used;
+    EXPECT_EQ(DecodeChunked("\r\n", 10, decoded, used), HttpChunkedDecoder::CHUNKED_FAULT);
+    EXPECT_EQ(DecodeChunked("5x\r\n", 10, decoded, used), HttpChunkedDecoder::CHUNKED_FAULT);
+    EXPECT_EQ(DecodeChunked("3\r\nabcX\r\n", 10, decoded, used), HttpChunkedDecoder::CHUNKED_FAULT);
+    EXPECT_EQ(DecodeChunked("1000000000000000\r\n", 10, decoded, used), HttpChunkedDecoder::CHUNKED_FAULT);
+    // whitespace is only allowed after the size, and the lines end with CRLF
+    EXPECT_EQ(DecodeChunked(" 3\r\nabc\r\n", 10, decoded, used), HttpChunkedDecoder::CHUNKED_FAULT);
+    EXPECT_EQ(DecodeChunked("1 0\r\n", 10, decoded, used), HttpChunkedDecoder::CHUNKED_FAULT);
+    EXPECT_EQ(DecodeChunked("3\nabc\r\n", 10, decoded, used), HttpChunkedDecoder::CHUNKED_FAULT);
+    EXPECT_EQ(DecodeChunked("3\rabc\r\n", 10, decoded, used), HttpChunkedDecoder::CHUNKED_FAULT);
+    EXPECT_EQ(DecodeChunked("3\r\nabc\n", 10, decoded, used), HttpChunkedDecoder::CHUNKED_FAULT);
+    EXPECT_EQ(DecodeChunked("3;a\rb\r\nabc\r\n", 10, decoded, used), HttpChunkedDecoder::CHUNKED_FAULT);
+    EXPECT_EQ(DecodeChunked("0\r\n\n", 10, decoded, used), HttpChunkedDecoder::CHUNKED_FAULT);
+    EXPECT_EQ(DecodeChunked("3\r\nabc\r\n0\r\n", 10, decoded, used), HttpChunkedDecoder::CHUNKED_INCOMPLETE);
+}
+
+static std::string FromHex(const char* hex)
+{
+    std::string data;
+    for (; hex[0] && hex[1]; hex += 2)
+        data += static_cast<char>(std::stoi(std::string(hex, 2), 0, 16));
+    return data;
+}
+
+TEST(Hpack,RequestExamples)
+{
+    // RFC 7541 C.4, the requests with Huffman coding share the dynamic table
+    HpackDecoder decoder;
+    HpackHeaderList headers;
+    std::string block = FromHex("828684418cf1e3c2e5f23a6ba0ab90f4ff");
+    ASSERT_TRUE(decoder.Decode(block.data(), block.length(), headers));
+    ASSERT_EQ(headers.size(), 4u);
+    EXPECT_EQ(headers[0], std::make_pair(std::string(":method"), std::string("GET")));
+    EXPECT_EQ(headers[1], std::make_pair(std::string(":scheme"), std::string("http")));
+    EXPECT_EQ(headers[2], std::make_pair(std::string(":path"), std::string("/")));
+    EXPECT_EQ(headers[3], std::make_pair(std::string(":authority"), std::string("www.example.com")));
+
+    block = FromHex("828684be5886a8eb10649cbf");
+    headers.clear();
+    ASSERT_TRUE(decoder.Decode(block.data(), block.length(), headers));
+    ASSERT_EQ(headers.size(), 5u);
+    EXPECT_EQ(headers[3], std::make_pair(std::string(":authority"), std::string("www.example.com")));
+    EXPECT_EQ(headers[4], std::make_pair(std::string("cache-control"), std::string("no-cache")));
+
+    block = FromHex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf");
+    headers.clear();
+    ASSERT_TRUE(decoder.Decode(block.data(), block.length(), headers));
+    ASSERT_EQ(headers.size(), 5u);
+    EXPECT_EQ(headers[1], std::make_pair(std::string(":scheme"), std::string("https")));
+    EXPECT_EQ(headers[2], std::make_pair(std::string(":path"), std::string("/index.html")));
+    EXPECT_EQ(headers[3], std::make_pair(std::string(":authority"), std::string("www.example.com")));
+    EXPECT_EQ(headers[4], std::make_pair(std::string("custom-key"), std::string("custom-value")));
+
+    // an index past the dynamic table is an error for the connection
+    block = FromHex("c2");
+    EXPECT_FALSE(decoder.Decode(block.data(), block.length(), headers));
+}
+
+TEST(Hpack,EncodeRoundTrip)
+{
+    std::string block;
+    HpackEncode(block, ":status", "200");
+    HpackEncode(block, "content-type", "application/json-rpc");
+    HpackEncode(block, "x-anyrpc", std::string(300, 'z'));
+    // an indexed field of the static table is a single byte
+    EXPECT_EQ(block[0], static_cast<char>(0x88));
+
+    HpackDecoder decoder;
+    HpackHeaderList headers;
+    ASSERT_TRUE(decoder.Decode(block.data(), block.length(), headers));
+    ASSERT_EQ(headers.size(), 3u);
+    EXPECT_EQ(headers[0].second, "200");
+    EXPECT_EQ(headers[1].first, "content-type");
+    EXPECT_EQ(headers[1].second, "application/json-rpc");
+    EXPECT_EQ(headers[2].second, std::string(300, 'z'));
+
+    std::string encoded;
+    std::string decoded;
+    std::string text = "www.example.com";
+    HuffmanEncode(text, encoded);
+    EXPECT_EQ(encoded, FromHex("f1e3c2e5f23a6ba0ab90f4ff"));
+    EXPECT_EQ(HuffmanEncodedLength(text), encoded.length());
+    ASSERT_TRUE(HuffmanDecode(reinterpret_cast<const unsigned char*>(encoded.data()), encoded.length(), decoded));
+    EXPECT_EQ(decoded, text);
+}
+
+TEST(Http2Frame,Headers)
+{
+    // a header block larger than the frame size continues in CONTINUATION frames
+    WriteStringStream os;
+    std::string block(100, 'b');
+    Http2Frame::WriteHeaders(os, 3, block, true, 64);
+    std::string frames = os.GetString();
+    ASSERT_EQ(frames.length(), 2*Http2Frame::HeaderLength + block.length());
+
+    Http2Frame frame;
+    frame.ParseHeader(frames.data());
+    EXPECT_EQ(frame.length_, 64u);
+    EXPECT_EQ(frame.type_, static_cast<unsigned>(Http2Frame::FRAME_HEADERS));
+    EXPECT_EQ(frame.flags_, static_cast<unsigned>(Http2Frame::FLAG_END_STREAM));
+    EXPECT_EQ(frame.streamId_, 3u);
+    frame.ParseHeader(frames.data() + Http2Frame::HeaderLength + 64);
+    EXPECT_EQ(frame.length_, 36u);
+    EXPECT_EQ(frame.type_, static_cast<unsigned>(Http2Frame::FRAME_CONTINUATION));
+    EXPECT_EQ(frame.flags_, static_cast<unsigned>(Http2Frame::FLAG_END_HEADERS));
+}
+
+TEST(WebSocket,Handshake)
+{
+    // example from RFC 6455
+    const char* inString =  "GET /chat HTTP/1.1\r\n"
+                            "Host: server.example.com\r\n"
+                            "Upgrade: websocket\r\n"
+                            "Connection: Upgrade\r\n"
+                            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                            "Sec-WebSocket-Protocol: chat, superchat\r\n"
+                            "Sec-WebSocket-Version: 13\r\n"
+                            "\r\n";
+
+    HttpRequest request;
+    bool eof=false;
+    EXPECT_EQ(request.ProcessHeaderData(inString, strlen(inString), eof), HttpHeader::HEADER_COMPLETE);
+    EXPECT_STREQ(request.GetMethod().c_str(), "GET");
+    EXPECT_STREQ(request.GetUpgrade().c_str(), "websocket");
+    EXPECT_TRUE(request.GetConnectionUpgrade());
+    EXPECT_STREQ(request.GetWebSocketProtocol().c_str(), "chat, superchat");
+    EXPECT_STREQ(request.GetWebSocketVersion().c_str(), "13");
+    EXPECT_STREQ(WebSocketAccept(request.GetWebSocketKey()).c_str(), "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+
+    // the response has no body
+    const char* outString = "HTTP/1.1 101 Switching Protocols\r\n"
+                            "Upgrade: websocket\r\n"
+                            "Connection: Upgrade\r\n"
+                            "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"
+                            "\r\n";
+    HttpResponse response;
+    EXPECT_EQ(response.ProcessHeaderData(outString, strlen(outString), eof), HttpHeader::HEADER_COMPLETE);
+    EXPECT_STREQ(response.GetResponseCode().c_str(), "101");
+    EXPECT_STREQ(response.GetWebSocketAccept().c_str(), "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+}
+
+TEST(WebSocket,Sha1)
+{
+    unsigned char digest[20];
+    Sha1("abc", 3, digest);
+    EXPECT_EQ(std::string(reinterpret_cast<char*>(digest), sizeof(digest)), FromHex("a9993e364706816aba3e25717850c26c9cd0d89d"));
+    // the padding of the message takes another block
+    const char* message = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    Sha1(message, strlen(message), digest);
+    EXPECT_EQ(std::string(reinterpret_cast<char*>(digest), sizeof(digest)), FromHex("84983e441c3bd26ebaae4aa1f95129e5e54670f1"));
+}
+
+TEST(WebSocket,Frames)
+{
+    // masked text message from RFC 6455
+    std::string frames = FromHex("818537fa213d7f9f4d5158");
+    WebSocketFrame frame;
+    EXPECT_EQ(frame.ParseHeader(frames.data(), 5), WebSocketFrame::FRAME_INCOMPLETE);
+    ASSERT_EQ(frame.ParseHeader(frames.data(), frames.length()), WebSocketFrame::FRAME_COMPLETE);
+    EXPECT_TRUE(frame.fin_);
+    EXPECT_EQ(frame.opcode_, static_cast<unsigned>(WebSocketFrame::OPCODE_TEXT));
+    EXPECT_TRUE(frame.masked_);
+    EXPECT_EQ(frame.length_, 5u);
+    EXPECT_EQ(frame.headerLength_, 6u);
+    WebSocketFrame::Mask(&frames[frame.headerLength_], 5, frame.mask_);
+    EXPECT_EQ(frames.substr(frame.headerLength_), "Hello");
+
+    // the lengths that need 16 and 64 bits
+    std::size_t lengths[2] = { 256, 65536 };
+    std::size_t headerLengths[2] = { 4, 10 };
+    for (int i=0; i<2; i++)
+    {
+        WriteStringStream os;
+        WebSocketFrame::WriteHeader(os, WebSocketFrame::OPCODE_BINARY, false, lengths[i]);
+        ASSERT_EQ(frame.ParseHeader(os.GetString().data(), os.GetString().length()), WebSocketFrame::FRAME_COMPLETE);
+        EXPECT_FALSE(frame.fin_);
+        EXPECT_FALSE(frame.masked_);
+        EXPECT_EQ(frame.opcode_, static_cast<unsigned>(WebSocketFrame::OPCODE_BINARY));
+        EXPECT_EQ(frame.length_, lengths[i]);
+        EXPECT_EQ(frame.headerLength_, headerLengths[i]);
+    }
+
+    // a 64 bit length can't have the most significant bit set
+    std::string huge = FromHex("817f8000000000000001");
+    EXPECT_EQ(frame.ParseHeader(huge.data(), huge.length()), WebSocketFrame::FRAME_FAULT);
+    huge = FromHex("817f7fffffffffffffff");
+    EXPECT_EQ(frame.ParseHeader(huge.data(), huge.length()), WebSocketFrame::FRAME_COMPLETE);
+}
@@ -217,3 +217,21 @@ TEST(Json,ParseError4)
     char inString[] = "7.423e";
     EXPECT_EQ(CheckParseError(inString), AnyRpcErrorNumberMissExponent);
 }
+
+TEST(Json,MethodName)
+{
+    std::string methodName;
+    const char* request = "{\"jsonrpc\":\"2.0\", \"method\" : \"subtract\", \"params\":[42,23], \"id\":1}";
+    EXPECT_TRUE(JsonRpcMethodName(request, strlen(request), methodName));
+    EXPECT_EQ(methodName, "subtract");
+
+    // a batch uses the first call
+    request = "[{\"jsonrpc\":\"2.0\",\"method\":\"sum\",\"params\":[1,2],\"id\":1},{\"jsonrpc\":\"2.0\",\"method\":\"get\",\"id\":2}]";
+    EXPECT_TRUE(JsonRpcMethodName(request, strlen(request), methodName));
+    EXPECT_EQ(methodName, "sum");
+
+    request = "{\"jsonrpc\":\"2.0\",\"params\":[42,23],\"id\":1}";
+    EXPECT_FALSE(JsonRpcMethodName(request, strlen(request), methodName));
+    request = "{\"jsonrpc\":\"2.0\",\"method\":\"subtr";
+    EXPECT_FALSE(JsonRpcMethodName(request, strlen(request), methodName));
+}
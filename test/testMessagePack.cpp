@@ -166,3 +166,28 @@ TEST(MessagePack,Binary)
     EXPECT_TRUE(outValue.IsBinary());
     EXPECT_EQ( strncmp((char*)outValue.GetBinary(), (char*)value.GetBinary(), 8), 0);
 }
+
+TEST(MessagePack,MethodName)
+{
+    std::string methodName;
+    // [0, 1, "add", [5, 6]]
+    const char request[] = "\x94\x00\x01\xa3" "add" "\x92\x05\x06";
+    EXPECT_TRUE(MessagePackRpcMethodName(request, sizeof(request) - 1, methodName));
+    EXPECT_EQ(methodName, "add");
+
+    // [0, 300, "subtract", []] with a two byte id
+    const char request2[] = "\x94\x00\xcd\x01\x2c\xa8" "subtract" "\x90";
+    EXPECT_TRUE(MessagePackRpcMethodName(request2, sizeof(request2) - 1, methodName));
+    EXPECT_EQ(methodName, "subtract");
+
+    // notification [2, "log", []]
+    const char notification[] = "\x93\x02\xa3" "log" "\x90";
+    EXPECT_TRUE(MessagePackRpcMethodName(notification, sizeof(notification) - 1, methodName));
+    EXPECT_EQ(methodName, "log");
+
+    // truncated name
+    EXPECT_FALSE(MessagePackRpcMethodName(request, 5, methodName));
+    // response [1, 1, nil, 11]
+    const char response[] = "\x94\x01\x01\xc0\x0b";
+    EXPECT_FALSE(MessagePackRpcMethodName(response, sizeof(response) - 1, methodName));
+}
@@ -41,6 +41,73 @@ public:
     }
 };
 
+#if defined(ANYRPC_THREADING)
+static void RespondLater(Value params, MethodResponder* responder)
+{
+    if (params[0].GetInt() < 0)
+        responder->Fault(AnyRpcErrorApplicationError, "Negative delay");
+    else
+    {
+        MilliSleep(params[0].GetInt());
+        responder->Respond(params[0]);
+    }
+}
+
+static void AsyncDelay(Value& params, MethodResponder* responder)
+{
+    if (!params.IsArray() || (params.Size() != 1) || !params[0].IsInt())
+        throw AnyRpcException(AnyRpcErrorInvalidParams, "Invalid parameters");
+    // the params are only valid during the call so the thread gets a copy
+    std::thread(&RespondLater, params, responder).detach();
+}
+
+static void NullEncoder(Value& /* id */, Value* /* result */, int /* errorCode */, std::string const& /* errorMsg */, Stream& /* response */)
+{
+}
+
+//! Responder that keeps the result for the test to check
+class KeepResponder : public MethodResponder
+{
+public:
+    virtual void Respond(Value& result) { result_.Assign(result); }
+    virtual void Fault(int errorCode, std::string const& /* errorMsg */) { result_ = errorCode; }
+
+    Value result_;
+};
+
+//! Deferral that gives the method a KeepResponder instead of writing a response
+class TestDeferral : public CallDeferral
+{
+public:
+    KeepResponder responder_;
+
+protected:
+    virtual MethodResponder* CreateResponder(RpcResponseEncoder* /* encoder */, Value& /* id */) { return &responder_; }
+};
+
+//! Streamed result that records the elements as text
+class TextStreamedResult : public StreamedResult
+{
+public:
+    std::string text_;
+
+protected:
+    virtual void EncodeStart() { text_ += "["; }
+    virtual void EncodeElement(Value& element, std::size_t index) { text_ += (index > 0 ? "," : "") + std::to_string(element.GetInt()); }
+    virtual void EncodeEnd(std::size_t count) { text_ += "]" + std::to_string(count); }
+};
+#endif // defined(ANYRPC_THREADING)
+
+static void Count(Value& params, ResultWriter& writer)
+{
+    for (int i = 0; i < params[0].GetInt(); i++)
+    {
+        Value element;
+        element = i;
+        writer.Write(element);
+    }
+}
+
 TEST(MethodMap,General)
 {
     Multiply multiply;
@@ -79,3 +146,96 @@ TEST(MethodMap,General)
     methodManager.ExecuteMethod(METHOD_HELP,params,result);
     EXPECT_STREQ(result.GetString(),"Add two numbers");
 }
+
+#if defined(ANYRPC_THREADING)
+TEST(MethodMap,Async)
+{
+    MethodManager methodManager;
+    methodManager.AddAsyncFunction( &AsyncDelay, "delay", "Respond from another thread after a delay");
+
+    // without a deferral the call waits for the response
+    Value params;
+    Value result;
+    params.SetArray();
+    params[0] = 20;
+    EXPECT_TRUE(methodManager.ExecuteMethod("delay",params,result));
+    EXPECT_EQ(result.GetInt(), 20);
+
+    // a fault from the responder or from the method itself is thrown
+    params.SetArray();
+    params[0] = -1;
+    EXPECT_THROW(methodManager.ExecuteMethod("delay",params,result), AnyRpcException);
+    params.SetArray();
+    params[0] = "abc";
+    EXPECT_THROW(methodManager.ExecuteMethod("delay",params,result), AnyRpcException);
+
+    {
+        TestDeferral deferral;
+        EXPECT_EQ(CallDeferral::Current(), &deferral);
+        Value id;
+        id = 1;
+
+        // a call that wasn't described by the handler still waits
+        std::string otherName = "other";
+        deferral.SetCall(&NullEncoder, id, otherName);
+        params.SetArray();
+        params[0] = 0;
+        EXPECT_TRUE(methodManager.ExecuteMethod("delay",params,result));
+        EXPECT_FALSE(deferral.IsDeferred());
+
+        // the described call returns right away and responds later
+        std::string methodName = "delay";
+        deferral.SetCall(&NullEncoder, id, methodName);
+        params.SetArray();
+        params[0] = 50;
+        EXPECT_TRUE(methodManager.ExecuteMethod("delay",params,result));
+        EXPECT_TRUE(deferral.IsDeferred());
+        EXPECT_TRUE(deferral.responder_.result_.IsInvalid());
+        MilliSleep(200);
+        EXPECT_EQ(deferral.responder_.result_.GetInt(), 50);
+    }
+    EXPECT_TRUE(CallDeferral::Current() == 0);
+}
+#endif // defined(ANYRPC_THREADING)
+
+TEST(MethodMap,Stream)
+{
+    MethodManager methodManager;
+    methodManager.AddStreamFunction( &Count, "count", "Write the numbers up to the count");
+
+    // without a deferral the elements are collected into the result
+    Value params;
+    Value result;
+    params.SetArray();
+    params[0] = 3;
+    EXPECT_TRUE(methodManager.ExecuteMethod("count",params,result));
+    ASSERT_TRUE(result.IsArray());
+    ASSERT_EQ(result.Size(), 3u);
+    EXPECT_EQ(result[2].GetInt(), 2);
+    params.SetArray();
+    params[0] = 0;
+    EXPECT_TRUE(methodManager.ExecuteMethod("count",params,result));
+    EXPECT_TRUE(result.IsArray() && (result.Size() == 0));
+
+#if defined(ANYRPC_THREADING)
+    {
+        TestDeferral deferral;
+        TextStreamedResult streamedResult;
+        Value id;
+        id = 1;
+
+        // the described call writes its elements to the handler's encoder
+        std::string methodName = "count";
+        deferral.SetCall(&NullEncoder, id, methodName, &streamedResult);
+        params.SetArray();
+        params[0] = 3;
+        result.SetNull();
+        EXPECT_TRUE(methodManager.ExecuteMethod("count",params,result));
+        EXPECT_TRUE(deferral.IsStreamed());
+        EXPECT_TRUE(result.IsNull());
+        streamedResult.Finish();
+        EXPECT_TRUE(streamedResult.IsFinished());
+        EXPECT_EQ(streamedResult.text_, "[0,1,2]3");
+    }
+#endif // defined(ANYRPC_THREADING)
+}
@@ -0,0 +1,774 @@
+// Copyright (C) 2015 SRG Technology, LLC
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "anyrpc/anyrpc.h"
+#include "anyrpc/internal/poller.h"
+#include "anyrpc/internal/wakeup.h"
+#include "anyrpc/internal/completionqueue.h"
+#include "anyrpc/internal/workerpool.h"
+#include "anyrpc/internal/lrulist.h"
+#include "anyrpc/internal/timerwheel.h"
+#include "anyrpc/internal/zerocopyreaper.h"
+#include "anyrpc/internal/time.h"
+#include "anyrpc/internal/shmring.h"
+
+#include <gtest/gtest.h>
+#if defined(ANYRPC_THREADING)
+# include <thread>
+#endif // defined(ANYRPC_THREADING)
+#if !defined(WIN32)
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <unistd.h>
+#endif // !defined(WIN32)
+#if defined(ANYRPC_SHARED_MEMORY)
+# include <sys/mman.h>
+#endif // defined(ANYRPC_SHARED_MEMORY)
+
+using namespace std;
+using namespace anyrpc;
+using namespace anyrpc::internal;
+
+#if !defined(WIN32)
+
+static void TestPoller(Poller::PollerType type)
+{
+    Poller* poller = Poller::Create(type);
+    ASSERT_TRUE(poller != 0);
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    int data;
+
+    // Nothing to read yet
+    EXPECT_TRUE(poller->Add(fds[0], Poller::EVENT_READ, &data));
+    EXPECT_FALSE(poller->Add(fds[0], Poller::EVENT_READ, &data));
+    EXPECT_EQ(poller->Wait(10), 0);
+
+    // Readable after the peer writes
+    char buffer = 'a';
+    ASSERT_EQ(write(fds[1], &buffer, 1), 1);
+    ASSERT_EQ(poller->Wait(1000), 1);
+    EXPECT_TRUE((poller->GetEvents(0) & Poller::EVENT_READ) != 0);
+    EXPECT_EQ(poller->GetData(0), &data);
+
+    // Still readable since the data was not read
+    ASSERT_EQ(poller->Wait(1000), 1);
+    EXPECT_TRUE((poller->GetEvents(0) & Poller::EVENT_READ) != 0);
+    ASSERT_EQ(read(fds[0], &buffer, 1), 1);
+    EXPECT_EQ(poller->Wait(10), 0);
+
+    // Change the interest to writability
+    EXPECT_TRUE(poller->Modify(fds[0], Poller::EVENT_WRITE, &fds[0]));
+    ASSERT_EQ(poller->Wait(1000), 1);
+    EXPECT_TRUE((poller->GetEvents(0) & Poller::EVENT_WRITE) != 0);
+    EXPECT_EQ(poller->GetData(0), &fds[0]);
+
+    // No events after the socket is removed
+    EXPECT_TRUE(poller->Remove(fds[0]));
+    EXPECT_FALSE(poller->Modify(fds[0], Poller::EVENT_WRITE, &data));
+    EXPECT_EQ(poller->Wait(10), 0);
+
+    // Hangup is reported when the peer closes
+    EXPECT_TRUE(poller->Add(fds[0], Poller::EVENT_READ, &data));
+    close(fds[1]);
+    ASSERT_EQ(poller->Wait(1000), 1);
+    EXPECT_EQ(poller->GetData(0), &data);
+
+    EXPECT_TRUE(poller->Remove(fds[0]));
+    close(fds[0]);
+    delete poller;
+}
+
+TEST(Poller,Select)
+{
+    TestPoller(Poller::POLLER_SELECT);
+}
+
+TEST(Poller,Default)
+{
+    TestPoller(Poller::POLLER_DEFAULT);
+}
+
+TEST(Poller,Uring)
+{
+    // Falls back to epoll if io_uring is not available
+    TestPoller(Poller::POLLER_URING);
+}
+
+TEST(Poller,Wakeup)
+{
+    Poller* poller = Poller::Create();
+    Wakeup wakeup;
+    ASSERT_TRUE(wakeup.Create());
+    EXPECT_TRUE(poller->Add(wakeup.GetFileDescriptor(), Poller::EVENT_READ, &wakeup));
+    EXPECT_EQ(poller->Wait(10), 0);
+
+    // Multiple signals only produce one event
+    wakeup.Signal();
+    wakeup.Signal();
+    ASSERT_EQ(poller->Wait(1000), 1);
+    EXPECT_EQ(poller->GetData(0), &wakeup);
+    wakeup.Drain();
+    EXPECT_EQ(poller->Wait(10), 0);
+
+    EXPECT_TRUE(poller->Remove(wakeup.GetFileDescriptor()));
+    delete poller;
+}
+
+#endif // !defined(WIN32)
+
+struct CompletionItem
+{
+    CompletionItem() : value_(0), next_(0) {}
+    CompletionItem* GetNextCompleted() { return next_; }
+    void SetNextCompleted(CompletionItem* next) { next_ = next; }
+
+    int value_;
+    CompletionItem* next_;
+};
+
+TEST(CompletionQueue,Order)
+{
+    CompletionQueue<CompletionItem> queue;
+    CompletionItem items[3];
+
+    EXPECT_TRUE(queue.Empty());
+    EXPECT_TRUE(queue.PopAll() == 0);
+    for (int i=0; i<3; i++)
+    {
+        items[i].value_ = i;
+        EXPECT_EQ(queue.Push(&items[i]), i == 0);
+    }
+    EXPECT_FALSE(queue.Empty());
+
+    // Items are returned in the order they were pushed
+    CompletionItem* item = queue.PopAll();
+    for (int i=0; i<3; i++)
+    {
+        ASSERT_TRUE(item != 0);
+        EXPECT_EQ(item->value_, i);
+        item = item->GetNextCompleted();
+    }
+    EXPECT_TRUE(item == 0);
+    EXPECT_TRUE(queue.Empty());
+}
+
+struct ListItem
+{
+    ListItem() : prev_(0), next_(0) {}
+    ListItem* GetPrevListed() { return prev_; }
+    void SetPrevListed(ListItem* prev) { prev_ = prev; }
+    ListItem* GetNextListed() { return next_; }
+    void SetNextListed(ListItem* next) { next_ = next; }
+
+    ListItem* prev_;
+    ListItem* next_;
+};
+
+static void ExpectListOrder(LruList<ListItem>& list, ListItem* expected[], std::size_t count)
+{
+    EXPECT_EQ(list.Size(), count);
+    ListItem* item = list.Front();
+    for (std::size_t i=0; i<count; i++)
+    {
+        ASSERT_TRUE(item != 0);
+        EXPECT_EQ(item, expected[i]);
+        item = LruList<ListItem>::Next(item);
+    }
+    EXPECT_TRUE(item == 0);
+}
+
+TEST(LruList,Order)
+{
+    LruList<ListItem> list;
+    ListItem items[4];
+
+    EXPECT_TRUE(list.Empty());
+    EXPECT_TRUE(list.Front() == 0);
+    for (int i=0; i<4; i++)
+        list.PushBack(&items[i]);
+    ListItem* added[] = { &items[0], &items[1], &items[2], &items[3] };
+    ExpectListOrder(list, added, 4);
+
+    // Using an item moves it to the back so the front is the least recently used
+    list.Touch(&items[0]);
+    list.Touch(&items[2]);
+    list.Touch(&items[2]);
+    ListItem* touched[] = { &items[1], &items[3], &items[0], &items[2] };
+    ExpectListOrder(list, touched, 4);
+
+    // Remove from the front, middle, and back
+    list.Remove(&items[1]);
+    list.Remove(&items[0]);
+    list.Remove(&items[2]);
+    ListItem* removed[] = { &items[3] };
+    ExpectListOrder(list, removed, 1);
+    list.Remove(&items[3]);
+    EXPECT_TRUE(list.Empty());
+    EXPECT_TRUE(list.Front() == 0);
+}
+
+TEST(TimerWheel,Expire)
+{
+    TimerWheel wheel;
+    // delays that fall in each level of the wheel and beyond the top level
+    const unsigned delays[] = { 0, 1, 63, 64, 100, 4095, 4096, 300000, 20000000 };
+    const int numTimers = sizeof(delays)/sizeof(delays[0]);
+    TimerEntry timers[numTimers];
+    const int64_t start = 1000;
+
+    EXPECT_EQ(wheel.GetTimeout(start), -1);
+    for (int i=0; i<numTimers; i++)
+    {
+        timers[i].data_ = &timers[i];
+        wheel.Schedule(&timers[i], start, delays[i]);
+        EXPECT_TRUE(timers[i].IsScheduled());
+    }
+    EXPECT_EQ(wheel.Size(), static_cast<std::size_t>(numTimers));
+    EXPECT_EQ(wheel.GetTimeout(start), 0);
+
+    // each timer expires at its time and not before
+    for (int i=0; i<numTimers; i++)
+    {
+        int64_t expiry = start + delays[i];
+        if (expiry > start)
+            EXPECT_TRUE(wheel.Expire(expiry - 1) == 0);
+        EXPECT_TRUE(wheel.GetTimeout(expiry - 1) <= 1);
+        TimerEntry* timer = wheel.Expire(expiry);
+        ASSERT_TRUE(timer == &timers[i]);
+        EXPECT_FALSE(timer->IsScheduled());
+    }
+    EXPECT_EQ(wheel.Size(), 0u);
+    EXPECT_EQ(wheel.GetTimeout(start), -1);
+}
+
+TEST(TimerWheel,Cancel)
+{
+    TimerWheel wheel;
+    TimerEntry timers[3];
+
+    wheel.Schedule(&timers[0], 0, 10);
+    wheel.Schedule(&timers[1], 0, 10);
+    wheel.Schedule(&timers[2], 0, 5000);
+    wheel.Cancel(&timers[0]);
+    wheel.Cancel(&timers[0]);
+    EXPECT_FALSE(timers[0].IsScheduled());
+    EXPECT_EQ(wheel.Size(), 2u);
+    EXPECT_EQ(wheel.GetTimeout(0), 10);
+
+    // rescheduling moves the timer
+    wheel.Schedule(&timers[2], 0, 20);
+    EXPECT_TRUE(wheel.Expire(30) == &timers[1]);
+    EXPECT_TRUE(wheel.Expire(30) == &timers[2]);
+    EXPECT_TRUE(wheel.Expire(30) == 0);
+}
+
+#if defined(ANYRPC_THREADING)
+TEST(CompletionQueue,MultipleProducers)
+{
+    const int numThreads = 4;
+    const int numItems = 10000;
+    CompletionQueue<CompletionItem> queue;
+    std::vector<CompletionItem> items(numThreads * numItems);
+    std::vector<std::thread> threads;
+
+    for (int t=0; t<numThreads; t++)
+        threads.emplace_back([&queue, &items, t, numItems]()
+        {
+            for (int i=0; i<numItems; i++)
+            {
+                CompletionItem* item = &items[t*numItems + i];
+                item->value_ = i;
+                queue.Push(item);
+            }
+        });
+
+    // Consume concurrently and check that each producer's items arrive in order
+    std::vector<int> expected(numThreads, 0);
+    int count = 0;
+    while (count < numThreads * numItems)
+    {
+        for (CompletionItem* item = queue.PopAll(); item != 0; item = item->GetNextCompleted())
+        {
+            int t = static_cast<int>((item - &items[0]) / numItems);
+            EXPECT_EQ(item->value_, expected[t]++);
+            count++;
+        }
+    }
+    for (std::size_t t=0; t<threads.size(); t++)
+        threads[t].join();
+    EXPECT_TRUE(queue.PopAll() == 0);
+}
+
+TEST(TaskQueue,Bounded)
+{
+    TaskQueue queue(4);
+    int values[5];
+    Task task;
+
+    EXPECT_TRUE(queue.Empty());
+    EXPECT_FALSE(queue.Pop(task));
+    for (int i=0; i<4; i++)
+        EXPECT_TRUE(queue.Push(Task(0, &values[i], 0)));
+    EXPECT_FALSE(queue.Push(Task(0, &values[4], 0)));
+
+    // Tasks are returned in order and the space is reused
+    for (int lap=0; lap<2; lap++)
+    {
+        for (int i=0; i<4; i++)
+        {
+            ASSERT_TRUE(queue.Pop(task));
+            EXPECT_EQ(task.context_, &values[i]);
+        }
+        EXPECT_TRUE(queue.Empty());
+        for (int i=0; i<4; i++)
+            EXPECT_TRUE(queue.Push(Task(0, &values[i], 0)));
+    }
+}
+
+TEST(TaskDeque,OwnerAndThief)
+{
+    TaskDeque deque;
+    int values[3];
+    Task task;
+
+    EXPECT_FALSE(deque.Pop(task));
+    EXPECT_FALSE(deque.Steal(task));
+    for (int i=0; i<3; i++)
+        EXPECT_TRUE(deque.Push(Task(0, &values[i], 0)));
+
+    // The owner takes the newest task and a thief takes the oldest
+    ASSERT_TRUE(deque.Pop(task));
+    EXPECT_EQ(task.context_, &values[2]);
+    ASSERT_TRUE(deque.Steal(task));
+    EXPECT_EQ(task.context_, &values[0]);
+    ASSERT_TRUE(deque.Pop(task));
+    EXPECT_EQ(task.context_, &values[1]);
+    EXPECT_TRUE(deque.Empty());
+}
+
+struct PoolCounter
+{
+    WorkerPool* pool_;
+    std::atomic<int> count_;
+};
+
+static void CountTask(void* context, void* argument)
+{
+    PoolCounter* counter = static_cast<PoolCounter*>(context);
+    // the first level of tasks submit more tasks from the worker threads
+    if (argument != 0)
+        for (int i=0; i<10; i++)
+            counter->pool_->Submit(&CountTask, counter, 0);
+    counter->count_++;
+}
+
+TEST(WorkerPool,Execute)
+{
+    const int numTasks = 10000;
+    WorkerPool pool;
+    PoolCounter counter;
+    counter.pool_ = &pool;
+    counter.count_ = 0;
+
+    pool.Start(4);
+    EXPECT_EQ(pool.GetNumThreads(), 4u);
+    for (int i=0; i<numTasks; i++)
+        pool.Submit(&CountTask, &counter, (i % 10 == 0) ? &counter : 0);
+
+    // Each tenth task adds ten more
+    const int expected = numTasks + numTasks;
+    for (int i=0; (i<1000) && (counter.count_ < expected); i++)
+        MilliSleep(10);
+    EXPECT_EQ(counter.count_, expected);
+    pool.Stop();
+    EXPECT_EQ(pool.GetNumThreads(), 0u);
+
+    // Restart after the workers have parked
+    pool.Start(2);
+    MilliSleep(50);
+    pool.Submit(&CountTask, &counter, 0);
+    for (int i=0; (i<1000) && (counter.count_ < expected + 1); i++)
+        MilliSleep(10);
+    EXPECT_EQ(counter.count_, expected + 1);
+}
+#endif // defined(ANYRPC_THREADING)
+
+#if defined(ANYRPC_SHARED_MEMORY)
+TEST(ShmRing,WrapAround)
+{
+    ShmChannel client;
+    ASSERT_TRUE(client.Create(4000));
+    ShmChannel server;
+    ASSERT_TRUE(server.Attach(dup(client.GetFileDescriptor())));
+    client.CloseFileDescriptor();
+
+    ShmRing& producer = client.GetRequestRing();
+    ShmRing& consumer = server.GetRequestRing();
+    std::vector<char> data(10000);
+    for (size_t i=0; i<data.size(); i++)
+        data[i] = static_cast<char>(i * 7);
+    std::vector<char> received(10000);
+
+    // the capacity is rounded up to 4096 so the second block wraps around the end
+    size_t bytesWritten, bytesRead;
+    EXPECT_FALSE(consumer.IsReadable());
+    EXPECT_TRUE(producer.Write(&data[0], 3000, bytesWritten));
+    EXPECT_EQ(bytesWritten, 3000u);
+    EXPECT_TRUE(consumer.IsReadable());
+    EXPECT_TRUE(consumer.Read(&received[0], 10000, bytesRead));
+    EXPECT_EQ(bytesRead, 3000u);
+    EXPECT_TRUE(producer.Write(&data[3000], 7000, bytesWritten));
+    EXPECT_EQ(bytesWritten, 4096u);
+    EXPECT_FALSE(producer.IsWritable());
+    EXPECT_TRUE(consumer.Read(&received[3000], 7000, bytesRead));
+    EXPECT_EQ(bytesRead, 4096u);
+    EXPECT_TRUE(producer.IsWritable());
+    EXPECT_TRUE(memcmp(&data[0], &received[0], 3000 + 4096) == 0);
+
+    // the wait flags are shared by both sides and the server always wants a wake up for requests
+    EXPECT_TRUE(producer.IsConsumerWaiting());
+    EXPECT_FALSE(client.GetResponseRing().IsConsumerWaiting());
+    client.GetResponseRing().SetConsumerWaiting(true);
+    EXPECT_TRUE(server.GetResponseRing().IsConsumerWaiting());
+}
+
+TEST(ShmRing,Unsealed)
+{
+    // the server only maps memory that the client can't shrink
+    int fd = memfd_create("anyrpc-test", MFD_CLOEXEC);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(ftruncate(fd, 4096 + 2*4096), 0);
+    ShmChannel server;
+    EXPECT_FALSE(server.Attach(fd));
+}
+#endif // defined(ANYRPC_SHARED_MEMORY)
+
+#if !defined(WIN32)
+TEST(TcpSocket,SendGather)
+{
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    int bufferSize = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+    TcpSocket sender;
+    sender.SetFileDescriptor(fds[0]);
+    sender.SetNonBlocking();
+    sender.SetTimeout(0);
+
+    // a large stream in several buffers, and more small blocks than fit in one sendmsg call
+    WriteSegmentedStream body;
+    std::string expected;
+    for (int i=0; i<20000; i++)
+    {
+        std::string number = std::to_string(i) + ",";
+        body.Put(number);
+        expected += number;
+    }
+    std::vector<std::string> small;
+    for (int i=0; i<200; i++)
+        small.push_back(std::to_string(i * 3) + ";");
+    for (size_t i=0; i<small.size(); i++)
+        expected += small[i];
+
+    size_t offset = 0;
+    std::string received;
+    char buffer[8192];
+    int partialWrites = 0;
+    while (offset < expected.length())
+    {
+        // build the list again from the part that has not been sent
+        SendSegmentList segments;
+        AppendSegments(segments, body, std::min(offset, body.Length()));
+        size_t skip = (offset > body.Length()) ? offset - body.Length() : 0;
+        for (size_t i=0; i<small.size(); i++)
+        {
+            size_t length = std::min(skip, small[i].length());
+            skip -= length;
+            if (length < small[i].length())
+                segments.push_back(SendSegment(small[i].c_str() + length, small[i].length() - length));
+        }
+        size_t bytesWritten;
+        if (!sender.SendGather(segments, bytesWritten))
+        {
+            ASSERT_FALSE(sender.FatalError());
+            partialWrites++;
+        }
+        offset += bytesWritten;
+        ssize_t bytesRead;
+        while ((bytesRead = recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+            received.append(buffer, bytesRead);
+    }
+    EXPECT_GT(partialWrites, 0);
+    EXPECT_EQ(received, expected);
+    close(fds[1]);
+}
+#endif // !defined(WIN32)
+
+#if defined(ANYRPC_ZEROCOPY)
+static void ReceiveAvailable(int fd, std::string& received)
+{
+    char buffer[16384];
+    ssize_t bytesRead;
+    while ((bytesRead = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+        received.append(buffer, bytesRead);
+}
+
+//! Connect two sockets over loopback TCP, which zero copy needs
+static void ConnectTcpPair(int& fd, int& peer)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(::bind(listener, (struct sockaddr*)&address, sizeof(address)), 0);
+    ASSERT_EQ(listen(listener, 1), 0);
+    socklen_t length = sizeof(address);
+    ASSERT_EQ(getsockname(listener, (struct sockaddr*)&address, &length), 0);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_EQ(connect(fd, (struct sockaddr*)&address, sizeof(address)), 0);
+    peer = accept(listener, 0, 0);
+    ASSERT_GE(peer, 0);
+    close(listener);
+}
+
+TEST(TcpSocket,ZeroCopy)
+{
+    int fd, peer;
+    ConnectTcpPair(fd, peer);
+
+    TcpSocket sender;
+    sender.SetFileDescriptor(fd);
+    sender.SetNonBlocking();
+    sender.SetTimeout(0);
+    ASSERT_EQ(sender.SetZeroCopy(), 0);
+
+    // a copied block followed by blocks that the socket frees once the kernel is done with them
+    std::vector<void*> buffers;
+    SendSegmentList segments;
+    segments.push_back(SendSegment("header", 6));
+    std::string expected = "header";
+    for (int i=0; i<4; i++)
+    {
+        char* buffer = static_cast<char*>(malloc(64*1024));
+        memset(buffer, 'a' + i, 64*1024);
+        buffers.push_back(buffer);
+        segments.push_back(SendSegment(buffer, 64*1024, true));
+        expected.append(buffer, 64*1024);
+    }
+
+    size_t offset = 0;
+    std::string received;
+    while (offset < expected.length())
+    {
+        SendSegmentList remaining;
+        size_t skip = offset;
+        for (size_t i=0; i<segments.size(); i++)
+        {
+            if (skip >= segments[i].length_)
+                skip -= segments[i].length_;
+            else
+            {
+                remaining.push_back(SendSegment(segments[i].data_ + skip, segments[i].length_ - skip, segments[i].zeroCopy_));
+                skip = 0;
+            }
+        }
+        size_t bytesWritten;
+        if (!sender.SendGather(remaining, bytesWritten))
+            ASSERT_FALSE(sender.FatalError());
+        offset += bytesWritten;
+        ReceiveAvailable(peer, received);
+    }
+    EXPECT_TRUE(sender.IsZeroCopyPending());
+    sender.HoldZeroCopy(buffers);
+    EXPECT_TRUE(buffers.empty());
+
+    // the completions arrive on the error queue once the data has been acknowledged
+    for (int i=0; (i<200) && sender.IsZeroCopyPending(); i++)
+    {
+        ReceiveAvailable(peer, received);
+        MilliSleep(10);
+        sender.ReapZeroCopy();
+    }
+    EXPECT_FALSE(sender.IsZeroCopyPending());
+    ReceiveAvailable(peer, received);
+    EXPECT_EQ(received, expected);
+    close(peer);
+}
+
+//! Send a block with zero copy on a new socket and give it to the reaper, returning what was sent
+static void SendToReaper(ZeroCopyReaper& reaper, int& peer, std::string& expected)
+{
+    int fd;
+    ConnectTcpPair(fd, peer);
+
+    TcpSocket sender;
+    sender.SetFileDescriptor(fd);
+    sender.SetNonBlocking();
+    sender.SetTimeout(0);
+    ASSERT_EQ(sender.SetZeroCopy(), 0);
+
+    std::vector<void*> buffers;
+    char* buffer = static_cast<char*>(malloc(64*1024));
+    memset(buffer, 'z', 64*1024);
+    buffers.push_back(buffer);
+    SendSegmentList segments;
+    segments.push_back(SendSegment(buffer, 64*1024, true));
+    size_t bytesWritten;
+    sender.SendGather(segments, bytesWritten);
+    ASSERT_GT(bytesWritten, 0u);
+    expected.assign(buffer, bytesWritten);
+    sender.HoldZeroCopy(buffers);
+
+    // the peer hasn't read the data so the kernel still has the buffer
+    EXPECT_TRUE(reaper.Add(sender, MonotonicMicroTime() / 1000));
+    EXPECT_EQ(sender.GetFileDescriptor(), static_cast<SOCKET>(-1));
+    EXPECT_FALSE(sender.IsZeroCopyPending());
+    EXPECT_EQ(reaper.Size(), 1u);
+}
+
+//! Read from the socket until it is closed, returning 0 or the error
+static int ReceiveUntilClosed(int fd, std::string& received)
+{
+    char buffer[16384];
+    for (int i=0; i<200; i++)
+    {
+        ssize_t bytesRead = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (bytesRead > 0)
+            received.append(buffer, bytesRead);
+        else if (bytesRead == 0)
+            return 0;
+        else if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+            return errno;
+        else
+            MilliSleep(10);
+    }
+    return -1;
+}
+
+TEST(ZeroCopyReaper,Complete)
+{
+    ZeroCopyReaper reaper;
+    int peer;
+    std::string expected;
+    SendToReaper(reaper, peer, expected);
+
+    // the socket is closed normally once the peer has taken the data
+    std::string received;
+    ReceiveAvailable(peer, received);
+    for (int i=0; (i<200) && (reaper.Size() > 0); i++)
+    {
+        int timeout = reaper.GetTimeout(MonotonicMicroTime() / 1000);
+        EXPECT_GE(timeout, 0);
+        MilliSleep(timeout);
+        reaper.Reap(MonotonicMicroTime() / 1000);
+    }
+    EXPECT_EQ(reaper.Size(), 0u);
+    EXPECT_EQ(reaper.GetTimeout(MonotonicMicroTime() / 1000), -1);
+    EXPECT_EQ(ReceiveUntilClosed(peer, received), 0);
+    EXPECT_EQ(received, expected);
+    close(peer);
+}
+
+TEST(ZeroCopyReaper,Deadline)
+{
+    ZeroCopyReaper reaper;
+    int peer;
+    std::string expected;
+    SendToReaper(reaper, peer, expected);
+
+    // the peer never reads so the socket is reset at the deadline
+    reaper.Reap(MonotonicMicroTime() / 1000 + ZeroCopyReaper::Deadline + 1);
+    EXPECT_EQ(reaper.Size(), 0u);
+    std::string received;
+    EXPECT_EQ(ReceiveUntilClosed(peer, received), ECONNRESET);
+    close(peer);
+}
+#endif // defined(ANYRPC_ZEROCOPY)
+
+#if defined(ANYRPC_URING)
+TEST(TcpSocket,Uring)
+{
+    UringPoller poller;
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    TcpSocket socket;
+    socket.SetFileDescriptor(fds[0]);
+    socket.SetNonBlocking();
+    if (!poller.IsValid() || !poller.Attach(socket, false))
+    {
+        // the kernel doesn't support the ring or the provided buffers
+        close(fds[1]);
+        return;
+    }
+    int data;
+    ASSERT_TRUE(poller.Add(fds[0], Poller::EVENT_READ, &data));
+    EXPECT_EQ(poller.Wait(20), 0);
+
+    // the request is larger than a ring buffer and is read in smaller pieces
+    std::string request(40000, 'r');
+    ASSERT_EQ(write(fds[1], request.data(), request.length()), static_cast<ssize_t>(request.length()));
+    std::string received;
+    char buffer[4097];
+    size_t bytesRead;
+    bool eof = false;
+    int64_t startTime = MonotonicMicroTime();
+    while ((received.length() < request.length()) && (MonotonicMicroTime() - startTime < 2000000))
+    {
+        if (poller.Wait(100) != 1)
+            continue;
+        EXPECT_EQ(poller.GetData(0), &data);
+        EXPECT_TRUE((poller.GetEvents(0) & Poller::EVENT_READ) != 0);
+        EXPECT_TRUE(socket.Receive(buffer, sizeof(buffer)-1, bytesRead, eof));
+        received.append(buffer, bytesRead);
+    }
+    EXPECT_EQ(received, request);
+
+    // the response is only queued until the poller submits it
+    size_t bytesWritten;
+    EXPECT_TRUE(socket.Send("response", 8, bytesWritten));
+    EXPECT_EQ(bytesWritten, 8u);
+    poller.Submit();
+    char reply[16];
+    ASSERT_EQ(read(fds[1], reply, sizeof(reply)), 8);
+    EXPECT_EQ(std::string(reply, 8), "response");
+
+    // the data sent before the peer closed is returned before the end
+    ASSERT_EQ(write(fds[1], "last", 4), 4);
+    close(fds[1]);
+    received.clear();
+    startTime = MonotonicMicroTime();
+    while (!eof && (MonotonicMicroTime() - startTime < 2000000))
+    {
+        if (poller.Wait(100) != 1)
+            continue;
+        bool result = socket.Receive(buffer, sizeof(buffer)-1, bytesRead, eof);
+        received.append(buffer, bytesRead);
+        EXPECT_EQ(result, !eof);
+    }
+    EXPECT_TRUE(eof);
+    EXPECT_EQ(received, "last");
+    poller.Remove(fds[0]);
+    socket.Close();
+    EXPECT_FALSE(socket.IsUring());
+}
+#endif // defined(ANYRPC_URING)
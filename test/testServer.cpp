@@ -20,8 +20,20 @@
 
 #include "anyrpc/anyrpc.h"
 #include "anyrpc/internal/time.h"
+#include "anyrpc/internal/affinity.h"
 
 #include <gtest/gtest.h>
+#include <set>
+
+#if defined(__linux__)
+# include <pthread.h>  // for pthread_getname_np
+#endif // defined(__linux__)
+#if !defined(WIN32)
+# include <sys/socket.h>   // for setsockopt
+#endif // !defined(WIN32)
+#if defined(ANYRPC_LOCAL_SOCKET)
+# include <unistd.h>   // for access
+#endif // defined(ANYRPC_LOCAL_SOCKET)
 
 using namespace std;
 using namespace anyrpc;
@@ -61,9 +73,81 @@ static void Echo(Value& params, Value& result)
     result = params;
 }
 
-static void ServerSetup(Server& server)
+static void Sleep(Value& params, Value& result)
+{
+    MilliSleep(params[0].GetInt());
+    result = params[0];
+}
+
+static void ThreadId(Value& params, Value& result)
+{
+    // identify the thread executing the method
+    result = std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+}
+
+static void RespondLater(Value params, MethodResponder* responder)
+{
+    MilliSleep(params[0].GetInt());
+    responder->Respond(params[0]);
+}
+
+static void AsyncSleep(Value& params, MethodResponder* responder)
+{
+    // the params are only valid during the call so the thread gets a copy
+    std::thread(&RespondLater, params, responder).detach();
+}
+
+static void FaultLater(MethodResponder* responder)
+{
+    MilliSleep(10);
+    responder->Fault(AnyRpcErrorApplicationError, "Failed later");
+}
+
+static void AsyncFault(Value& params, MethodResponder* responder)
 {
-    server.BindAndListen(ServerPort);
+    // either fail right away or from another thread
+    if (params[0].GetBool())
+        throw AnyRpcException(AnyRpcErrorInvalidParams, "Invalid parameters");
+    std::thread(&FaultLater, responder).detach();
+}
+
+static void Rows(Value& params, ResultWriter& writer)
+{
+    // write the number of rows, failing at a row if one is given
+    int count = params[0].GetInt();
+    int failRow = (params.Size() > 1) ? params[1].GetInt() : -1;
+    for (int i = 0; i < count; i++)
+    {
+        if (i == failRow)
+            throw AnyRpcException(AnyRpcErrorApplicationError, "Failed row");
+        Value row;
+        row["row"] = i;
+        row["name"] = abcString;
+        writer.Write(row);
+    }
+}
+
+#if defined(__linux__)
+static void Placement(Value& params, Value& result)
+{
+    // return the name and allowed CPUs of the thread executing the method
+    char name[16];
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    internal::CpuSet cpus;
+    internal::GetCurrentThreadAffinity(cpus);
+    result.SetArray();
+    result[0] = name;
+    result[1] = static_cast<int>(cpus.size());
+    result[2] = cpus.empty() ? -1 : static_cast<int>(cpus[0]);
+}
+#endif // defined(__linux__)
+
+static void ServerSetup(Server& server, const char* localPath = 0)
+{
+    if (localPath)
+        server.BindAndListenLocal(localPath);
+    else
+        server.BindAndListen(ServerPort);
 
     // Add the method calls
     MethodManager *methodManager = server.GetMethodManager();
@@ -72,14 +156,14 @@ static void ServerSetup(Server& server)
     methodManager->AddFunction( &Echo, "echo", "Return the same data that was sent");
 }
 
-static void TestClient(Client &client)
+static void TestClient(Client &client, const char* host = ServerIpAddress)
 {
     Value params;
     Value result;
     bool success;
 
     MilliSleep(50);
-    client.SetServer(ServerIpAddress, ServerPort);
+    client.SetServer(host, ServerPort);
     client.SetTimeout(2000);
 
     // Add the parameters
@@ -130,7 +214,125 @@ static void TestClient(Client &client)
     }
 }
 
+static void AsyncSetup(Server& server)
+{
+    MethodManager *methodManager = server.GetMethodManager();
+    methodManager->AddAsyncFunction( &AsyncSleep, "asyncSleep", "Respond from another thread after a number of milliseconds");
+    methodManager->AddAsyncFunction( &AsyncFault, "asyncFault", "Respond with a fault");
+}
+
+static void TestAsyncClient(Client &client)
+{
+    Value params;
+    Value result;
+
+    params.SetArray();
+    params[0] = 50;
+    EXPECT_TRUE(client.Call("asyncSleep", params, result));
+    EXPECT_EQ(result.GetInt(), 50);
+
+    params.SetArray();
+    params[0] = false;
+    EXPECT_FALSE(client.Call("asyncFault", params, result));
+    params.SetArray();
+    params[0] = true;
+    EXPECT_FALSE(client.Call("asyncFault", params, result));
+
+    // the connection continues after the faults
+    params.SetArray();
+    params[0] = 0;
+    EXPECT_TRUE(client.Call("asyncSleep", params, result));
+    EXPECT_EQ(result.GetInt(), 0);
+}
+
+static void StreamSetup(Server& server)
+{
+    MethodManager *methodManager = server.GetMethodManager();
+    methodManager->AddStreamFunction( &Rows, "rows", "Write a number of rows");
+}
+
+static void TestStreamClient(Client &client)
+{
+    Value params;
+    Value result;
+    client.SetMaxContentLength(10000000);
+
+    params.SetArray();
+    params[0] = 3;
+    EXPECT_TRUE(client.Call("rows", params, result));
+    ASSERT_TRUE(result.IsArray());
+    ASSERT_EQ(result.Size(), 3u);
+    EXPECT_EQ(result[2]["row"].GetInt(), 2);
+    EXPECT_EQ(result[2]["name"].GetString(), abcString);
+
+    params.SetArray();
+    params[0] = 0;
+    EXPECT_TRUE(client.Call("rows", params, result));
+    EXPECT_TRUE(result.IsArray() && (result.Size() == 0));
+
+    // large enough to be sent in parts over http
+    params.SetArray();
+    params[0] = 10000;
+    EXPECT_TRUE(client.Call("rows", params, result));
+    ASSERT_TRUE(result.IsArray());
+    ASSERT_EQ(result.Size(), 10000u);
+    EXPECT_EQ(result[9999]["row"].GetInt(), 9999);
+
+    // a fault before any of the response is sent
+    params.SetArray();
+    params[0] = 10;
+    params[1] = 5;
+    EXPECT_FALSE(client.Call("rows", params, result));
+
+    // a fault after part of the response may have been sent
+    params.SetArray();
+    params[0] = 10000;
+    params[1] = 9000;
+    EXPECT_FALSE(client.Call("rows", params, result));
+
+    params.SetArray();
+    params[0] = 2;
+    EXPECT_TRUE(client.Call("rows", params, result));
+    EXPECT_TRUE(result.IsArray() && (result.Size() == 2));
+}
+
 #if defined(ANYRPC_INCLUDE_JSON)
+static void SleepCaller(std::string method, int ms)
+{
+    JsonTcpClient client(ServerIpAddress, ServerPort);
+    client.SetTimeout(2000);
+    Value params;
+    Value result;
+    params.SetArray();
+    params[0] = ms;
+    EXPECT_TRUE(client.Call(method.c_str(), params, result));
+}
+
+//! Check that the server keeps executing other calls while a number of asynchronous calls are outstanding
+static void TestAsyncConcurrency(Client &client, int numCalls)
+{
+    Value params;
+    Value result;
+
+    int64_t startTime = MonotonicMicroTime();
+    std::vector<std::thread> callers;
+    for (int i=0; i<numCalls; i++)
+        callers.push_back(std::thread(&SleepCaller, "asyncSleep", 300));
+    MilliSleep(50);
+
+    params.SetArray();
+    params[0] = 1;
+    int64_t echoTime = MonotonicMicroTime();
+    for (int i=0; i<5; i++)
+        EXPECT_TRUE(client.Call("echo", params, result));
+    EXPECT_LT(MonotonicMicroTime() - echoTime, 200000);
+
+    // the slow calls waited together instead of one after another
+    for (int i=0; i<numCalls; i++)
+        callers[i].join();
+    EXPECT_LT(MonotonicMicroTime() - startTime, 300000 * numCalls);
+}
+
 TEST(Server, JsonHttp)
 {
 	log_time(WARN,"JsonHttp");
@@ -157,6 +359,26 @@ TEST(Server, JsonHttpMultiple)
     server.StopThread();
 }
 
+TEST(Server, JsonHttpPooled)
+{
+    log_time(WARN,"JsonHttpPooled");
+    JsonHttpServer server;
+
+    server.SetConnectionPoolSize(2, 2);
+    ServerSetup(server);
+    EXPECT_EQ(server.GetNumPooledConnections(), 2u);
+    server.StartThread();
+    for (int i=0; i<4; i++)
+    {
+        // each client closes so its connection is returned to the pool for the next one
+        JsonHttpClient client;
+        TestClient(client);
+    }
+    MilliSleep(20);
+    server.StopThread();
+    EXPECT_EQ(server.GetNumPooledConnections(), 2u);
+}
+
 TEST(Server, JsonTcp)
 {
 	log_time(WARN, "JsonTcp");
@@ -181,6 +403,26 @@ TEST(Server, JsonHttpMT)
     server.StopThread();
 }
 
+TEST(Server, JsonTcpMTPooled)
+{
+    log_time(WARN,"JsonTcpMTPooled");
+    JsonTcpServerMT server;
+
+    server.SetConnectionPoolSize(1, 1);
+    ServerSetup(server);
+    EXPECT_EQ(server.GetNumPooledConnections(), 1u);
+    server.StartThread();
+    for (int i=0; i<3; i++)
+    {
+        // a stopped thread's connection is recycled as soon as the thread stops and taken again
+        JsonTcpClient client;
+        TestClient(client);
+    }
+    MilliSleep(20);
+    server.StopThread();
+    EXPECT_EQ(server.GetNumPooledConnections(), 1u);
+}
+
 TEST(Server, JsonHttpMTMultiple)
 {
     log_time(WARN,"JsonHttpMTMultiple");
@@ -195,6 +437,66 @@ TEST(Server, JsonHttpMTMultiple)
     server.StopThread();
 }
 
+//! Call add on an open socket to the HTTP server.  Return whether the result arrived.
+static bool RawAddCall(TcpSocket& socket)
+{
+    std::string body = "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"add\",\"params\":[5,6]}";
+    std::string request = "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json-rpc\r\nContent-Length: " +
+                          std::to_string(body.length()) + "\r\n\r\n" + body;
+    size_t bytesWritten;
+    if (!socket.Send(request.c_str(), request.length(), bytesWritten, 1000))
+        return false;
+    std::string response;
+    int64_t startTime = MonotonicMicroTime();
+    while ((response.find("\"result\":11") == std::string::npos) && (MonotonicMicroTime() - startTime < 1000000))
+    {
+        char buffer[1025];
+        size_t bytesRead;
+        bool eof;
+        socket.Receive(buffer, 1024, bytesRead, eof, 50);
+        response.append(buffer, bytesRead);
+        if (eof)
+            return false;
+    }
+    return (response.find("\"result\":11") != std::string::npos);
+}
+
+TEST(Server, JsonHttpMTForcedDisconnect)
+{
+    log_time(WARN,"JsonHttpMTForcedDisconnect");
+    JsonHttpServerMT server;
+    TcpSocket socket[3];
+
+    server.SetMaxConnections(2);
+    ServerSetup(server);
+    server.StartThread();
+
+    // the first connection is used again so the second one is the least recently used
+    ASSERT_EQ(socket[0].Connect(ServerIpAddress, ServerPort), 0);
+    EXPECT_TRUE(RawAddCall(socket[0]));
+    ASSERT_EQ(socket[1].Connect(ServerIpAddress, ServerPort), 0);
+    EXPECT_TRUE(RawAddCall(socket[1]));
+    EXPECT_TRUE(RawAddCall(socket[0]));
+    MilliSleep(20);
+
+    ASSERT_EQ(socket[2].Connect(ServerIpAddress, ServerPort), 0);
+    EXPECT_TRUE(RawAddCall(socket[2]));
+    char buffer[1025];
+    size_t bytesRead;
+    bool eof = false;
+    socket[1].Receive(buffer, 1024, bytesRead, eof, 100);
+    EXPECT_TRUE(eof);
+    EXPECT_TRUE(RawAddCall(socket[0]));
+
+    // the stopped thread is joined without another accept
+    MilliSleep(20);
+    std::list<std::string> ips;
+    std::list<unsigned> ports;
+    server.GetConnectionsPeerInfo(ips, ports);
+    EXPECT_EQ(ips.size(), 2u);
+    server.StopThread();
+}
+
 TEST(Server, JsonTcpMT)
 {
 	log_time(WARN, "JsonTcpMT");
@@ -206,62 +508,217 @@ TEST(Server, JsonTcpMT)
     TestClient(client);
     server.StopThread();
 }
-#endif // defined(ANYRPC_INCLUDE_JSON)
-#if defined(ANYRPC_INCLUDE_XML)
-TEST(Server, XmlHttp)
+
+TEST(Server, JsonHttpMTPool)
 {
-	log_time(WARN, "XmlHttp");
-    XmlHttpServer server;
-    XmlHttpClient client;
+    log_time(WARN, "JsonHttpMTPool");
+    JsonHttpServerMT server;
+    JsonHttpClient client[4];
 
+    server.SetThreadPoolSize(2);
+    server.SetMaxConnections(2);
     ServerSetup(server);
     server.StartThread();
-    TestClient(client);
+    for (int i=0; i<4; i++)
+        TestClient(client[i]);
     server.StopThread();
 }
 
-TEST(Server, XmlTcp)
+TEST(Server, JsonTcpMTPool)
 {
-	log_time(WARN, "XmlTcp");
-    XmlTcpServer server;
-    XmlTcpClient client;
+    log_time(WARN, "JsonTcpMTPool");
+    JsonTcpServerMT server;
+    JsonTcpClient client;
 
+    server.SetThreadPoolSize(2);
     ServerSetup(server);
     server.StartThread();
     TestClient(client);
     server.StopThread();
 }
 
-TEST(Server, XmlHttpMT)
+TEST(Server, JsonHttpTimeout)
 {
-	log_time(WARN, "XmlHttpMT");
-    XmlHttpServerMT server;
-    XmlHttpClient client;
+    log_time(WARN, "JsonHttpTimeout");
+    JsonHttpServer server;
+    JsonHttpClient client[2];
+    std::list<std::string> ips;
+    std::list<unsigned> ports;
+
+    server.SetIdleTimeout(100);
+    server.SetMaxRequests(2);
+    ServerSetup(server);
+    server.StartThread();
+
+    // the client reconnects after the server closes after each second request
+    for (int i=0; i<2; i++)
+        TestClient(client[i]);
+
+    // both connections are closed after the idle time
+    MilliSleep(300);
+    server.GetConnectionsPeerInfo(ips, ports);
+    EXPECT_EQ(ips.size(), 0u);
+    server.StopThread();
+}
+
+TEST(Server, JsonHttpAcceptBatch)
+{
+    log_time(WARN, "JsonHttpAcceptBatch");
+    JsonHttpServer server;
+    TcpSocket sockets[6];
+    Server::AcceptStats stats;
+
+    server.SetMaxConnections(4);
+    server.SetAcceptBatch(8);
+    ServerSetup(server);
+
+    // queue the connections before the server runs so they are accepted together
+    for (int i=0; i<6; i++)
+        EXPECT_EQ(sockets[i].Connect(ServerIpAddress, ServerPort), 0);
+    MilliSleep(50);
+    server.Work(50);
+    server.GetAcceptStats(stats);
+    EXPECT_EQ(stats.accepted_, 6u);
+    EXPECT_EQ(stats.wakeups_, 1u);
+    EXPECT_EQ(stats.errors_, 0u);
 
+    // idle connections were forced to disconnect to make room
+    std::list<std::string> ips;
+    std::list<unsigned> ports;
+    server.GetConnectionsPeerInfo(ips, ports);
+    EXPECT_EQ(ips.size(), 4u);
+    EXPECT_EQ(stats.rejected_, 0u);
+    server.Shutdown();
+
+    // new connections are deferred until the client sends a request
+    JsonHttpServer deferServer;
+    JsonHttpClient client;
+    deferServer.SetDeferAccept(1);
+    ServerSetup(deferServer);
+    deferServer.StartThread();
+    TestClient(client);
+    deferServer.StopThread();
+}
+
+TEST(Server, JsonHttpForcedDisconnect)
+{
+    log_time(WARN, "JsonHttpForcedDisconnect");
+    JsonHttpServer server;
+    TcpSocket busy;
+    TcpSocket idle;
+    TcpSocket added;
+    char buffer[1025];
+    size_t bytesRead;
+    size_t bytesWritten;
+    bool eof = false;
+
+    server.SetMaxConnections(2);
+    ServerSetup(server);
+
+    // the oldest connection is in the middle of a request so the idle one is disconnected
+    std::string body = "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"add\",\"params\":[5,6]}";
+    std::string request = "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json-rpc\r\nContent-Length: " +
+                          std::to_string(body.length()) + "\r\n\r\n" + body.substr(0, 10);
+    ASSERT_EQ(busy.Connect(ServerIpAddress, ServerPort), 0);
+    EXPECT_TRUE(busy.Send(request.c_str(), request.length(), bytesWritten, 1000));
+    server.Work(50);
+    ASSERT_EQ(idle.Connect(ServerIpAddress, ServerPort), 0);
+    server.Work(50);
+    ASSERT_EQ(added.Connect(ServerIpAddress, ServerPort), 0);
+    server.Work(50);
+
+    std::list<std::string> ips;
+    std::list<unsigned> ports;
+    server.GetConnectionsPeerInfo(ips, ports);
+    EXPECT_EQ(ips.size(), 2u);
+    idle.Receive(buffer, 1024, bytesRead, eof, 50);
+    EXPECT_TRUE(eof);
+
+    // the request that was kept is finished
+    request = body.substr(10);
+    EXPECT_TRUE(busy.Send(request.c_str(), request.length(), bytesWritten, 1000));
+    server.Work(50);
+    std::string response;
+    busy.Receive(buffer, 1024, bytesRead, eof, 50);
+    response.append(buffer, bytesRead);
+    EXPECT_NE(response.find("\"result\":11"), std::string::npos);
+    server.Shutdown();
+}
+
+TEST(Server, JsonHttpInterrupt)
+{
+    log_time(WARN, "JsonHttpInterrupt");
+    JsonHttpServer server;
+    JsonHttpClient client;
+
+    // Work without a time limit only returns when woken
     ServerSetup(server);
+    std::thread worker([&server]() { server.Work(-1); });
+    MilliSleep(20);
+    int64_t startTime = MonotonicMicroTime();
+    server.Interrupt();
+    worker.join();
+    EXPECT_LT(MonotonicMicroTime() - startTime, 50000);
+
+    // the idle server thread stops without waiting for a polling interval
     server.StartThread();
     TestClient(client);
+    MilliSleep(20);
+    startTime = MonotonicMicroTime();
     server.StopThread();
+    EXPECT_LT(MonotonicMicroTime() - startTime, 50000);
 }
 
-TEST(Server, XmlTcpMT)
+TEST(Server, JsonHttpMTInterrupt)
 {
-	log_time(WARN, "XmlTcpMT");
-    XmlTcpServerMT server;
-    XmlTcpClient client;
+    log_time(WARN, "JsonHttpMTInterrupt");
+    JsonHttpServerMT server;
+    JsonHttpClient client;
 
+    // the connection thread is waiting on the open connection when the server stops
     ServerSetup(server);
     server.StartThread();
     TestClient(client);
+    MilliSleep(20);
+    int64_t startTime = MonotonicMicroTime();
     server.StopThread();
+    EXPECT_LT(MonotonicMicroTime() - startTime, 50000);
 }
-#endif // defined(ANYRPC_INCLUDE_XML)
-#if defined(ANYRPC_INCLUDE_MESSAGEPACK)
-TEST(Server, MessagePackHttp)
+
+TEST(Server, JsonHttpUring)
 {
-	log_time(WARN, "MessagePackHttp");
-    MessagePackHttpServer server;
-    MessagePackHttpClient client;
+    log_time(WARN, "JsonHttpUring");
+    JsonHttpServer server;
+    JsonHttpClient client[4];
+
+    // falls back to epoll or select if io_uring is not available
+    server.SetPollerType(internal::Poller::POLLER_URING);
+    server.SetMaxConnections(2);
+    ServerSetup(server);
+    server.StartThread();
+    for (int i=0; i<4; i++)
+        TestClient(client[i]);
+    server.StopThread();
+}
+
+TEST(Server, JsonHttpTP)
+{
+    log_time(WARN, "JsonHttpTP");
+    JsonHttpServerTP server;
+    JsonHttpClient client[4];
+
+    ServerSetup(server);
+    server.StartThread();
+    for (int i=0; i<4; i++)
+        TestClient(client[i]);
+    server.StopThread();
+}
+
+TEST(Server, JsonTcpTP)
+{
+    log_time(WARN, "JsonTcpTP");
+    JsonTcpServerTP server;
+    JsonTcpClient client;
 
     ServerSetup(server);
     server.StartThread();
@@ -269,15 +726,1388 @@ TEST(Server, MessagePackHttp)
     server.StopThread();
 }
 
-TEST(Server, MessagePackTcp)
+TEST(Server, JsonTcpTPShed)
 {
-	log_time(WARN, "MessagePackTcp");
+    log_time(WARN, "JsonTcpTPShed");
+    JsonTcpServerTP server(1);
+    JsonTcpClient slowClient;
+    JsonTcpClient client;
+    ServerTP::AdmissionStats stats;
+    Value params;
+    Value result;
+
+    server.SetMaxPending(1);
+    ServerSetup(server);
+    server.GetMethodManager()->AddFunction( &Sleep, "sleep", "Sleep for a number of milliseconds");
+    server.StartThread();
+    MilliSleep(50);
+
+    // the only worker is busy so the second request is rejected with a fault
+    std::thread slowThread([&slowClient]()
+    {
+        Value slowParams;
+        Value slowResult;
+        slowParams[0] = 300;
+        slowClient.SetServer(ServerIpAddress, ServerPort);
+        slowClient.SetTimeout(2000);
+        EXPECT_TRUE(slowClient.Call("sleep", slowParams, slowResult));
+    });
+    MilliSleep(100);
+    client.SetServer(ServerIpAddress, ServerPort);
+    client.SetTimeout(2000);
+    params[0] = 5;
+    params[1] = 6;
+    EXPECT_FALSE(client.Call("add", params, result));
+    EXPECT_EQ(result["code"].GetInt(), AnyRpcErrorServerBusy);
+    slowThread.join();
+
+    // the same connection is used once the worker is available
+    params[0] = 5;
+    params[1] = 6;
+    EXPECT_TRUE(client.Call("add", params, result));
+
+    server.GetAdmissionStats(stats);
+    EXPECT_EQ(stats.admitted_, 2u);
+    EXPECT_EQ(stats.shedLimit_, 1u);
+    EXPECT_EQ(stats.shedExpired_, 0u);
+    server.StopThread();
+}
+
+TEST(Server, JsonHttpTPShed)
+{
+    log_time(WARN, "JsonHttpTPShed");
+    JsonHttpServerTP server(1);
+    JsonHttpClient client[3];
+    ServerTP::AdmissionStats stats;
+    std::thread clientThread[3];
+
+    // the requests queued behind a slow request wait too long and are rejected
+    server.SetQueueTimeBudget(100);
+    ServerSetup(server);
+    server.GetMethodManager()->AddFunction( &Sleep, "sleep", "Sleep for a number of milliseconds");
+    server.StartThread();
+    MilliSleep(50);
+    for (int i=0; i<3; i++)
+    {
+        clientThread[i] = std::thread([&client, i]()
+        {
+            Value params;
+            Value result;
+            params[0] = 300;
+            client[i].SetServer(ServerIpAddress, ServerPort);
+            client[i].SetTimeout(2000);
+            MilliSleep(20 * i);
+            EXPECT_EQ(client[i].Call("sleep", params, result), i == 0);
+        });
+    }
+    for (int i=0; i<3; i++)
+        clientThread[i].join();
+
+    // the worker may still be returning the last connection
+    MilliSleep(20);
+    server.GetAdmissionStats(stats);
+    EXPECT_EQ(stats.admitted_, 3u);
+    EXPECT_EQ(stats.shedExpired_, 2u);
+    EXPECT_EQ(stats.pending_, 0u);
+    server.StopThread();
+}
+
+//! Send four calls on one connection without waiting - the first one takes the longest.  Return the ids in the order answered.
+static void PipelinedCalls(std::string method, std::vector<int>& ids, int64_t& elapsed)
+{
+    TcpSocket socket;
+    std::string requests;
+
+    for (int i=1; i<=4; i++)
+    {
+        std::string body = "{\"jsonrpc\":\"2.0\",\"id\":" + std::to_string(i) +
+            ",\"method\":\"" + method + "\",\"params\":[" + ((i == 1) ? "200" : "50") + "]}";
+        requests += std::to_string(body.length()) + ":" + body + ",";
+    }
+    ASSERT_EQ(socket.Connect(ServerIpAddress, ServerPort), 0);
+    int64_t startTime = MonotonicMicroTime();
+    size_t bytesWritten;
+    EXPECT_TRUE(socket.Send(requests, bytesWritten));
+
+    // read the netstring responses and record the order of the ids
+    std::string responses;
+    while ((ids.size() < 4) && (MonotonicMicroTime() - startTime < 2000000))
+    {
+        char buffer[1025];
+        size_t bytesRead;
+        bool eof;
+        socket.Receive(buffer, 1024, bytesRead, eof, 50);
+        responses.append(buffer, bytesRead);
+        size_t colon;
+        while ((colon = responses.find(':')) != std::string::npos)
+        {
+            size_t length = std::stoul(responses.substr(0, colon));
+            if (responses.length() < colon + length + 2)
+                break;
+            std::string body = responses.substr(colon + 1, length);
+            size_t idPos = body.find("\"id\":");
+            ASSERT_NE(idPos, std::string::npos);
+            ids.push_back(atoi(body.c_str() + idPos + 5));
+            responses.erase(0, colon + length + 2);
+        }
+    }
+    elapsed = MonotonicMicroTime() - startTime;
+}
+
+//! Send the calls in one write without pipelining enabled on the server.  Return the response bodies.
+static void BufferedCalls(const std::vector<std::string>& methods, std::vector<std::string>& bodies)
+{
+    TcpSocket socket;
+    std::string requests;
+
+    for (size_t i=0; i<methods.size(); i++)
+    {
+        std::string body = "{\"jsonrpc\":\"2.0\",\"id\":" + std::to_string(i+1) +
+            ",\"method\":\"" + methods[i] + "\",\"params\":[1,2]}";
+        requests += std::to_string(body.length()) + ":" + body + ",";
+    }
+    ASSERT_EQ(socket.Connect(ServerIpAddress, ServerPort), 0);
+    int64_t startTime = MonotonicMicroTime();
+    size_t bytesWritten;
+    EXPECT_TRUE(socket.Send(requests, bytesWritten));
+
+    std::string responses;
+    while ((bodies.size() < methods.size()) && (MonotonicMicroTime() - startTime < 2000000))
+    {
+        char buffer[1025];
+        size_t bytesRead;
+        bool eof;
+        socket.Receive(buffer, 1024, bytesRead, eof, 50);
+        responses.append(buffer, bytesRead);
+        size_t colon;
+        while ((colon = responses.find(':')) != std::string::npos)
+        {
+            size_t length = std::stoul(responses.substr(0, colon));
+            if (responses.length() < colon + length + 2)
+                break;
+            bodies.push_back(responses.substr(colon + 1, length));
+            responses.erase(0, colon + length + 2);
+        }
+    }
+}
+
+TEST(Server, JsonTcpTPBuffered)
+{
+    log_time(WARN, "JsonTcpTPBuffered");
+    JsonTcpServerTP server(1);
+    ServerTP::AdmissionStats stats;
+    std::vector<std::string> bodies;
+
+    server.SetMaxPending(1);
+    ServerSetup(server);
+    server.StartThread();
+
+    // the worker gives the connection back after each call so the second one is admitted separately
+    std::vector<std::string> methods;
+    methods.push_back("add");
+    methods.push_back("subtract");
+    BufferedCalls(methods, bodies);
+    ASSERT_EQ(bodies.size(), 2u);
+    EXPECT_NE(bodies[0].find("\"result\":3"), std::string::npos);
+    EXPECT_NE(bodies[1].find("\"result\":-1"), std::string::npos);
+
+    server.GetAdmissionStats(stats);
+    EXPECT_EQ(stats.admitted_, 2u);
+    EXPECT_EQ(stats.shedLimit_, 0u);
+    server.StopThread();
+}
+
+//! Get the string result from a response body
+static std::string ResultString(const std::string& body)
+{
+    size_t start = body.find("\"result\":\"");
+    if (start == std::string::npos)
+        return "";
+    start += 10;
+    return body.substr(start, body.find('"', start) - start);
+}
+
+TEST(Server, JsonTcpTPBufferedLanes)
+{
+    log_time(WARN, "JsonTcpTPBufferedLanes");
+    JsonTcpServerTP server(1);
+    std::vector<std::string> bodies;
+
+    // each of the calls read together is given to the workers of its own lane
+    unsigned lane = server.AddLane(1);
+    ServerSetup(server);
+    server.GetMethodManager()->AddFunction( &ThreadId, "thread", "Get the executing thread");
+    server.GetMethodManager()->AddFunction( &ThreadId, "laneThread", "Get the executing thread");
+    EXPECT_TRUE(server.GetMethodManager()->SetMethodLane("laneThread", lane));
+    server.StartThread();
+
+    std::vector<std::string> methods;
+    methods.push_back("thread");
+    methods.push_back("laneThread");
+    methods.push_back("thread");
+    BufferedCalls(methods, bodies);
+    ASSERT_EQ(bodies.size(), 3u);
+    EXPECT_NE(ResultString(bodies[0]), "");
+    EXPECT_NE(ResultString(bodies[1]), "");
+    EXPECT_NE(ResultString(bodies[0]), ResultString(bodies[1]));
+    EXPECT_EQ(ResultString(bodies[0]), ResultString(bodies[2]));
+    server.StopThread();
+}
+
+TEST(Server, JsonTcpTPPipelined)
+{
+    log_time(WARN, "JsonTcpTPPipelined");
+    JsonTcpServerTP server(4);
+    JsonTcpClient client;
+    std::vector<int> ids;
+    int64_t elapsed;
+
+    server.SetPipelining(true);
+    ServerSetup(server);
+    server.GetMethodManager()->AddFunction( &Sleep, "sleep", "Sleep for a number of milliseconds");
+    server.StartThread();
+
+    // a client that waits for each response works the same way
+    TestClient(client);
+    PipelinedCalls("sleep", ids, elapsed);
+
+    // the requests executed concurrently and the slow one was answered last
+    ASSERT_EQ(ids.size(), 4u);
+    EXPECT_EQ(ids[3], 1);
+    EXPECT_LT(elapsed, 300000);
+    server.StopThread();
+}
+
+TEST(Server, JsonTcpTPLanes)
+{
+    log_time(WARN, "JsonTcpTPLanes");
+    JsonTcpServerTP server(1);
+    JsonTcpClient client;
+    Value params;
+    Value result;
+
+    // the slow method gets its own lane so it can't take the default lane's thread
+    unsigned slowLane = server.AddLane(1);
+    ServerSetup(server);
+    server.GetMethodManager()->AddFunction( &Sleep, "sleep", "Sleep for a number of milliseconds");
+    EXPECT_TRUE(server.GetMethodManager()->SetMethodLane("sleep", slowLane));
+    EXPECT_EQ(server.GetMethodManager()->GetMethodLane("sleep"), slowLane);
+    EXPECT_EQ(server.GetMethodManager()->GetMethodLane("echo"), 0u);
+    server.StartThread();
+    TestClient(client);
+
+    std::thread slow1(&SleepCaller, "sleep", 300);
+    std::thread slow2(&SleepCaller, "sleep", 300);
+    MilliSleep(50);
+
+    // the fast calls don't wait behind the queued slow ones
+    params.SetArray();
+    params[0] = 1;
+    int64_t startTime = MonotonicMicroTime();
+    for (int i=0; i<5; i++)
+        EXPECT_TRUE(client.Call("echo", params, result));
+    EXPECT_LT(MonotonicMicroTime() - startTime, 200000);
+
+    slow1.join();
+    slow2.join();
+    server.StopThread();
+}
+
+#if defined(__linux__)
+TEST(Server, JsonTcpTPPlacement)
+{
+    log_time(WARN, "JsonTcpTPPlacement");
+    JsonTcpServerTP server(2);
+    JsonTcpClient client;
+    Value params;
+    Value result;
+
+    server.SetThreadAffinity(std::vector<unsigned>(1, 0));
+    server.SetThreadName("rpc-server");
+    server.SetWorkerName("rpc-worker-");
+    server.SetWorkerColocation(true);
+    ServerSetup(server);
+    server.GetMethodManager()->AddFunction( &Placement, "placement", "Get the placement of the executing thread");
+    server.StartThread();
+    TestClient(client);
+
+    // the method runs on a named worker that shares the CPU of the server thread
+    params.SetArray();
+    ASSERT_TRUE(client.Call("placement", params, result));
+    ASSERT_TRUE(result.IsArray());
+    EXPECT_EQ(std::string(result[0].GetString()).substr(0, 11), "rpc-worker-");
+    EXPECT_EQ(result[1].GetInt(), 1);
+    EXPECT_EQ(result[2].GetInt(), 0);
+    server.StopThread();
+}
+
+TEST(Server, JsonTcpMREphemeralPort)
+{
+    log_time(WARN, "JsonTcpMREphemeralPort");
+    JsonTcpServerMR server(2);
+    Value params;
+    Value result;
+
+    server.SetThreadName("rpc-mr");
+    ASSERT_TRUE(server.BindAndListen(0));
+    string ip;
+    unsigned port;
+    ASSERT_TRUE(server.GetMainSockInfo(ip, port));
+    EXPECT_NE(port, 0u);
+    server.GetMethodManager()->AddFunction( &Placement, "placement", "Get the placement of the executing thread");
+    server.StartThread();
+    MilliSleep(50);
+
+    // the connections to the port are spread over both reactors, which only happens if they share it
+    std::set<std::string> names;
+    params.SetArray();
+    for (int i=0; (i<64) && (names.size() < 2); i++)
+    {
+        JsonTcpClient client(ServerIpAddress, port);
+        ASSERT_TRUE(client.Call("placement", params, result));
+        names.insert(result[0].GetString());
+    }
+    EXPECT_EQ(names.size(), 2u);
+    server.StopThread();
+}
+#endif // defined(__linux__)
+
+TEST(Server, JsonHttpMR)
+{
+    log_time(WARN, "JsonHttpMR");
+    JsonHttpServerMR server(2);
+    JsonHttpClient client[4];
+
+    ServerSetup(server);
+    server.StartThread();
+    for (int i=0; i<4; i++)
+        TestClient(client[i]);
+    server.StopThread();
+}
+
+TEST(Server, JsonTcpMR)
+{
+    log_time(WARN, "JsonTcpMR");
+    JsonTcpServerMR server(2);
+    JsonTcpClient client;
+
+    server.SetCpuAffinity(true);
+    ServerSetup(server);
+    server.StartThread();
+    TestClient(client);
+    server.StopThread();
+}
+
+static void TestLongEcho(Client& client)
+{
+    Value params;
+    Value result;
+    string longString(200000, 'x');
+    for (int i=0; i<8; i++)
+    {
+        longString[i] = 'a' + i;
+        params.SetArray();
+        params[0] = longString;
+        EXPECT_TRUE(client.Call("echo", params, result));
+        EXPECT_TRUE(result.IsArray() && result[0].IsString());
+        EXPECT_EQ(result[0].GetString(), longString);
+    }
+}
+
+TEST(Server, JsonHttpMRUring)
+{
+    log_time(WARN, "JsonHttpMRUring");
+    JsonHttpServerMR server(2);
+    JsonHttpClient client[2];
+
+    // the reactors accept, read, and write through the ring when io_uring is available
+    server.SetPollerType(internal::Poller::POLLER_URING);
+    ServerSetup(server);
+    AsyncSetup(server);
+    StreamSetup(server);
+    server.StartThread();
+    for (int i=0; i<2; i++)
+    {
+        TestClient(client[i]);
+        // the requests and responses are larger than the ring buffers
+        TestLongEcho(client[i]);
+        TestStreamClient(client[i]);
+        TestAsyncClient(client[i]);
+    }
+    server.StopThread();
+}
+
+#if defined(ANYRPC_LOCAL_SOCKET)
+static const char* LocalPath = "/tmp/anyrpc-test.sock";
+static const char* LocalHost = "unix:/tmp/anyrpc-test.sock";
+
+TEST(Server, JsonTcpLocal)
+{
+    log_time(WARN, "JsonTcpLocal");
+    JsonTcpServer server;
+    JsonTcpClient client;
+
+    ServerSetup(server, LocalPath);
+    EXPECT_EQ(server.GetLocalPath(), LocalPath);
+    string ip;
+    unsigned port;
+    EXPECT_TRUE(server.GetMainSockInfo(ip, port));
+    EXPECT_EQ(ip, LocalPath);
+    EXPECT_EQ(port, 0u);
+
+    server.StartThread();
+    TestClient(client, LocalHost);
+    EXPECT_TRUE(client.GetPeerInfo(ip, port));
+    EXPECT_EQ(ip, LocalPath);
+    server.StopThread();
+
+    // the socket file is removed when the server shuts down
+    EXPECT_NE(access(LocalPath, F_OK), 0);
+}
+
+TEST(Server, JsonHttpLocalStale)
+{
+    log_time(WARN, "JsonHttpLocalStale");
+    // leave a socket file behind as if a server had crashed
+    TcpSocket stale;
+    stale.CreateLocal();
+    ASSERT_EQ(stale.BindLocal(LocalPath), 0);
+    stale.Close();
+    EXPECT_EQ(access(LocalPath, F_OK), 0);
+
+    JsonHttpServer server;
+    JsonHttpClient client;
+    ServerSetup(server, LocalPath);
+    server.StartThread();
+    TestClient(client, LocalHost);
+
+    // a running server keeps its path
+    JsonHttpServer other;
+    EXPECT_FALSE(other.BindAndListenLocal(LocalPath));
+    TestClient(client, LocalHost);
+    server.StopThread();
+    EXPECT_NE(access(LocalPath, F_OK), 0);
+}
+
+# if defined(__linux__)
+TEST(Server, JsonHttpTPLocalAbstract)
+{
+    log_time(WARN, "JsonHttpTPLocalAbstract");
+    JsonHttpServerTP server;
+    JsonHttpClient client;
+
+    ServerSetup(server, "@anyrpc-test");
+    string ip;
+    unsigned port;
+    EXPECT_TRUE(server.GetMainSockInfo(ip, port));
+    EXPECT_EQ(ip, "@anyrpc-test");
+    server.StartThread();
+    TestClient(client, "unix:@anyrpc-test");
+    server.StopThread();
+}
+# endif // defined(__linux__)
+
+TEST(Server, JsonTcpMRLocal)
+{
+    log_time(WARN, "JsonTcpMRLocal");
+    JsonTcpServerMR server(2);
+    JsonTcpClient client[4];
+
+    ServerSetup(server, LocalPath);
+    server.StartThread();
+    for (int i=0; i<4; i++)
+        TestClient(client[i], LocalHost);
+    server.StopThread();
+    EXPECT_NE(access(LocalPath, F_OK), 0);
+}
+
+# if defined(ANYRPC_SHARED_MEMORY)
+static const char* SharedHost = "shm:/tmp/anyrpc-test.sock";
+
+//! Echo long strings so the data wraps around the rings several times
+TEST(Server, JsonTcpShared)
+{
+    log_time(WARN, "JsonTcpShared");
+    JsonTcpServer server;
+    JsonTcpClient client;
+
+    server.SetSharedMemory(true);
+    ServerSetup(server, LocalPath);
+    server.StartThread();
+    TestClient(client, SharedHost);
+    TestLongEcho(client);
+
+    // a client that doesn't ask for the rings still uses the socket
+    JsonTcpClient socketClient;
+    TestClient(socketClient, LocalHost);
+    server.StopThread();
+}
+
+TEST(Server, JsonHttpMTShared)
+{
+    log_time(WARN, "JsonHttpMTShared");
+    JsonHttpServerMT server;
+    JsonHttpClient client;
+
+    server.SetSharedMemory(true);
+    ServerSetup(server, LocalPath);
+    server.StartThread();
+    TestClient(client, SharedHost);
+    TestLongEcho(client);
+    server.StopThread();
+}
+
+#  if defined(ANYRPC_INCLUDE_MESSAGEPACK)
+TEST(Server, MessagePackTcpTPSharedBusyPoll)
+{
+    log_time(WARN, "MessagePackTcpTPSharedBusyPoll");
+    MessagePackTcpServerTP server;
+    MessagePackTcpClient client;
+
+    server.SetSharedMemory(true);
+    ServerSetup(server, LocalPath);
+    server.StartThread();
+    client.SetBusyPoll(100);
+    client.SetRingSize(64*1024);
+    TestClient(client, SharedHost);
+    server.StopThread();
+}
+#  endif // defined(ANYRPC_INCLUDE_MESSAGEPACK)
+
+TEST(Server, JsonTcpSharedRefused)
+{
+    log_time(WARN, "JsonTcpSharedRefused");
+    JsonTcpServer server;
+    JsonTcpClient client;
+
+    // the server closes the connection when it gets the rings without allowing them
+    ServerSetup(server, LocalPath);
+    server.StartThread();
+    MilliSleep(50);
+    client.SetServer(SharedHost, 0);
+    client.SetTimeout(200);
+    Value params;
+    Value result;
+    params.SetArray();
+    params[0] = 1;
+    params[1] = 2;
+    EXPECT_FALSE(client.Call("add", params, result));
+    server.StopThread();
+}
+# endif // defined(ANYRPC_SHARED_MEMORY)
+#endif // defined(ANYRPC_LOCAL_SOCKET)
+
+//! Send raw HTTP requests on one connection and return the bodies of the responses
+static void RawHttpCalls(const std::string& requests, size_t count, std::vector<std::string>& bodies)
+{
+    TcpSocket socket;
+    ASSERT_EQ(socket.Connect(ServerIpAddress, ServerPort), 0);
+    size_t bytesWritten;
+    EXPECT_TRUE(socket.Send(requests.c_str(), requests.length(), bytesWritten, 1000));
+
+    std::string responses;
+    int64_t startTime = MonotonicMicroTime();
+    while ((bodies.size() < count) && (MonotonicMicroTime() - startTime < 2000000))
+    {
+        char buffer[4096];
+        size_t bytesRead;
+        bool eof;
+        socket.Receive(buffer, sizeof(buffer), bytesRead, eof, 50);
+        responses.append(buffer, bytesRead);
+        size_t headerEnd;
+        while ((headerEnd = responses.find("\r\n\r\n")) != std::string::npos)
+        {
+            std::string header = responses.substr(0, headerEnd);
+            std::transform(header.begin(), header.end(), header.begin(), ::tolower);
+            size_t lengthPos = header.find("content-length:");
+            ASSERT_NE(lengthPos, std::string::npos);
+            size_t length = atoi(header.c_str() + lengthPos + 15);
+            if (responses.length() < headerEnd + 4 + length)
+                break;
+            bodies.push_back(responses.substr(headerEnd + 4, length));
+            responses.erase(0, headerEnd + 4 + length);
+        }
+        if (eof)
+            break;
+    }
+}
+
+TEST(Server, JsonHttp2)
+{
+    log_time(WARN, "JsonHttp2");
+    JsonHttp2Server server;
+    JsonHttp2Client client;
+
+    ServerSetup(server);
+    AsyncSetup(server);
+    server.StartThread();
+    TestClient(client);
+    // the requests and responses are larger than the flow control windows
+    TestLongEcho(client);
+    TestAsyncClient(client);
+    server.StopThread();
+}
+
+TEST(Server, JsonHttp2TPStreams)
+{
+    log_time(WARN, "JsonHttp2TPStreams");
+    JsonHttp2ServerTP server(4);
+    JsonHttp2Client client;
+
+    ServerSetup(server);
+    server.GetMethodManager()->AddFunction( &Sleep, "sleep", "Sleep for a number of milliseconds");
+    server.StartThread();
+    TestClient(client);
+
+    // the streams of the connection are executed concurrently
+    Value params;
+    Value result;
+    int64_t startTime = MonotonicMicroTime();
+    for (int i=0; i<4; i++)
+    {
+        params.SetArray();
+        params[0] = (i == 0) ? 200 : 50 + i;
+        EXPECT_TRUE(client.Post("sleep", params, result));
+    }
+    for (int i=0; i<4; i++)
+    {
+        EXPECT_TRUE(client.GetPostResult(result));
+        EXPECT_EQ(result.GetInt(), (i == 0) ? 200 : 50 + i);
+    }
+    EXPECT_LT(MonotonicMicroTime() - startTime, 300000);
+    EXPECT_FALSE(client.GetPostResult(result));
+    server.StopThread();
+}
+
+TEST(Server, JsonHttp2HeaderBlockLimit)
+{
+    log_time(WARN, "JsonHttp2HeaderBlockLimit");
+    TcpSocket listener;
+    listener.Create();
+    listener.SetReuseAddress();
+    ASSERT_EQ(listener.Bind(ServerPort), 0);
+    ASSERT_EQ(listener.Listen(), 0);
+
+    // the server answers with a header block that never ends
+    std::string received;
+    std::thread server([&]()
+    {
+        TcpSocket socket;
+        socket.SetFileDescriptor(listener.Accept());
+        WriteStringStream os;
+        std::string block(16000, 'x');
+        internal::Http2Frame::WriteHeader(os, 0, internal::Http2Frame::FRAME_SETTINGS, 0, 0);
+        internal::Http2Frame::WriteHeader(os, block.length(), internal::Http2Frame::FRAME_HEADERS, 0, 1);
+        os.Put(block);
+        for (int i=0; i<8; i++)
+        {
+            internal::Http2Frame::WriteHeader(os, block.length(), internal::Http2Frame::FRAME_CONTINUATION, 0, 1);
+            os.Put(block);
+        }
+        size_t bytesWritten;
+        socket.Send(os.GetString().c_str(), os.Length(), bytesWritten, 1000);
+
+        int64_t startTime = MonotonicMicroTime();
+        while (MonotonicMicroTime() - startTime < 2000000)
+        {
+            char buffer[4096];
+            size_t bytesRead;
+            bool eof;
+            socket.Receive(buffer, sizeof(buffer), bytesRead, eof, 50);
+            received.append(buffer, bytesRead);
+            if (eof)
+                break;
+        }
+    });
+
+    JsonHttp2Client client(ServerIpAddress, ServerPort);
+    Value params;
+    Value result;
+    params[0] = 1;
+    params[1] = 2;
+    EXPECT_FALSE(client.Call("add", params, result));
+    EXPECT_EQ(result["code"].GetInt(), AnyRpcErrorTransportError);
+    server.join();
+
+    // the client ends the connection with a GOAWAY frame
+    WriteStringStream goAway;
+    internal::Http2Frame::WriteGoAway(goAway, 0, internal::Http2Frame::ERR_ENHANCE_YOUR_CALM);
+    const std::string& expected = goAway.GetString();
+    ASSERT_GE(received.length(), expected.length());
+    EXPECT_EQ(received.substr(received.length() - expected.length()), expected);
+}
+
+TEST(Server, JsonWebSocket)
+{
+    log_time(WARN, "JsonWebSocket");
+    JsonWebSocketServer server;
+    JsonWebSocketClient client;
+
+    ServerSetup(server);
+    AsyncSetup(server);
+    server.StartThread();
+    TestClient(client);
+    // the messages are larger than the buffer of the connection
+    TestLongEcho(client);
+    TestAsyncClient(client);
+    server.StopThread();
+}
+
+TEST(Server, JsonWebSocketTP)
+{
+    log_time(WARN, "JsonWebSocketTP");
+    JsonWebSocketServerTP server(4);
+    JsonWebSocketClient client;
+
+    ServerSetup(server);
+    AsyncSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestLongEcho(client);
+    TestAsyncClient(client);
+    server.StopThread();
+}
+
+static void AppendFrame(std::string& data, unsigned opcode, bool fin, const std::string& payload)
+{
+    static const unsigned char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    WriteStringStream os;
+    internal::WebSocketFrame::WriteHeader(os, opcode, fin, payload.length(), mask);
+    std::string masked = payload;
+    internal::WebSocketFrame::Mask(&masked[0], masked.length(), mask);
+    data += os.GetString() + masked;
+}
+
+static const char* WebSocketHandshake = "GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: keep-alive, Upgrade\r\n"
+                                        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n"
+                                        "Sec-WebSocket-Protocol: chat, json-rpc\r\n\r\n";
+
+static void RawWebSocketSession(const std::string& data, std::string& responses)
+{
+    TcpSocket socket;
+    ASSERT_EQ(socket.Connect(ServerIpAddress, ServerPort), 0);
+    size_t bytesWritten;
+    EXPECT_TRUE(socket.Send(data.c_str(), data.length(), bytesWritten, 1000));
+
+    // the server closes the connection after sending a close frame
+    int64_t startTime = MonotonicMicroTime();
+    while (MonotonicMicroTime() - startTime < 2000000)
+    {
+        char buffer[4096];
+        size_t bytesRead;
+        bool eof;
+        socket.Receive(buffer, sizeof(buffer), bytesRead, eof, 50);
+        responses.append(buffer, bytesRead);
+        if (eof)
+            break;
+    }
+}
+
+TEST(Server, JsonWebSocketFrames)
+{
+    log_time(WARN, "JsonWebSocketFrames");
+    // the subprotocol selects the handler of the server
+    AnyWebSocketServer server;
+    ServerSetup(server);
+    server.StartThread();
+
+    // the handshake and all of the frames are sent together
+    std::string data = WebSocketHandshake;
+    AppendFrame(data, internal::WebSocketFrame::OPCODE_PING, true, "hi");
+    AppendFrame(data, internal::WebSocketFrame::OPCODE_TEXT, true, "{\"jsonrpc\":\"2.0\",\"method\":\"add\",\"params\":[1,2],\"id\":1}");
+    AppendFrame(data, internal::WebSocketFrame::OPCODE_TEXT, false, "{\"jsonrpc\":\"2.0\",\"method\":");
+    AppendFrame(data, internal::WebSocketFrame::OPCODE_PING, true, "");
+    AppendFrame(data, internal::WebSocketFrame::OPCODE_CONTINUATION, true, "\"add\",\"params\":[3,4],\"id\":2}");
+    AppendFrame(data, internal::WebSocketFrame::OPCODE_TEXT, true, "[{\"jsonrpc\":\"2.0\",\"method\":\"add\",\"params\":[5,6],\"id\":3},"
+                                                                   "{\"jsonrpc\":\"2.0\",\"method\":\"add\",\"params\":[7,8]}]");
+    AppendFrame(data, internal::WebSocketFrame::OPCODE_TEXT, true, "{\"jsonrpc\":\"2.0\",\"method\":\"add\",\"params\":[9,10]}");
+    AppendFrame(data, internal::WebSocketFrame::OPCODE_CLOSE, true, std::string("\x03\xe8", 2));
+
+    std::string responses;
+    RawWebSocketSession(data, responses);
+    server.StopThread();
+
+    size_t headerEnd = responses.find("\r\n\r\n");
+    ASSERT_NE(headerEnd, std::string::npos);
+    std::string header = responses.substr(0, headerEnd);
+    EXPECT_EQ(header.find("HTTP/1.1 101"), 0u);
+    EXPECT_NE(header.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo="), std::string::npos);
+    EXPECT_NE(header.find("Sec-WebSocket-Protocol: json-rpc"), std::string::npos);
+
+    std::vector<unsigned> opcodes;
+    std::vector<std::string> payloads;
+    size_t position = headerEnd + 4;
+    internal::WebSocketFrame frame;
+    while (frame.ParseHeader(responses.data() + position, responses.length() - position) == internal::WebSocketFrame::FRAME_COMPLETE)
+    {
+        EXPECT_FALSE(frame.masked_);
+        EXPECT_TRUE(frame.fin_);
+        ASSERT_LE(position + frame.headerLength_ + frame.length_, responses.length());
+        opcodes.push_back(frame.opcode_);
+        payloads.push_back(responses.substr(position + frame.headerLength_, static_cast<size_t>(frame.length_)));
+        position += frame.headerLength_ + static_cast<size_t>(frame.length_);
+    }
+    EXPECT_EQ(position, responses.length());
+
+    // the notification has no response
+    ASSERT_EQ(opcodes.size(), 6u);
+    EXPECT_EQ(opcodes[0], internal::WebSocketFrame::OPCODE_PONG);
+    EXPECT_EQ(payloads[0], "hi");
+    EXPECT_EQ(opcodes[1], internal::WebSocketFrame::OPCODE_TEXT);
+    EXPECT_NE(payloads[1].find("\"id\":1"), std::string::npos);
+    EXPECT_EQ(opcodes[2], internal::WebSocketFrame::OPCODE_PONG);
+    EXPECT_EQ(payloads[2], "");
+    EXPECT_EQ(opcodes[3], internal::WebSocketFrame::OPCODE_TEXT);
+    EXPECT_NE(payloads[3].find("\"id\":2"), std::string::npos);
+    EXPECT_EQ(opcodes[4], internal::WebSocketFrame::OPCODE_TEXT);
+    EXPECT_EQ(payloads[4][0], '[');
+    EXPECT_NE(payloads[4].find("\"id\":3"), std::string::npos);
+    EXPECT_EQ(opcodes[5], internal::WebSocketFrame::OPCODE_CLOSE);
+}
+
+TEST(Server, JsonWebSocketFramesHugeLength)
+{
+    log_time(WARN, "JsonWebSocketFramesHugeLength");
+    JsonWebSocketServer server;
+    ServerSetup(server);
+    server.StartThread();
+
+    // the length of the continuation would wrap around when added to the first fragment
+    std::string first = "{\"jsonrpc\":\"2.0\",";
+    std::string data = WebSocketHandshake;
+    AppendFrame(data, internal::WebSocketFrame::OPCODE_TEXT, false, first);
+    static const unsigned char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    WriteStringStream os;
+    internal::WebSocketFrame::WriteHeader(os, internal::WebSocketFrame::OPCODE_CONTINUATION, true, 0 - static_cast<uint64_t>(first.length()) + 1, mask);
+    data += os.GetString() + std::string(1000, 'x');
+
+    std::string responses;
+    RawWebSocketSession(data, responses);
+    server.StopThread();
+
+    // the only frame is the close frame for the protocol error
+    size_t headerEnd = responses.find("\r\n\r\n");
+    ASSERT_NE(headerEnd, std::string::npos);
+    EXPECT_EQ(responses.find("HTTP/1.1 101"), 0u);
+    std::string frames = responses.substr(headerEnd + 4);
+    internal::WebSocketFrame frame;
+    ASSERT_EQ(frame.ParseHeader(frames.data(), frames.length()), internal::WebSocketFrame::FRAME_COMPLETE);
+    EXPECT_EQ(frame.opcode_, static_cast<unsigned>(internal::WebSocketFrame::OPCODE_CLOSE));
+    ASSERT_EQ(frames.length(), frame.headerLength_ + 2);
+    EXPECT_EQ(frames.substr(frame.headerLength_), std::string("\x03\xea", 2));
+}
+
+TEST(Server, JsonHttpChunked)
+{
+    log_time(WARN, "JsonHttpChunked");
+    JsonHttpServer server;
+    ServerSetup(server);
+    server.StartThread();
+    MilliSleep(50);
+
+    // a chunked request with an extension and a trailer, followed by a request with a content length
+    std::string text(5000, 'c');
+    std::string body = "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"echo\",\"params\":[\"" + text + "\"]}";
+    std::string requests = "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json-rpc\r\n"
+                           "Transfer-Encoding: chunked\r\n\r\n";
+    for (size_t pos = 0; pos < body.length(); pos += 1000)
+    {
+        std::string chunk = body.substr(pos, 1000);
+        char size[32];
+        snprintf(size, sizeof(size), "%zx", chunk.length());
+        requests += std::string(size) + ((pos == 0) ? ";name=value" : "") + "\r\n" + chunk + "\r\n";
+    }
+    requests += "0\r\nX-Trailer: done\r\n\r\n";
+    std::string second = "{\"jsonrpc\":\"2.0\",\"id\":2,\"method\":\"add\",\"params\":[5,6]}";
+    requests += "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json-rpc\r\nContent-Length: " +
+                std::to_string(second.length()) + "\r\n\r\n" + second;
+
+    std::vector<std::string> bodies;
+    RawHttpCalls(requests, 2, bodies);
+    ASSERT_EQ(bodies.size(), 2u);
+    EXPECT_NE(bodies[0].find(text), std::string::npos);
+    EXPECT_NE(bodies[1].find("11"), std::string::npos);
+    server.StopThread();
+}
+
+TEST(Server, JsonTcpMaxContentLength)
+{
+    log_time(WARN, "JsonTcpMaxContentLength");
+    JsonTcpServer server;
+    JsonTcpClient client;
+    Value params;
+    Value result;
+
+    server.SetMaxContentLength(4000000);
+    ServerSetup(server);
+    server.StartThread();
+    TestClient(client);
+
+    // the response is larger than the client accepts by default
+    string longString(2000000, 'x');
+    params.SetArray();
+    params[0] = longString;
+    EXPECT_FALSE(client.Call("echo", params, result));
+    client.SetMaxContentLength(4000000);
+    params.SetArray();
+    params[0] = longString;
+    EXPECT_TRUE(client.Call("echo", params, result));
+    EXPECT_TRUE(result.IsArray() && result[0].IsString());
+    EXPECT_EQ(result[0].GetString(), longString);
+
+    // the request is larger than the server accepts
+    params.SetArray();
+    params[0] = string(5000000, 'x');
+    EXPECT_FALSE(client.Call("echo", params, result));
+    server.StopThread();
+}
+
+#if defined(ANYRPC_ZEROCOPY)
+TEST(Server, JsonTcpZeroCopy)
+{
+    log_time(WARN, "JsonTcpZeroCopy");
+    JsonTcpServer server;
+    JsonTcpClient client;
+
+    // the short responses are still copied
+    server.SetZeroCopyThreshold(16*1024);
+    ServerSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestLongEcho(client);
+    server.StopThread();
+}
+
+TEST(Server, JsonTcpTPPipelinedZeroCopy)
+{
+    log_time(WARN, "JsonTcpTPPipelinedZeroCopy");
+    JsonTcpServerTP server(4);
+    JsonTcpClient client;
+
+    server.SetPipelining(true);
+    server.SetZeroCopyThreshold(16*1024);
+    ServerSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestLongEcho(client);
+    server.StopThread();
+}
+
+TEST(Server, JsonHttpZeroCopyClose)
+{
+    log_time(WARN, "JsonHttpZeroCopyClose");
+    JsonHttpServer server;
+    server.SetZeroCopyThreshold(16*1024);
+    ServerSetup(server);
+    server.StartThread();
+
+    // the connection closes right after each response
+    for (int i=0; i<8; i++)
+    {
+        std::string longString(200000, 'a' + i);
+        std::string body = "{\"jsonrpc\":\"2.0\",\"method\":\"echo\",\"params\":[\"" + longString + "\"],\"id\":1}";
+        std::ostringstream request;
+        request << "POST /RPC2 HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nContent-Type: application/json-rpc\r\n"
+                << "Content-length: " << body.length() << "\r\n\r\n" << body;
+        std::vector<std::string> bodies;
+        RawHttpCalls(request.str(), 1, bodies);
+        ASSERT_EQ(bodies.size(), 1u);
+        EXPECT_NE(bodies[0].find("[\"" + longString + "\"]"), std::string::npos);
+    }
+
+    // a kept connection is closed by the server while its response may still be sent without a copy
+    JsonHttpClient client;
+    client.SetServer(ServerIpAddress, ServerPort);
+    TestLongEcho(client);
+    server.StopThread();
+}
+#endif // defined(ANYRPC_ZEROCOPY)
+
+TEST(Server, JsonHttpStream)
+{
+    log_time(WARN, "JsonHttpStream");
+    JsonHttpServer server;
+    JsonHttpClient client;
+
+    ServerSetup(server);
+    StreamSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestStreamClient(client);
+
+    // the large result is sent in chunks
+    TcpSocket socket;
+    ASSERT_EQ(socket.Connect(ServerIpAddress, ServerPort), 0);
+    std::string body = "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"rows\",\"params\":[10000]}";
+    std::string request = "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json-rpc\r\nContent-Length: " +
+                          std::to_string(body.length()) + "\r\n\r\n" + body;
+    size_t bytesWritten;
+    EXPECT_TRUE(socket.Send(request.c_str(), request.length(), bytesWritten, 1000));
+    std::string response;
+    int64_t startTime = MonotonicMicroTime();
+    while ((response.find("\r\n0\r\n\r\n") == std::string::npos) && (MonotonicMicroTime() - startTime < 2000000))
+    {
+        char buffer[4096];
+        size_t bytesRead;
+        bool eof;
+        socket.Receive(buffer, sizeof(buffer), bytesRead, eof, 50);
+        response.append(buffer, bytesRead);
+        if (eof)
+            break;
+    }
+    std::string header = response.substr(0, response.find("\r\n\r\n"));
+    EXPECT_NE(header.find("Transfer-Encoding: chunked"), std::string::npos);
+    EXPECT_EQ(header.find("Content-length"), std::string::npos);
+    EXPECT_NE(response.find("\"row\":9999"), std::string::npos);
+    server.StopThread();
+}
+
+TEST(Server, JsonHttpStreamSlowClient)
+{
+    log_time(WARN, "JsonHttpStreamSlowClient");
+    JsonHttpServer server;
+    JsonHttpClient client;
+    Value params;
+    Value result;
+
+    ServerSetup(server);
+    StreamSetup(server);
+    server.StartThread();
+
+    // the client doesn't read while the result is produced, which can't block the server thread
+    TcpSocket socket;
+    ASSERT_EQ(socket.Connect(ServerIpAddress, ServerPort), 0);
+    int receiveBuffer = 64*1024;
+    setsockopt(socket.GetFileDescriptor(), SOL_SOCKET, SO_RCVBUF, (char*)&receiveBuffer, sizeof(receiveBuffer));
+    std::string body = "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"rows\",\"params\":[200000]}";
+    std::string request = "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json-rpc\r\nContent-Length: " +
+                          std::to_string(body.length()) + "\r\n\r\n" + body;
+    size_t bytesWritten;
+    EXPECT_TRUE(socket.Send(request.c_str(), request.length(), bytesWritten, 1000));
+    MilliSleep(50);
+    client.SetServer(ServerIpAddress, ServerPort);
+    client.SetTimeout(2000);
+    params[0] = 5;
+    params[1] = 6;
+    int64_t startTime = MonotonicMicroTime();
+    EXPECT_TRUE(client.Call("add", params, result));
+    EXPECT_LT(MonotonicMicroTime() - startTime, 3000000);
+
+    // the chunks that were kept are sent in order once the client reads
+    std::string response;
+    startTime = MonotonicMicroTime();
+    while ((response.find("\r\n0\r\n\r\n") == std::string::npos) && (MonotonicMicroTime() - startTime < 5000000))
+    {
+        char buffer[65536];
+        size_t bytesRead;
+        bool eof;
+        socket.Receive(buffer, sizeof(buffer), bytesRead, eof, 50);
+        response.append(buffer, bytesRead);
+        if (eof)
+            break;
+    }
+    size_t offset = response.find("\r\n\r\n");
+    ASSERT_NE(offset, std::string::npos);
+    offset += 4;
+    std::string content;
+    while (offset < response.length())
+    {
+        size_t chunkSize = strtoul(response.c_str() + offset, 0, 16);
+        offset = response.find("\r\n", offset);
+        ASSERT_NE(offset, std::string::npos);
+        offset += 2;
+        if (chunkSize == 0)
+            break;
+        content.append(response, offset, chunkSize);
+        offset += chunkSize;
+        ASSERT_EQ(response.compare(offset, 2, "\r\n"), 0);
+        offset += 2;
+    }
+    EXPECT_EQ(response.compare(offset, 2, "\r\n"), 0);
+    EXPECT_EQ(content.compare(0, 8, "{\"jsonrp"), 0);
+    EXPECT_NE(content.find("\"row\":199999"), std::string::npos);
+    EXPECT_EQ(content[content.length()-1], '}');
+    server.StopThread();
+}
+
+TEST(Server, JsonTcpStream)
+{
+    log_time(WARN, "JsonTcpStream");
+    JsonTcpServer server;
+    JsonTcpClient client;
+
+    ServerSetup(server);
+    StreamSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestStreamClient(client);
+    server.StopThread();
+}
+
+TEST(Server, JsonHttpTPStream)
+{
+    log_time(WARN, "JsonHttpTPStream");
+    JsonHttpServerTP server;
+    JsonHttpClient client;
+
+    ServerSetup(server);
+    StreamSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestStreamClient(client);
+    server.StopThread();
+}
+
+TEST(Server, JsonHttpAsync)
+{
+    log_time(WARN, "JsonHttpAsync");
+    JsonHttpServer server;
+    JsonHttpClient client;
+
+    ServerSetup(server);
+    AsyncSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestAsyncClient(client);
+    server.StopThread();
+}
+
+TEST(Server, JsonTcpAsync)
+{
+    log_time(WARN, "JsonTcpAsync");
+    JsonTcpServer server;
+    JsonTcpClient client;
+
+    ServerSetup(server);
+    AsyncSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestAsyncClient(client);
+    TestAsyncConcurrency(client, 3);
+    server.StopThread();
+}
+
+TEST(Server, JsonHttpTPAsync)
+{
+    log_time(WARN, "JsonHttpTPAsync");
+    JsonHttpServerTP server(1);
+    JsonHttpClient client;
+
+    ServerSetup(server);
+    AsyncSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestAsyncClient(client);
+    server.StopThread();
+}
+
+TEST(Server, JsonTcpTPAsync)
+{
+    log_time(WARN, "JsonTcpTPAsync");
+    JsonTcpServerTP server(1);
+    JsonTcpClient client;
+
+    ServerSetup(server);
+    AsyncSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestAsyncClient(client);
+    TestAsyncConcurrency(client, 3);
+    server.StopThread();
+}
+
+TEST(Server, JsonTcpTPPipelinedAsync)
+{
+    log_time(WARN, "JsonTcpTPPipelinedAsync");
+    JsonTcpServerTP server(1);
+    JsonTcpClient client;
+
+    server.SetPipelining(true);
+    ServerSetup(server);
+    AsyncSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestAsyncClient(client);
+    TestAsyncConcurrency(client, 3);
+
+    // the calls from one connection wait together without holding the only worker thread
+    std::vector<int> ids;
+    int64_t elapsed;
+    PipelinedCalls("asyncSleep", ids, elapsed);
+    ASSERT_EQ(ids.size(), 4u);
+    EXPECT_EQ(ids[3], 1);
+    EXPECT_LT(elapsed, 300000);
+    server.StopThread();
+}
+
+TEST(Server, JsonHttpMTAsync)
+{
+    log_time(WARN, "JsonHttpMTAsync");
+    JsonHttpServerMT server;
+    JsonHttpClient client;
+
+    ServerSetup(server);
+    AsyncSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestAsyncClient(client);
+    server.StopThread();
+}
+
+TEST(Server, JsonTcpMRAsync)
+{
+    log_time(WARN, "JsonTcpMRAsync");
+    JsonTcpServerMR server(2);
+    JsonTcpClient client;
+
+    ServerSetup(server);
+    AsyncSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestAsyncClient(client);
+    server.StopThread();
+}
+#endif // defined(ANYRPC_INCLUDE_JSON)
+#if defined(ANYRPC_INCLUDE_XML)
+TEST(Server, XmlHttp)
+{
+	log_time(WARN, "XmlHttp");
+    XmlHttpServer server;
+    XmlHttpClient client;
+
+    ServerSetup(server);
+    server.StartThread();
+    TestClient(client);
+    server.StopThread();
+}
+
+TEST(Server, XmlHttpStream)
+{
+    log_time(WARN, "XmlHttpStream");
+    XmlHttpServer server;
+    XmlHttpClient client;
+
+    ServerSetup(server);
+    StreamSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestStreamClient(client);
+    server.StopThread();
+}
+
+TEST(Server, XmlHttpAsync)
+{
+    log_time(WARN, "XmlHttpAsync");
+    XmlHttpServer server;
+    XmlHttpClient client;
+
+    ServerSetup(server);
+    AsyncSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestAsyncClient(client);
+    server.StopThread();
+}
+
+TEST(Server, XmlTcp)
+{
+	log_time(WARN, "XmlTcp");
+    XmlTcpServer server;
+    XmlTcpClient client;
+
+    ServerSetup(server);
+    server.StartThread();
+    TestClient(client);
+    server.StopThread();
+}
+
+TEST(Server, XmlHttpMT)
+{
+	log_time(WARN, "XmlHttpMT");
+    XmlHttpServerMT server;
+    XmlHttpClient client;
+
+    ServerSetup(server);
+    server.StartThread();
+    TestClient(client);
+    server.StopThread();
+}
+
+TEST(Server, XmlTcpMT)
+{
+	log_time(WARN, "XmlTcpMT");
+    XmlTcpServerMT server;
+    XmlTcpClient client;
+
+    ServerSetup(server);
+    server.StartThread();
+    TestClient(client);
+    server.StopThread();
+}
+#endif // defined(ANYRPC_INCLUDE_XML)
+#if defined(ANYRPC_INCLUDE_MESSAGEPACK)
+TEST(Server, MessagePackHttp)
+{
+	log_time(WARN, "MessagePackHttp");
+    MessagePackHttpServer server;
+    MessagePackHttpClient client;
+
+    ServerSetup(server);
+    server.StartThread();
+    TestClient(client);
+    server.StopThread();
+}
+
+TEST(Server, MessagePackTcp)
+{
+	log_time(WARN, "MessagePackTcp");
+    MessagePackTcpServer server;
+    MessagePackTcpClient client;
+
+    ServerSetup(server);
+    server.StartThread();
+    TestClient(client);
+    server.StopThread();
+}
+
+TEST(Server, MessagePackWebSocket)
+{
+    log_time(WARN, "MessagePackWebSocket");
+    AnyWebSocketServer server;
+    MessagePackWebSocketClient client;
+
+    ServerSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestLongEcho(client);
+    server.StopThread();
+}
+
+TEST(Server, MessagePackHttpStream)
+{
+    log_time(WARN, "MessagePackHttpStream");
+    MessagePackHttpServer server;
+    MessagePackHttpClient client;
+
+    ServerSetup(server);
+    StreamSetup(server);
+    server.StartThread();
+    TestClient(client);
+    TestStreamClient(client);
+    server.StopThread();
+}
+
+TEST(Server, MessagePackTcpAsync)
+{
+    log_time(WARN, "MessagePackTcpAsync");
     MessagePackTcpServer server;
     MessagePackTcpClient client;
 
     ServerSetup(server);
+    AsyncSetup(server);
     server.StartThread();
     TestClient(client);
+    TestAsyncClient(client);
     server.StopThread();
 }
 
@@ -348,3 +348,17 @@ TEST(Xml,ParseError)
     inString = "<value><i4>5736298</i4></ value>";
     EXPECT_EQ(CheckParseError(inString), AnyRpcErrorTagInvalid);
 }
+
+TEST(Xml,MethodName)
+{
+    std::string methodName;
+    const char* request = "<?xml version=\"1.0\"?><methodCall><methodName> examples.getStateName </methodName>"
+                          "<params><param><value><i4>41</i4></value></param></params></methodCall>";
+    EXPECT_TRUE(XmlRpcMethodName(request, strlen(request), methodName));
+    EXPECT_EQ(methodName, "examples.getStateName");
+
+    request = "<?xml version=\"1.0\"?><methodCall><params></params></methodCall>";
+    EXPECT_FALSE(XmlRpcMethodName(request, strlen(request), methodName));
+    request = "<?xml version=\"1.0\"?><methodCall><methodName>examples";
+    EXPECT_FALSE(XmlRpcMethodName(request, strlen(request), methodName));
+}